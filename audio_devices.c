@@ -0,0 +1,220 @@
+/*
+ * audio_devices.c
+ *
+ * Description:
+ * Sound card lookup by index, id or name from /proc/asound/cards, and the
+ * inotify watch on /dev/snd that tells the audio engine when to look again.
+ * /proc/asound/cards has two lines per card:
+ *
+ *    5 [Device         ]: USB-Audio - USB Audio Device
+ *                         C-Media Electronics Inc. USB Audio Device at usb-0000:01:00.0-1.3, full speed
+ *
+ * Lookups read the file afresh every time, it is a few hundred bytes and only
+ * read when a device is opened.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include "audio_devices.h"
+
+static struct {
+  int fd;
+  guint io_watch;
+  guint settle_timer;
+  audio_devices_fn fn;
+  void * data;
+} ad = { .fd = -1 };
+
+// Copy [begin, end) without the surrounding white space, truncated to size
+static void copy_trimmed(char * dest, size_t size, const char * begin, const char * end) {
+  while (begin < end && isspace((unsigned char) * begin)) {
+    begin++;
+  }
+  while (end > begin && isspace((unsigned char) end[-1])) {
+    end--;
+  }
+  size_t len = (size_t)(end - begin) < size - 1 ? (size_t)(end - begin) : size - 1;
+  memcpy(dest, begin, len);
+  dest[len] = '\0';
+}
+
+static bool contains_nocase(const char * text, const char * part) {
+  size_t len = strlen(part);
+  for (; * text != '\0'; text++) {
+    if (strncasecmp(text, part, len) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int audio_devices_list(struct audio_card * cards, int max) {
+  FILE * file = fopen(AUDIO_DEVICES_CARDS, "r");
+  if (file == NULL) {
+    return 0; // No ALSA at all, or no cards yet
+  }
+  char line[256];
+  int n = 0;
+  struct audio_card * card = NULL; // Waiting for its long name on the next line
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char * end;
+    long index = strtol(line, & end, 10);
+    char * open = strchr(line, '[');
+    char * close = strstr(line, "]: ");
+    if (end != line && open != NULL && close != NULL && open < close) {
+      card = n < max ? & cards[n++] : NULL;
+      if (card == NULL) {
+        continue;
+      }
+      memset(card, 0, sizeof( * card));
+      card->index = (int) index;
+      copy_trimmed(card->id, sizeof(card->id), open + 1, close);
+      // The driver name may hold a '-' itself (USB-Audio), only " - " separates it from the name
+      const char * desc = close + 3;
+      const char * dash = strstr(desc, " - ");
+      if (dash != NULL) {
+        copy_trimmed(card->driver, sizeof(card->driver), desc, dash);
+        desc = dash + 3;
+      }
+      copy_trimmed(card->name, sizeof(card->name), desc, desc + strlen(desc));
+    } else if (card != NULL) {
+      copy_trimmed(card->longname, sizeof(card->longname), line, line + strlen(line));
+      card = NULL;
+    }
+  }
+  fclose(file);
+  return n;
+}
+
+void audio_devices_print(void) {
+  struct audio_card cards[AUDIO_DEVICES_MAX];
+  int n = audio_devices_list(cards, AUDIO_DEVICES_MAX);
+  if (n == 0) {
+    printf("No sound cards found\n");
+  }
+  for (int i = 0; i < n; i++) {
+    printf("Sound card %d: CARD=%s (%s, %s)\n", cards[i].index, cards[i].id, cards[i].name, cards[i].driver);
+  }
+}
+
+bool audio_devices_resolve(const char * spec, char * device, size_t size) {
+  const char * colon = strchr(spec, ':');
+  if (colon != NULL) {
+    spec = colon + 1; // hw: or plughw:, we pick the plugin ourselves
+  }
+  char card_spec[80];
+  int dev = 0;
+  bool named = strncmp(spec, "CARD=", 5) == 0;
+  if (named) {
+    spec += 5;
+  }
+  // CARD=<card>,DEV=<n> or the shorter <card>,<n> as in hw:1,0
+  const char * comma = strchr(spec, ',');
+  copy_trimmed(card_spec, sizeof(card_spec), spec, comma != NULL ? comma : spec + strlen(spec));
+  if (comma != NULL && named && strncmp(comma + 1, "DEV=", 4) == 0) {
+    dev = atoi(comma + 5);
+  } else if (comma != NULL && !named) {
+    dev = atoi(comma + 1);
+  }
+  if (card_spec[0] == '\0') {
+    return false;
+  }
+
+  struct audio_card cards[AUDIO_DEVICES_MAX];
+  int n = audio_devices_list(cards, AUDIO_DEVICES_MAX);
+  const struct audio_card * found = NULL;
+  char * end;
+  long index = strtol(card_spec, & end, 10);
+  if ( * end == '\0') {
+    for (int i = 0; i < n && found == NULL; i++) {
+      if (cards[i].index == index) {
+        found = & cards[i];
+      }
+    }
+  } else {
+    // An exact id first, so "Device" does not pick the first card whose name merely contains it
+    for (int i = 0; i < n && found == NULL; i++) {
+      if (strcasecmp(cards[i].id, card_spec) == 0) {
+        found = & cards[i];
+      }
+    }
+    for (int i = 0; i < n && found == NULL; i++) {
+      if (contains_nocase(cards[i].name, card_spec) || contains_nocase(cards[i].longname, card_spec)) {
+        found = & cards[i];
+      }
+    }
+  }
+  if (found == NULL) {
+    return false;
+  }
+  snprintf(device, size, "CARD=%s,DEV=%d", found->id, dev);
+  return true;
+}
+
+static gboolean on_settled(gpointer data) {
+  ad.settle_timer = 0;
+  printf("Sound devices changed\n");
+  audio_devices_print();
+  ad.fn(ad.data);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean on_inotify(gint fd, GIOCondition condition, gpointer data) {
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+  ssize_t len;
+  while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+    for (char * p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ((struct inotify_event * ) p)->len) {
+      const struct inotify_event * event = (const struct inotify_event * ) p;
+      // PCM and control nodes only, the timer and sequencer have nothing to do with a card coming or going
+      if ((event->mask & IN_Q_OVERFLOW) != 0 ||
+          (event->len > 0 && (strncmp(event->name, "pcmC", 4) == 0 || strncmp(event->name, "controlC", 8) == 0))) {
+        changed = true;
+      }
+    }
+  }
+  if (changed && ad.settle_timer == 0) {
+    ad.settle_timer = g_timeout_add(AUDIO_DEVICES_SETTLE_MS, on_settled, NULL);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+int audio_devices_watch(audio_devices_fn fn, void * data) {
+  ad.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (ad.fd < 0) {
+    perror("Failed to start watching sound devices");
+    return -1;
+  }
+  // IN_ATTRIB too: udev creates the node first and grants the audio group access a moment later
+  if (inotify_add_watch(ad.fd, AUDIO_DEVICES_DIR, IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+    perror("Failed to watch " AUDIO_DEVICES_DIR);
+    close(ad.fd);
+    ad.fd = -1;
+    return -1;
+  }
+  ad.fn = fn;
+  ad.data = data;
+  ad.io_watch = g_unix_fd_add(ad.fd, G_IO_IN, on_inotify, NULL);
+  return 0;
+}
+
+void audio_devices_unwatch(void) {
+  if (ad.settle_timer != 0) {
+    g_source_remove(ad.settle_timer);
+    ad.settle_timer = 0;
+  }
+  if (ad.io_watch != 0) {
+    g_source_remove(ad.io_watch);
+    ad.io_watch = 0;
+  }
+  if (ad.fd >= 0) {
+    close(ad.fd);
+    ad.fd = -1;
+  }
+}
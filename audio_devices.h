@@ -0,0 +1,60 @@
+/*
+ * audio_devices.h
+ *
+ * Description:
+ * Finds the sound cards by what they are rather than by the number ALSA gave
+ * them at boot, and notices when they come and go. USB cards are numbered in
+ * the order they show up, so a headset that was card 5 can come back as card 6
+ * after a replug or a reboot with another device plugged in; its ALSA id (e.g.
+ * "Device", "Headset", "Loopback_1") stays the same.
+ *
+ * A device spec in config.ini is CARD=<card>,DEV=<n> or <card>,<n> (ALSA's own
+ * syntaxes, with an optional hw: or plughw: in front), or just <card> for
+ * DEV=0. <card> is matched against the cards in /proc/asound/cards by index,
+ * then by id, then as a case-insensitive part of the card's name, so
+ * "CARD=5,DEV=0", "hw:5,0", "CARD=Device,DEV=0" and "USB Audio" can all name
+ * the same headset.
+ *
+ * Hot-plug is watched with inotify on /dev/snd, where udev creates and removes
+ * the PCM and control nodes of every card. /proc/asound cannot be watched
+ * (procfs sends no inotify events), so it is re-read on each change instead.
+ */
+#ifndef AUDIO_DEVICES_H
+#define AUDIO_DEVICES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define AUDIO_DEVICES_CARDS "/proc/asound/cards"
+#define AUDIO_DEVICES_DIR "/dev/snd"
+#define AUDIO_DEVICES_MAX 32       // Cards ALSA allows
+#define AUDIO_DEVICES_SETTLE_MS 20 // A card's nodes appear within a few ms of each other, report them as one change
+#define AUDIO_DEVICE_NAME_MAX 48   // Resolved CARD=<id>,DEV=<n>, ids are at most 15 characters
+
+struct audio_card {
+  int index;
+  char id[16];
+  char driver[32];
+  char name[80];
+  char longname[128];
+};
+
+// Called on the GLib main loop after sound devices have been added, removed or had their permissions changed
+typedef void ( * audio_devices_fn)(void * data);
+
+// Read the cards present now, returns how many were stored (0 when there are none)
+int audio_devices_list(struct audio_card * cards, int max);
+
+// Print the cards present, one line each, so the right spec is easy to pick
+void audio_devices_print(void);
+
+// Find the card a spec names and write CARD=<id>,DEV=<n> for it, false if it is not present.
+// Safe to call from any thread.
+bool audio_devices_resolve(const char * spec, char * device, size_t size);
+
+// Start watching AUDIO_DEVICES_DIR, returns -1 if hot-plug cannot be watched
+int audio_devices_watch(audio_devices_fn fn, void * data);
+
+void audio_devices_unwatch(void);
+
+#endif
@@ -0,0 +1,961 @@
+/*
+ * audio_engine.c
+ *
+ * Description:
+ * In-process replacement for the TX and RX shell pipelines:
+ *
+ *   TX: arecord (headset) | sox vol | freedv_tx | aplay (sBitx)
+ *   RX: arecord (sBitx) | freedv_rx | aplay (headset)
+ *
+ * Each path has a capture thread that reads the input PCM in short periods
+ * straight into a lock-free sample ring, and a modem thread that pulls whole
+ * modem frames from the ring, runs them through libcodec2 and writes the result
+ * to the output PCM. The capture thread never waits on the modem thread: when
+ * the ring is full it drops the period and counts an overrun. The modem thread
+ * sleeps on a semaphore the capture thread posts after each period, and counts
+ * an underrun when no audio has arrived for AUDIO_STARVED_MS.
+ *
+ * Both paths run for the whole session. The TX modem thread keeps a few
+ * milliseconds of silence queued on the sBitx input while idle, so on PTT it can
+ * modulate a frame of silence and play it at once; the speech of the over starts
+ * with the microphone audio captured after PTT, anything said before is dropped.
+ * On PTT off it modulates whatever is left of the last word, drains the sBitx
+ * input and only then reports the over as finished, so the radio is un-keyed
+ * right after the last modem sample has been played.
+ * The RX modem thread keeps demodulating during TX so the freedv state (and its
+ * sync) survives our own overs; its output is just muted. It feeds each capture
+ * period to an rx_fanout, which demodulates it in every RX channel and mode in parallel.
+ * Every period and the speech it produced are also handed to the time-shift
+ * recorder before the speech is muted or replaced by a replay.
+ *
+ * The sound cards are opened as hw: devices at their own rate and channel
+ * count (48 kHz stereo on most USB headsets) instead of through plughw:, whose
+ * generic rate converter cost more CPU on the Pi than the modems. The capture
+ * threads take the first channel and resample it to 8 kHz before it enters the
+ * ring, and playback is resampled up and copied to every channel on the way
+ * out, with the polyphase resampler in dsp.c. A card that refuses S16 or any
+ * rate falls back to plughw: at 8 kHz as before.
+ *
+ * Devices are named in config.ini by card id or name (see audio_devices.h) and
+ * looked up again every time they are opened, so a card that has been given a
+ * new number is still found. A device that fails with an error ALSA cannot
+ * recover from (-ENODEV when a USB headset is unplugged) is closed and marked
+ * lost by the thread using it, which drops its audio and tries to open it
+ * again each time the sound devices change and every AUDIO_REOPEN_RETRY_MS.
+ * Only that stream stops: the other path, and the other direction of the same
+ * path, carry on, and the modems and their sync are never touched. A device
+ * missing at startup is treated the same way.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <alsa/asoundlib.h>
+#include "audio_engine.h"
+#include "audio_devices.h"
+#include "trace.h"
+
+#define AUDIO_RATE 8000
+#define AUDIO_NATIVE_RATE 48000 // Asked of hw: devices, they may pick another
+#define AUDIO_PCM_CHUNK 320 // 8 kHz samples converted per pass on the way to a native rate device
+#define CAPTURE_PERIOD 160 // 20 ms per capture read
+#define CAPTURE_LATENCY_US 100000
+#define AUDIO_RING_FRAME 1280 // 700D frame, a multiple of CAPTURE_PERIOD and of the 700C/700E frames
+#define AUDIO_RING_FRAMES 12  // About 2 seconds between capture and modem
+#define AUDIO_STARVED_MS 200  // No capture audio for this long counts as an underrun
+#define MAX_FRAME_SAMPLES AUDIO_RATE // Larger than any FreeDV frame
+#define TX_IDLE_FILL (AUDIO_RATE * 40 / 1000) // Silence kept queued on the sBitx input while idle
+#define RX_MAX_DELAY (AUDIO_RATE * 300 / 1000) // Headset queue limit before decoded audio is dropped (clock drift)
+#define AUDIO_REOPEN_RETRY_MS 2000 // A lost device is also tried this often when no change has been seen
+#define AUDIO_LOST_POLL_MS 5 // Capture thread of a lost device checks for a change this often
+
+// A PCM, once open the conversion between its rate and channels and the engine's 8 kHz mono
+struct audio_pcm {
+  const char * role; // "headset", "sbitx_tx" or "sbitx_rx", for audio_engine_missing_devices
+  char spec[AUDIO_DEVICE_SPEC_MAX]; // As configured, looked up on every open
+  snd_pcm_stream_t stream;
+  unsigned int latency_us;
+  bool native;
+  atomic_bool lost; // Closed after an error or never opened, the thread using it opens it again
+  unsigned int generation; // engine.device_generation when the last open was tried
+  int64_t retry_ns; // Try again then even if no device has changed
+  int64_t lost_ns;
+  snd_pcm_t * handle;
+  char name[32];
+  unsigned int rate;
+  unsigned int channels;
+  bool resample; // rate is not AUDIO_RATE
+  struct dsp_resampler resampler; // Device rate -> AUDIO_RATE on capture, the other way on playback
+  short * frames; // Interleaved device frames for one read or one AUDIO_PCM_CHUNK
+  short * mono;   // Resampler output before it is spread over the channels (playback)
+};
+
+// One direction: capture device -> modem -> playback device
+struct audio_path {
+  const char * name;
+  struct audio_pcm capture;
+  struct audio_pcm playback;
+  struct sample_ring ring; // Capture thread -> modem thread
+  sem_t wake;              // Posted after every capture period, path_kick() and path_stop()
+  atomic_bool kicked;      // Wake the modem thread early, e.g. on a PTT change
+  atomic_bool closed;
+  struct modem * modem; // TX only, owned by the modem thread while it runs
+  _Atomic(struct modem *) pending; // Replacement modem handed over by audio_engine_configure
+  struct rx_fanout * fanout; // RX only, owned by the modem thread while it runs
+  _Atomic(struct rx_fanout *) fanout_pending;
+  pthread_t capture_thread;
+  pthread_t modem_thread;
+};
+
+// Single-producer single-consumer queue from the RX modem thread to the GUI.
+// head is only written by the producer and tail only by the consumer.
+struct rx_stats_queue {
+  struct rx_channel_stats items[RX_STATS_QUEUE_SIZE];
+  atomic_uint head;
+  atomic_uint tail;
+};
+
+static struct rx_stats_queue rx_stats;
+
+static struct audio_path tx_path = { .name = "TX" };
+static struct audio_path rx_path = { .name = "RX" };
+
+static struct {
+  atomic_bool running;
+  atomic_int select;
+  atomic_bool tx_active; // From the first modem frame of an over until it has drained
+  atomic_bool drain_pending; // TX was left and the drained callback is still owed
+  atomic_int input_level_db;
+  atomic_int squelch_level;
+  atomic_int rx_channel; // Chosen by the user or RX_CHANNEL_AUTO
+  atomic_bool rx_reset; // The radio was retuned, drop queued RX audio and modem sync
+  _Atomic int64_t ptt_requested_ns;
+  _Atomic double ptt_turnaround_ms;
+  atomic_uint device_generation; // Bumped by audio_engine_devices_changed
+  _Atomic int64_t device_change_ns;
+  audio_tx_drained_fn tx_drained;
+  void * tx_drained_data;
+  audio_device_fn device_changed;
+  void * device_changed_data;
+  struct audio_settings settings; // Last applied settings, only touched by the GTK thread
+  struct rt_settings rt; // Fixed while the threads run
+  struct timeshift * timeshift; // Fixed while the threads run
+  bool opened;
+} engine;
+
+static int64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, & ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Wait for n samples from the capture ring. Returns 1 when they were copied out, -1 when woken
+// by path_kick() or after AUDIO_STARVED_MS without them, and 0 once the path has been closed.
+static int path_read(struct audio_path * p, short * samples, int n) {
+  for (;;) {
+    if (sample_ring_read( & p->ring, samples, n) == n) {
+      return 1;
+    }
+    if (atomic_load( & p->closed)) {
+      return 0;
+    }
+    if (atomic_exchange( & p->kicked, false)) {
+      return -1;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, & deadline);
+    deadline.tv_nsec += AUDIO_STARVED_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    if (sem_timedwait( & p->wake, & deadline) < 0 && errno == ETIMEDOUT) {
+      sample_ring_underrun( & p->ring);
+      return -1; // Let the caller look after its output device meanwhile
+    }
+  }
+}
+
+static void path_kick(struct audio_path * p) {
+  atomic_store( & p->kicked, true);
+  sem_post( & p->wake);
+}
+
+// Start playing as soon as anything is queued instead of waiting for a full buffer
+static void set_start_threshold(snd_pcm_t * pcm, const char * name) {
+  snd_pcm_sw_params_t * sw;
+  snd_pcm_sw_params_alloca( & sw);
+  snd_pcm_sw_params_current(pcm, sw);
+  snd_pcm_sw_params_set_start_threshold(pcm, sw, 1);
+  int err = snd_pcm_sw_params(pcm, sw);
+  if (err < 0) {
+    fprintf(stderr, "Failed to set start threshold on %s: %s\n", name, snd_strerror(err));
+  }
+}
+
+// Open hw:<device> as S16 at the rate nearest AUDIO_NATIVE_RATE with as few channels as it allows
+static int open_native_pcm(struct audio_pcm * pcm, const char * device, snd_pcm_stream_t stream, unsigned int latency_us) {
+  snprintf(pcm->name, sizeof(pcm->name), "hw:%s", device);
+  int err = snd_pcm_open( & pcm->handle, pcm->name, stream, 0);
+  if (err < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", pcm->name, snd_strerror(err));
+    return -1;
+  }
+  snd_pcm_hw_params_t * hw;
+  snd_pcm_hw_params_alloca( & hw);
+  unsigned int buffer_us = latency_us, period_us = latency_us / 4;
+  pcm->rate = AUDIO_NATIVE_RATE;
+  pcm->channels = 1;
+  if ((err = snd_pcm_hw_params_any(pcm->handle, hw)) < 0 ||
+      (err = snd_pcm_hw_params_set_access(pcm->handle, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+      (err = snd_pcm_hw_params_set_format(pcm->handle, hw, SND_PCM_FORMAT_S16_LE)) < 0 ||
+      (err = snd_pcm_hw_params_set_channels_near(pcm->handle, hw, & pcm->channels)) < 0 ||
+      (err = snd_pcm_hw_params_set_rate_near(pcm->handle, hw, & pcm->rate, NULL)) < 0 ||
+      (err = snd_pcm_hw_params_set_buffer_time_near(pcm->handle, hw, & buffer_us, NULL)) < 0 ||
+      (err = snd_pcm_hw_params_set_period_time_near(pcm->handle, hw, & period_us, NULL)) < 0 ||
+      (err = snd_pcm_hw_params(pcm->handle, hw)) < 0) {
+    fprintf(stderr, "Failed to configure %s: %s\n", pcm->name, snd_strerror(err));
+    return -1;
+  }
+
+  pcm->resample = pcm->rate != AUDIO_RATE;
+  if (pcm->resample) {
+    int rate_in = stream == SND_PCM_STREAM_CAPTURE ? (int) pcm->rate : AUDIO_RATE;
+    int rate_out = stream == SND_PCM_STREAM_CAPTURE ? AUDIO_RATE : (int) pcm->rate;
+    if (dsp_resampler_init( & pcm->resampler, rate_in, rate_out) < 0) {
+      fprintf(stderr, "Cannot resample between %d and %d Hz for %s\n", rate_in, rate_out, pcm->name);
+      return -1;
+    }
+  }
+  // One capture period or one AUDIO_PCM_CHUNK of playback, at the device rate
+  size_t max_frames = (size_t) AUDIO_PCM_CHUNK * pcm->rate / AUDIO_RATE + 2;
+  pcm->frames = malloc(max_frames * pcm->channels * sizeof(short));
+  pcm->mono = malloc(max_frames * sizeof(short));
+  if (pcm->frames == NULL || pcm->mono == NULL) {
+    return -1;
+  }
+  return 0;
+}
+
+// Open plughw:<device> as 8 kHz mono S16, letting ALSA do any conversion the card needs
+static int open_plug_pcm(struct audio_pcm * pcm, const char * device, snd_pcm_stream_t stream, unsigned int latency_us) {
+  snprintf(pcm->name, sizeof(pcm->name), "plughw:%s", device);
+  pcm->rate = AUDIO_RATE;
+  pcm->channels = 1;
+  int err = snd_pcm_open( & pcm->handle, pcm->name, stream, 0);
+  if (err < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", pcm->name, snd_strerror(err));
+    return -1;
+  }
+  err = snd_pcm_set_params(pcm->handle, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, 1, AUDIO_RATE, 1, latency_us);
+  if (err < 0) {
+    fprintf(stderr, "Failed to configure %s: %s\n", pcm->name, snd_strerror(err));
+    return -1;
+  }
+  return 0;
+}
+
+static void close_pcm(struct audio_pcm * pcm) {
+  if (pcm->handle != NULL) {
+    snd_pcm_drop(pcm->handle);
+    snd_pcm_close(pcm->handle);
+  }
+  if (pcm->resample) {
+    dsp_resampler_free( & pcm->resampler);
+  }
+  free(pcm->frames);
+  free(pcm->mono);
+  // What was configured stays for the next open
+  pcm->handle = NULL;
+  pcm->resample = false;
+  pcm->frames = NULL;
+  pcm->mono = NULL;
+}
+
+// Open the device of pcm->spec for 8 kHz mono S16 audio, natively with our own conversion when pcm->native is set
+static int open_pcm(struct audio_pcm * pcm) {
+  char device[AUDIO_DEVICE_NAME_MAX];
+  if (!audio_devices_resolve(pcm->spec, device, sizeof(device))) {
+    snprintf(pcm->name, sizeof(pcm->name), "%s", pcm->spec);
+    if (!atomic_load( & pcm->lost)) {
+      fprintf(stderr, "No sound card matches %s (%s)\n", pcm->spec, pcm->role);
+    }
+    return -1;
+  }
+  if (pcm->native) {
+    if (open_native_pcm(pcm, device, pcm->stream, pcm->latency_us) == 0) {
+      if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
+        set_start_threshold(pcm->handle, pcm->name);
+      }
+      return 0;
+    }
+    close_pcm(pcm);
+    fprintf(stderr, "Falling back to plughw:%s\n", device);
+  }
+  if (open_plug_pcm(pcm, device, pcm->stream, pcm->latency_us) < 0) {
+    close_pcm(pcm);
+    return -1;
+  }
+  if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
+    set_start_threshold(pcm->handle, pcm->name);
+  }
+  return 0;
+}
+
+static void notify_device_changed(void) {
+  if (engine.device_changed != NULL) {
+    engine.device_changed(engine.device_changed_data);
+  }
+}
+
+// Called by the thread using pcm after an error snd_pcm_recover could not handle
+static void pcm_lost(struct audio_pcm * pcm, int err) {
+  fprintf(stderr, "Lost %s (%s): %s, reopening it when it is back\n", pcm->name, pcm->role, snd_strerror(err));
+  close_pcm(pcm);
+  // One try straight away, the error may not have been an unplug
+  pcm->generation = atomic_load( & engine.device_generation);
+  pcm->lost_ns = monotonic_ns();
+  pcm->retry_ns = pcm->lost_ns;
+  atomic_store( & pcm->lost, true);
+  notify_device_changed();
+}
+
+// Open a lost device again if the sound devices have changed since the last try or
+// AUDIO_REOPEN_RETRY_MS has passed. Returns true once it is open.
+static bool reopen_pcm(struct audio_pcm * pcm) {
+  unsigned int generation = atomic_load( & engine.device_generation);
+  int64_t now = monotonic_ns();
+  if (generation == pcm->generation && now < pcm->retry_ns) {
+    return false;
+  }
+  pcm->generation = generation;
+  pcm->retry_ns = now + AUDIO_REOPEN_RETRY_MS * 1000000LL;
+  if (open_pcm(pcm) < 0) {
+    return false;
+  }
+  int64_t change_ns = atomic_load( & engine.device_change_ns);
+  if (change_ns > pcm->lost_ns) {
+    printf("Reopened %s (%s, %u Hz, %u ch) %.1f ms after the sound devices changed\n", pcm->name, pcm->role, pcm->rate,
+      pcm->channels, (monotonic_ns() - change_ns) / 1e6);
+  } else {
+    printf("Reopened %s (%s, %u Hz, %u ch) %.0f ms after losing it\n", pcm->name, pcm->role, pcm->rate, pcm->channels,
+      (monotonic_ns() - pcm->lost_ns) / 1e6);
+  }
+  atomic_store( & pcm->lost, false);
+  notify_device_changed();
+  return true;
+}
+
+// Write interleaved device frames, recovering from underruns
+static bool write_frames(struct audio_pcm * pcm, const short * frames, int n) {
+  while (n > 0) {
+    snd_pcm_sframes_t written = snd_pcm_writei(pcm->handle, frames, n);
+    if (written < 0) {
+      written = snd_pcm_recover(pcm->handle, (int) written, 1);
+      if (written < 0) {
+        pcm_lost(pcm, (int) written);
+        return false;
+      }
+      continue;
+    }
+    frames += written * pcm->channels;
+    n -= (int) written;
+  }
+  return true;
+}
+
+// Write all 8 kHz mono samples to the playback device, converting them to its rate and channels.
+// Returns false if the device is lost, the samples are dropped then.
+static bool write_samples(struct audio_pcm * pcm, const short * samples, int n) {
+  if (atomic_load( & pcm->lost) && !reopen_pcm(pcm)) {
+    return false;
+  }
+  if (!pcm->resample && pcm->channels == 1) {
+    return write_frames(pcm, samples, n);
+  }
+  while (n > 0) {
+    int len = n < AUDIO_PCM_CHUNK ? n : AUDIO_PCM_CHUNK;
+    const short * mono = samples;
+    int frames = len;
+    if (pcm->resample) {
+      frames = dsp_resample( & pcm->resampler, samples, len, pcm->mono);
+      mono = pcm->mono;
+    }
+    for (int i = 0; i < frames; i++) {
+      for (unsigned int c = 0; c < pcm->channels; c++) {
+        pcm->frames[i * pcm->channels + c] = mono[i];
+      }
+    }
+    if (!write_frames(pcm, pcm->frames, frames)) {
+      return false;
+    }
+    samples += len;
+    n -= len;
+  }
+  return true;
+}
+
+// Push the last samples written out of the resampler's filter, a few ms at the end of an over
+static void flush_samples(struct audio_pcm * pcm) {
+  if (pcm->resample) {
+    short silence[DSP_FIR_MAX_TAPS] = { 0 };
+    for (int left = pcm->resampler.ntaps; left > 0; left -= DSP_FIR_MAX_TAPS) {
+      write_samples(pcm, silence, left < DSP_FIR_MAX_TAPS ? left : DSP_FIR_MAX_TAPS);
+    }
+  }
+}
+
+// Read one capture period of up to max 8 kHz mono samples, converted from the device's rate and
+// channels. Returns how many, which varies by one around max when the rates are not multiples.
+static snd_pcm_sframes_t read_samples(struct audio_pcm * pcm, short * samples, int max) {
+  if (!pcm->resample && pcm->channels == 1) {
+    return snd_pcm_readi(pcm->handle, samples, max);
+  }
+  snd_pcm_sframes_t n = snd_pcm_readi(pcm->handle, pcm->frames, (snd_pcm_uframes_t) max * pcm->rate / AUDIO_RATE);
+  if (n <= 0) {
+    return n;
+  }
+  // The first channel only: USB headsets put the microphone on the left, the sBitx sends the same on both
+  for (snd_pcm_sframes_t i = 0; i < n; i++) {
+    pcm->mono[i] = pcm->frames[i * pcm->channels];
+  }
+  if (!pcm->resample) {
+    memcpy(samples, pcm->mono, n * sizeof(short));
+    return n;
+  }
+  return dsp_resample( & pcm->resampler, pcm->mono, (int) n, samples);
+}
+
+// 8 kHz samples queued on a playback device ahead of the next write
+static snd_pcm_sframes_t queued_samples(struct audio_pcm * pcm) {
+  snd_pcm_sframes_t delay;
+  if (atomic_load( & pcm->lost) || snd_pcm_delay(pcm->handle, & delay) < 0 || delay < 0) {
+    return 0;
+  }
+  return delay * AUDIO_RATE / pcm->rate;
+}
+
+// Called from the RX modem thread, drops the frame if the GUI has not caught up
+static void rx_stats_push(const struct rx_channel_stats * stats) {
+  unsigned int head = atomic_load_explicit( & rx_stats.head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit( & rx_stats.tail, memory_order_acquire);
+  if (head - tail == RX_STATS_QUEUE_SIZE) {
+    return;
+  }
+  rx_stats.items[head % RX_STATS_QUEUE_SIZE] = * stats;
+  atomic_store_explicit( & rx_stats.head, head + 1, memory_order_release);
+}
+
+// Throw away whatever the capture thread has queued
+static void path_drop_queued(struct audio_path * p) {
+  const short * queued;
+  int n;
+  while ((n = sample_ring_peek( & p->ring, & queued, sample_ring_available( & p->ring))) > 0) {
+    sample_ring_release( & p->ring, n);
+  }
+}
+
+// Pick up a modem handed over by audio_engine_configure
+static struct modem * take_pending_modem(struct audio_path * p, struct modem * current) {
+  struct modem * next = atomic_exchange( & p->pending, NULL);
+  if (next == NULL) {
+    return current;
+  }
+  modem_close(current);
+  p->modem = next;
+  printf("Audio engine %s modem replaced\n", p->name);
+  return next;
+}
+
+// Pick up an RX mode set handed over by audio_engine_configure
+static struct rx_fanout * take_pending_fanout(struct audio_path * p, struct rx_fanout * current) {
+  struct rx_fanout * next = atomic_exchange( & p->fanout_pending, NULL);
+  if (next == NULL) {
+    return current;
+  }
+  rx_fanout_close(current);
+  p->fanout = next;
+  printf("Audio engine %s modes replaced\n", p->name);
+  return next;
+}
+
+// Modem threads run one step below the capture threads so a long modem frame never delays a capture read
+static int modem_thread_priority(void) {
+  int priority = engine.rt.priority;
+  return priority > 1 ? priority - 1 : priority;
+}
+
+static void * capture_thread(void * arg) {
+  struct audio_path * p = arg;
+  short scratch[CAPTURE_PERIOD + 1]; // Resampling can give one more
+  const struct timespec lost_poll = { 0, AUDIO_LOST_POLL_MS * 1000000L };
+
+  const char * name = p == & tx_path ? "TX capture" : "RX capture";
+  trace_set_thread_name(name);
+  rt_setup_thread(name, engine.rt.priority, engine.rt.cpu);
+  while (atomic_load( & engine.running)) {
+    if (atomic_load( & p->capture.lost) && !reopen_pcm( & p->capture)) {
+      nanosleep( & lost_poll, NULL);
+      continue;
+    }
+    // A reopened device may have come back with another rate or channel count
+    bool converted = p->capture.resample || p->capture.channels != 1;
+    // Read in place when a whole period fits and needs no conversion, otherwise through scratch so the ring keeps what fits
+    short * dest;
+    if (converted || sample_ring_reserve( & p->ring, & dest, CAPTURE_PERIOD) < CAPTURE_PERIOD) {
+      dest = scratch;
+    }
+    snd_pcm_sframes_t n = read_samples( & p->capture, dest, CAPTURE_PERIOD);
+    if (n < 0) {
+      n = snd_pcm_recover(p->capture.handle, (int) n, 1);
+      if (n < 0) {
+        pcm_lost( & p->capture, (int) n);
+      }
+      continue;
+    }
+    if (dest == scratch) {
+      sample_ring_write( & p->ring, scratch, (int) n);
+    } else {
+      sample_ring_commit( & p->ring, (int) n);
+    }
+    sem_post( & p->wake);
+  }
+
+  atomic_store( & p->closed, true);
+  sem_post( & p->wake);
+  return NULL;
+}
+
+static void * tx_modem_thread(void * arg) {
+  struct audio_path * p = arg;
+  struct modem * m = p->modem;
+  short chunk[CAPTURE_PERIOD];
+  short * speech = calloc(MAX_FRAME_SAMPLES, sizeof(short));
+  short * modem_out = calloc(MAX_FRAME_SAMPLES, sizeof(short));
+  short * silence = calloc(TX_IDLE_FILL, sizeof(short));
+  int have = 0; // Microphone samples collected in speech, only while transmitting
+  bool transmitting = false;
+
+  trace_set_thread_name("TX modem");
+  rt_setup_thread("TX modem", modem_thread_priority(), engine.rt.cpu);
+  for (;;) {
+    if (atomic_load( & p->playback.lost)) {
+      reopen_pcm( & p->playback); // Also while the headset is gone and no microphone audio arrives
+    }
+    m = take_pending_modem(p, m);
+    int input_level_db = atomic_load( & engine.input_level_db);
+    if (input_level_db != m->input_level_db) {
+      modem_set_input_level(m, input_level_db);
+    }
+    if (have > m->n_speech) {
+      memmove(speech, speech + have - m->n_speech, m->n_speech * sizeof(short));
+      have = m->n_speech;
+    }
+
+    bool tx = atomic_load( & engine.select) == AUDIO_PATH_TX;
+    if (tx && !transmitting) {
+      // PTT on: modulate a frame of silence right away so the sBitx input gets modem audio at once,
+      // and start the speech with the first capture period read from now on, not audio from before PTT
+      path_drop_queued(p);
+      memset(speech, 0, m->n_speech * sizeof(short));
+      TRACE_INSTANT("TX modem woken");
+      snd_pcm_sframes_t queued = queued_samples( & p->playback);
+      TRACE_COUNTER("sBitx input queued samples", queued);
+      TRACE_BEGIN("modulate first frame");
+      modem_tx_frame(m, modem_out, speech);
+      TRACE_END("modulate first frame");
+      write_samples( & p->playback, modem_out, m->n_modem);
+      TRACE_ASYNC_END("PTT on", TRACE_ID_PTT_ON);
+
+      double turnaround_ms = (monotonic_ns() - atomic_load( & engine.ptt_requested_ns)) / 1e6 + queued * 1000.0 / AUDIO_RATE;
+      atomic_store( & engine.ptt_turnaround_ms, turnaround_ms);
+      printf("PTT turnaround: %.1f ms (target %.0f ms)\n", turnaround_ms, AUDIO_PTT_TARGET_MS);
+      have = 0;
+      transmitting = true;
+      atomic_store( & engine.tx_active, true);
+    } else if (!tx && atomic_exchange( & engine.drain_pending, false)) {
+      // PTT off: send the rest of the last word, then let everything queued play out
+      if (transmitting) {
+        if (have > 0) {
+          memset(speech + have, 0, (m->n_speech - have) * sizeof(short));
+          modem_tx_frame(m, modem_out, speech);
+          write_samples( & p->playback, modem_out, m->n_modem);
+        }
+        flush_samples( & p->playback);
+        int64_t drain_start_ns = monotonic_ns();
+        TRACE_BEGIN("drain TX tail");
+        if (!atomic_load( & p->playback.lost)) {
+          snd_pcm_drain(p->playback.handle);
+          snd_pcm_prepare(p->playback.handle);
+        }
+        TRACE_END("drain TX tail");
+        printf("TX tail drained in %.1f ms\n", (monotonic_ns() - drain_start_ns) / 1e6);
+      }
+
+      transmitting = false;
+      have = 0;
+      atomic_store( & engine.tx_active, false);
+      if (engine.tx_drained != NULL) {
+        engine.tx_drained(engine.tx_drained_data);
+      }
+    }
+
+    int result = path_read(p, chunk, CAPTURE_PERIOD);
+    if (result == 0) {
+      break;
+    } else if (result < 0) {
+      continue;
+    }
+
+    if (transmitting) {
+      memcpy(speech + have, chunk, sizeof(chunk));
+      have += CAPTURE_PERIOD;
+      if (have >= m->n_speech) {
+        modem_tx_frame(m, modem_out, speech);
+        write_samples( & p->playback, modem_out, m->n_modem);
+        have -= m->n_speech;
+        memmove(speech, speech + m->n_speech, have * sizeof(short));
+      }
+    } else {
+      // Idle: the microphone audio is not kept, only a little silence queued on the sBitx input
+      snd_pcm_sframes_t queued = queued_samples( & p->playback);
+      if (queued < TX_IDLE_FILL) {
+        write_samples( & p->playback, silence, TX_IDLE_FILL - (int) queued);
+      }
+    }
+  }
+
+  free(speech);
+  free(modem_out);
+  free(silence);
+  return NULL;
+}
+
+static void * rx_modem_thread(void * arg) {
+  struct audio_path * p = arg;
+  struct rx_fanout * f = p->fanout;
+  short modem_in[CAPTURE_PERIOD];
+  short * speech = calloc(MAX_FRAME_SAMPLES, sizeof(short));
+  bool sync = false; // Of the channel being played, for the recorder
+  int mode = 0;
+
+  trace_set_thread_name("RX modem");
+  rt_setup_thread("RX modem", modem_thread_priority(), engine.rt.cpu);
+  for (;;) {
+    if (atomic_load( & p->playback.lost)) {
+      reopen_pcm( & p->playback);
+    }
+    f = take_pending_fanout(p, f);
+    rx_fanout_set_squelch(f, atomic_load( & engine.squelch_level));
+    rx_fanout_select_channel(f, atomic_load( & engine.rx_channel));
+    if (atomic_exchange( & engine.rx_reset, false)) {
+      // Up to AUDIO_RING_FRAMES of audio from the old frequency may be queued, none of it is wanted
+      path_drop_queued(p);
+      rx_fanout_reset(f);
+      sync = false;
+    }
+
+    int result = path_read(p, modem_in, CAPTURE_PERIOD);
+    if (result == 0) {
+      break;
+    } else if (result < 0) {
+      continue;
+    }
+
+    int nout = rx_fanout_process(f, modem_in, CAPTURE_PERIOD, speech, MAX_FRAME_SAMPLES);
+    struct rx_channel_stats stats[RX_FANOUT_MAX_CHANNELS];
+    int channels = rx_fanout_take_stats(f, stats, RX_FANOUT_MAX_CHANNELS);
+    for (int i = 0; i < channels; i++) {
+      rx_stats_push( & stats[i]);
+      if (stats[i].playing) {
+        sync = stats[i].modem.sync;
+        mode = stats[i].modem.mode;
+      }
+    }
+    if (engine.timeshift != NULL) {
+      timeshift_record(engine.timeshift, modem_in, CAPTURE_PERIOD, speech, nout, sync, mode);
+    }
+    if (nout == 0) {
+      continue; // No modem frame finished in this capture period
+    } else if (atomic_load( & engine.select) != AUDIO_PATH_RX || atomic_load( & engine.tx_active)) {
+      memset(speech, 0, nout * sizeof(short));
+    } else if (engine.timeshift != NULL) {
+      timeshift_replay_read(engine.timeshift, speech, nout);
+    }
+
+    // The sBitx and headset clocks drift apart over a session, shed a frame rather than let latency grow
+    if (queued_samples( & p->playback) > RX_MAX_DELAY) {
+      continue;
+    }
+    write_samples( & p->playback, speech, nout);
+  }
+
+  free(speech);
+  return NULL;
+}
+
+// Close whatever path_open managed to open
+static void path_release(struct audio_path * p) {
+  close_pcm( & p->capture);
+  close_pcm( & p->playback);
+  modem_close(p->modem);
+  modem_close(atomic_exchange( & p->pending, NULL));
+  p->modem = NULL;
+  rx_fanout_close(p->fanout);
+  rx_fanout_close(atomic_exchange( & p->fanout_pending, NULL));
+  p->fanout = NULL;
+}
+
+// Open one device of a path, one that is not there yet is left to the thread using it
+static void path_open_pcm(struct audio_pcm * pcm, const char * role, const char * spec, snd_pcm_stream_t stream,
+  unsigned int latency_us) {
+  pcm->role = role;
+  snprintf(pcm->spec, sizeof(pcm->spec), "%s", spec);
+  pcm->stream = stream;
+  pcm->latency_us = latency_us;
+  pcm->native = engine.settings.native_rate;
+  atomic_store( & pcm->lost, false);
+  if (open_pcm(pcm) < 0) {
+    fprintf(stderr, "Audio engine starts without %s (%s), it is opened when it appears\n", pcm->spec, role);
+    pcm->generation = atomic_load( & engine.device_generation);
+    pcm->lost_ns = monotonic_ns();
+    pcm->retry_ns = pcm->lost_ns + AUDIO_REOPEN_RETRY_MS * 1000000LL;
+    atomic_store( & pcm->lost, true);
+  }
+}
+
+// Open the devices of a path whose modem (TX) or fanout (RX) has been set, releases them on failure
+static int path_open(struct audio_path * p, const char * capture_role, const char * capture_spec,
+  const char * playback_role, const char * playback_spec) {
+  atomic_store( & p->pending, NULL);
+  atomic_store( & p->fanout_pending, NULL);
+  if (p->modem == NULL && p->fanout == NULL) {
+    path_release(p);
+    return -1;
+  }
+  path_open_pcm( & p->capture, capture_role, capture_spec, SND_PCM_STREAM_CAPTURE, CAPTURE_LATENCY_US);
+  path_open_pcm( & p->playback, playback_role, playback_spec, SND_PCM_STREAM_PLAYBACK, engine.settings.playback_latency_ms * 1000);
+  if (sample_ring_init( & p->ring, AUDIO_RING_FRAME, AUDIO_RING_FRAMES) < 0) {
+    path_release(p);
+    return -1;
+  }
+  sem_init( & p->wake, 0, 0);
+  atomic_store( & p->kicked, false);
+  atomic_store( & p->closed, false);
+  return 0;
+}
+
+// Name, rate and channels of a device for the log
+static void describe_pcm(const struct audio_pcm * pcm, char * text, size_t size) {
+  if (atomic_load( & pcm->lost)) {
+    snprintf(text, size, "%s (%s, waiting for it)", pcm->spec, pcm->role);
+  } else {
+    snprintf(text, size, "%s (%u Hz, %u ch)", pcm->name, pcm->rate, pcm->channels);
+  }
+}
+
+static void path_start(struct audio_path * p, void * ( * modem_thread)(void * )) {
+  char capture[96], playback[96];
+  describe_pcm( & p->capture, capture, sizeof(capture));
+  describe_pcm( & p->playback, playback, sizeof(playback));
+  pthread_create( & p->capture_thread, NULL, capture_thread, p);
+  pthread_create( & p->modem_thread, NULL, modem_thread, p);
+  printf("Audio engine %s path running: %s -> %s\n", p->name, capture, playback);
+}
+
+// Undo the rest of path_open once the threads are gone
+static void path_destroy(struct audio_path * p) {
+  sem_destroy( & p->wake);
+  sample_ring_destroy( & p->ring);
+}
+
+static void path_stop(struct audio_path * p) {
+  atomic_store( & p->closed, true);
+  sem_post( & p->wake);
+  pthread_join(p->capture_thread, NULL);
+  pthread_join(p->modem_thread, NULL);
+  path_release(p);
+
+  struct sample_ring_stats stats;
+  sample_ring_get_stats( & p->ring, & stats);
+  printf("Audio engine %s ring: high water %d of %d samples, %llu samples overrun, %llu underruns\n", p->name,
+    stats.high_water, stats.capacity, (unsigned long long) stats.overruns, (unsigned long long) stats.underruns);
+  path_destroy(p);
+}
+
+// Modes the RX path decodes
+static const char * rx_modes(const struct audio_settings * settings) {
+  return settings->rx_modes[0] != '\0' ? settings->rx_modes : settings->mode;
+}
+
+static struct rx_fanout * open_rx_fanout(const struct audio_settings * settings) {
+  return rx_fanout_open(rx_modes(settings), settings->rx_channels, settings->rx_workers, settings->squelch_level,
+    modem_thread_priority());
+}
+
+int audio_engine_open(const struct audio_settings * settings) {
+  if (engine.opened) {
+    return 0;
+  }
+  engine.settings = * settings;
+  engine.rt = settings->rt;
+  atomic_store( & engine.select, AUDIO_PATH_NONE);
+  atomic_store( & engine.input_level_db, settings->input_level_db);
+  atomic_store( & engine.squelch_level, settings->squelch_level);
+  atomic_store( & engine.rx_channel, RX_CHANNEL_AUTO);
+
+  tx_path.modem = modem_open_tx(settings->mode, settings->callsign, settings->input_level_db);
+  if (path_open( & tx_path, "headset", settings->headset_device, "sbitx_tx", settings->sbitx_tx_device) < 0) {
+    return -1;
+  }
+  rx_path.fanout = open_rx_fanout(settings);
+  if (path_open( & rx_path, "sbitx_rx", settings->sbitx_rx_device, "headset", settings->headset_device) < 0) {
+    path_release( & tx_path);
+    path_destroy( & tx_path);
+    return -1;
+  }
+
+  engine.timeshift = timeshift_open(settings->timeshift_file, settings->timeshift_minutes);
+  atomic_store( & engine.running, true);
+  path_start( & tx_path, tx_modem_thread);
+  path_start( & rx_path, rx_modem_thread);
+  engine.opened = true;
+  return 0;
+}
+
+// Hand a new modem to a running path, discarding one it has not picked up yet
+static void replace_modem(struct audio_path * p, struct modem * m) {
+  if (m != NULL) {
+    modem_close(atomic_exchange( & p->pending, m));
+  }
+}
+
+void audio_engine_configure(const struct audio_settings * settings) {
+  atomic_store( & engine.input_level_db, settings->input_level_db);
+  atomic_store( & engine.squelch_level, settings->squelch_level);
+
+  if (engine.opened) {
+    if (strcmp(settings->mode, engine.settings.mode) != 0 || strcmp(settings->callsign, engine.settings.callsign) != 0) {
+      replace_modem( & tx_path, modem_open_tx(settings->mode, settings->callsign, settings->input_level_db));
+    }
+    if (strcmp(rx_modes(settings), rx_modes( & engine.settings)) != 0 ||
+        strcmp(settings->rx_channels, engine.settings.rx_channels) != 0 || settings->rx_workers != engine.settings.rx_workers) {
+      struct rx_fanout * f = open_rx_fanout(settings);
+      if (f != NULL) {
+        rx_fanout_close(atomic_exchange( & rx_path.fanout_pending, f));
+      }
+    }
+  }
+  engine.settings = * settings;
+}
+
+bool audio_engine_select(enum audio_path_select path) {
+  TRACE_INSTANT(path == AUDIO_PATH_TX ? "audio select TX" : "audio select RX");
+  if (path == AUDIO_PATH_TX) {
+    atomic_store( & engine.ptt_requested_ns, monotonic_ns());
+    atomic_store( & engine.drain_pending, false);
+  }
+  enum audio_path_select previous = atomic_exchange( & engine.select, path);
+  if (!engine.opened || path == previous) {
+    return false;
+  }
+
+  bool leaving_tx = previous == AUDIO_PATH_TX;
+  if (leaving_tx) {
+    atomic_store( & engine.drain_pending, true);
+  }
+  path_kick( & tx_path);
+  return leaving_tx;
+}
+
+void audio_engine_set_tx_drained_callback(audio_tx_drained_fn fn, void * data) {
+  engine.tx_drained = fn;
+  engine.tx_drained_data = data;
+}
+
+void audio_engine_set_device_callback(audio_device_fn fn, void * data) {
+  engine.device_changed = fn;
+  engine.device_changed_data = data;
+}
+
+void audio_engine_devices_changed(void) {
+  atomic_store( & engine.device_change_ns, monotonic_ns());
+  atomic_fetch_add( & engine.device_generation, 1);
+  if (engine.opened) {
+    // The capture threads notice within AUDIO_LOST_POLL_MS, wake the modem threads for their output devices
+    path_kick( & tx_path);
+    path_kick( & rx_path);
+  }
+}
+
+void audio_engine_missing_devices(char * roles, size_t size) {
+  const struct audio_pcm * pcms[] = { & tx_path.capture, & tx_path.playback, & rx_path.capture, & rx_path.playback };
+  roles[0] = '\0';
+  if (!engine.opened) {
+    return;
+  }
+  for (size_t i = 0; i < sizeof(pcms) / sizeof(pcms[0]); i++) {
+    // The headset is two of them, name it once
+    if (atomic_load( & pcms[i]->lost) && strstr(roles, pcms[i]->role) == NULL) {
+      size_t len = strlen(roles);
+      snprintf(roles + len, size - len, "%s%s", len > 0 ? "," : "", pcms[i]->role);
+    }
+  }
+}
+
+double audio_engine_ptt_turnaround_ms(void) {
+  return atomic_load( & engine.ptt_turnaround_ms);
+}
+
+int audio_engine_take_rx_stats(struct rx_channel_stats * stats, int max) {
+  unsigned int tail = atomic_load_explicit( & rx_stats.tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit( & rx_stats.head, memory_order_acquire);
+  int n = 0;
+  while (tail != head && n < max) {
+    stats[n++] = rx_stats.items[tail % RX_STATS_QUEUE_SIZE];
+    tail++;
+  }
+  atomic_store_explicit( & rx_stats.tail, tail, memory_order_release);
+  return n;
+}
+
+void audio_engine_select_rx_channel(int channel) {
+  atomic_store( & engine.rx_channel, channel);
+}
+
+void audio_engine_reset_rx(void) {
+  if (!engine.opened) {
+    return;
+  }
+  atomic_store( & engine.rx_reset, true);
+  path_kick( & rx_path); // Don't wait for the next capture period
+}
+
+bool audio_engine_get_ring_stats(enum audio_path_select path, struct sample_ring_stats * stats) {
+  if (!engine.opened || path == AUDIO_PATH_NONE) {
+    return false;
+  }
+  sample_ring_get_stats(path == AUDIO_PATH_TX ? & tx_path.ring : & rx_path.ring, stats);
+  return true;
+}
+
+struct timeshift * audio_engine_timeshift(void) {
+  return engine.opened ? engine.timeshift : NULL;
+}
+
+void audio_engine_close(void) {
+  if (!engine.opened) {
+    return;
+  }
+  atomic_store( & engine.running, false);
+  path_stop( & tx_path);
+  path_stop( & rx_path);
+  timeshift_close(engine.timeshift);
+  engine.timeshift = NULL;
+  engine.opened = false;
+  printf("Audio engine closed\n");
+}
@@ -0,0 +1,123 @@
+/*
+ * audio_engine.h
+ *
+ * Description:
+ * In-process audio engine. Opens the headset and sBitx PCM devices with the ALSA
+ * API and runs capture -> gain -> FreeDV modem -> playback on dedicated threads,
+ * replacing the arecord | sox | freedv_tx | aplay shell pipelines. The devices
+ * run at their native rate; conversion to and from the modems' 8 kHz is done
+ * here (see dsp.h) rather than by ALSA's plug layer.
+ *
+ * The engine is opened once at startup and stays warm for the whole session:
+ * both freedv instances and all four PCM streams remain open, and a PTT change
+ * only selects which path feeds its output device.
+ *
+ * RX decodes every mode in rx_modes in every channel of rx_channels at once (see
+ * rx_fanout.h) and plays the one that has sync, so the mode setting only decides
+ * what we transmit.
+ *
+ * RX also feeds a time-shift recorder (see timeshift.h) with the modem input and
+ * the speech of the channel being played; a replay takes the place of the live
+ * speech on the headset until it catches up.
+ *
+ * Each of the three devices is found by card id or name (see audio_devices.h)
+ * and may come and go while the engine runs: a lost device is reopened by the
+ * thread that uses it once audio_engine_devices_changed says it may be back,
+ * without disturbing any other stream.
+ */
+#ifndef AUDIO_ENGINE_H
+#define AUDIO_ENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "modem.h"
+#include "dsp.h"
+#include "sample_ring.h"
+#include "rt_sched.h"
+#include "rx_fanout.h"
+#include "timeshift.h"
+
+#define AUDIO_PTT_TARGET_MS 50.0 // Click to first modem sample on the sBitx input
+#define RX_STATS_QUEUE_SIZE 256  // Per-frame RX channel stats waiting for the GUI, a power of two
+#define AUDIO_DEVICE_SPEC_MAX 64 // Device spec from config.ini
+
+// Which path currently drives its output device
+enum audio_path_select {
+  AUDIO_PATH_NONE, // Neither: sBitx input gets silence, headset is muted
+  AUDIO_PATH_TX,   // Headset microphone -> freedv_tx -> sBitx input
+  AUDIO_PATH_RX    // sBitx output -> freedv_rx -> headset speaker
+};
+
+// Settings from config.ini that the modems are built from
+struct audio_settings {
+  char mode[8];
+  char callsign[64];
+  char rx_modes[32];        // Modes decoded in parallel on RX, e.g. "700C,700D,700E", empty for just mode
+  char rx_channels[64];     // RX channel offsets in Hz, e.g. "-300,0,300", empty for one channel at 0
+  int rx_workers;           // Worker threads decoding RX channels and modes besides the RX modem thread
+  int input_level_db;
+  int squelch_level;
+  int playback_latency_ms;  // ALSA buffer on both playback devices, only read by audio_engine_open
+  bool native_rate;         // Open hw: devices at their own rate and resample here, else plughw: at 8 kHz; only read by audio_engine_open
+  char headset_device[AUDIO_DEVICE_SPEC_MAX];  // Device specs, see audio_devices.h; only read by audio_engine_open
+  char sbitx_tx_device[AUDIO_DEVICE_SPEC_MAX]; // sBitx modulator input
+  char sbitx_rx_device[AUDIO_DEVICE_SPEC_MAX]; // sBitx receiver output
+  struct rt_settings rt;    // Scheduling of the audio threads, only read by audio_engine_open
+  char timeshift_file[256]; // Time-shift recording, only read by audio_engine_open
+  int timeshift_minutes;    // Length of the recording, 0 to not record
+};
+
+// Called from the TX audio thread once the last modem frame of an over has left the sBitx input
+typedef void ( * audio_tx_drained_fn)(void * data);
+
+// Called from an audio thread when one of its devices has been lost or opened again
+typedef void ( * audio_device_fn)(void * data);
+
+// Open all devices and modems and start the audio threads
+int audio_engine_open(const struct audio_settings * settings);
+
+// Apply changed settings. Level changes take effect on the next frame, a mode or
+// callsign change replaces the affected modem at a frame boundary.
+void audio_engine_configure(const struct audio_settings * settings);
+
+// Switch the active path, returns immediately. Leaving TX modulates the rest of the
+// microphone audio and plays out everything queued, then calls the drained callback;
+// the headset stays muted until then. Returns true if that callback will follow.
+bool audio_engine_select(enum audio_path_select path);
+
+void audio_engine_set_tx_drained_callback(audio_tx_drained_fn fn, void * data);
+
+void audio_engine_set_device_callback(audio_device_fn fn, void * data);
+
+// Sound devices have been added or removed: lost devices are tried again within a few milliseconds
+void audio_engine_devices_changed(void);
+
+// Comma-separated roles of the devices that are lost, e.g. "headset,sbitx_rx", empty when all are open
+void audio_engine_missing_devices(char * roles, size_t size);
+
+// Measured time from the last switch to TX until its first modem sample reaches the sBitx input
+double audio_engine_ptt_turnaround_ms(void);
+
+// Take up to max per-frame RX channel stats, oldest first, queued since the last call.
+// Single consumer: call from one thread only. Frames are dropped, never waited for,
+// when the consumer falls behind. Returns the number taken.
+int audio_engine_take_rx_stats(struct rx_channel_stats * stats, int max);
+
+// Play RX channel (an index in rx_channels) on the headset, or RX_CHANNEL_AUTO for the best one
+void audio_engine_select_rx_channel(int channel);
+
+// The radio has been retuned: drop the RX audio still queued from the old frequency and make
+// every demodulator search for sync afresh. Takes effect within one capture period.
+void audio_engine_reset_rx(void);
+
+// Fill level and xrun counters of the ring between the capture and modem thread of
+// AUDIO_PATH_TX or AUDIO_PATH_RX. Returns false while the engine is not open.
+bool audio_engine_get_ring_stats(enum audio_path_select path, struct sample_ring_stats * stats);
+
+// Time-shift recorder of the RX path, NULL while the engine is not open or not recording
+struct timeshift * audio_engine_timeshift(void);
+
+// Stop the threads and close all devices and modems
+void audio_engine_close(void);
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * config_store.c
+ *
+ * Description:
+ * Replaces load_config() / save_config(). load_config() reopened and scanned
+ * config.ini for every value (three times per TX/RX press) and stopped at the
+ * first space, so "version=sBitx fdv_ptt 2.4.6a" read back as "sBitx".
+ * save_config() copied the whole file through tmpfile() and rewrote it in
+ * place, once per key, six times per Apply.
+ *
+ * Lines are kept in file order so a write-back only changes the values that
+ * were set; lines that are not key=value pairs are written back untouched.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glib.h>
+#include "config_store.h"
+
+struct config_line {
+  char * key;   // NULL for lines that are not key=value, kept verbatim in value
+  char * value;
+};
+
+static struct {
+  char * path;
+  GPtrArray * lines;   // struct config_line, in file order
+  GHashTable * index;  // key -> struct config_line
+  bool dirty;
+  guint flush_timer;
+  config_changed_fn changed_fn;
+  void * changed_data;
+} cs;
+
+static void line_free(gpointer data) {
+  struct config_line * line = data;
+  g_free(line->key);
+  g_free(line->value);
+  g_free(line);
+}
+
+static void add_line(char * key, char * value) {
+  struct config_line * line = g_new0(struct config_line, 1);
+  line->key = key;
+  line->value = value;
+  g_ptr_array_add(cs.lines, line);
+  if (key != NULL) {
+    g_hash_table_replace(cs.index, key, line);
+  }
+}
+
+bool config_store_open(const char * path) {
+  cs.path = g_strdup(path);
+  cs.lines = g_ptr_array_new_with_free_func(line_free);
+  cs.index = g_hash_table_new(g_str_hash, g_str_equal);
+
+  FILE * file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+  char buffer[512];
+  while (fgets(buffer, sizeof(buffer), file) != NULL) {
+    buffer[strcspn(buffer, "\r\n")] = '\0';
+    char * equals = strchr(buffer, '=');
+    if (equals == NULL || equals == buffer) {
+      add_line(NULL, g_strdup(buffer));
+      continue;
+    }
+    * equals = '\0';
+    add_line(g_strdup(g_strstrip(buffer)), g_strdup(g_strstrip(equals + 1)));
+  }
+  fclose(file);
+  printf("Loaded %u settings from %s\n", g_hash_table_size(cs.index), path);
+  return true;
+}
+
+const char * config_get(const char * key, const char * default_value) {
+  struct config_line * line = cs.index != NULL ? g_hash_table_lookup(cs.index, key) : NULL;
+  return line != NULL ? line->value : default_value;
+}
+
+int config_get_int(const char * key, int default_value) {
+  const char * value = config_get(key, NULL);
+  return value != NULL ? atoi(value) : default_value;
+}
+
+static gboolean on_flush_timer(gpointer data) {
+  cs.flush_timer = 0;
+  config_store_flush();
+  return G_SOURCE_REMOVE;
+}
+
+void config_set(const char * key, const char * value) {
+  struct config_line * line = g_hash_table_lookup(cs.index, key);
+  if (line != NULL && strcmp(line->value, value) == 0) {
+    return;
+  }
+  if (line != NULL) {
+    g_free(line->value);
+    line->value = g_strdup(value);
+  } else {
+    add_line(g_strdup(key), g_strdup(value));
+  }
+
+  cs.dirty = true;
+  if (cs.flush_timer == 0) {
+    cs.flush_timer = g_timeout_add(CONFIG_FLUSH_DELAY_MS, on_flush_timer, NULL);
+  }
+  if (cs.changed_fn != NULL) {
+    cs.changed_fn(key, value, cs.changed_data);
+  }
+}
+
+void config_set_int(const char * key, int value) {
+  char text[16];
+  snprintf(text, sizeof(text), "%d", value);
+  config_set(key, text);
+}
+
+void config_store_set_change_callback(config_changed_fn fn, void * data) {
+  cs.changed_fn = fn;
+  cs.changed_data = data;
+}
+
+int config_store_flush(void) {
+  if (!cs.dirty) {
+    return 0;
+  }
+  if (cs.flush_timer != 0) {
+    g_source_remove(cs.flush_timer);
+    cs.flush_timer = 0;
+  }
+
+  // Write the new contents next to the old file, then swap them in one step
+  char * tmp_path = g_strdup_printf("%s.tmp", cs.path);
+  FILE * file = fopen(tmp_path, "w");
+  if (file == NULL) {
+    perror("Failed to create temporary configuration file");
+    g_free(tmp_path);
+    return -1;
+  }
+  for (guint i = 0; i < cs.lines->len; i++) {
+    struct config_line * line = g_ptr_array_index(cs.lines, i);
+    if (line->key != NULL) {
+      fprintf(file, "%s=%s\n", line->key, line->value);
+    } else {
+      fprintf(file, "%s\n", line->value);
+    }
+  }
+  int result = 0;
+  if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+    perror("Failed to write configuration file");
+    result = -1;
+  }
+  if (fclose(file) != 0) {
+    result = -1;
+  }
+  if (result == 0 && rename(tmp_path, cs.path) != 0) {
+    perror("Failed to replace configuration file");
+    result = -1;
+  }
+  if (result != 0) {
+    unlink(tmp_path);
+  } else {
+    // Make the rename itself durable
+    char * dir = g_path_get_dirname(cs.path);
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+      fsync(dir_fd);
+      close(dir_fd);
+    }
+    g_free(dir);
+    cs.dirty = false;
+  }
+  g_free(tmp_path);
+  return result;
+}
+
+void config_store_close(void) {
+  config_store_flush();
+  if (cs.index != NULL) {
+    g_hash_table_destroy(cs.index);
+    cs.index = NULL;
+  }
+  if (cs.lines != NULL) {
+    g_ptr_array_free(cs.lines, TRUE);
+    cs.lines = NULL;
+  }
+  g_free(cs.path);
+  cs.path = NULL;
+}
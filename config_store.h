@@ -0,0 +1,41 @@
+/*
+ * config_store.h
+ *
+ * Description:
+ * config.ini held in memory. The file is parsed once at startup and every
+ * lookup after that is a hash table read. Changes are collected and written
+ * back together a moment later, to a temporary file that is then renamed over
+ * config.ini, so a power cut never leaves a half written file on the SD card.
+ */
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <stdbool.h>
+
+#define CONFIG_FLUSH_DELAY_MS 500 // Changes made within this window go out in one write
+
+// Called after a value has changed in memory
+typedef void ( * config_changed_fn)(const char * key, const char * value, void * data);
+
+// Parse the file, returns false if it does not exist yet (the store is then empty)
+bool config_store_open(const char * path);
+
+// Value for key, or default_value when the key is not set
+const char * config_get(const char * key, const char * default_value);
+
+int config_get_int(const char * key, int default_value);
+
+// Change a value in memory and schedule a write-back, unchanged values are ignored
+void config_set(const char * key, const char * value);
+
+void config_set_int(const char * key, int value);
+
+void config_store_set_change_callback(config_changed_fn fn, void * data);
+
+// Write pending changes now, returns 0 on success
+int config_store_flush(void);
+
+// Flush and free the store
+void config_store_close(void);
+
+#endif
@@ -0,0 +1,264 @@
+/*
+ * control_client.c
+ *
+ * Description:
+ * The command connection is blocking with send and receive timeouts, which
+ * wake the wait up to log a slow daemon and give up on it after
+ * CONTROL_REPLY_MAX_WAITS of them.
+ * Both connections read into a buffer and split it into lines; the event
+ * connection does so from its GLib watch.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include "control_client.h"
+#include "control_protocol.h"
+
+static struct {
+  char path[sizeof(((struct sockaddr_un * ) 0)->sun_path)];
+  int fd;           // Commands and replies
+  GString * in;
+  int event_fd;     // Subscribed
+  GString * events;
+  guint event_watch;
+  control_event_fn event_fn;
+  void * event_data;
+  bool timed_out;   // Why the connections were last dropped
+} cc = { .fd = -1, .event_fd = -1 };
+
+static int connect_socket(const char * path) {
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("Control socket creation error");
+    return -1;
+  }
+  memset( & addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+  if (connect(fd, (struct sockaddr * ) & addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  struct timeval timeout = { CONTROL_REPLY_TIMEOUT_MS / 1000, (CONTROL_REPLY_TIMEOUT_MS % 1000) * 1000 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, & timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, & timeout, sizeof(timeout));
+  return fd;
+}
+
+static bool send_line(int fd, const char * line) {
+  GString * out = g_string_new(line);
+  g_string_append_c(out, '\n');
+  size_t sent = 0;
+  int waits = 0;
+  while (sent < out->len) {
+    ssize_t n = send(fd, out->str + sent, out->len - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && ++waits < CONTROL_REPLY_MAX_WAITS) {
+      continue;
+    }
+    if (n <= 0) {
+      g_string_free(out, TRUE);
+      return false;
+    }
+    sent += n;
+  }
+  g_string_free(out, TRUE);
+  return true;
+}
+
+// Take the first complete line out of buf into line, false if there is none yet
+static bool take_line(GString * buf, char * line, size_t size) {
+  char * end = memchr(buf->str, '\n', buf->len);
+  if (end == NULL) {
+    return false;
+  }
+  size_t len = end - buf->str;
+  snprintf(line, size, "%.*s", (int) len, buf->str);
+  g_string_erase(buf, 0, len + 1);
+  return true;
+}
+
+// Close both connections and tell the event function, the daemon has gone away or stopped replying
+static void connection_lost(bool timed_out) {
+  cc.timed_out = timed_out;
+  if (cc.event_watch != 0) {
+    g_source_remove(cc.event_watch);
+    cc.event_watch = 0;
+  }
+  if (cc.event_fd >= 0) {
+    close(cc.event_fd);
+    cc.event_fd = -1;
+  }
+  if (cc.fd >= 0) {
+    close(cc.fd);
+    cc.fd = -1;
+  }
+  if (cc.event_fn != NULL) {
+    cc.event_fn(NULL, cc.event_data);
+  }
+}
+
+int control_client_open(const char * path) {
+  cc.fd = connect_socket(path);
+  if (cc.fd < 0) {
+    return -1;
+  }
+  snprintf(cc.path, sizeof(cc.path), "%s", path);
+  cc.in = g_string_new(NULL);
+  cc.timed_out = false;
+  return 0;
+}
+
+bool control_client_request(const char * command, char * reply, size_t size) {
+  char line[CONTROL_LINE_MAX];
+  if (reply != NULL && size > 0) {
+    reply[0] = '\0';
+  }
+  if (cc.fd < 0) {
+    fprintf(stderr, "Control request %s not sent, no daemon\n", command);
+    return false;
+  }
+  if (!send_line(cc.fd, command)) {
+    bool timed_out = errno == EAGAIN || errno == EWOULDBLOCK;
+    fprintf(stderr, "Control request %s not sent: %s\n", command, timed_out ? "daemon not responding" : strerror(errno));
+    connection_lost(timed_out);
+    return false;
+  }
+  int waited_ms = 0;
+  while (!take_line(cc.in, line, sizeof(line))) {
+    char buf[512];
+    ssize_t n = recv(cc.fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      waited_ms += CONTROL_REPLY_TIMEOUT_MS;
+      if (waited_ms < CONTROL_REPLY_MAX_WAITS * CONTROL_REPLY_TIMEOUT_MS) {
+        fprintf(stderr, "Control request %s: no reply after %d ms, still waiting\n", command, waited_ms);
+        continue;
+      }
+      // A new connection cannot be handed the late reply, so the next command starts on one
+      fprintf(stderr, "Control request %s: no reply after %d ms, daemon not responding\n", command, waited_ms);
+      connection_lost(true);
+      return false;
+    }
+    if (n <= 0) {
+      fprintf(stderr, "Control request %s: %s\n", command, n == 0 ? "daemon closed the connection" : strerror(errno));
+      connection_lost(false);
+      return false;
+    }
+    g_string_append_len(cc.in, buf, n);
+  }
+
+  bool ok = strncmp(line, "OK", 2) == 0;
+  const char * text = line + (ok ? 2 : 3);
+  if (reply != NULL) {
+    snprintf(reply, size, "%s", * text == ' ' ? text + 1 : text);
+  }
+  if (!ok) {
+    fprintf(stderr, "Control request %s failed: %s\n", command, line);
+  }
+  return ok;
+}
+
+bool control_client_timed_out(void) {
+  return cc.timed_out;
+}
+
+static gboolean on_event_socket(gint fd, GIOCondition condition, gpointer data) {
+  char buf[2048];
+  ssize_t n = (condition & G_IO_IN) ? recv(fd, buf, sizeof(buf), MSG_DONTWAIT) : 0;
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return G_SOURCE_CONTINUE;
+  }
+  if (n <= 0) {
+    fprintf(stderr, "Control event connection closed\n");
+    cc.event_watch = 0; // Removed by returning G_SOURCE_REMOVE
+    connection_lost(false);
+    return G_SOURCE_REMOVE;
+  }
+  g_string_append_len(cc.events, buf, n);
+  char line[CONTROL_LINE_MAX];
+  while (take_line(cc.events, line, sizeof(line))) {
+    if (strncmp(line, "EVENT ", 6) == 0) {
+      cc.event_fn(line + 6, cc.event_data);
+    }
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+int control_client_subscribe(control_event_fn fn, void * data) {
+  // Not after the command connection was lost, the caller is about to start over
+  cc.event_fd = cc.fd >= 0 ? connect_socket(cc.path) : -1;
+  if (cc.event_fd >= 0 && !send_line(cc.event_fd, "SUBSCRIBE")) {
+    close(cc.event_fd);
+    cc.event_fd = -1;
+  }
+  if (cc.event_fd < 0) {
+    fprintf(stderr, "Control event connection failed\n");
+    return -1;
+  }
+  cc.event_fn = fn;
+  cc.event_data = data;
+  cc.events = g_string_new(NULL);
+  cc.event_watch = g_unix_fd_add(cc.event_fd, G_IO_IN | G_IO_HUP | G_IO_ERR, on_event_socket, NULL);
+  return 0;
+}
+
+bool control_value(const char * line, const char * key, char * value, size_t size) {
+  size_t key_len = strlen(key);
+  for (const char * p = line; p != NULL && * p != '\0'; p = strchr(p, ' ')) {
+    while ( * p == ' ') {
+      p++;
+    }
+    if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+      const char * start = p + key_len + 1;
+      snprintf(value, size, "%.*s", (int) strcspn(start, " "), start);
+      return true;
+    }
+  }
+  return false;
+}
+
+int control_value_int(const char * line, const char * key, int default_value) {
+  char value[64];
+  return control_value(line, key, value, sizeof(value)) ? atoi(value) : default_value;
+}
+
+double control_value_double(const char * line, const char * key, double default_value) {
+  char value[64];
+  return control_value(line, key, value, sizeof(value)) ? atof(value) : default_value;
+}
+
+void control_client_close(void) {
+  if (cc.event_watch != 0) {
+    g_source_remove(cc.event_watch);
+    cc.event_watch = 0;
+  }
+  if (cc.event_fd >= 0) {
+    close(cc.event_fd);
+    cc.event_fd = -1;
+  }
+  if (cc.fd >= 0) {
+    close(cc.fd);
+    cc.fd = -1;
+  }
+  if (cc.in != NULL) {
+    g_string_free(cc.in, TRUE);
+    cc.in = NULL;
+  }
+  if (cc.events != NULL) {
+    g_string_free(cc.events, TRUE);
+    cc.events = NULL;
+  }
+}
@@ -0,0 +1,51 @@
+/*
+ * control_client.h
+ *
+ * Description:
+ * Client side of the freedv_pttd control API (see control_protocol.h) for the
+ * GTK window. Commands go over one connection and wait for their reply, which
+ * on a local socket takes well under a millisecond; events arrive on a second,
+ * subscribed connection watched by the GLib main loop, so a reply never has to
+ * be picked out from between events.
+ *
+ * A slow reply is waited for CONTROL_REPLY_MAX_WAITS periods of
+ * CONTROL_REPLY_TIMEOUT_MS, then the daemon is taken as not responding and the
+ * connection is dropped; the reply can then never be read as the answer to a
+ * later command, which goes over a new connection. Either connection going
+ * away, or a daemon not responding, closes both and calls the event function
+ * with NULL, after which the caller closes the client and opens it again once
+ * the daemon is back.
+ */
+#ifndef CONTROL_CLIENT_H
+#define CONTROL_CLIENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CONTROL_REPLY_TIMEOUT_MS 2000 // A reply slower than this is logged
+#define CONTROL_REPLY_MAX_WAITS 3 // Timeouts before the daemon is taken as not responding
+
+// Called with every event line, without "EVENT ". NULL when the daemon has gone away.
+typedef void ( * control_event_fn)(const char * event, void * data);
+
+// Connect to the daemon at path, returns -1 if none is listening
+int control_client_open(const char * path);
+
+// Send a command and wait for its reply. The text after OK or ERR goes to reply (may be NULL).
+// Returns true for OK, false for ERR, no connection, a lost connection or no reply.
+bool control_client_request(const char * command, char * reply, size_t size);
+
+// True when the connections were dropped because the daemon stopped replying, rather than closed by it
+bool control_client_timed_out(void);
+
+// Open the event connection, returns -1 on failure
+int control_client_subscribe(control_event_fn fn, void * data);
+
+// Value of key=value in a reply or event line, false when the key is absent
+bool control_value(const char * line, const char * key, char * value, size_t size);
+int control_value_int(const char * line, const char * key, int default_value);
+double control_value_double(const char * line, const char * key, double default_value);
+
+void control_client_close(void);
+
+#endif
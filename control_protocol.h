@@ -0,0 +1,72 @@
+/*
+ * control_protocol.h
+ *
+ * Description:
+ * Local control API of freedv_pttd, shared by the daemon and its clients.
+ *
+ * A client connects to the Unix stream socket at CONTROL_SOCKET_PATH and sends
+ * one command per line. Every command gets exactly one reply line, in order:
+ *
+ *   OK [key=value ...]
+ *   ERR <reason>
+ *
+ * After SUBSCRIBE the connection also receives event lines, which may arrive
+ * between replies:
+ *
+ *   EVENT <name> [key=value ...]
+ *
+ * Commands:
+ *   STATUS                      OK with the same fields as the STATE event
+ *   PTT ON | PTT OFF            Key or un-key; OFF keeps the radio keyed until the TX audio has played out
+ *   FREQ <hz>                   Tune the radio to a FreeDV channel, ends a scan
+ *   CHANNELS                    OK count=<n>, the size of the channel table
+ *   CHANNEL <index>             OK freq=<hz> mode=<LSB|USB|DIGITAL> pitch=<hz> low=<hz> high=<hz> band=<name>,
+ *                               in frequency order; the band name runs to the end of the line
+ *   SCAN [dwell_ms] | SCAN STOP Step through the channel table until a channel has sync
+ *   GET <key>                   OK value=<value> from config.ini, the value runs to the end of the line
+ *   SET <key> <value>           Change a setting; squelch_level, input_level, fdvmode and callsign apply at once
+ *   RX_CHANNEL <index> | AUTO   RX channel played on the headset
+ *   REPLAY [seconds] | REPLAY STOP
+ *   SAVE_RX                     Start writing the recent RX to WAV files, OK prefix=<name>
+ *   SUBSCRIBE                   Send events on this connection from now on
+ *   SHUTDOWN                    Stop the daemon
+ *
+ * Events:
+ *   STATE ptt=<rx|tx|none> radio_ptt=<-1|0|1> freq=<hz> radio=<0|1> hamlib=<0|1> audio=<opening|ready|failed>
+ *         missing=<devices> timeshift=<0|1> replay=<0|1> scan=<0|1>
+ *   RX channel=<i> offset=<hz> playing=<0|1> sync=<0|1> mode=<name> snr=<dB> ber=<ber> foff=<Hz> clock=<ppm> callsign=<call>
+ *   RING path=<tx|rx> fill=<n> capacity=<n> high=<n> overruns=<n> underruns=<n>
+ *   SAVED prefix=<name> | SAVE_FAILED
+ *
+ * ptt is what the station asked for and radio_ptt what rigctld last reported
+ * (-1 while unknown). They differ when the radio's time-out timer or another
+ * controller changed PTT; the station never re-keys the radio because of it.
+ *
+ * missing lists the sound devices that are unplugged or could not be opened,
+ * comma-separated from headset, sbitx_tx and sbitx_rx; it is empty when all
+ * are there, and a STATE goes out whenever one goes or comes back.
+ *
+ * RX is sent at most CONTROL_RX_EVENT_HZ times a second per channel, with the
+ * SNR and BER averaged over the frames since the last one. Values never hold
+ * spaces; an empty value is written as key= .
+ *
+ * PTT keyed with PTT ON is released when the connection that keyed it closes,
+ * so a client that crashes mid-over does not leave the radio transmitting.
+ *
+ * freedv_pttd exits with DAEMON_EXIT_NO_SBITX when sBitx is not running, so a
+ * client that started it can say why. Missing sound cards do not stop it.
+ */
+#ifndef CONTROL_PROTOCOL_H
+#define CONTROL_PROTOCOL_H
+
+#define FREEDV_PTT_VERSION "2.4.6a"
+#define CONTROL_SOCKET_PATH "/tmp/freedv_ptt.sock"
+#define CONTROL_LINE_MAX 512
+#define CONTROL_MAX_CHANNELS 8    // RX channels a client has to be ready for
+#define CONTROL_CHANNEL_AUTO -1
+#define CONTROL_RX_EVENT_HZ 10
+#define CONTROL_RING_EVENT_MS 1000
+
+#define DAEMON_EXIT_NO_SBITX 2
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * control_server.c
+ *
+ * Description:
+ * A stale socket file left by a daemon that crashed is replaced; one that still
+ * answers a connect belongs to a running daemon and is left alone.
+ *
+ * Each client has an input buffer, split into lines as they complete, and an
+ * output buffer that is written whenever the socket is writable. SUBSCRIBE is
+ * handled here, every other line goes to the handler. Clients are few and local,
+ * so they are kept in a plain list.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib-unix.h>
+#include "control_server.h"
+#include "control_protocol.h"
+
+struct control_client {
+  int id;
+  int fd;
+  GString * in;
+  GString * out;
+  guint watch;
+  bool watching_out;
+  bool subscribed;
+  bool closing; // Shut down, freed once its watch sees the hangup
+};
+
+static struct {
+  char path[sizeof(((struct sockaddr_un * ) 0)->sun_path)];
+  int fd;
+  guint accept_watch;
+  GList * clients;
+  int next_id;
+  control_command_fn handler;
+  control_closed_fn closed;
+  void * handler_data;
+} cs = { .fd = -1 };
+
+static gboolean on_client_event(gint fd, GIOCondition condition, gpointer data);
+
+static void client_free(struct control_client * c) {
+  if (c->watch != 0) {
+    g_source_remove(c->watch);
+  }
+  close(c->fd);
+  g_string_free(c->in, TRUE);
+  g_string_free(c->out, TRUE);
+  cs.clients = g_list_remove(cs.clients, c);
+  int id = c->id;
+  g_free(c);
+  if (cs.closed != NULL) {
+    cs.closed(id, cs.handler_data);
+  }
+}
+
+static void client_watch(struct control_client * c, bool writable) {
+  if (c->watch != 0) {
+    if (c->watching_out == writable) {
+      return;
+    }
+    g_source_remove(c->watch);
+  }
+  c->watching_out = writable;
+  c->watch = g_unix_fd_add(c->fd, G_IO_IN | G_IO_HUP | G_IO_ERR | (writable ? G_IO_OUT : 0), on_client_event, c);
+}
+
+// Write as much of the output buffer as the socket takes, returns false when the client is gone
+static bool client_flush(struct control_client * c) {
+  while (c->out->len > 0) {
+    ssize_t n = send(c->fd, c->out->str, c->out->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        client_watch(c, true);
+        return true;
+      }
+      return false;
+    }
+    g_string_erase(c->out, 0, n);
+  }
+  client_watch(c, false);
+  return true;
+}
+
+// Stop talking to a client. It is only freed from its own watch, so callers up the stack can still use it.
+static void client_shutdown(struct control_client * c) {
+  c->closing = true;
+  shutdown(c->fd, SHUT_RDWR);
+}
+
+// Queue a line for the client, returns false when the client is being dropped
+static bool client_send(struct control_client * c, const char * prefix, const char * text) {
+  if (c->closing) {
+    return false;
+  }
+  if (c->out->len > CONTROL_BACKLOG_MAX) {
+    fprintf(stderr, "Control client not reading, disconnected\n");
+    client_shutdown(c);
+    return false;
+  }
+  g_string_append(c->out, prefix);
+  if (text[0] != '\0') {
+    g_string_append_c(c->out, ' ');
+    g_string_append(c->out, text);
+  }
+  g_string_append_c(c->out, '\n');
+  if (!client_flush(c)) {
+    client_shutdown(c);
+    return false;
+  }
+  return true;
+}
+
+// Run every complete line in the input buffer
+static void client_run_lines(struct control_client * c) {
+  GString * reply = g_string_new(NULL);
+  char * end;
+  while ((end = memchr(c->in->str, '\n', c->in->len)) != NULL) {
+    * end = '\0';
+    if (end > c->in->str && end[-1] == '\r') {
+      end[-1] = '\0';
+    }
+    g_string_truncate(reply, 0);
+    bool ok;
+    if (strcmp(c->in->str, "SUBSCRIBE") == 0) {
+      c->subscribed = true;
+      ok = true;
+    } else {
+      ok = cs.handler(c->id, c->in->str, reply, cs.handler_data);
+    }
+    g_string_erase(c->in, 0, end - c->in->str + 1);
+    if (!client_send(c, ok ? "OK" : "ERR", reply->str)) {
+      break;
+    }
+  }
+  g_string_free(reply, TRUE);
+}
+
+static gboolean on_client_event(gint fd, GIOCondition condition, gpointer data) {
+  struct control_client * c = data;
+  bool gone = c->closing;
+  if (!gone && (condition & G_IO_IN)) {
+    char buf[1024];
+    ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0) {
+      g_string_append_len(c->in, buf, n);
+      if (c->in->len > CONTROL_LINE_MAX && memchr(c->in->str, '\n', c->in->len) == NULL) {
+        fprintf(stderr, "Control client sent an overlong line, disconnected\n");
+        client_shutdown(c);
+      }
+      client_run_lines(c);
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+      gone = true;
+    }
+  } else if (condition & (G_IO_HUP | G_IO_ERR)) {
+    gone = true;
+  }
+  if (!gone && (condition & G_IO_OUT) && !client_flush(c)) {
+    gone = true;
+  }
+  if (gone || c->closing) {
+    client_free(c); // Also removes this watch, or the one that replaced it
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_accept(gint fd, GIOCondition condition, gpointer data) {
+  int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (client_fd < 0) {
+    return G_SOURCE_CONTINUE;
+  }
+  if (g_list_length(cs.clients) >= CONTROL_CLIENTS_MAX) {
+    fprintf(stderr, "Too many control clients, connection refused\n");
+    close(client_fd);
+    return G_SOURCE_CONTINUE;
+  }
+  struct control_client * c = g_new0(struct control_client, 1);
+  c->id = ++cs.next_id;
+  c->fd = client_fd;
+  c->in = g_string_new(NULL);
+  c->out = g_string_new(NULL);
+  cs.clients = g_list_prepend(cs.clients, c);
+  client_watch(c, false);
+  return G_SOURCE_CONTINUE;
+}
+
+int control_server_open(const char * path, control_command_fn command, control_closed_fn closed, void * data) {
+  struct sockaddr_un addr;
+  memset( & addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+  // Someone answering on the socket means a daemon is already running
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe >= 0) {
+    bool running = connect(probe, (struct sockaddr * ) & addr, sizeof(addr)) == 0;
+    close(probe);
+    if (running) {
+      fprintf(stderr, "Another freedv_pttd is already listening on %s\n", path);
+      return -1;
+    }
+  }
+  unlink(path);
+
+  cs.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (cs.fd < 0) {
+    perror("Control socket creation error");
+    return -1;
+  }
+  if (bind(cs.fd, (struct sockaddr * ) & addr, sizeof(addr)) < 0 || listen(cs.fd, 4) < 0) {
+    perror("Control socket bind failed");
+    close(cs.fd);
+    cs.fd = -1;
+    return -1;
+  }
+  snprintf(cs.path, sizeof(cs.path), "%s", path);
+  cs.handler = command;
+  cs.closed = closed;
+  cs.handler_data = data;
+  cs.accept_watch = g_unix_fd_add(cs.fd, G_IO_IN, on_accept, NULL);
+  printf("Control API listening on %s\n", path);
+  return 0;
+}
+
+void control_server_broadcast(const char * event) {
+  for (GList * l = cs.clients; l != NULL; l = l->next) {
+    struct control_client * c = l->data;
+    if (c->subscribed) {
+      client_send(c, "EVENT", event);
+    }
+  }
+}
+
+void control_server_close(void) {
+  cs.closed = NULL;
+  while (cs.clients != NULL) {
+    client_free(cs.clients->data);
+  }
+  if (cs.accept_watch != 0) {
+    g_source_remove(cs.accept_watch);
+    cs.accept_watch = 0;
+  }
+  if (cs.fd >= 0) {
+    close(cs.fd);
+    cs.fd = -1;
+    unlink(cs.path);
+  }
+}
@@ -0,0 +1,37 @@
+/*
+ * control_server.h
+ *
+ * Description:
+ * Unix socket server for the control API of freedv_pttd (see control_protocol.h),
+ * driven by the GLib main loop. It frames lines, keeps track of which clients
+ * have subscribed and fans events out to them; what a command means is left to
+ * the handler. Nothing ever blocks the loop: replies and events wait in a
+ * per-client buffer until the socket takes them.
+ */
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include <stdbool.h>
+#include <glib.h>
+
+#define CONTROL_CLIENTS_MAX 16
+#define CONTROL_BACKLOG_MAX (256 * 1024) // Unsent bytes after which a client that stopped reading is dropped
+
+// Run one command line (without the newline) from client, a number that identifies the
+// connection. Append the reply text, without OK or ERR, to reply and return true for OK,
+// false for ERR.
+typedef bool ( * control_command_fn)(int client, const char * command, GString * reply, void * data);
+
+// Called once a client's connection has closed
+typedef void ( * control_closed_fn)(int client, void * data);
+
+// Listen on path, returns -1 if another daemon is already serving it or the socket cannot be made
+int control_server_open(const char * path, control_command_fn command, control_closed_fn closed, void * data);
+
+// Send "EVENT <event>" to every subscribed client
+void control_server_broadcast(const char * event);
+
+// Disconnect every client and remove the socket
+void control_server_close(void);
+
+#endif
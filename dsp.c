@@ -0,0 +1,492 @@
+/*
+ * dsp.c
+ *
+ * Description:
+ * Replaces the sox "vol <input_level>dB" stage of the old TX pipeline, and adds
+ * the other blocks a microphone path wants. Everything is S16 in and out with
+ * saturation; intermediate products are 32 bit.
+ *
+ * The vector versions must stay bit-identical to the _scalar ones: the same
+ * truncating shifts, the same rounding and the same saturation points (block
+ * peaks are taken as min(|x|, 32767), which is what the saturating vector abs
+ * instructions produce). Build with -march=native (or -mavx2) to get AVX2 on
+ * x86, SSE2 is the x86-64 baseline. NEON is the baseline on 64 bit Pi OS; on
+ * 32 bit it needs -mfpu=neon.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "dsp.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DSP_NEON 1
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define DSP_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DSP_SSE2 1
+#endif
+
+static inline short saturate16(int x) {
+  return (short) (x > 32767 ? 32767 : (x < -32768 ? -32768 : x));
+}
+
+const char * dsp_simd_name(void) {
+#if defined(DSP_NEON)
+  return "neon";
+#elif defined(DSP_AVX2)
+  return "avx2";
+#elif defined(DSP_SSE2)
+  return "sse2";
+#else
+  return "scalar";
+#endif
+}
+
+int dsp_gain_q12_from_db(float db) {
+  int gain = (int) lrintf(DSP_Q12_ONE * powf(10.0f, db / 20.0f));
+  return gain > 32767 ? 32767 : gain;
+}
+
+/*
+ * Kernels: x = saturate((x * g) >> shift), g in 0..32767
+ */
+
+static void scale_scalar(short * x, int n, int g, int shift) {
+  for (int i = 0; i < n; i++) {
+    x[i] = saturate16((x[i] * g) >> shift);
+  }
+}
+
+static void scale_simd(short * x, int n, int g, int shift) {
+  int i = 0;
+#if defined(DSP_NEON)
+  int32x4_t sh = vdupq_n_s32(-shift);
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t v = vld1q_s16(x + i);
+    int32x4_t lo = vshlq_s32(vmull_n_s16(vget_low_s16(v), (int16_t) g), sh);
+    int32x4_t hi = vshlq_s32(vmull_n_s16(vget_high_s16(v), (int16_t) g), sh);
+    vst1q_s16(x + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+  }
+#elif defined(DSP_AVX2)
+  __m256i gv = _mm256_set1_epi16((short) g);
+  __m128i sh = _mm_cvtsi32_si128(shift);
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i * ) (x + i));
+    __m256i plo = _mm256_mullo_epi16(v, gv);
+    __m256i phi = _mm256_mulhi_epi16(v, gv);
+    // unpack and packs both work within 128 bit lanes, so the sample order comes back unchanged
+    __m256i p0 = _mm256_sra_epi32(_mm256_unpacklo_epi16(plo, phi), sh);
+    __m256i p1 = _mm256_sra_epi32(_mm256_unpackhi_epi16(plo, phi), sh);
+    _mm256_storeu_si256((__m256i * ) (x + i), _mm256_packs_epi32(p0, p1));
+  }
+#elif defined(DSP_SSE2)
+  __m128i gv = _mm_set1_epi16((short) g);
+  __m128i sh = _mm_cvtsi32_si128(shift);
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i * ) (x + i));
+    __m128i plo = _mm_mullo_epi16(v, gv);
+    __m128i phi = _mm_mulhi_epi16(v, gv);
+    __m128i p0 = _mm_sra_epi32(_mm_unpacklo_epi16(plo, phi), sh);
+    __m128i p1 = _mm_sra_epi32(_mm_unpackhi_epi16(plo, phi), sh);
+    _mm_storeu_si128((__m128i * ) (x + i), _mm_packs_epi32(p0, p1));
+  }
+#endif
+  scale_scalar(x + i, n - i, g, shift);
+}
+
+// Largest min(|x|, 32767) in the block
+static int peak_scalar(const short * x, int n) {
+  int peak = 0;
+  for (int i = 0; i < n; i++) {
+    int a = x[i] < 0 ? -x[i] : x[i];
+    if (a > peak) {
+      peak = a;
+    }
+  }
+  return peak > 32767 ? 32767 : peak;
+}
+
+static int peak_simd(const short * x, int n) {
+  if (n != DSP_LIMITER_BLOCK) {
+    return peak_scalar(x, n);
+  }
+#if defined(DSP_NEON)
+  int16x8_t m = vmaxq_s16(vqabsq_s16(vld1q_s16(x)), vqabsq_s16(vld1q_s16(x + 8)));
+#if defined(__aarch64__)
+  return vmaxvq_s16(m);
+#else
+  int16x4_t p = vpmax_s16(vget_low_s16(m), vget_high_s16(m));
+  p = vpmax_s16(p, p);
+  p = vpmax_s16(p, p);
+  return vget_lane_s16(p, 0);
+#endif
+#elif defined(DSP_AVX2)
+  __m256i v = _mm256_loadu_si256((const __m256i * ) x);
+  __m256i a = _mm256_max_epi16(v, _mm256_subs_epi16(_mm256_setzero_si256(), v));
+  __m128i m = _mm_max_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+  m = _mm_max_epi16(m, _mm_srli_si128(m, 8));
+  m = _mm_max_epi16(m, _mm_srli_si128(m, 4));
+  m = _mm_max_epi16(m, _mm_srli_si128(m, 2));
+  return (short) _mm_cvtsi128_si32(m);
+#elif defined(DSP_SSE2)
+  __m128i v0 = _mm_loadu_si128((const __m128i * ) x);
+  __m128i v1 = _mm_loadu_si128((const __m128i * ) (x + 8));
+  __m128i zero = _mm_setzero_si128();
+  __m128i m = _mm_max_epi16(_mm_max_epi16(v0, _mm_subs_epi16(zero, v0)), _mm_max_epi16(v1, _mm_subs_epi16(zero, v1)));
+  m = _mm_max_epi16(m, _mm_srli_si128(m, 8));
+  m = _mm_max_epi16(m, _mm_srli_si128(m, 4));
+  m = _mm_max_epi16(m, _mm_srli_si128(m, 2));
+  return (short) _mm_cvtsi128_si32(m);
+#else
+  return peak_scalar(x, n);
+#endif
+}
+
+// sum(a[i] * b[i]) over n samples, n a multiple of 16
+static int dot_scalar(const short * a, const short * b, int n) {
+  int acc = 0;
+  for (int i = 0; i < n; i++) {
+    acc += a[i] * b[i];
+  }
+  return acc;
+}
+
+static int dot_simd(const short * a, const short * b, int n) {
+#if defined(DSP_NEON)
+  int32x4_t acc = vdupq_n_s32(0);
+  for (int i = 0; i < n; i += 8) {
+    int16x8_t va = vld1q_s16(a + i);
+    int16x8_t vb = vld1q_s16(b + i);
+    acc = vmlal_s16(acc, vget_low_s16(va), vget_low_s16(vb));
+    acc = vmlal_s16(acc, vget_high_s16(va), vget_high_s16(vb));
+  }
+#if defined(__aarch64__)
+  return vaddvq_s32(acc);
+#else
+  int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+  return vget_lane_s32(vpadd_s32(s, s), 0);
+#endif
+#elif defined(DSP_AVX2)
+  __m256i acc = _mm256_setzero_si256();
+  for (int i = 0; i < n; i += 16) {
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i * ) (a + i)),
+      _mm256_loadu_si256((const __m256i * ) (b + i))));
+  }
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+  s = _mm_add_epi32(s, _mm_srli_si128(s, 4));
+  return _mm_cvtsi128_si32(s);
+#elif defined(DSP_SSE2)
+  __m128i acc = _mm_setzero_si128();
+  for (int i = 0; i < n; i += 8) {
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i * ) (a + i)),
+      _mm_loadu_si128((const __m128i * ) (b + i))));
+  }
+  acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+  acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+  return _mm_cvtsi128_si32(acc);
+#else
+  return dot_scalar(a, b, n);
+#endif
+}
+
+/*
+ * Gain
+ */
+
+void dsp_gain(short * x, int n, int gain_q12) {
+  if (gain_q12 != DSP_Q12_ONE) {
+    scale_simd(x, n, gain_q12, 12);
+  }
+}
+
+void dsp_gain_scalar(short * x, int n, int gain_q12) {
+  if (gain_q12 != DSP_Q12_ONE) {
+    scale_scalar(x, n, gain_q12, 12);
+  }
+}
+
+/*
+ * Limiter / compressor
+ */
+
+void dsp_limiter_init(struct dsp_limiter * l, float threshold_dbfs, float ratio, float release_ms, int rate) {
+  l->threshold = (int) (32767.0f * powf(10.0f, threshold_dbfs / 20.0f));
+  l->ratio = ratio;
+  l->release = expf(-(float) DSP_LIMITER_BLOCK / (release_ms * rate / 1000.0f));
+  l->envelope = 0;
+}
+
+// Follow the block peak and return the Q15 gain for the block, -1 for unity
+static int limiter_gain(struct dsp_limiter * l, int peak) {
+  if (peak > l->envelope) {
+    l->envelope = (float) peak;
+  } else {
+    l->envelope = peak + (l->envelope - peak) * l->release;
+  }
+  if (l->envelope <= l->threshold) {
+    return -1;
+  }
+  float target = l->ratio > 0 ? l->threshold + (l->envelope - l->threshold) / l->ratio : (float) l->threshold;
+  return (int) (32767.0f * target / l->envelope);
+}
+
+void dsp_limiter(struct dsp_limiter * l, short * x, int n) {
+  for (int i = 0; i < n; i += DSP_LIMITER_BLOCK) {
+    int len = n - i < DSP_LIMITER_BLOCK ? n - i : DSP_LIMITER_BLOCK;
+    int gain = limiter_gain(l, peak_simd(x + i, len));
+    if (gain >= 0) {
+      scale_simd(x + i, len, gain, 15);
+    }
+  }
+}
+
+void dsp_limiter_scalar(struct dsp_limiter * l, short * x, int n) {
+  for (int i = 0; i < n; i += DSP_LIMITER_BLOCK) {
+    int len = n - i < DSP_LIMITER_BLOCK ? n - i : DSP_LIMITER_BLOCK;
+    int gain = limiter_gain(l, peak_scalar(x + i, len));
+    if (gain >= 0) {
+      scale_scalar(x + i, len, gain, 15);
+    }
+  }
+}
+
+/*
+ * DC blocker
+ */
+
+void dsp_dc_block(struct dsp_dc_block * d, short * x, int n) {
+  const long long pole_q15 = 32604; // 0.995, corner about 6 Hz at 8 kHz
+  for (int i = 0; i < n; i++) {
+    int in = x[i];
+    int y_q15 = (in - d->x1) * 32768 + (int) ((pole_q15 * d->y1_q15) >> 15);
+    d->x1 = in;
+    d->y1_q15 = y_q15;
+    x[i] = saturate16((y_q15 + (1 << 14)) >> 15);
+  }
+}
+
+/*
+ * FIR bandpass
+ */
+
+void dsp_fir_bandpass_init(struct dsp_fir * f, int ntaps, float low_hz, float high_hz, int rate) {
+  float h[DSP_FIR_MAX_TAPS];
+  if (ntaps > DSP_FIR_MAX_TAPS) {
+    ntaps = DSP_FIR_MAX_TAPS;
+  }
+  memset(f, 0, sizeof( * f));
+  f->ntaps = (ntaps + 15) / 16 * 16;
+
+  // Windowed sinc, the difference of two lowpass filters
+  float centre = (ntaps - 1) / 2.0f;
+  float mean = 0;
+  for (int j = 0; j < ntaps; j++) {
+    float t = j - centre;
+    float high = 2 * high_hz / rate, low = 2 * low_hz / rate;
+    float ideal = t == 0 ? high - low : (sinf((float) M_PI * high * t) - sinf((float) M_PI * low * t)) / ((float) M_PI * t);
+    float window = 0.54f - 0.46f * cosf(2 * (float) M_PI * j / (ntaps - 1));
+    h[j] = ideal * window;
+    mean += h[j] / ntaps;
+  }
+
+  // Force zero gain at DC and keep sum |h| below 2 so the 32 bit accumulator cannot overflow
+  float sum_abs = 0;
+  for (int j = 0; j < ntaps; j++) {
+    h[j] -= mean;
+    sum_abs += fabsf(h[j]);
+  }
+  float scale = sum_abs > 1.99f ? 1.99f / sum_abs : 1.0f;
+  int dc = 0;
+  for (int j = 0; j < ntaps; j++) {
+    f->taps[f->ntaps - 1 - j] = (short) lrintf(h[j] * scale * 32767.0f);
+    dc += f->taps[f->ntaps - 1 - j];
+  }
+  f->taps[f->ntaps - 1 - ntaps / 2] -= dc; // Rounding left a little DC, take it off the centre tap
+}
+
+// Filter in place through a work buffer of [history | chunk]
+static void fir_run(struct dsp_fir * f, short * x, int n, int ( * dot)(const short * , const short * , int)) {
+  short work[DSP_FIR_MAX_TAPS + DSP_FIR_CHUNK];
+  int keep = f->ntaps - 1;
+  while (n > 0) {
+    int len = n < DSP_FIR_CHUNK ? n : DSP_FIR_CHUNK;
+    memcpy(work, f->history, keep * sizeof(short));
+    memcpy(work + keep, x, len * sizeof(short));
+    for (int i = 0; i < len; i++) {
+      x[i] = saturate16((dot(f->taps, work + i, f->ntaps) + (1 << 14)) >> 15);
+    }
+    memcpy(f->history, work + len, keep * sizeof(short));
+    x += len;
+    n -= len;
+  }
+}
+
+void dsp_fir(struct dsp_fir * f, short * x, int n) {
+  fir_run(f, x, n, dot_simd);
+}
+
+void dsp_fir_scalar(struct dsp_fir * f, short * x, int n) {
+  fir_run(f, x, n, dot_scalar);
+}
+
+/*
+ * Polyphase resampler
+ *
+ * The rate ratio is reduced to up / down. Conceptually the input is zero-stuffed
+ * to up times its rate, lowpass filtered and every down-th sample kept; only the
+ * taps that meet non-zero input are ever multiplied, which splits the filter
+ * into up phases of ntaps taps. Every output is then one dot product over the
+ * newest ntaps input samples, the same kernel the FIR bandpass uses.
+ */
+
+static int gcd(int a, int b) {
+  while (b != 0) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// Zeroth order modified Bessel function, for the Kaiser window
+static double bessel_i0(double x) {
+  double sum = 1, term = 1;
+  for (int k = 1; k < 50 && term > 1e-12 * sum; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+int dsp_resampler_init(struct dsp_resampler * r, int rate_in, int rate_out) {
+  memset(r, 0, sizeof( * r));
+  int g = gcd(rate_in, rate_out);
+  r->up = rate_out / g;
+  r->down = rate_in / g;
+  if (r->up > DSP_RESAMPLE_MAX_PHASES) {
+    return -1;
+  }
+
+  // Kaiser windowed sinc at up * rate_in, cut off halfway through the transition band of the lower rate
+  double rate = (double) rate_in * r->up;
+  double low_rate = rate_in < rate_out ? rate_in : rate_out;
+  double transition = (DSP_RESAMPLE_STOPBAND - DSP_RESAMPLE_PASSBAND) * low_rate / rate; // Cycles per sample
+  double cutoff = (DSP_RESAMPLE_STOPBAND + DSP_RESAMPLE_PASSBAND) / 2 * low_rate / rate;
+  double beta = 0.1102 * (DSP_RESAMPLE_ATTENUATION_DB - 8.7);
+  int length = (int) ceil((DSP_RESAMPLE_ATTENUATION_DB - 8) / (2.285 * 2 * M_PI * transition)) + 1;
+  r->ntaps = ((length + r->up - 1) / r->up + 15) / 16 * 16;
+  length = r->ntaps * r->up; // Longer than needed, the window narrows the transition a little further
+  r->taps = calloc((size_t) r->up * r->ntaps, sizeof(short));
+  r->work = calloc(r->ntaps - 1 + DSP_RESAMPLE_CHUNK, sizeof(short));
+  float * h = malloc(length * sizeof(float));
+  if (r->taps == NULL || r->work == NULL || h == NULL) {
+    free(h);
+    dsp_resampler_free(r);
+    return -1;
+  }
+  double centre = (length - 1) / 2.0;
+  for (int m = 0; m < length; m++) {
+    double t = m - centre;
+    double ideal = t == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+    double w = (m - centre) / centre;
+    h[m] = (float) (r->up * ideal * bessel_i0(beta * sqrt(1 - w * w)) / bessel_i0(beta));
+  }
+
+  // Phase p holds h[p], h[p + up], h[p + 2 up] ... time reversed. Each phase is normalised to
+  // unity gain at DC, so the level matches plughw whatever the ratio, and peaks above full scale
+  // saturate in resample_run. The taps use as much of the 32 bit accumulator as the largest
+  // sum |h| leaves, as dsp_fir_bandpass_init does; unlike there the scale is taken back out of
+  // every output, so it costs no level.
+  double sum_abs_max = 0, tap_max = 0;
+  for (int p = 0; p < r->up; p++) {
+    double sum = 0, sum_abs = 0;
+    for (int k = 0; k < r->ntaps; k++) {
+      sum += h[p + k * r->up];
+    }
+    for (int k = 0; k < r->ntaps; k++) {
+      sum_abs += fabs(h[p + k * r->up] / sum);
+      tap_max = fabs(h[p + k * r->up] / sum) > tap_max ? fabs(h[p + k * r->up] / sum) : tap_max;
+    }
+    sum_abs_max = sum_abs > sum_abs_max ? sum_abs : sum_abs_max;
+  }
+  r->one = (int) (1.99 * 32768 / sum_abs_max);
+  r->one = r->one > 32768 ? 32768 : r->one;
+  r->one = r->one * tap_max > 32766 ? (int) (32766 / tap_max) : r->one;
+  r->gain = ((1LL << 32) + r->one / 2) / r->one;
+  float * fraction = malloc(r->ntaps * sizeof(float));
+  if (fraction == NULL) {
+    free(h);
+    dsp_resampler_free(r);
+    return -1;
+  }
+  for (int p = 0; p < r->up; p++) {
+    short * phase = r->taps + p * r->ntaps;
+    double sum = 0;
+    for (int k = 0; k < r->ntaps; k++) {
+      sum += h[p + k * r->up];
+    }
+    // Round down, then up again on the taps that lost the most until the phase sums to one exactly
+    int total = 0;
+    for (int k = 0; k < r->ntaps; k++) {
+      double tap = h[p + k * r->up] / sum * r->one;
+      phase[r->ntaps - 1 - k] = (short) floor(tap);
+      fraction[r->ntaps - 1 - k] = (float) (tap - floor(tap));
+      total += phase[r->ntaps - 1 - k];
+    }
+    for (; total < r->one; total++) {
+      int most = 0;
+      for (int k = 1; k < r->ntaps; k++) {
+        most = fraction[k] > fraction[most] ? k : most;
+      }
+      phase[most]++;
+      fraction[most] = -1;
+    }
+  }
+  free(fraction);
+  free(h);
+  return 0;
+}
+
+void dsp_resampler_free(struct dsp_resampler * r) {
+  free(r->taps);
+  free(r->work);
+  r->taps = NULL;
+  r->work = NULL;
+}
+
+int dsp_resample_max_out(const struct dsp_resampler * r, int n) {
+  return (int) (((long long) n * r->up + r->down - 1) / r->down) + 1;
+}
+
+static int resample_run(struct dsp_resampler * r, const short * in, int n, short * out,
+    int ( * dot)(const short * , const short * , int)) {
+  int keep = r->ntaps - 1;
+  int produced = 0;
+  while (n > 0) {
+    int len = n < DSP_RESAMPLE_CHUNK ? n : DSP_RESAMPLE_CHUNK;
+    memcpy(r->work + keep, in, len * sizeof(short));
+    // Output at t needs input t / up and the ntaps - 1 before it, which start at work[t / up]
+    int limit = len * r->up;
+    for (; r->t < limit; r->t += r->down) {
+      const short * phase = r->taps + (r->t % r->up) * r->ntaps;
+      out[produced++] = saturate16((int) ((dot(phase, r->work + r->t / r->up, r->ntaps) * r->gain + (1LL << 31)) >> 32));
+    }
+    r->t -= limit;
+    memmove(r->work, r->work + len, keep * sizeof(short));
+    in += len;
+    n -= len;
+  }
+  return produced;
+}
+
+int dsp_resample(struct dsp_resampler * r, const short * in, int n, short * out) {
+  return resample_run(r, in, n, out, dot_simd);
+}
+
+int dsp_resample_scalar(struct dsp_resampler * r, const short * in, int n, short * out) {
+  return resample_run(r, in, n, out, dot_scalar);
+}
@@ -0,0 +1,91 @@
+/*
+ * dsp.h
+ *
+ * Description:
+ * Fixed-point S16 processing blocks for the TX microphone path: gain, peak
+ * limiter / compressor, DC blocker and FIR bandpass, all saturating, and the
+ * polyphase resampler between the sound cards' native rates and the modems'
+ * 8 kHz. Gain, limiter, FIR and resampler have a vectorised implementation
+ * (NEON on the Pi, AVX2 or SSE2 on x86, picked at compile time) and a plain C
+ * reference version with the _scalar suffix that gives bit-identical results.
+ * freedv_bench --dsp checks that they agree and times both; freedv_bench
+ * --resample also measures the resampler's passband ripple, stopband rejection
+ * and CPU cost per second of audio.
+ */
+#ifndef DSP_H
+#define DSP_H
+
+#define DSP_Q12_ONE 4096          // Unity gain for dsp_gain
+#define DSP_LIMITER_BLOCK 16      // Samples that share one limiter gain value (2 ms at 8 kHz)
+#define DSP_FIR_MAX_TAPS 64
+#define DSP_FIR_CHUNK 256         // Samples filtered per pass through the work buffer
+#define DSP_RESAMPLE_MAX_PHASES 512     // Largest interpolation factor after reducing the ratio, 8000 -> 44100 needs 441
+#define DSP_RESAMPLE_ATTENUATION_DB 70  // Stopband of the anti-alias / anti-image filter
+#define DSP_RESAMPLE_PASSBAND 0.45f     // Passband edge as a fraction of the lower rate, 3.6 kHz at 8 kHz
+#define DSP_RESAMPLE_STOPBAND 0.55f     // Stopband edge, aliases and images land above the passband
+#define DSP_RESAMPLE_CHUNK 256          // Input samples filtered per pass through the work buffer
+
+struct dsp_limiter {
+  int threshold;     // Peak level where gain reduction starts
+  float ratio;       // Compression above the threshold, 0 for a hard limiter
+  float release;     // Envelope decay per block
+  float envelope;    // Peak envelope of the input
+};
+
+struct dsp_dc_block {
+  int x1;            // Previous input
+  int y1_q15;        // Previous output, Q15
+};
+
+struct dsp_fir {
+  int ntaps;         // Rounded up to a multiple of 16 with zero taps
+  short taps[DSP_FIR_MAX_TAPS] __attribute__((aligned(32))); // Time reversed, Q15
+  short history[DSP_FIR_MAX_TAPS]; // Last ntaps - 1 input samples
+};
+
+struct dsp_resampler {
+  int up;            // Interpolation factor L, the number of filter phases
+  int down;          // Decimation factor M
+  int ntaps;         // Taps per phase, a multiple of 16
+  short * taps;      // up * ntaps, each phase time reversed, each phase summing to one
+  int one;           // Unity gain of the taps, as large as the 32 bit accumulator allows
+  long long gain;    // 2^32 / one, scales each dot product back to unity
+  short * work;      // Last ntaps - 1 input samples followed by up to DSP_RESAMPLE_CHUNK new ones
+  int t;             // Position of the next output in 1/up input samples, from the current chunk's start
+};
+
+// Name of the vector instruction set compiled in, e.g. "neon", "avx2", "sse2" or "scalar"
+const char * dsp_simd_name(void);
+
+// Q12 gain for a level in dB, limited to what fits in 16 bits (about +18 dB)
+int dsp_gain_q12_from_db(float db);
+
+// x = saturate(x * gain_q12 / 4096)
+void dsp_gain(short * x, int n, int gain_q12);
+void dsp_gain_scalar(short * x, int n, int gain_q12);
+
+// Peak limiter (ratio 0) or compressor above threshold_dbfs, instant attack
+void dsp_limiter_init(struct dsp_limiter * l, float threshold_dbfs, float ratio, float release_ms, int rate);
+void dsp_limiter(struct dsp_limiter * l, short * x, int n);
+void dsp_limiter_scalar(struct dsp_limiter * l, short * x, int n);
+
+// First order DC blocker, y[n] = x[n] - x[n-1] + 0.995 y[n-1]. Recursive, so scalar only.
+void dsp_dc_block(struct dsp_dc_block * d, short * x, int n);
+
+// Linear phase bandpass with zero gain at DC, ntaps <= DSP_FIR_MAX_TAPS
+void dsp_fir_bandpass_init(struct dsp_fir * f, int ntaps, float low_hz, float high_hz, int rate);
+void dsp_fir(struct dsp_fir * f, short * x, int n);
+void dsp_fir_scalar(struct dsp_fir * f, short * x, int n);
+
+// Rational polyphase resampler from rate_in to rate_out, returns -1 if the ratio needs too many phases or memory
+int dsp_resampler_init(struct dsp_resampler * r, int rate_in, int rate_out);
+void dsp_resampler_free(struct dsp_resampler * r);
+
+// Most output samples n input samples can produce
+int dsp_resample_max_out(const struct dsp_resampler * r, int n);
+
+// Resample n samples from in to out, returns how many were written. in and out must not overlap.
+int dsp_resample(struct dsp_resampler * r, const short * in, int n, short * out);
+int dsp_resample_scalar(struct dsp_resampler * r, const short * in, int n, short * out);
+
+#endif
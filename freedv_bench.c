@@ -0,0 +1,698 @@
+/*
+ * freedv_bench.c
+ *
+ * Description:
+ * Offline benchmark of the FreeDV processing done by the audio engine, for
+ * finding out how much CPU each mode leaves on the Pi next to sBitx. For every
+ * mode it times the same calls the live TX and RX modem threads make
+ * (modem_tx_frame and modem_rx_frame + modem_get_rx_stats from modem.c) on
+ * 8 kHz S16 audio, without any sound card.
+ *
+ * TX input is synthetic speech-like audio or a recorded speech file. RX input
+ * is the TX output with white noise added at --snr dB (in 3 kHz), or a recorded
+ * modem file. Files are raw S16LE at 8 kHz (what arecord -t raw / freedv_tx
+ * use) or 8 kHz mono 16 bit WAV.
+ *
+ * Results are one JSON object per line (or CSV with --csv) per mode and
+ * direction: frames/sec, real-time factor (processing time / audio time, lower
+ * is better), per-frame latency percentiles, CPU time and peak RSS.
+ *
+ * With --dsp it instead runs every vectorised block in dsp.c next to its
+ * scalar reference on the same input, reports any output sample that differs
+ * and the time per sample of both, and exits non-zero on a mismatch.
+ *
+ * With --resample it checks the resampler the audio engine uses between the
+ * sound cards' native rates and 8 kHz, in both directions for each rate in
+ * --rates: vector against scalar output, passband gain and ripple from tones
+ * across the passband, the worst alias or image left by a tone, and the CPU
+ * time per second of audio of both versions. It exits non-zero on a mismatch,
+ * a passband gain further than BENCH_RESAMPLE_MAX_GAIN_ERROR_DB from 0 dB (a
+ * level change against plughw), more than BENCH_RESAMPLE_MAX_RIPPLE_DB of
+ * ripple or less than BENCH_RESAMPLE_MIN_REJECTION_DB of rejection.
+ *
+ * Usage:
+ * 1. Compile the program using:
+ *    gcc -O2 -o freedv_bench freedv_bench.c modem.c dsp.c `pkg-config --cflags --libs codec2` -lm
+ *
+ * 2. Run the program:
+ *    ./freedv_bench [--modes 700C,700D,700E] [--seconds 60] [--snr 10]
+ *                   [--speech file] [--modem file] [--label text] [--csv] [--dsp]
+ *                   [--resample] [--rates 48000,44100,16000]
+ *    e.g. ./freedv_bench --label "$(git rev-parse --short HEAD) pi4" >> bench.jsonl
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include "modem.h"
+#include "dsp.h"
+
+#define BENCH_RATE 8000
+#define BENCH_MAX_FRAME BENCH_RATE // Larger than any FreeDV frame
+#define BENCH_DEFAULT_SECONDS 60
+#define BENCH_DEFAULT_SNR_DB 10.0
+#define BENCH_DSP_BLOCK 320        // Samples per call in --dsp, one 700C speech frame
+#define BENCH_RESAMPLE_BLOCK_MS 20 // Audio per call in --resample, one capture period of the audio engine
+#define BENCH_RESAMPLE_TONE_S 0.5  // Length of each test tone
+#define BENCH_RESAMPLE_MAX_GAIN_ERROR_DB 0.1
+#define BENCH_RESAMPLE_MAX_RIPPLE_DB 0.1
+#define BENCH_RESAMPLE_MIN_REJECTION_DB 60.0
+
+struct bench_options {
+  char modes[64];
+  int seconds;
+  double snr_db;
+  const char * speech_file;
+  const char * modem_file;
+  const char * label;
+  bool csv;
+  bool dsp;
+  bool resample;
+  char rates[64];
+};
+
+struct bench_result {
+  const char * mode;
+  const char * direction; // "tx" or "rx"
+  int frames;
+  double audio_s;      // Duration of the audio processed
+  double wall_s;       // Time spent inside the timed calls
+  double cpu_s;        // User + system CPU time over the run
+  double p50_us, p90_us, p99_us, max_us;
+  long max_rss_kb;
+  int sync_frames;     // RX only, frames the demodulator was in sync
+};
+
+static int64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, & ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double cpu_seconds(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, & ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static long max_rss_kb(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, & ru);
+  return ru.ru_maxrss;
+}
+
+static int compare_int64(const void * a, const void * b) {
+  int64_t x = * (const int64_t * ) a, y = * (const int64_t * ) b;
+  return (x > y) - (x < y);
+}
+
+// Fill in the latency percentiles from per-frame times, sorts times
+static void set_percentiles(struct bench_result * r, int64_t * times_ns, int n) {
+  if (n == 0) {
+    return;
+  }
+  qsort(times_ns, n, sizeof(int64_t), compare_int64);
+  r->p50_us = times_ns[n * 50 / 100] / 1000.0;
+  r->p90_us = times_ns[n * 90 / 100] / 1000.0;
+  r->p99_us = times_ns[n * 99 / 100] / 1000.0;
+  r->max_us = times_ns[n - 1] / 1000.0;
+}
+
+// Load raw S16LE or a WAV file, returns the number of samples or -1
+static long load_samples(const char * path, short ** samples) {
+  FILE * file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long bytes = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  // Skip the header of a canonical 44 byte WAV file
+  char header[4];
+  if (fread(header, 1, 4, file) == 4 && memcmp(header, "RIFF", 4) == 0) {
+    fseek(file, 44, SEEK_SET);
+    bytes -= 44;
+  } else {
+    fseek(file, 0, SEEK_SET);
+  }
+
+  long n = bytes / (long) sizeof(short);
+  * samples = malloc(n * sizeof(short));
+  if ( * samples == NULL || (long) fread( * samples, sizeof(short), n, file) != n) {
+    fprintf(stderr, "Failed to read %s\n", path);
+    free( * samples);
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+  return n;
+}
+
+// Speech-like test signal: a voiced harmonic series with a syllable-rate envelope
+static short * synth_speech(long n) {
+  short * out = malloc(n * sizeof(short));
+  double phase = 0;
+  for (long i = 0; i < n; i++) {
+    double t = (double) i / BENCH_RATE;
+    double f0 = 120.0 + 30.0 * sin(2 * M_PI * 0.7 * t); // Pitch drifts like intonation
+    phase += 2 * M_PI * f0 / BENCH_RATE;
+    double voiced = 0;
+    for (int h = 1; h <= 20 && h * f0 < 3500; h++) {
+      voiced += sin(h * phase) / h;
+    }
+    double envelope = 0.5 + 0.5 * sin(2 * M_PI * 4.0 * t); // About four syllables a second
+    out[i] = (short) (6000.0 * envelope * voiced);
+  }
+  return out;
+}
+
+// Gaussian noise from a fixed-seed generator so runs are comparable
+static double gaussian(uint32_t * state) {
+  double u1, u2;
+  do {
+    * state = * state * 1664525u + 1013904223u;
+    u1 = ( * state >> 8) / 16777216.0;
+  } while (u1 <= 0.0);
+  * state = * state * 1664525u + 1013904223u;
+  u2 = ( * state >> 8) / 16777216.0;
+  return sqrt(-2.0 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+// Add white noise for snr_db in a 3 kHz bandwidth
+static void add_noise(short * samples, long n, double snr_db) {
+  double power = 0;
+  for (long i = 0; i < n; i++) {
+    power += (double) samples[i] * samples[i];
+  }
+  power /= n;
+  // The noise fills 0..4 kHz, only 3 kHz of it counts against the SNR
+  double sigma = sqrt(power / pow(10.0, snr_db / 10.0) * (BENCH_RATE / 2.0) / 3000.0);
+  uint32_t seed = 1;
+  for (long i = 0; i < n; i++) {
+    double s = samples[i] + sigma * gaussian( & seed);
+    samples[i] = (short) (s > 32767 ? 32767 : (s < -32768 ? -32768 : s));
+  }
+}
+
+// Time modem_tx_frame over speech, returns the modem signal in * modem_out
+static int bench_tx(const char * mode, const short * speech, long n_speech, short ** modem_out, long * n_modem_out, struct bench_result * r) {
+  struct modem * m = modem_open_tx(mode, "N0CALL", 0);
+  if (m == NULL) {
+    return -1;
+  }
+  int frames = (int) (n_speech / m->n_speech);
+  int64_t * times = malloc(frames * sizeof(int64_t));
+  short * frame = malloc(m->n_speech * sizeof(short));
+  * modem_out = malloc((size_t) frames * m->n_modem * sizeof(short));
+
+  double cpu_start = cpu_seconds();
+  int64_t total = 0;
+  for (int i = 0; i < frames; i++) {
+    memcpy(frame, speech + (long) i * m->n_speech, m->n_speech * sizeof(short)); // modem_tx_frame applies the gain in place
+    int64_t t0 = now_ns();
+    modem_tx_frame(m, * modem_out + (long) i * m->n_modem, frame);
+    times[i] = now_ns() - t0;
+    total += times[i];
+  }
+  r->cpu_s = cpu_seconds() - cpu_start;
+  r->frames = frames;
+  r->audio_s = (double) frames * m->n_speech / BENCH_RATE;
+  r->wall_s = total / 1e9;
+  set_percentiles(r, times, frames);
+  r->max_rss_kb = max_rss_kb();
+  * n_modem_out = (long) frames * m->n_modem;
+
+  free(times);
+  free(frame);
+  modem_close(m);
+  return 0;
+}
+
+// Time modem_rx_frame + modem_get_rx_stats over a modem signal, as the RX modem thread runs them
+static int bench_rx(const char * mode, const short * modem_in, long n_modem, struct bench_result * r) {
+  struct modem * m = modem_open_rx(mode, -100); // Squelch open, decode everything
+  if (m == NULL) {
+    return -1;
+  }
+  int max_frames = (int) (n_modem / (m->n_modem / 2)) + 1; // nin only moves a little around n_modem
+  int64_t * times = malloc(max_frames * sizeof(int64_t));
+  short * speech = malloc(BENCH_MAX_FRAME * sizeof(short));
+  struct modem_rx_stats stats;
+
+  double cpu_start = cpu_seconds();
+  int64_t total = 0;
+  long pos = 0;
+  int frames = 0;
+  int nin;
+  while (frames < max_frames && pos + (nin = modem_rx_nin(m)) <= n_modem) {
+    int64_t t0 = now_ns();
+    modem_rx_frame(m, speech, modem_in + pos);
+    modem_get_rx_stats(m, & stats);
+    times[frames] = now_ns() - t0;
+    total += times[frames];
+    r->sync_frames += stats.sync;
+    pos += nin;
+    frames++;
+  }
+  r->cpu_s = cpu_seconds() - cpu_start;
+  r->frames = frames;
+  r->audio_s = (double) pos / BENCH_RATE;
+  r->wall_s = total / 1e9;
+  set_percentiles(r, times, frames);
+  r->max_rss_kb = max_rss_kb();
+
+  free(times);
+  free(speech);
+  modem_close(m);
+  return 0;
+}
+
+static void print_result(const struct bench_options * opt, const struct utsname * host, const struct bench_result * r, bool first) {
+  double fps = r->wall_s > 0 ? r->frames / r->wall_s : 0;
+  double rtf = r->audio_s > 0 ? r->wall_s / r->audio_s : 0;
+  if (opt->csv) {
+    if (first) {
+      printf("label,host,machine,mode,direction,frames,audio_s,wall_s,cpu_s,frames_per_s,rtf,p50_us,p90_us,p99_us,max_us,max_rss_kb,sync_frames\n");
+    }
+    printf("%s,%s,%s,%s,%s,%d,%.3f,%.6f,%.3f,%.1f,%.5f,%.1f,%.1f,%.1f,%.1f,%ld,%d\n",
+      opt->label, host->nodename, host->machine, r->mode, r->direction, r->frames, r->audio_s, r->wall_s, r->cpu_s,
+      fps, rtf, r->p50_us, r->p90_us, r->p99_us, r->max_us, r->max_rss_kb, r->sync_frames);
+  } else {
+    printf("{\"label\":\"%s\",\"host\":\"%s\",\"machine\":\"%s\",\"mode\":\"%s\",\"direction\":\"%s\","
+      "\"frames\":%d,\"audio_s\":%.3f,\"wall_s\":%.6f,\"cpu_s\":%.3f,\"frames_per_s\":%.1f,\"rtf\":%.5f,"
+      "\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f},\"max_rss_kb\":%ld,\"sync_frames\":%d}\n",
+      opt->label, host->nodename, host->machine, r->mode, r->direction, r->frames, r->audio_s, r->wall_s, r->cpu_s,
+      fps, rtf, r->p50_us, r->p90_us, r->p99_us, r->max_us, r->max_rss_kb, r->sync_frames);
+  }
+  fflush(stdout);
+}
+
+struct dsp_result {
+  const char * block;
+  long samples;
+  long mismatches;     // Output samples where the vector and scalar versions differ
+  double scalar_ns;    // Per sample
+  double simd_ns;
+};
+
+// Run the same block of input through a vector block and its scalar reference, in
+// BENCH_DSP_BLOCK sized calls as the TX path does, compare and time them
+#define DSP_COMPARE(r, input, n, simd_call, scalar_call) do { \
+    short * a = malloc((n) * sizeof(short)); \
+    short * b = malloc((n) * sizeof(short)); \
+    memcpy(a, input, (n) * sizeof(short)); \
+    memcpy(b, input, (n) * sizeof(short)); \
+    int64_t t0 = now_ns(); \
+    for (long off = 0; off + BENCH_DSP_BLOCK <= (n); off += BENCH_DSP_BLOCK) { \
+      short * x = a + off; \
+      simd_call; \
+    } \
+    int64_t t1 = now_ns(); \
+    for (long off = 0; off + BENCH_DSP_BLOCK <= (n); off += BENCH_DSP_BLOCK) { \
+      short * x = b + off; \
+      scalar_call; \
+    } \
+    int64_t t2 = now_ns(); \
+    (r)->samples += (n); \
+    (r)->simd_ns += (double) (t1 - t0); \
+    (r)->scalar_ns += (double) (t2 - t1); \
+    for (long k = 0; k < (n); k++) { \
+      (r)->mismatches += a[k] != b[k]; \
+    } \
+    free(a); \
+    free(b); \
+  } while (0)
+
+static void print_dsp_result(const struct bench_options * opt, const struct utsname * host, struct dsp_result * r, bool first) {
+  double scalar_ns = r->samples > 0 ? r->scalar_ns / r->samples : 0;
+  double simd_ns = r->samples > 0 ? r->simd_ns / r->samples : 0;
+  double speedup = simd_ns > 0 ? scalar_ns / simd_ns : 0;
+  if (opt->csv) {
+    if (first) {
+      printf("label,host,machine,block,simd,samples,mismatches,scalar_ns_per_sample,simd_ns_per_sample,speedup\n");
+    }
+    printf("%s,%s,%s,%s,%s,%ld,%ld,%.3f,%.3f,%.2f\n", opt->label, host->nodename, host->machine, r->block,
+      dsp_simd_name(), r->samples, r->mismatches, scalar_ns, simd_ns, speedup);
+  } else {
+    printf("{\"label\":\"%s\",\"host\":\"%s\",\"machine\":\"%s\",\"block\":\"%s\",\"simd\":\"%s\","
+      "\"samples\":%ld,\"mismatches\":%ld,\"scalar_ns_per_sample\":%.3f,\"simd_ns_per_sample\":%.3f,\"speedup\":%.2f}\n",
+      opt->label, host->nodename, host->machine, r->block, dsp_simd_name(), r->samples, r->mismatches,
+      scalar_ns, simd_ns, speedup);
+  }
+  fflush(stdout);
+}
+
+// Check every vectorised block in dsp.c against its scalar version on speech and
+// on full scale noise, which exercises saturation. Returns the number of blocks that differ.
+static int bench_dsp(const struct bench_options * opt, const struct utsname * host, const short * speech, long n) {
+  n -= n % BENCH_DSP_BLOCK;
+  short * noise = malloc(n * sizeof(short));
+  uint32_t seed = 1;
+  for (long i = 0; i < n; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    noise[i] = (short) (seed >> 16);
+  }
+  const short * inputs[] = { speech, noise };
+  int failures = 0;
+
+  struct dsp_result gain = { "gain" };
+  static const float gains_db[] = { -20.0f, -3.0f, 0.0f, 6.0f, 18.0f };
+  for (int i = 0; i < 2; i++) {
+    for (size_t g = 0; g < sizeof(gains_db) / sizeof(gains_db[0]); g++) {
+      int q12 = dsp_gain_q12_from_db(gains_db[g]);
+      DSP_COMPARE( & gain, inputs[i], n, dsp_gain(x, BENCH_DSP_BLOCK, q12), dsp_gain_scalar(x, BENCH_DSP_BLOCK, q12));
+    }
+  }
+
+  struct dsp_result limiter = { "limiter" };
+  static const float ratios[] = { 0.0f, 4.0f };
+  for (int i = 0; i < 2; i++) {
+    for (size_t k = 0; k < sizeof(ratios) / sizeof(ratios[0]); k++) {
+      struct dsp_limiter la, lb;
+      dsp_limiter_init( & la, -12.0f, ratios[k], 50.0f, BENCH_RATE);
+      lb = la;
+      DSP_COMPARE( & limiter, inputs[i], n, dsp_limiter( & la, x, BENCH_DSP_BLOCK), dsp_limiter_scalar( & lb, x, BENCH_DSP_BLOCK));
+    }
+  }
+
+  struct dsp_result fir = { "fir_bandpass" };
+  for (int i = 0; i < 2; i++) {
+    struct dsp_fir fa, fb;
+    dsp_fir_bandpass_init( & fa, 31, 300.0f, 2700.0f, BENCH_RATE);
+    fb = fa;
+    DSP_COMPARE( & fir, inputs[i], n, dsp_fir( & fa, x, BENCH_DSP_BLOCK), dsp_fir_scalar( & fb, x, BENCH_DSP_BLOCK));
+  }
+
+  struct dsp_result * results[] = { & gain, & limiter, & fir };
+  for (int i = 0; i < 3; i++) {
+    print_dsp_result(opt, host, results[i], i == 0);
+    if (results[i]->mismatches != 0) {
+      fprintf(stderr, "%s: %s and scalar versions differ in %ld samples\n", results[i]->block, dsp_simd_name(), results[i]->mismatches);
+      failures++;
+    }
+  }
+  free(noise);
+  return failures;
+}
+
+struct resample_result {
+  int rate_in, rate_out;
+  int phase_taps;
+  long samples;        // Input samples compared between the vector and scalar versions
+  long mismatches;
+  double scalar_ns;    // Over opt->seconds of audio
+  double simd_ns;
+  double min_gain_db;  // Over the passband tones
+  double max_gain_db;
+  double ripple_db;    // Max - min passband gain
+  double rejection_db; // Worst alias or image below the tone that caused it
+};
+
+// Resample all of in (at rate_in) through r in BENCH_RESAMPLE_BLOCK_MS calls, returns the output length
+static long resample_all(struct dsp_resampler * r, bool simd, const short * in, long n, int rate_in, short * out) {
+  int block = rate_in * BENCH_RESAMPLE_BLOCK_MS / 1000;
+  long produced = 0;
+  for (long off = 0; off < n; off += block) {
+    int len = n - off < block ? (int) (n - off) : block;
+    produced += simd ? dsp_resample(r, in + off, len, out + produced) : dsp_resample_scalar(r, in + off, len, out + produced);
+  }
+  return produced;
+}
+
+// Pass a tone of freq_hz through a fresh resampler. Returns the output's gain at freq_hz in dB
+// (-inf when the tone is above the output's Nyquist) and sets * residual_db to what is left
+// after removing that component, relative to the tone.
+static double tone_response(int rate_in, int rate_out, double freq_hz, double * residual_db) {
+  struct dsp_resampler r;
+  dsp_resampler_init( & r, rate_in, rate_out);
+  long n = (long) (BENCH_RESAMPLE_TONE_S * rate_in);
+  short * in = malloc(n * sizeof(short));
+  short * out = malloc(dsp_resample_max_out( & r, (int) n) * sizeof(short));
+  const double amplitude = 10000;
+  for (long i = 0; i < n; i++) {
+    in[i] = (short) lrint(amplitude * sin(2 * M_PI * freq_hz * i / rate_in));
+  }
+  long m = resample_all( & r, true, in, n, rate_in, out);
+
+  // Least squares fit of the tone over the second half, well past the filter delay
+  long start = m / 2;
+  double cc = 0, ss = 0, cs = 0, yc = 0, ys = 0, power = 0;
+  bool in_band = freq_hz < rate_out / 2.0;
+  for (long i = start; i < m; i++) {
+    double c = in_band ? cos(2 * M_PI * freq_hz * i / rate_out) : 0;
+    double s = in_band ? sin(2 * M_PI * freq_hz * i / rate_out) : 0;
+    cc += c * c;
+    ss += s * s;
+    cs += c * s;
+    yc += out[i] * c;
+    ys += out[i] * s;
+  }
+  double a = 0, b = 0;
+  double det = cc * ss - cs * cs;
+  if (in_band && det > 0) {
+    a = (yc * ss - ys * cs) / det;
+    b = (ys * cc - yc * cs) / det;
+  }
+  for (long i = start; i < m; i++) {
+    double fit = a * cos(2 * M_PI * freq_hz * i / rate_out) + b * sin(2 * M_PI * freq_hz * i / rate_out);
+    power += (out[i] - fit) * (out[i] - fit);
+  }
+  double residual_rms = sqrt(power / (m - start));
+  * residual_db = 20 * log10((residual_rms > 0 ? residual_rms : 1e-3) / (amplitude / sqrt(2)));
+
+  free(in);
+  free(out);
+  dsp_resampler_free( & r);
+  return in_band ? 20 * log10(sqrt(a * a + b * b) / amplitude) : -INFINITY;
+}
+
+static void measure_resampler(const struct bench_options * opt, struct resample_result * res) {
+  int low_rate = res->rate_in < res->rate_out ? res->rate_in : res->rate_out;
+  double passband = DSP_RESAMPLE_PASSBAND * low_rate;
+  double stopband = DSP_RESAMPLE_STOPBAND * low_rate;
+  double max_gain = -INFINITY, min_gain = INFINITY, worst = -INFINITY;
+
+  // Passband tones: flat gain, and nothing else in the output (images when interpolating)
+  for (double f = 100; f <= passband; f += 100) {
+    double residual_db, gain_db = tone_response(res->rate_in, res->rate_out, f, & residual_db);
+    max_gain = gain_db > max_gain ? gain_db : max_gain;
+    min_gain = gain_db < min_gain ? gain_db : min_gain;
+    worst = residual_db > worst ? residual_db : worst;
+  }
+  // Stopband tones when decimating: whatever comes out is an alias
+  for (double f = stopband; f < res->rate_in / 2.0; f += 250) {
+    double residual_db;
+    tone_response(res->rate_in, res->rate_out, f, & residual_db);
+    worst = residual_db > worst ? residual_db : worst;
+  }
+  res->min_gain_db = min_gain;
+  res->max_gain_db = max_gain;
+  res->ripple_db = max_gain - min_gain;
+  res->rejection_db = -worst;
+
+  // Vector against scalar on full scale noise, which exercises saturation, timing both
+  struct dsp_resampler a, b;
+  dsp_resampler_init( & a, res->rate_in, res->rate_out);
+  dsp_resampler_init( & b, res->rate_in, res->rate_out);
+  res->phase_taps = a.ntaps;
+  long n = (long) opt->seconds * res->rate_in;
+  short * in = malloc(n * sizeof(short));
+  short * out_a = malloc(dsp_resample_max_out( & a, (int) n) * sizeof(short));
+  short * out_b = malloc(dsp_resample_max_out( & b, (int) n) * sizeof(short));
+  uint32_t seed = 1;
+  for (long i = 0; i < n; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    in[i] = (short) (seed >> 16);
+  }
+  int64_t t0 = now_ns();
+  long m = resample_all( & a, true, in, n, res->rate_in, out_a);
+  int64_t t1 = now_ns();
+  long m_scalar = resample_all( & b, false, in, n, res->rate_in, out_b);
+  int64_t t2 = now_ns();
+  res->samples = n;
+  res->simd_ns = (double) (t1 - t0);
+  res->scalar_ns = (double) (t2 - t1);
+  res->mismatches = labs(m - m_scalar);
+  for (long k = 0; k < m && k < m_scalar; k++) {
+    res->mismatches += out_a[k] != out_b[k];
+  }
+  free(in);
+  free(out_a);
+  free(out_b);
+  dsp_resampler_free( & a);
+  dsp_resampler_free( & b);
+}
+
+static void print_resample_result(const struct bench_options * opt, const struct utsname * host, const struct resample_result * r, bool first) {
+  double seconds = (double) r->samples / r->rate_in;
+  double scalar_ms = r->scalar_ns / 1e6 / seconds; // CPU ms per second of audio
+  double simd_ms = r->simd_ns / 1e6 / seconds;
+  double speedup = simd_ms > 0 ? scalar_ms / simd_ms : 0;
+  if (opt->csv) {
+    if (first) {
+      printf("label,host,machine,rate_in,rate_out,simd,phase_taps,samples,mismatches,min_gain_db,max_gain_db,ripple_db,rejection_db,scalar_ms_per_s,simd_ms_per_s,speedup\n");
+    }
+    printf("%s,%s,%s,%d,%d,%s,%d,%ld,%ld,%.4f,%.4f,%.4f,%.1f,%.3f,%.3f,%.2f\n", opt->label, host->nodename, host->machine,
+      r->rate_in, r->rate_out, dsp_simd_name(), r->phase_taps, r->samples, r->mismatches, r->min_gain_db, r->max_gain_db,
+      r->ripple_db, r->rejection_db, scalar_ms, simd_ms, speedup);
+  } else {
+    printf("{\"label\":\"%s\",\"host\":\"%s\",\"machine\":\"%s\",\"block\":\"resample\",\"rate_in\":%d,\"rate_out\":%d,"
+      "\"simd\":\"%s\",\"phase_taps\":%d,\"samples\":%ld,\"mismatches\":%ld,\"min_gain_db\":%.4f,\"max_gain_db\":%.4f,"
+      "\"ripple_db\":%.4f,\"rejection_db\":%.1f,\"scalar_ms_per_s\":%.3f,\"simd_ms_per_s\":%.3f,\"speedup\":%.2f}\n",
+      opt->label, host->nodename, host->machine, r->rate_in, r->rate_out, dsp_simd_name(), r->phase_taps, r->samples,
+      r->mismatches, r->min_gain_db, r->max_gain_db, r->ripple_db, r->rejection_db, scalar_ms, simd_ms, speedup);
+  }
+  fflush(stdout);
+}
+
+// Check the resampler between every rate in opt->rates and BENCH_RATE, both ways. Returns the number of failures.
+static int bench_resample(struct bench_options * opt, const struct utsname * host) {
+  int failures = 0;
+  bool first = true;
+  char * saveptr;
+  for (char * rate = strtok_r(opt->rates, ",", & saveptr); rate != NULL; rate = strtok_r(NULL, ",", & saveptr)) {
+    for (int direction = 0; direction < 2; direction++) {
+      struct resample_result r = { 0 };
+      r.rate_in = direction == 0 ? atoi(rate) : BENCH_RATE;
+      r.rate_out = direction == 0 ? BENCH_RATE : atoi(rate);
+      struct dsp_resampler probe;
+      if (r.rate_in <= 0 || r.rate_out <= 0 || dsp_resampler_init( & probe, r.rate_in, r.rate_out) < 0) {
+        fprintf(stderr, "Cannot resample %s Hz\n", rate);
+        failures++;
+        break;
+      }
+      dsp_resampler_free( & probe);
+      measure_resampler(opt, & r);
+      print_resample_result(opt, host, & r, first);
+      first = false;
+      if (r.mismatches != 0) {
+        fprintf(stderr, "resample %d -> %d: %s and scalar versions differ in %ld samples\n", r.rate_in, r.rate_out, dsp_simd_name(), r.mismatches);
+        failures++;
+      }
+      if (fabs(r.min_gain_db) > BENCH_RESAMPLE_MAX_GAIN_ERROR_DB || fabs(r.max_gain_db) > BENCH_RESAMPLE_MAX_GAIN_ERROR_DB) {
+        fprintf(stderr, "resample %d -> %d: passband gain %.3f to %.3f dB, not 0 dB\n", r.rate_in, r.rate_out, r.min_gain_db, r.max_gain_db);
+        failures++;
+      }
+      if (r.ripple_db > BENCH_RESAMPLE_MAX_RIPPLE_DB || r.rejection_db < BENCH_RESAMPLE_MIN_REJECTION_DB) {
+        fprintf(stderr, "resample %d -> %d: %.3f dB ripple, %.1f dB rejection\n", r.rate_in, r.rate_out, r.ripple_db, r.rejection_db);
+        failures++;
+      }
+    }
+  }
+  return failures;
+}
+
+static void usage(const char * program) {
+  fprintf(stderr, "Usage: %s [--modes 700C,700D,700E] [--seconds N] [--snr dB] [--speech file] [--modem file] [--label text] [--csv] [--dsp]\n"
+    "       [--resample] [--rates 48000,44100,16000]\n", program);
+}
+
+int main(int argc, char * argv[]) {
+  struct bench_options opt = { "700C,700D,700E", BENCH_DEFAULT_SECONDS, BENCH_DEFAULT_SNR_DB, NULL, NULL, "", false, false, false, "48000,44100,16000" };
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--modes") == 0 && has_value) {
+      snprintf(opt.modes, sizeof(opt.modes), "%s", argv[++i]);
+    } else if (strcmp(argv[i], "--seconds") == 0 && has_value) {
+      opt.seconds = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--snr") == 0 && has_value) {
+      opt.snr_db = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--speech") == 0 && has_value) {
+      opt.speech_file = argv[++i];
+    } else if (strcmp(argv[i], "--modem") == 0 && has_value) {
+      opt.modem_file = argv[++i];
+    } else if (strcmp(argv[i], "--label") == 0 && has_value) {
+      opt.label = argv[++i];
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      opt.csv = true;
+    } else if (strcmp(argv[i], "--dsp") == 0) {
+      opt.dsp = true;
+    } else if (strcmp(argv[i], "--resample") == 0) {
+      opt.resample = true;
+    } else if (strcmp(argv[i], "--rates") == 0 && has_value) {
+      snprintf(opt.rates, sizeof(opt.rates), "%s", argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (opt.seconds <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  short * speech;
+  long n_speech;
+  if (opt.speech_file != NULL) {
+    n_speech = load_samples(opt.speech_file, & speech);
+    if (n_speech < 0) {
+      return 1;
+    }
+  } else {
+    n_speech = (long) opt.seconds * BENCH_RATE;
+    speech = synth_speech(n_speech);
+  }
+  short * recorded_modem = NULL;
+  long n_recorded_modem = 0;
+  if (opt.modem_file != NULL) {
+    n_recorded_modem = load_samples(opt.modem_file, & recorded_modem);
+    if (n_recorded_modem < 0) {
+      return 1;
+    }
+  }
+
+  struct utsname host;
+  uname( & host);
+  if (opt.resample) {
+    free(speech);
+    free(recorded_modem);
+    return bench_resample( & opt, & host) == 0 ? 0 : 1;
+  }
+  if (opt.dsp) {
+    int failures = bench_dsp( & opt, & host, speech, n_speech);
+    free(speech);
+    free(recorded_modem);
+    return failures == 0 ? 0 : 1;
+  }
+  bool first = true;
+  int failures = 0;
+  char * saveptr;
+  for (char * mode = strtok_r(opt.modes, ",", & saveptr); mode != NULL; mode = strtok_r(NULL, ",", & saveptr)) {
+    struct bench_result tx = { mode, "tx" };
+    short * modem_signal;
+    long n_modem;
+    if (bench_tx(mode, speech, n_speech, & modem_signal, & n_modem, & tx) < 0) {
+      failures++;
+      continue;
+    }
+    print_result( & opt, & host, & tx, first);
+    first = false;
+
+    struct bench_result rx = { mode, "rx" };
+    if (recorded_modem != NULL) {
+      free(modem_signal);
+      modem_signal = NULL;
+    } else {
+      add_noise(modem_signal, n_modem, opt.snr_db);
+    }
+    if (bench_rx(mode, recorded_modem != NULL ? recorded_modem : modem_signal,
+        recorded_modem != NULL ? n_recorded_modem : n_modem, & rx) < 0) {
+      failures++;
+    } else {
+      print_result( & opt, & host, & rx, first);
+    }
+    free(modem_signal);
+  }
+
+  free(speech);
+  free(recorded_modem);
+  return failures == 0 ? 0 : 1;
+}
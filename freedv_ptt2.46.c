@@ -7,35 +7,56 @@
  * user to select a frequency band from predefined options and change the operating
  * frequency and mode accordingly using telnet commands directly to the radio subsystem.
  *
+ * The radio, audio and reporter run in the freedv_pttd daemon (see freedv_pttd.c); this
+ * window is a client of its control API and starts it when it is not already running.
+ *
  * Features:
- * - GUI with dropdown menus for frequency band selection
+ * - GUI with dropdown menus for frequency band selection, built from the daemon's channel table
+ *   (extra channels can be listed in channels_file from config.ini, see rig_state.h)
+ * - Scans the channels and stops on the first one with a FreeDV signal
  * - Buttons for TX (transmit) and RX (receive)
  * - Header bar with Settings button for codec settings
  * - Automatically connects to a telnet server to send frequency and mode commands
  * - Squelch control and audio input level adjustment
- * - Integration with FreeDV Reporter website via Socket.io 
+ * - RX decodes 700C, 700D and 700E at once and shows the mode that has sync
+ * - Optionally decodes several channels of the passband at once (rx_channels in config.ini),
+ *   showing each one's mode, SNR and callsign and letting the user pick which one is heard
+ * - Records the last minutes of RX (timeshift_minutes in config.ini) so a missed over can be
+ *   replayed, or saved as WAV files, without stopping RX
+ * - Finds the headset and sBitx sound cards by name, and carries on when the USB headset is
+ *   unplugged and plugged back in (headset_device etc. in config.ini, see audio_devices.h)
+ * - Integration with FreeDV Reporter website via Socket.io
  *
  * Usage:
- * 1. Compile the program using:
- *    gcc -o freedv_ptt2.46 freedv_ptt2.46.c `pkg-config --cflags --libs gtk+-3.0`
+ * 1. Compile the window and the daemon using:
+ *    gcc -O2 -o freedv_ptt2.46 freedv_ptt2.46.c control_client.c `pkg-config --cflags --libs gtk+-3.0`
+ *    and the build line in freedv_pttd.c, and keep both programs in the same directory.
  *
  * 2. Run the program:
- *    ./freedv_ptt2.4.6
+ *    ./freedv_ptt2.4.6 [--rt-priority N] [--audio-cpu N] [--lock-memory] [--playback-latency-ms N]
+ *    The options are passed on to freedv_pttd when the window starts it, see freedv_pttd.c.
+ *    Closing the window stops a daemon it started; one that was already running keeps going.
+ *
+ * 3. Optionally dump the recent PTT trace (Chrome trace-event JSON, see trace.h) with:
+ *    kill -USR1 $(pidof freedv_pttd)
+ *    The file is trace_file from config.ini, /tmp/freedv_ptt_trace.json by default.
+ *
+ * 4. Measure modem CPU use per mode without a radio, see freedv_bench.c
  *
  * Requirements:
  *
  * - As the code is written the directory must be called /freedv_ptt this of course can be changed but all references to the location in the code will need adjustment to reflect new.
  *
- * - Codec2 freedv_tx, freedv_rx in freedv_ptt directory with this comiled code 
- * - Codec2 library /usr/lib/libcodec2.so.1.2 (https://github.com/drowe67/codec2)
+ * - Codec2 library /usr/lib/libcodec2.so.1.2 (https://github.com/drowe67/codec2), linked directly for the FreeDV modem
  *
  * - GTK+ 3 library
+ * - ALSA library (libasound), used to open the headset and sBitx audio devices in-process
  * - Telnet server will be running on localhost (127.0.0.1) at port 8081
  * - Hamlib Net Server eill be running on localhost (127.0.0.1) at port 4532
  *
  *
- * - To communicate with the qso.freedv.org reporter website the host machine will need to have the socket.io library installed
- * - The sioclient.py file is the client required to make this connection.
+ * - The qso.freedv.org reporter website is reached directly by freedv_pttd (see reporter_client.h),
+ *   no Python or socket.io library is needed.
  *
  *
  * Author:
@@ -48,6 +69,7 @@
  * 6/9/24
  */
 #include <gtk/gtk.h>
+#include <glib-unix.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -55,158 +77,38 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <errno.h>
-#include <arpa/inet.h>
 #include <sys/wait.h>
 #include <stdbool.h>
- 
-#define SERVER_IP "127.0.0.1"
-#define SERVER_PORT 4532
-#define TELNET_PORT 8081
-#define BUFFER_SIZE 1024
-#define CONFIG_FILE "config.ini"
-const char * RELEASE_VERSION = "2.4.6a";
-int sockfd_telnet, sockfd_server;
-int rxtx_mode = -1; // -1 indicates no mode selected, 0 for TX, 1 for RX
-pid_t tx_pid, rx_pid;//Global variable to store the PID of the TX and RX process
-pid_t python_pid;//Global variable to store the PID of the Python script process
+#include "control_client.h"
+#include "control_protocol.h"
+
+#define DAEMON_PROGRAM "freedv_pttd"
+#define DAEMON_START_TIMEOUT_MS 15000 // Covers the sBitx check and opening the control socket
+#define DAEMON_POLL_MS 100
+#define DAEMON_RECONNECT_MS 1000 // Retry interval after losing the daemon
+#define DAEMON_STOP_TIMEOUT_MS 5000 // Covers un-keying the radio and closing audio, then it is killed
+const char * RELEASE_VERSION = FREEDV_PTT_VERSION;
 GtkWidget * value_label = NULL; // Declare value_label globally
 GtkWidget * selected_menu_item = NULL; // Used to track selected freq dropdown
-
-
-// Used to print the current environment variables. This was used for diagnostics and is not required
-//extern char **environ;
-//
-//void print_environment_variables() {
-//    int i = 0;
-//    while (environ[i] != NULL) {
-//        printf("%s\n", environ[i++]);
-//    }
-//}
-
-
-// Function to start the Python script 
-void start_python_script() {
-    if ((python_pid = fork()) == 0) {
-        // Child process: Execute the Python script
-        execl("/usr/bin/python3", "python3", "/home/pi/freedv_ptt/sioclient.py", NULL);
-        perror("Failed to start Python script");
-        exit(EXIT_FAILURE);
-    } else if (python_pid < 0) {
-        perror("Failed to fork");
-        exit(EXIT_FAILURE);
-    } else {
-        printf("Started Python script with PID: %d\n", python_pid);
-    }
-}
-
-
-//// Function to start the -=(Compiled)=- Python script 
-//void start_python_script() {
-//    if ((python_pid = fork()) == 0) {
-//        // Child process: Create a new process group
-//        setpgid(0, 0);
-//        char *argv[] = {"/home/pi/freedv_ptt/assets/sioclient", NULL};
-//        char *envp[] = { "PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin", NULL };
-
-//        // Redirect output to a log file
-//        freopen("/tmp/sioclient_stdout.log", "w", stdout);
-//        freopen("/tmp/sioclient_stderr.log", "w", stderr);
-
-//        execve(argv[0], argv, envp);
-//        perror("Failed to start Python executable");
-//        exit(EXIT_FAILURE);
-//    } else if (python_pid < 0) {
-//        perror("Failed to fork");
-//        exit(EXIT_FAILURE);
-//    } else {
-//        printf("Started Python executable with PID: %d\n", python_pid);
-//        // Set the parent process to be the leader of the process group
-//        setpgid(python_pid, python_pid);
-//    }
-//}
-
-// Function to send IPC command
-void send_ipc_command(const char *command) {
-    int sock;
-    struct sockaddr_in server_addr;
-    char buffer[1024] = {0};
-
-    // Create socket
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("Socket creation error");
-        return;
-    }
-
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(50007);
-
-    // Convert IPv4 and IPv6 addresses from text to binary form
-    if (inet_pton(AF_INET, "127.0.0.1", &server_addr.sin_addr) <= 0) {
-        perror("Invalid address/ Address not supported");
-        return;
-    }
-
-    // Connect to server
-    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Connection failed");
-        return;
-    }
-
-    // Send command
-    send(sock, command, strlen(command), 0);
-    printf("IPC command sent: %s\n", command);
-
-    close(sock);
-}
-
-// Function to send commands to the Hamlib Net server
-void send_command(const char * command) {
-  if (send(sockfd_server, command, strlen(command), 0) < 0) {
-    perror("Send failed");
-    exit(EXIT_FAILURE);
-  }
-}
-
-void handle_termination(int signum) {
-    // Terminate the Python script process if it's running
-    if (python_pid > 0) {
-        // Kill the entire process group
-        kill(-python_pid, SIGTERM);
-        printf("Terminated Python script with PID: %d\n", python_pid);
-        // Wait for the child process to terminate
-        waitpid(python_pid, NULL, 0);
-    }
-
-    // Close the socket opened to the Hamlib server
-    close(sockfd_server);  
-    exit(0);
-}
-
-// Function to check if the configuration file exists
-int config_file_exists() {
-  FILE * file = fopen(CONFIG_FILE, "r");
-  if (file) {
-    fclose(file);
-    return 1; // File exists
-  }
-  return 0; // File doesn't exist
-}
-int check_audio_device(const char *device) {
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/asound/%s", device);
-    FILE *file = fopen(path, "r");
-    if (file) {
-        fclose(file);
-        return 1; // Device found
-    }
-    return 0; // Device not found
-}
-
-int check_program_running(const char *program) {
-    char command[256];
-    snprintf(command, sizeof(command), "pgrep %s > /dev/null", program);
-    return system(command) == 0;
-}
+GtkWidget * channel_menu; // Band menu, filled from the daemon's channel table
+GtkWidget * scan_item;
+bool updating_scan = false; // Scan item changed by a STATE event, not by the user
+GtkWidget * status_label = NULL; // Connection status line under the TX/RX buttons
+GtkWidget * sync_label = NULL; // RX modem stats next to the TX/RX buttons
+GtkWidget * snr_label = NULL;
+GtkWidget * ber_label = NULL;
+GtkWidget * channel_labels[CONTROL_MAX_CHANNELS][3]; // Mode/sync, SNR and callsign per RX channel
+int channel_count = 0; // RX channels in the table, 0 when only one is decoded
+GtkWidget * tx_button;
+GtkWidget * rx_button;
+GtkWidget * replay_button;
+GtkWidget * save_rx_button;
+char ring_stats[2][160]; // Last RING event per path, shown in the status line tooltip
+bool updating_replay = false; // Replay button changed by a STATE event, not by the user
+pid_t daemon_pid = 0; // freedv_pttd when this window started it
+int daemon_wait_ms = 0;
+guint reconnect_timer = 0; // Waiting for the daemon to come back
+char ** daemon_args; // Command line options passed on to freedv_pttd
 
 void on_dialog_response(GtkDialog *dialog, gint response_id, gpointer user_data) {
     gtk_widget_destroy(GTK_WIDGET(dialog));
@@ -233,166 +135,34 @@ void show_message_dialog(const char *message) {
     gtk_dialog_run(GTK_DIALOG(dialog));
 }
 
-
-// Function to create the configuration file with default values
-void create_default_config() {
-  FILE * file = fopen(CONFIG_FILE, "w");
-  if (file != NULL) {
-    fprintf(file, "fdvmode=700D\n");
-    fprintf(file, "callsign=N0CALL\n");
-    fprintf(file, "grid_square=AA00ab\n");
-    fprintf(file, "squelch_level=-5\n");
-    fprintf(file, "input_level=1\n");
-    fprintf(file, "start_mode=-1\n");
-    fprintf(file, "version=sBitx fdv_ptt %s\n",RELEASE_VERSION);
-    fprintf(file, "message=--\n");
-    fclose(file);
-  } else {
-    perror("Failed to create configuration file");
-  }
+// Function to show a message that does not end the program, unlike show_message_dialog
+void show_info_dialog(const char * message) {
+  GtkWidget * dialog = gtk_message_dialog_new(NULL, GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_INFO, GTK_BUTTONS_OK, "%s", message);
+  g_signal_connect(dialog, "response", G_CALLBACK(gtk_widget_destroy), NULL);
+  gtk_widget_show_all(dialog);
 }
 
-// Generic function to save a key-value pair to a configuration file
-void save_config(const char * key,
-  const char * value) {
-  FILE * file = fopen(CONFIG_FILE, "r+");
-  if (file != NULL) {
-    char line[256];
-    int found = 0;
-    FILE * tempFile = tmpfile();
-    if (tempFile == NULL) {
-      perror("Failed to create temporary file");
-      fclose(file);
-      return;
-    }
-
-    // Read each line from the configuration file and update key-value pair
-    while (fgets(line, sizeof(line), file) != NULL) {
-      if (strstr(line, key) == line) {
-        fprintf(tempFile, "%s=%s\n", key, value);
-        found = 1;
-      } else {
-        fputs(line, tempFile);
-      }
-    }
-
-    // If key was not found, append it to the end of the temporary file
-    if (!found) {
-      fprintf(tempFile, "%s=%s\n", key, value);
-    }
-
-    // Copy the updated content back to the original file
-    rewind(file);
-    rewind(tempFile);
-    while (fgets(line, sizeof(line), tempFile) != NULL) {
-      fputs(line, file);
-    }
-
-    // Truncate the original file to the new length
-    ftruncate(fileno(file), ftell(file));
-
-    fclose(tempFile);
-    fclose(file);
-  } else {
-    perror("Failed to open configuration file");
-  }
-}
-
-// Generic function to load a value by key from a configuration file
-void load_config(const char * key, char * value,
-  const char * default_value) {
-  strcpy(value, default_value);
-
-  FILE * file = fopen(CONFIG_FILE, "r");
-  if (file != NULL) {
-    char file_key[50];
-    char file_value[256];
-    while (fscanf(file, "%49[^=]=%255s\n", file_key, file_value) == 2) {
-      if (strcmp(file_key, key) == 0) {
-        strcpy(value, file_value);
-        break;
-      }
-    }
-    fclose(file);
-  } else {
-    perror("Failed to open configuration file");
-  }
-}
-
-
-// Specific save/load functions for each configuration parameter
-
-void save_squelch_level(int squelch_level) {
-  char value[50];
-  snprintf(value, sizeof(value), "%d", squelch_level);
-  save_config("squelch_level", value);
-}
-
-int load_squelch_level() {
-  char value[50];
-  load_config("squelch_level", value, "-5");
-  return atoi(value);
-}
-
-void save_input_level(int input_level) {
-  char value[50];
-  snprintf(value, sizeof(value), "%d", input_level);
-  save_config("input_level", value);
-}
-
-int load_input_level() {
-  char value[50];
-  load_config("input_level", value, "1");
-  return atoi(value);
-}
-
-void save_fdvmode(const char * fdvmode) {
-  save_config("fdvmode", fdvmode);
- 
-// Send IPC command for mode change
-  char command[30]; // Assuming a sufficient size for the command
-  sprintf(command, "MODE_CHANGE %s", fdvmode);
-  send_ipc_command(command);
-  
+// Function to read a config.ini setting through the daemon, empty when it cannot be read
+void get_setting(const char * key, char * value, size_t size) {
+  char command[64], reply[CONTROL_LINE_MAX];
+  snprintf(command, sizeof(command), "GET %s", key);
+  bool ok = control_client_request(command, reply, sizeof(reply)) && strncmp(reply, "value=", 6) == 0;
+  snprintf(value, size, "%s", ok ? reply + 6 : "");
 }
-void save_release_version(const char *release_version) {
-  // Allocate enough memory to hold the concatenated string
-  char full_version[256]; // Adjust size as needed
 
-  // Concatenate the prefix and the release version in one line
-  snprintf(full_version, sizeof(full_version), "sBitx fdv_ptt %s", release_version);
-
-  // Save the concatenated string
-  save_config("version", full_version);
-}
-
-char * load_fdvmode() {
-  static char fdvmode[256];
-  load_config("fdvmode", fdvmode, "700D");
-  printf("Mode from config file: %s\n", fdvmode);
-  return fdvmode;
+int get_setting_int(const char * key, int default_value) {
+  char value[32];
+  get_setting(key, value, sizeof(value));
+  return value[0] != '\0' ? atoi(value) : default_value;
 }
 
-void save_callsign(const char * callsign) {
-  save_config("callsign", callsign);
-}
-
-char * load_callsign() {
-  static char callsign[256];
-  load_config("callsign", callsign, "N0CALL");
-  printf("Callsign from config file: %s\n", callsign);
-  return callsign;
-}
-
-void save_grid_square(const char * grid_square) {
-  save_config("grid_square", grid_square);
-}
-
-char * load_grid_square() {
-  static char grid_square[256];
-  load_config("grid_square", grid_square, "AA00ab");
-  printf("Grid_square from config file: %s\n", grid_square);
-  return grid_square;
+// Function to change a setting, the daemon saves it and applies it to the running station
+void set_setting(const char * key, const char * value) {
+  char command[CONTROL_LINE_MAX];
+  snprintf(command, sizeof(command), "SET %s %s", key, value);
+  if (control_client_request(command, NULL, 0)) {
+    printf("Saved %s: %s\n", key, value);
+  }
 }
 
 // Function to update the value label when the slider is adjusted
@@ -406,21 +176,17 @@ void on_adjustment_value_changed(GtkAdjustment * adjustment, gpointer data) {
   g_free(label_text);
 }
 
+
 // Function to apply codec settings
 void apply_codec_settings(int squelch_level, int input_level, const char * fdvmode, const char * callsign, const char * grid_square) {
-  // Implement the logic to apply codec settings here
-  printf("Saved squelch level: %d\n", squelch_level);
-  printf("Saved input level: %d\n", input_level);
-  printf("Saved mode: %s\n", fdvmode);
-  printf("Saved Callsign: %s\n", callsign);
-  printf("Saved Grid Square: %s\n", grid_square);
-  save_squelch_level(squelch_level);
-  save_input_level(input_level);
-  save_fdvmode(fdvmode);
-  save_callsign(callsign);
-  save_grid_square(grid_square);
-  save_release_version(RELEASE_VERSION);
- 
+  char value[16];
+  snprintf(value, sizeof(value), "%d", squelch_level);
+  set_setting("squelch_level", value);
+  snprintf(value, sizeof(value), "%d", input_level);
+  set_setting("input_level", value);
+  set_setting("fdvmode", fdvmode);
+  set_setting("callsign", callsign);
+  set_setting("grid_square", grid_square);
 }
 
 // Function to handle apply button click
@@ -459,106 +225,45 @@ void on_apply_button_clicked(GtkButton * button, gpointer data) {
 
 // Function to handle TX button click
 void on_tx_button_clicked(GtkButton * button, gpointer data) {
-  if (rxtx_mode != 0) {
-    // If not already in TX mode, terminate RX process (if running) and launch TX process
-    if (rx_pid > 0) {
-      if (killpg(rx_pid, SIGTERM) == -1 && errno != ESRCH) {
-        perror("Failed to kill RX process group");
-        exit(EXIT_FAILURE);
-      }
-      rx_pid = 0;
-    }
-    // Load the input level from the configuration file
-    int input_level = load_input_level();
-    char * mode = load_fdvmode();
-    char * callsign = load_callsign();
-
-    if ((tx_pid = fork()) == 0) {
-      if (setpgid(0, 0) == -1) {
-        perror("Failed to set TX process group");
-        exit(EXIT_FAILURE);
-      }
-      char tx_command[256];
-
-      // Buffer included to reduce underruns ( This buffer could induce approx 1 second of latency to the audio stream depending on system load.)
-      sprintf(tx_command, "arecord -f S16_LE -c 1 -r 8000 -D plughw:CARD=5,DEV=0 | sox -t raw -r 8000 -e signed -b 16 -c 1 - -t raw - vol %ddB | ./freedv_tx %s --reliabletext %s - - | aplay -f S16_LE -D plughw:CARD=2,DEV=0 --buffer-size=8192", input_level, mode, callsign);
-
-      printf("Executing TX command: %s\n", tx_command);
-      execl("/bin/sh", "sh", "-c", tx_command, NULL);
-      perror("Failed to execute TX process");
-      exit(EXIT_FAILURE);
-    }
-
-    rxtx_mode = 0;
-    send_command("T 1\n"); // Send TX command to radio
-    printf("Switched to TX mode.\n");
-    // Send IPC command to Python script
-    send_ipc_command("TX_ON");
-  }
+  control_client_request("PTT ON", NULL, 0);
 }
 
-// Function to handle RX button click
+// Function to handle RX button click, the daemon keeps the radio keyed until the TX tail has played out
 void on_rx_button_clicked(GtkButton * button, gpointer data) {
-  if (rxtx_mode != 1) {
-    // If not already in RX mode, terminate TX process (if running) and launch RX process
-    if (tx_pid > 0) {
-      // Insert delay of 1.5 seconds before killing the TX process. This will ensure the aplay buffer has played out.
-      usleep(1500000); // 1.5 seconds = 1,500,000 microseconds
-
-      if (killpg(tx_pid, SIGTERM) == -1 && errno != ESRCH) {
-        perror("Failed to kill TX process group");
-        exit(EXIT_FAILURE);
-      }
-      tx_pid = 0;
-    }
+  control_client_request("PTT OFF", NULL, 0);
+}
 
-    // Load the squelch level from the configuration file
-    int squelch_level = load_squelch_level();
-    char * mode = load_fdvmode();
-
-    if ((rx_pid = fork()) == 0) {
-      if (setpgid(0, 0) == -1) {
-        perror("Failed to set RX process group");
-        exit(EXIT_FAILURE);
-      }
-      char rx_command[256];
-      // Modify the rx_command string to include the squelch level argument
-      sprintf(rx_command, "arecord -f S16_LE -c 1 -r 8000 -D plughw:CARD=1,DEV=1 |./freedv_rx %s --squelch %d - - -| aplay -f S16_LE -D plughw:CARD=5,DEV=0", mode, squelch_level);
-      //sprintf(rx_command, "arecord -f S16_LE -c 1 -r 8000 -D plughw:CARD=1,DEV=1 |./freedv_rx %s --squelch %d --reliabletext --txtrx txtrx.tmp -v - - | aplay -f S16_LE -D plughw:CARD=5,DEV=0", mode, squelch_level);
-
-      printf("Executing RX command: %s\n", rx_command);
-      execl("/bin/sh", "sh", "-c", rx_command, NULL);
-      perror("Failed to execute RX process");
-      exit(EXIT_FAILURE);
+// Function to wait for a daemon this window asked to stop, killing it if it does not
+void wait_for_daemon(void) {
+  for (int waited_ms = 0; waitpid(daemon_pid, NULL, WNOHANG) == 0; waited_ms += DAEMON_POLL_MS) {
+    if (waited_ms >= DAEMON_STOP_TIMEOUT_MS) {
+      fprintf(stderr, "%s did not stop within %d ms, killing it\n", DAEMON_PROGRAM, DAEMON_STOP_TIMEOUT_MS);
+      kill(daemon_pid, SIGKILL);
+      waitpid(daemon_pid, NULL, 0);
+      break;
     }
-    rxtx_mode = 1;
-    send_command("T 0\n"); // Send RX command to radio
-    printf("Switched to RX mode.\n");
-    // Send IPC command to Python script
-    send_ipc_command("TX_OFF");
+    g_usleep(DAEMON_POLL_MS * 1000);
   }
+  daemon_pid = 0;
 }
 
-// Function to handle closing of the GTK window
+// Function to handle closing of the GTK window, a daemon started by this window is stopped with it
 void on_window_closed(GtkWidget * widget, gpointer data) {
-  close(sockfd_server);
-  if (tx_pid > 0) {
-    if (killpg(tx_pid, SIGTERM) == -1 && errno != ESRCH) {
-      perror("Failed to kill TX process group");
-      exit(EXIT_FAILURE);
+  if (daemon_pid > 0) {
+    if (!control_client_request("SHUTDOWN", NULL, 0)) {
+      kill(daemon_pid, SIGTERM); // Not connected yet, or not responding
     }
-    tx_pid = 0;
-  }
-  if (rx_pid > 0) {
-    if (killpg(rx_pid, SIGTERM) == -1 && errno != ESRCH) {
-      perror("Failed to kill RX process group");
-      exit(EXIT_FAILURE);
-    }
-    rx_pid = 0;
+    wait_for_daemon();
   }
+  control_client_close();
   gtk_main_quit();
 }
 
+gboolean on_quit_signal(gpointer data) {
+  on_window_closed(NULL, NULL);
+  return G_SOURCE_REMOVE;
+}
+
 // Function to open the codec settings window
 void open_codec_settings_window(GtkWidget * widget, gpointer data) {
   // Create a new window
@@ -576,7 +281,7 @@ void open_codec_settings_window(GtkWidget * widget, gpointer data) {
   gtk_box_pack_start(GTK_BOX(vbox), squelch_label, FALSE, FALSE, 0);
 
   // Create an adjustment for the squelch level slider
-  GtkAdjustment * squelch_adjustment = gtk_adjustment_new(load_squelch_level(), -5, 15, 1, 1, 0);
+  GtkAdjustment * squelch_adjustment = gtk_adjustment_new(get_setting_int("squelch_level", 0), -5, 15, 1, 1, 0);
   GtkWidget * squelch_slider = gtk_scale_new(GTK_ORIENTATION_HORIZONTAL, squelch_adjustment);
   gtk_widget_set_hexpand(squelch_slider, TRUE);
   gtk_box_pack_start(GTK_BOX(vbox), squelch_slider, TRUE, TRUE, 0);
@@ -601,7 +306,7 @@ void open_codec_settings_window(GtkWidget * widget, gpointer data) {
   gtk_box_pack_start(GTK_BOX(vbox), input_label, FALSE, FALSE, 0);
 
   // Create an adjustment for the input level slider
-  GtkAdjustment * input_adjustment = gtk_adjustment_new(load_input_level(), -10, +10, 1, 1, 0);
+  GtkAdjustment * input_adjustment = gtk_adjustment_new(get_setting_int("input_level", 0), -10, +10, 1, 1, 0);
   GtkWidget * input_slider = gtk_scale_new(GTK_ORIENTATION_HORIZONTAL, input_adjustment);
   gtk_widget_set_hexpand(input_slider, TRUE);
   gtk_box_pack_start(GTK_BOX(vbox), input_slider, TRUE, TRUE, 0);
@@ -638,7 +343,8 @@ void open_codec_settings_window(GtkWidget * widget, gpointer data) {
   gtk_box_pack_start(GTK_BOX(mode_box), mode_700e_button, FALSE, FALSE, 0);
 
   // Load the current fdvmode to set the active button
-  const char * current_mode = load_fdvmode();
+  char current_mode[16];
+  get_setting("fdvmode", current_mode, sizeof(current_mode));
   if (strcmp(current_mode, "700C") == 0) {
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(mode_700c_button), TRUE);
   } else if (strcmp(current_mode, "700D") == 0) {
@@ -664,7 +370,8 @@ void open_codec_settings_window(GtkWidget * widget, gpointer data) {
   gtk_box_pack_start(GTK_BOX(hbox_callsign), callsign_entry, FALSE, FALSE, 0);
 
   // Load the current callsign and set it in the text entry
-  const char * current_callsign = load_callsign();
+  char current_callsign[32];
+  get_setting("callsign", current_callsign, sizeof(current_callsign));
   gtk_entry_set_text(GTK_ENTRY(callsign_entry), current_callsign);
 
   // Create a horizontal box for grid_square label and entry
@@ -681,7 +388,8 @@ void open_codec_settings_window(GtkWidget * widget, gpointer data) {
   gtk_box_pack_start(GTK_BOX(hbox_grid_square), grid_square_entry, FALSE, FALSE, 0);
 
   // Load the current grid_square and set it in the text entry
-  const char * current_grid_square = load_grid_square();
+  char current_grid_square[16];
+  get_setting("grid_square", current_grid_square, sizeof(current_grid_square));
   gtk_entry_set_text(GTK_ENTRY(grid_square_entry), current_grid_square);
 
 
@@ -718,242 +426,379 @@ gtk_box_pack_start(GTK_BOX(vbox), github_label, FALSE, FALSE, 0);
   gtk_widget_show_all(window);
 }
 
-void send_telnet_commands(int sockfd_telnet) {
-  char * commands[] = {
-    "m DIGITAL",
-    "LOW 900",
-    "HIGH 2100",
-    "PITCH 1500",
-    "f 14236"
-  };
-
-  // Define delay in milliseconds (200 milliseconds = 0.2 seconds)
-  struct timespec delay = {
-    0,
-    200 * 1000 * 1000
-  }; // 200 milliseconds
-
-  for (int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
-    if (send(sockfd_telnet, commands[i], strlen(commands[i]), 0) < 0) {
-      perror("Send command failed");
-      exit(EXIT_FAILURE);
-    }
-    printf("Sent: %s\n", commands[i]);
-    // Sleep for 200 milliseconds between commands
-    nanosleep( & delay, NULL);
-  }
-
-  // Close the socket after sending commands
-  //close(sockfd_telnet);
+// Function to tune to the channel of the menu item, data is its frequency in Hz
+void menu_item_selected(GtkWidget * widget, gpointer data) {
+  // Change frequency, the daemon also tells the reporter and ends a scan
+  char command[50];
+  snprintf(command, sizeof(command), "FREQ %d", GPOINTER_TO_INT(data));
+  control_client_request(command, NULL, 0);
 }
-void change_mode(const char * frequency) {
-  // Determine mode command based on frequency band
-  char * mode_command;
 
-  if (strstr(frequency, "1997") || strstr(frequency, "3625") || strstr(frequency, "3643") || strstr(frequency, "3693") || strstr(frequency, "3697") || strstr(frequency, "3850") || strstr(frequency, "7177") || strstr(frequency, "7197")) {
-    mode_command = "m LSB";
-  } else {
-    mode_command = "m DIGITAL";
+// Function to start or stop scanning the channels for a signal
+void on_scan_toggled(GtkCheckMenuItem * item, gpointer data) {
+  if (updating_scan) {
+    return;
   }
-
-  // Format the mode command
-  char command[20]; 
-  sprintf(command, "%s", mode_command); 
-
-  // Send the command
-  if (send(sockfd_telnet, command, strlen(command), 0) < 0) {
-    perror("Send command failed");
-    exit(EXIT_FAILURE);
+  if (!gtk_check_menu_item_get_active(item)) {
+    control_client_request("SCAN STOP", NULL, 0);
+  } else if (!control_client_request("SCAN", NULL, 0)) {
+    updating_scan = true;
+    gtk_check_menu_item_set_active(item, FALSE);
+    updating_scan = false;
   }
-  printf("Changing mode to: %s\n", mode_command); //  Report changing the radio mode to console
-
-  // Define delay in milliseconds (200 milliseconds = 0.2 seconds)
-  struct timespec delay = {
-    0,
-    200 * 1000 * 1000
-  }; // 200 milliseconds
+}
 
-  // Sleep for 200 milliseconds between commands
-  nanosleep( & delay, NULL);
+void destroy_menu_item(GtkWidget * item, gpointer data) {
+  gtk_widget_destroy(item);
 }
 
-void change_frequency(const char * frequency) {
-  // Telnet command to change frequency
-  // Format the command
-  char command[20];
-  sprintf(command, "f %s", frequency);
-
-  // Define delay in milliseconds (200 milliseconds = 0.2 seconds)
-  struct timespec delay = {
-    0,
-    200 * 1000 * 1000
-  }; // 200 milliseconds
-
-  // Send the command
-  if (send(sockfd_telnet, command, strlen(command), 0) < 0) {
-    perror("Send command failed");
-    exit(EXIT_FAILURE);
+// Function to fill the band menu from the daemon's channel table, one group per band
+void create_channel_menu(void) {
+  char reply[CONTROL_LINE_MAX];
+  char band[64] = "";
+  int count = 0;
+  // Filled afresh after a reconnect, the daemon may have been restarted with another table
+  gtk_container_foreach(GTK_CONTAINER(channel_menu), destroy_menu_item, NULL);
+  if (control_client_request("CHANNELS", reply, sizeof(reply))) {
+    count = control_value_int(reply, "count", 0);
   }
-
-  printf("Changing frequency to: %s MHz\n", frequency); 
-
- 
-  // Sleep for 200 milliseconds between commands
-  nanosleep( & delay, NULL);
-
-  // Change mode based on frequency band
-  change_mode(frequency);
-
-  // Center to 1500
-  char pitch_command[] = "PITCH 1500";
-  if (send(sockfd_telnet, pitch_command, strlen(pitch_command), 0) < 0) {
-    perror("Send PITCH command failed");
-    exit(EXIT_FAILURE);
+  for (int i = 0; i < count; i++) {
+    char command[32];
+    snprintf(command, sizeof(command), "CHANNEL %d", i);
+    const char * name;
+    if (!control_client_request(command, reply, sizeof(reply)) || (name = strstr(reply, "band=")) == NULL) {
+      continue;
+    }
+    name += 5;
+    if (strcmp(name, band) != 0) {
+      // Band group label, the table is in frequency order so each band comes once
+      snprintf(band, sizeof(band), "%s", name);
+      GtkWidget * group_label = gtk_menu_item_new_with_label(band);
+      gtk_widget_set_sensitive(group_label, FALSE);
+      gtk_menu_shell_append(GTK_MENU_SHELL(channel_menu), group_label);
+      gtk_widget_show(group_label);
+    }
+    int freq_hz = control_value_int(reply, "freq", 0);
+    gchar * label = g_strdup_printf("%.*f MHz", freq_hz % 1000 != 0 ? 4 : 3, freq_hz / 1e6);
+    GtkWidget * menu_item = gtk_menu_item_new_with_label(label);
+    g_free(label);
+    g_signal_connect(menu_item, "activate", G_CALLBACK(menu_item_selected), GINT_TO_POINTER(freq_hz));
+    gtk_menu_shell_append(GTK_MENU_SHELL(channel_menu), menu_item);
+    gtk_widget_show(menu_item);
   }
 
-  printf("Setting PITCH to 1500\n");
-
-  // Sleep for 200 milliseconds between commands
-  nanosleep( & delay, NULL);
-
-  // Set LOW bandpass shoulder
-  char low_command[] = "LOW 900";
-  if (send(sockfd_telnet, low_command, strlen(low_command), 0) < 0) {
-    perror("Send LOW command failed");
-    exit(EXIT_FAILURE);
+  // Scan stops by itself on the first channel with a signal, see the STATE event
+  GtkWidget * separator = gtk_separator_menu_item_new();
+  gtk_menu_shell_append(GTK_MENU_SHELL(channel_menu), separator);
+  gtk_widget_show(separator);
+  scan_item = gtk_check_menu_item_new_with_label("Scan for signals");
+  g_signal_connect(scan_item, "toggled", G_CALLBACK(on_scan_toggled), NULL);
+  gtk_menu_shell_append(GTK_MENU_SHELL(channel_menu), scan_item);
+  gtk_widget_show(scan_item);
+}
+
+// Function to play the RX channel whose button was chosen
+void on_rx_channel_toggled(GtkToggleButton * button, gpointer data) {
+  if (gtk_toggle_button_get_active(button)) {
+    char command[32];
+    int channel = GPOINTER_TO_INT(data);
+    if (channel == CONTROL_CHANNEL_AUTO) {
+      snprintf(command, sizeof(command), "RX_CHANNEL AUTO");
+    } else {
+      snprintf(command, sizeof(command), "RX_CHANNEL %d", channel);
+    }
+    control_client_request(command, NULL, 0);
   }
+}
 
-  printf("Setting LOW to 900\n");
-
-  // Sleep for 200 milliseconds between commands
-  nanosleep( & delay, NULL);
-
-  // Set HIGH bandpass shoulder
-  char high_command[] = "HIGH 2100";
-  if (send(sockfd_telnet, high_command, strlen(high_command), 0) < 0) {
-    perror("Send HIGH command failed");
-    exit(EXIT_FAILURE);
+// Function to create the RX channel table (mode, SNR, callsign and an audio selector per channel), only when several are decoded
+void create_channel_table(GtkWidget * vbox) {
+  char list[64];
+  get_setting("rx_channels", list, sizeof(list));
+  int offsets[CONTROL_MAX_CHANNELS];
+  int n = 0;
+  char * saveptr;
+  for (char * item = strtok_r(list, ", ", & saveptr); item != NULL && n < CONTROL_MAX_CHANNELS; item = strtok_r(NULL, ", ", & saveptr)) {
+    offsets[n++] = atoi(item);
+  }
+  if (n < 2) {
+    return;
   }
 
-  printf("Setting HIGH to 2100\n");
-
-  // Sleep for 200 milliseconds between commands
-  nanosleep( & delay, NULL);
-
+  GtkWidget * grid = gtk_grid_new();
+  gtk_grid_set_column_spacing(GTK_GRID(grid), 10);
+  GtkWidget * auto_button = gtk_radio_button_new_with_label(NULL, "Auto");
+  gtk_widget_set_tooltip_text(auto_button, "Play the channel with the best signal");
+  g_signal_connect(auto_button, "toggled", G_CALLBACK(on_rx_channel_toggled), GINT_TO_POINTER(CONTROL_CHANNEL_AUTO));
+  gtk_grid_attach(GTK_GRID(grid), auto_button, 0, 0, 1, 1);
+  for (int i = 0; i < n; i++) {
+    gchar * name = g_strdup_printf("%+d Hz", offsets[i]);
+    GtkWidget * button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(auto_button), name);
+    g_free(name);
+    g_signal_connect(button, "toggled", G_CALLBACK(on_rx_channel_toggled), GINT_TO_POINTER(i));
+    gtk_grid_attach(GTK_GRID(grid), button, 0, i + 1, 1, 1);
+    for (int column = 0; column < 3; column++) {
+      channel_labels[i][column] = gtk_label_new(column == 0 ? "--" : "");
+      gtk_label_set_xalign(GTK_LABEL(channel_labels[i][column]), 0);
+      gtk_grid_attach(GTK_GRID(grid), channel_labels[i][column], column + 1, i + 1, 1, 1);
+    }
+  }
+  gtk_box_pack_start(GTK_BOX(vbox), grid, FALSE, FALSE, 2);
+  gtk_widget_show_all(grid);
+  channel_count = n;
 }
 
-void menu_item_selected(GtkWidget * widget, gpointer data) {
-  // Get label from selected menu item
-  GtkWidget * label = gtk_bin_get_child(GTK_BIN(widget));
-  const gchar * full_text = gtk_label_get_text(GTK_LABEL(label));
-
-  // Extract frequency from label text (remove " MHz" and decimal point)
-  gchar frequency[10]; // Assuming max 9 characters for frequency (e.g., "14.236 MHz")
-  int i = 0;
-  while ( * full_text && !g_ascii_isdigit( * full_text)) {
-    full_text++;
+// Function to start or stop playing back the last over, RX keeps decoding and recording meanwhile
+void on_replay_toggled(GtkToggleButton * button, gpointer data) {
+  if (updating_replay) {
+    return;
   }
-  while ( * full_text && (g_ascii_isdigit( * full_text) || * full_text == '.')) {
-    if ( * full_text != '.') {
-      frequency[i++] = * full_text;
-    }
-    full_text++;
+  if (!gtk_toggle_button_get_active(button)) {
+    control_client_request("REPLAY STOP", NULL, 0);
+  } else if (!control_client_request("REPLAY", NULL, 0)) {
+    gtk_toggle_button_set_active(button, FALSE);
   }
-  frequency[i] = '\0';
-
-  // Change frequency
-  change_frequency(frequency);
+}
 
- // Send IPC command
-    char command[50]; // Adjust size as needed
-    int freq_khz = atoi(frequency); // Convert frequency string to integer (kHz)
-    sprintf(command, "FREQ_CHANGE %d", freq_khz);
-    send_ipc_command(command);
+// Function to save the last few minutes of RX, the daemon names the files after the time and sends SAVED when done
+void on_save_rx_clicked(GtkButton * button, gpointer data) {
+  if (control_client_request("SAVE_RX", NULL, 0)) {
+    gtk_widget_set_sensitive(save_rx_button, FALSE);
+  }
+}
 
+// Function to show the radio, Hamlib and audio state from a STATE event or STATUS reply
+void show_station_state(const char * state) {
+  char audio[16], missing[64], ptt[8];
+  if (!control_value(state, "audio", audio, sizeof(audio))) {
+    snprintf(audio, sizeof(audio), "unknown");
+  }
+  if (!control_value(state, "missing", missing, sizeof(missing))) {
+    missing[0] = '\0';
+  }
+  if (!control_value(state, "ptt", ptt, sizeof(ptt))) {
+    ptt[0] = '\0';
+  }
+  // The daemon follows the radio when it drops TX by itself, but leaves it keyed when someone else keyed it
+  bool keyed_elsewhere = control_value_int(state, "radio_ptt", -1) == 1 && strcmp(ptt, "tx") != 0;
+  // An unplugged headset or sBitx card is picked up again by the daemon as soon as it is back
+  gchar * text = g_strdup_printf("Radio: %s   Hamlib: %s   Audio: %s%s%s%s",
+    control_value_int(state, "radio", 0) ? "connected" : "connecting",
+    control_value_int(state, "hamlib", 0) ? "connected" : "connecting",
+    audio, missing[0] != '\0' ? ", waiting for " : "", missing, keyed_elsewhere ? "   Keyed by another controller" : "");
+  gtk_label_set_text(GTK_LABEL(status_label), text);
+  g_free(text);
+
+  // TX/RX wait for the audio engine, a failed one still lets the radio be keyed
+  bool opening = strcmp(audio, "opening") == 0;
+  gtk_widget_set_sensitive(tx_button, !opening);
+  gtk_widget_set_sensitive(rx_button, !opening);
+  bool timeshift = control_value_int(state, "timeshift", 0);
+  gtk_widget_set_sensitive(replay_button, timeshift);
+  gtk_widget_set_sensitive(save_rx_button, timeshift);
+
+  // A replay ends by itself once it has caught up with the recording, and a scan once it finds a signal
+  updating_replay = true;
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(replay_button), control_value_int(state, "replay", 0));
+  updating_replay = false;
+  if (scan_item != NULL) {
+    updating_scan = true;
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(scan_item), control_value_int(state, "scan", 0));
+    updating_scan = false;
+  }
 }
 
-int main(int argc, char * argv[]) {
-  GtkWidget * window;
-  GtkWidget * hbox;
-  GtkWidget * tx_button;
-  GtkWidget * rx_button;
-  
-  save_release_version(RELEASE_VERSION);  
-  
-    const char *audio_device = "card5"; // Simplified device name for path checking
-    const char *sbitx_program = "sbitx";  // Replace with your actual program name
-    //const char *device = "card5";  // Replace with your actual audio device name
-	
-    // Check if sBitx program is running
-    if (!check_program_running(sbitx_program)) {
-        show_message_dialog("ERROR:\n\n                    sBitx is not running.\n\nPlease exit and start the sBitx application");
-        return 1; // Exit program if sBitx is not running
-    }
+// Function to show one RX event, in the channel table and, for the channel being played, next to the TX/RX buttons
+void show_rx_stats(const char * rx) {
+  char mode[16], callsign[32];
+  control_value(rx, "mode", mode, sizeof(mode));
+  if (!control_value(rx, "callsign", callsign, sizeof(callsign))) {
+    callsign[0] = '\0';
+  }
+  bool sync = control_value_int(rx, "sync", 0);
+  double snr_db = control_value_double(rx, "snr", 0);
+  int channel = control_value_int(rx, "channel", 0);
+  gchar * text;
+
+  if (channel < channel_count) {
+    GtkWidget ** labels = channel_labels[channel];
+    text = sync ?
+      g_strdup_printf("<span foreground=\"green\"><b>%s</b></span>", mode) :
+      g_strdup("<span foreground=\"grey\">--</span>");
+    gtk_label_set_markup(GTK_LABEL(labels[0]), text);
+    g_free(text);
+    text = sync ? g_strdup_printf("%.1f dB", snr_db) : g_strdup("");
+    gtk_label_set_text(GTK_LABEL(labels[1]), text);
+    g_free(text);
+    gtk_label_set_text(GTK_LABEL(labels[2]), callsign);
+  }
+  if (!control_value_int(rx, "playing", 0)) {
+    return;
+  }
 
-    // Check if audio device is present
-    if (!check_audio_device(audio_device)) {
-        show_message_dialog("ERROR:\n\n     plughw:CARD=5,DEV=0 not found\n\nConnect USB audio device and try again.\n");
-        return 1; // Exit program if audio device is not present
+  // The mode comes from the demodulator being played, which is the one that found the signal
+  text = sync ?
+    g_strdup_printf("<span foreground=\"green\"><b>SYNC %s</b></span>", mode) :
+    g_strdup("<span foreground=\"grey\">no sync</span>");
+  gtk_label_set_markup(GTK_LABEL(sync_label), text);
+  g_free(text);
+  text = g_strdup_printf("SNR %.1f dB", snr_db);
+  gtk_label_set_text(GTK_LABEL(snr_label), text);
+  g_free(text);
+  text = g_strdup_printf("Frequency offset %.1f Hz, clock offset %.0f ppm", control_value_double(rx, "foff", 0), control_value_double(rx, "clock", 0));
+  gtk_widget_set_tooltip_text(snr_label, text);
+  g_free(text);
+  text = sync ? g_strdup_printf("BER ~%.0e", control_value_double(rx, "ber", 0)) : g_strdup("BER --");
+  gtk_label_set_text(GTK_LABEL(ber_label), text);
+  g_free(text);
+}
+
+// Function to show the audio ring fill and xrun counters in the status line tooltip
+void show_ring_stats(const char * ring) {
+  char path[8];
+  if (!control_value(ring, "path", path, sizeof(path))) {
+    return;
+  }
+  int i = strcmp(path, "tx") == 0 ? 0 : 1;
+  snprintf(ring_stats[i], sizeof(ring_stats[i]), "%s audio ring: %d/%d samples (high water %d), %d overrun, %d underruns",
+    i == 0 ? "TX" : "RX", control_value_int(ring, "fill", 0), control_value_int(ring, "capacity", 0),
+    control_value_int(ring, "high", 0), control_value_int(ring, "overruns", 0), control_value_int(ring, "underruns", 0));
+  gchar * text = g_strdup_printf("%s%s%s", ring_stats[0], ring_stats[0][0] != '\0' && ring_stats[1][0] != '\0' ? "\n" : "", ring_stats[1]);
+  gtk_widget_set_tooltip_text(status_label, text);
+  g_free(text);
+}
+
+gboolean reconnect_daemon(gpointer data);
+
+// Function called with every event from the daemon, NULL when it has gone away
+void on_daemon_event(const char * event, void * data) {
+  if (event == NULL) {
+    gtk_label_set_text(GTK_LABEL(status_label), control_client_timed_out() ? "Engine: not responding" : "Engine: stopped");
+    gtk_widget_set_sensitive(tx_button, FALSE);
+    gtk_widget_set_sensitive(rx_button, FALSE);
+    gtk_widget_set_sensitive(replay_button, FALSE);
+    gtk_widget_set_sensitive(save_rx_button, FALSE);
+    control_client_close();
+    if (reconnect_timer == 0) {
+      reconnect_timer = g_timeout_add(DAEMON_RECONNECT_MS, reconnect_daemon, data);
     }
-
-
-  // Check if the configuration file exists
-  if (!config_file_exists()) {
-    // Create the configuration file with default values
-    create_default_config();
+    return;
   }
-
-  struct sockaddr_in servaddr_telnet, servaddr_server;
-
-  // Create socket for telnet
-  if ((sockfd_telnet = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-    perror("Telnet socket creation failed");
-    exit(EXIT_FAILURE);
+  size_t len = strcspn(event, " ");
+  const char * args = event + len;
+  if (strncmp(event, "STATE", len) == 0) {
+    show_station_state(args);
+  } else if (strncmp(event, "RX", len) == 0) {
+    show_rx_stats(args);
+  } else if (strncmp(event, "RING", len) == 0) {
+    show_ring_stats(args);
+  } else if (strncmp(event, "SAVED", len) == 0) {
+    char prefix[64];
+    control_value(args, "prefix", prefix, sizeof(prefix));
+    gchar * text = g_strdup_printf("RX saved as %s_modem.wav and %s_speech.wav", prefix, prefix);
+    gtk_widget_set_sensitive(save_rx_button, TRUE);
+    show_info_dialog(text);
+    g_free(text);
+  } else if (strncmp(event, "SAVE_FAILED", len) == 0) {
+    gtk_widget_set_sensitive(save_rx_button, TRUE);
+    show_info_dialog("Saving RX failed, see the freedv_pttd log");
   }
+}
 
-  // Set telnet server address and port
-  memset( & servaddr_telnet, 0, sizeof(servaddr_telnet));
-  servaddr_telnet.sin_family = AF_INET;
-  servaddr_telnet.sin_addr.s_addr = inet_addr(SERVER_IP);
-  servaddr_telnet.sin_port = htons(TELNET_PORT);
+// Function to start following the daemon once connected, fills in the parts of the window that depend on its settings.
+// Also used after a reconnect, the channel table is only built once.
+void attach_to_daemon(GtkWidget * vbox) {
+  char status[CONTROL_LINE_MAX];
+  if (channel_count == 0) {
+    create_channel_table(vbox);
+  }
+  create_channel_menu();
+  if (control_client_subscribe(on_daemon_event, vbox) < 0) {
+    on_daemon_event(NULL, vbox);
+    return;
+  }
+  // Events only report changes, start from the current state
+  if (control_client_request("STATUS", status, sizeof(status))) {
+    show_station_state(status);
+  }
+}
 
-  // Connect to telnet server
-  if (connect(sockfd_telnet, (struct sockaddr * ) & servaddr_telnet, sizeof(servaddr_telnet)) < 0) {
-    perror("Telnet connection failed");
-    exit(EXIT_FAILURE);
+// Function to start freedv_pttd from the directory this program was started from
+pid_t start_daemon(const char * self) {
+  gchar * dir = g_path_get_dirname(self);
+  gchar * path = g_build_filename(dir, DAEMON_PROGRAM, NULL);
+  g_free(dir);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // Own session, so a terminal Ctrl+C for the window reaches the daemon only through SHUTDOWN
+    setsid();
+    daemon_args[0] = path;
+    execv(path, daemon_args);
+    perror("Failed to start " DAEMON_PROGRAM);
+    _exit(EXIT_FAILURE);
+  } else if (pid < 0) {
+    perror("Failed to fork");
+  } else {
+    printf("Started %s with PID: %d\n", path, pid);
   }
+  g_free(path);
+  return pid;
+}
 
-  // Send telnet commands
-  send_telnet_commands(sockfd_telnet);
+// Function to wait for a daemon this window started to open its control socket
+gboolean poll_daemon(gpointer data) {
+  if (control_client_open(CONTROL_SOCKET_PATH) == 0) {
+    attach_to_daemon(data);
+    return G_SOURCE_REMOVE;
+  }
+  int status;
+  if (waitpid(daemon_pid, & status, WNOHANG) == daemon_pid) {
+    daemon_pid = 0;
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    if (code == DAEMON_EXIT_NO_SBITX) {
+      show_message_dialog("ERROR:\n\n                    sBitx is not running.\n\nPlease exit and start the sBitx application");
+    } else {
+      show_message_dialog("ERROR:\n\n     " DAEMON_PROGRAM " stopped while starting\n\nSee its output for the reason.\n");
+    }
+    gtk_main_quit();
+    return G_SOURCE_REMOVE;
+  }
+  daemon_wait_ms += DAEMON_POLL_MS;
+  if (daemon_wait_ms >= DAEMON_START_TIMEOUT_MS) {
+    show_message_dialog("ERROR:\n\n     " DAEMON_PROGRAM " did not start\n\nSee its output for the reason.\n");
+    on_window_closed(NULL, NULL);
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
 
-  // Create socket for Hamlib net server
-  if ((sockfd_server = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-    perror("Server socket creation failed");
-    exit(EXIT_FAILURE);
+// Function to reconnect after the daemon went away, from a restart or a dropped connection
+gboolean reconnect_daemon(gpointer data) {
+  if (daemon_pid > 0 && waitpid(daemon_pid, NULL, WNOHANG) == daemon_pid) {
+    daemon_pid = 0; // The one this window started has exited, another may be started in its place
+  }
+  if (control_client_open(CONTROL_SOCKET_PATH) < 0) {
+    return G_SOURCE_CONTINUE;
   }
+  printf("Reconnected to %s\n", DAEMON_PROGRAM);
+  reconnect_timer = 0;
+  attach_to_daemon(data);
+  return G_SOURCE_REMOVE;
+}
 
-  // Set Hamlib net server address and port
-  memset( & servaddr_server, 0, sizeof(servaddr_server));
-  servaddr_server.sin_family = AF_INET;
-  servaddr_server.sin_addr.s_addr = inet_addr(SERVER_IP);
-  servaddr_server.sin_port = htons(SERVER_PORT);
+int main(int argc, char * argv[]) {
+  GtkWidget * window;
+  GtkWidget * vbox;
+  GtkWidget * hbox;
 
-  // Connect to Hamlib net server
-  if (connect(sockfd_server, (struct sockaddr * ) & servaddr_server, sizeof(servaddr_server)) < 0) {
-    perror("Server connection failed");
-    exit(EXIT_FAILURE);
-  }
-  
-  // Print_environment_variables();// Was only used as diagnostic tool
-  
-  // Set up signal handling to clean up child process on exit
-  signal(SIGINT, handle_termination);
-  signal(SIGTERM, handle_termination);
-  // Start the Python script to handle socket.io communications
-  start_python_script();
-  
-  // Initialize GTK
+  // Set up signal handling so a daemon started by this window is stopped with it
+  signal(SIGPIPE, SIG_IGN);
+  g_unix_signal_add(SIGINT, on_quit_signal, NULL);
+  g_unix_signal_add(SIGTERM, on_quit_signal, NULL);
+
+  // Initialize GTK, what is left of the command line is for freedv_pttd
   gtk_init( & argc, & argv);
+  daemon_args = argv;
 
   // Create the main window
   window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -962,9 +807,13 @@ int main(int argc, char * argv[]) {
   // Set window title
   gtk_window_set_title(GTK_WINDOW(window), "FreeDV 700D PTT");
 
+  // Create a vertical box holding the buttons and the status line
+  vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+  gtk_container_add(GTK_CONTAINER(window), vbox);
+
   // Create a horizontal box layout
   hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 2);
-  gtk_container_add(GTK_CONTAINER(window), hbox);
+  gtk_box_pack_start(GTK_BOX(vbox), hbox, TRUE, TRUE, 0);
 
   // Create a header bar
   GtkWidget * header_bar = gtk_header_bar_new();
@@ -980,71 +829,8 @@ int main(int argc, char * argv[]) {
   GtkWidget * menu_button = gtk_menu_button_new();
   GtkWidget * menu = gtk_menu_new();
 
-  // Function to add a group of menu items
-  void add_menu_group(GtkWidget * menu,
-    const char * group_name,
-      const char * options[], int num_options) {
-    GtkWidget * group_label = gtk_menu_item_new_with_label(group_name);
-    gtk_widget_set_sensitive(group_label, FALSE);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), group_label);
-    gtk_widget_show(group_label);
-
-    for (int i = 0; i < num_options; i++) {
-      GtkWidget * menu_item = gtk_menu_item_new_with_label(options[i]);
-      g_signal_connect(menu_item, "activate", G_CALLBACK(menu_item_selected), NULL);
-      gtk_menu_shell_append(GTK_MENU_SHELL(menu), menu_item);
-      gtk_widget_show(menu_item);
-    }
-  }
-
-  // Add menu items (sBitx doesnt really support 160 or 60 meters)
-  // const char *options_160_meters[] = {"1.997 MHz"};
-  // add_menu_group(menu, "160 Meters", options_160_meters, 1);
-
-  const char * options_80_meters[] = {
-    "3.625 MHz",
-    "3.643 MHz",
-    "3.693 MHz",
-    "3.697 MHz",
-    "3.850 MHz"
-  };
-  add_menu_group(menu, "80 Meters", options_80_meters, 5);
-
-  // const char *options_60_meters[] = {"5.4035 MHz", "5.3665 MHz", "5.3685 MHz"};
-  // add_menu_group(menu, "60 Meters", options_60_meters, 3);
-
-  const char * options_40_meters[] = {
-    "7.177 MHz",
-    "7.197 MHz"
-  };
-  add_menu_group(menu, "40 Meters", options_40_meters, 2);
-
-  const char * options_20_meters[] = {
-    "14.236 MHz",
-    "14.240 MHz"
-  };
-  add_menu_group(menu, "20 Meters", options_20_meters, 2);
-
-  const char * options_17_meters[] = {
-    "18.118 MHz"
-  };
-  add_menu_group(menu, "17 Meters", options_17_meters, 1);
-
-  const char * options_15_meters[] = {
-    "21.313 MHz"
-  };
-  add_menu_group(menu, "15 Meters", options_15_meters, 1);
-
-  const char * options_12_meters[] = {
-    "24.933 MHz"
-  };
-  add_menu_group(menu, "12 Meters", options_12_meters, 1);
-
-  const char * options_10_meters[] = {
-    "28.330 MHz",
-    "28.720 MHz"
-  };
-  add_menu_group(menu, "10 Meters", options_10_meters, 2);
+  // The channels come from the daemon, see create_channel_menu()
+  channel_menu = menu;
 
   gtk_menu_button_set_popup(GTK_MENU_BUTTON(menu_button), menu);
   gtk_header_bar_pack_end(GTK_HEADER_BAR(header_bar), menu_button);
@@ -1064,14 +850,58 @@ int main(int argc, char * argv[]) {
   g_signal_connect(rx_button, "clicked", G_CALLBACK(on_rx_button_clicked), NULL);
   gtk_box_pack_start(GTK_BOX(hbox), rx_button, TRUE, TRUE, 5);
 
+  // Create the RX modem stats column, filled in from the daemon's RX events
+  GtkWidget * stats_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+  gtk_widget_set_size_request(stats_box, 90, -1);
+  gtk_widget_set_valign(stats_box, GTK_ALIGN_CENTER);
+  sync_label = gtk_label_new(NULL);
+  gtk_label_set_markup(GTK_LABEL(sync_label), "<span foreground=\"grey\">no sync</span>");
+  snr_label = gtk_label_new("SNR --");
+  ber_label = gtk_label_new("BER --");
+  gtk_box_pack_start(GTK_BOX(stats_box), sync_label, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(stats_box), snr_label, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(stats_box), ber_label, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), stats_box, FALSE, FALSE, 5);
+
+  // TX/RX wait for the daemon's audio engine, see show_station_state()
+  gtk_widget_set_sensitive(tx_button, FALSE);
+  gtk_widget_set_sensitive(rx_button, FALSE);
+
+  // Create the status line, the RX channel table goes under the TX/RX buttons once connected
+  status_label = gtk_label_new("Engine: starting");
+  gtk_box_pack_end(GTK_BOX(vbox), status_label, FALSE, FALSE, 2);
+
+  // Time-shift controls, usable once the recorder is running
+  GtkWidget * timeshift_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 2);
+  replay_button = gtk_toggle_button_new_with_label("Replay");
+  gtk_widget_set_tooltip_text(replay_button, "Play back the last over, RX keeps recording");
+  g_signal_connect(replay_button, "toggled", G_CALLBACK(on_replay_toggled), NULL);
+  gtk_box_pack_start(GTK_BOX(timeshift_box), replay_button, TRUE, TRUE, 5);
+  save_rx_button = gtk_button_new_with_label("Save RX");
+  gtk_widget_set_tooltip_text(save_rx_button, "Save the last minutes of RX as WAV files");
+  g_signal_connect(save_rx_button, "clicked", G_CALLBACK(on_save_rx_clicked), NULL);
+  gtk_box_pack_start(GTK_BOX(timeshift_box), save_rx_button, TRUE, TRUE, 5);
+  gtk_box_pack_end(GTK_BOX(vbox), timeshift_box, FALSE, FALSE, 2);
+  gtk_widget_set_sensitive(replay_button, FALSE);
+  gtk_widget_set_sensitive(save_rx_button, FALSE);
+
   // Show all widgets
   gtk_widget_show_all(window);
-    		
+
+  // Use the running daemon, or start one and wait for its control socket
+  if (control_client_open(CONTROL_SOCKET_PATH) == 0) {
+    attach_to_daemon(vbox);
+  } else {
+    daemon_pid = start_daemon(argv[0]);
+    if (daemon_pid < 0) {
+      show_message_dialog("ERROR:\n\n     Could not start " DAEMON_PROGRAM "\n");
+      return 1;
+    }
+    g_timeout_add(DAEMON_POLL_MS, poll_daemon, vbox);
+  }
+
   // Start GTK main loop
   gtk_main();
-  
-  // Clean up before exiting (kill python instance)
-  handle_termination(0);
-	
+
   return 0;
 }
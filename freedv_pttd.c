@@ -0,0 +1,178 @@
+/*
+ * freedv_pttd.c
+ *
+ * Description:
+ * Headless FreeDV station for the sBitx: rig control, PTT, the FreeDV modems
+ * and the FreeDV Reporter client, with no desktop session needed. Everything
+ * is driven through the local control API (see control_protocol.h); the GTK
+ * window freedv_ptt2.46 is one client of it and starts the daemon when none is
+ * running. Scripts, loggers and keyers can connect alongside it, e.g.
+ *
+ *   echo "PTT ON" | socat - UNIX-CONNECT:/tmp/freedv_ptt.sock
+ *
+ * Usage:
+ * 1. Compile the program using:
+ *    gcc -O2 -o freedv_pttd freedv_pttd.c station.c control_server.c audio_engine.c audio_devices.c modem.c dsp.c sample_ring.c telnet_queue.c rig_state.c hamlib_client.c reporter_client.c websocket.c config_store.c startup_timing.c trace.c rt_sched.c rx_fanout.c timeshift.c rx_report.c `pkg-config --cflags --libs glib-2.0 codec2 alsa` -lpthread -lm
+ *
+ * 2. Run it from the freedv_ptt directory (config.ini is read from the current directory):
+ *    ./freedv_pttd [--rt-priority N] [--audio-cpu N] [--lock-memory] [--playback-latency-ms N]
+ *    The options override rt_priority, audio_cpu, lock_memory and playback_latency_ms
+ *    from config.ini for this run, see rt_sched.h for the permissions they need.
+ *
+ * 3. Optionally dump the recent PTT trace (Chrome trace-event JSON, see trace.h) with:
+ *    kill -USR1 $(pidof freedv_pttd)
+ *    The file is trace_file from config.ini, /tmp/freedv_ptt_trace.json by default.
+ *
+ * The headset and sBitx sound cards are headset_device, sbitx_tx_device and
+ * sbitx_rx_device in config.ini, by card id or name; the cards present are
+ * listed at startup. One can be unplugged and plugged back in while it runs.
+ *
+ * SIGINT and SIGTERM, or the SHUTDOWN command, stop it cleanly.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <dirent.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include "station.h"
+#include "control_server.h"
+#include "control_protocol.h"
+#include "config_store.h"
+#include "startup_timing.h"
+#include "trace.h"
+
+#define CONFIG_FILE "config.ini"
+
+GMainLoop * loop;
+
+// Function to check for a running process by name, scans /proc instead of running pgrep
+int check_program_running(const char * program) {
+  DIR * proc = opendir("/proc");
+  if (proc == NULL) {
+    perror("Failed to open /proc");
+    return 0;
+  }
+  struct dirent * entry;
+  int found = 0;
+  while (!found && (entry = readdir(proc)) != NULL) {
+    if (entry->d_name[0] < '1' || entry->d_name[0] > '9') {
+      continue; // Not a process directory
+    }
+    char path[64], name[64];
+    snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+    FILE * file = fopen(path, "r");
+    if (file == NULL) {
+      continue; // Process exited while scanning
+    }
+    // Same substring match pgrep does on the process name
+    if (fgets(name, sizeof(name), file) != NULL && strstr(name, program) != NULL) {
+      found = 1;
+    }
+    fclose(file);
+  }
+  closedir(proc);
+  return found;
+}
+
+// Function to override the real-time settings from config.ini with command line options, returns false on a bad option
+bool parse_command_line(int argc, char * argv[], struct station_options * options) {
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--rt-priority") == 0 && has_value) {
+      options->rt.priority = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--audio-cpu") == 0 && has_value) {
+      options->rt.cpu = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--lock-memory") == 0) {
+      options->rt.lock_memory = true;
+    } else if (strcmp(argv[i], "--playback-latency-ms") == 0 && has_value) {
+      options->playback_latency_ms = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--rt-priority N] [--audio-cpu N] [--lock-memory] [--playback-latency-ms N]\n", argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Function to run a control API command, SHUTDOWN is handled here and the rest by the station
+bool on_control_command(int client, const char * command, GString * reply, void * data) {
+  if (strcmp(command, "SHUTDOWN") == 0) {
+    printf("Shutdown requested by a control client\n");
+    g_main_loop_quit(loop);
+    return true;
+  }
+  return station_command(client, command, reply);
+}
+
+void on_control_client_closed(int client, void * data) {
+  station_client_closed(client);
+}
+
+void on_station_event(const char * event, void * data) {
+  control_server_broadcast(event);
+}
+
+gboolean on_quit_signal(gpointer data) {
+  g_main_loop_quit(loop);
+  return G_SOURCE_CONTINUE;
+}
+
+// Function to write the trace ring to disk on SIGUSR1
+gboolean on_trace_dump_signal(gpointer data) {
+  trace_dump(config_get("trace_file", TRACE_DEFAULT_FILE));
+  return G_SOURCE_CONTINUE;
+}
+
+int main(int argc, char * argv[]) {
+  // Config, checks, control API, telnet, Hamlib, audio and reporter, see startup_timing.c
+  startup_timing_begin(7);
+
+  // Read the configuration once, everything after this works from memory
+  if (!config_store_open(CONFIG_FILE)) {
+    station_create_default_config();
+  }
+  struct station_options options;
+  station_load_options( & options);
+  if (!parse_command_line(argc, argv, & options)) {
+    return 1;
+  }
+  // Before any thread exists, so only the audio threads started later end up on the audio core
+  if (options.rt.lock_memory) {
+    rt_lock_memory();
+  }
+  rt_avoid_cpu(options.rt.cpu);
+  startup_mark("config loaded");
+
+  if (!check_program_running("sbitx")) {
+    fprintf(stderr, "sBitx is not running, start the sBitx application first\n");
+    config_store_close();
+    return DAEMON_EXIT_NO_SBITX;
+  }
+  // A missing sound card is not fatal, the audio engine opens it once it is plugged in (see audio_devices.h)
+  startup_mark("sBitx check");
+
+  trace_set_thread_name("main");
+  loop = g_main_loop_new(NULL, FALSE);
+  g_unix_signal_add(SIGINT, on_quit_signal, NULL);
+  g_unix_signal_add(SIGTERM, on_quit_signal, NULL);
+  g_unix_signal_add(SIGUSR1, on_trace_dump_signal, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (control_server_open(CONTROL_SOCKET_PATH, on_control_command, on_control_client_closed, NULL) < 0) {
+    config_store_close();
+    return 1;
+  }
+  startup_mark("control API listening");
+  station_start( & options, on_station_event, NULL);
+
+  g_main_loop_run(loop);
+
+  station_stop();
+  control_server_close();
+  config_store_close();
+  g_main_loop_unref(loop);
+  printf("freedv_pttd stopped\n");
+  return 0;
+}
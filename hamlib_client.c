@@ -0,0 +1,365 @@
+/*
+ * hamlib_client.c
+ *
+ * Description:
+ * Replaces the fire-and-forget send_command() on sockfd_server. That code never
+ * read rigctld's "RPRT 0" replies, so they piled up in the socket receive buffer
+ * for the whole session, and any send error ended the program.
+ *
+ * Requests are written as they come and matched to reply lines in order (every
+ * command used here answers with exactly one line). Works against a real sBitx
+ * or any stand-in rigctld, e.g. "rigctld -m 1" (the Hamlib dummy rig), by
+ * pointing hamlib_host / hamlib_port in config.ini at it. hamlib_client_test.c
+ * runs it against a scripted one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include "hamlib_client.h"
+#include "trace.h"
+
+struct hamlib_request {
+  char command[16];
+  gint64 sent_us;
+};
+
+static struct {
+  struct sockaddr_in addr;
+  int fd;
+  bool connected;
+  bool ever_connected;
+  guint io_watch;
+  guint reconnect_timer;
+  guint keepalive_timer;
+  guint connect_timer; // While a connect is in progress
+  GQueue awaiting; // Requests sent and waiting for their reply line
+  GString * inbuf;
+  int backoff_ms;
+  int wanted_ptt; // -1 until the first PTT request
+  int radio_ptt;  // -1 until acknowledged or polled
+  gint64 last_activity_us;
+  hamlib_state_fn state_fn;
+  void * state_data;
+  hamlib_ptt_fn ptt_fn;
+  void * ptt_data;
+  struct hamlib_client_stats stats;
+} hc = { .fd = -1, .wanted_ptt = -1, .radio_ptt = -1 };
+
+static void start_connect(void);
+
+static void set_connected(bool connected) {
+  if (hc.connected == connected) {
+    return;
+  }
+  hc.connected = connected;
+  if (hc.state_fn != NULL) {
+    hc.state_fn(connected, hc.state_data);
+  }
+}
+
+static void remove_source(guint * id) {
+  if ( * id != 0) {
+    g_source_remove( * id);
+    * id = 0;
+  }
+}
+
+// The radio's PTT as we last learned it, reported when a poll finds it differs from what we asked for
+static void set_radio_ptt(int ptt, bool polled) {
+  int previous = hc.radio_ptt;
+  hc.radio_ptt = ptt;
+  if (!polled || ptt == previous || ptt == hc.wanted_ptt) {
+    return;
+  }
+  fprintf(stderr, "Hamlib: radio reports PTT %s, we asked for %s; leaving it that way\n", ptt ? "on" : "off",
+    hc.wanted_ptt < 0 ? "nothing yet" : (hc.wanted_ptt ? "on" : "off"));
+  if (hc.ptt_fn != NULL) {
+    hc.ptt_fn(ptt != 0, hc.ptt_data);
+  }
+}
+
+static void close_socket(void) {
+  remove_source( & hc.io_watch);
+  remove_source( & hc.connect_timer);
+  if (hc.fd >= 0) {
+    close(hc.fd);
+    hc.fd = -1;
+  }
+  g_queue_clear_full( & hc.awaiting, g_free);
+  if (hc.inbuf != NULL) {
+    g_string_truncate(hc.inbuf, 0);
+  }
+  hc.radio_ptt = -1; // Not known again until acknowledged or polled
+}
+
+static gboolean on_reconnect_timer(gpointer data) {
+  hc.reconnect_timer = 0;
+  start_connect();
+  return G_SOURCE_REMOVE;
+}
+
+// Drop the connection and try again after the current backoff
+static void schedule_reconnect(const char * reason) {
+  fprintf(stderr, "Hamlib connection lost (%s), retrying in %d ms\n", reason, hc.backoff_ms);
+  close_socket();
+  set_connected(false);
+  remove_source( & hc.reconnect_timer);
+  hc.reconnect_timer = g_timeout_add(hc.backoff_ms, on_reconnect_timer, NULL);
+  hc.backoff_ms = MIN(hc.backoff_ms * 2, HAMLIB_BACKOFF_MAX_MS);
+}
+
+static void send_request(const char * command) {
+  char line[20];
+  snprintf(line, sizeof(line), "%s\n", command);
+  if (send(hc.fd, line, strlen(line), MSG_NOSIGNAL) < 0) {
+    schedule_reconnect(strerror(errno));
+    return;
+  }
+  if (command[0] == 'T') {
+    TRACE_INSTANT(command[2] == '1' ? "hamlib T 1 sent" : "hamlib T 0 sent");
+  }
+  struct hamlib_request * req = g_new0(struct hamlib_request, 1);
+  snprintf(req->command, sizeof(req->command), "%s", command);
+  req->sent_us = g_get_monotonic_time();
+  hc.last_activity_us = req->sent_us;
+  g_queue_push_tail( & hc.awaiting, req);
+}
+
+static void send_ptt(void) {
+  send_request(hc.wanted_ptt ? "T 1" : "T 0");
+}
+
+// Match one reply line to the oldest outstanding request
+static void handle_reply(const char * line) {
+  struct hamlib_request * req = g_queue_pop_head( & hc.awaiting);
+  if (req == NULL) {
+    fprintf(stderr, "Hamlib: unexpected reply '%s'\n", line);
+    return;
+  }
+  double rtt_ms = (g_get_monotonic_time() - req->sent_us) / 1000.0;
+
+  if (strncmp(line, "RPRT ", 5) == 0 && atoi(line + 5) != 0) {
+    hc.stats.errors++;
+    fprintf(stderr, "Hamlib: '%s' failed: %s\n", req->command, line);
+  } else if (req->command[0] == 'T') {
+    if (req->command[2] == '1') {
+      TRACE_INSTANT("hamlib T 1 acknowledged");
+    } else {
+      TRACE_INSTANT("hamlib T 0 acknowledged");
+      TRACE_ASYNC_END("PTT off", TRACE_ID_PTT_OFF);
+    }
+    hc.stats.last_ptt_ms = rtt_ms;
+    if (rtt_ms > hc.stats.max_ptt_ms) {
+      hc.stats.max_ptt_ms = rtt_ms;
+    }
+    printf("Hamlib: %s acknowledged in %.1f ms\n", req->command, rtt_ms);
+    set_radio_ptt(req->command[2] == '1', false);
+  } else if (req->command[0] == 't') {
+    // Never re-key from a poll: the radio's time-out timer or another operator may have had good reason
+    set_radio_ptt(atoi(line) != 0, true);
+  }
+  g_free(req);
+}
+
+// Read what rigctld sent and handle every complete line, false once the connection has been dropped
+static bool read_replies(void) {
+  char buffer[512];
+  int fd = hc.fd;
+  ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    schedule_reconnect(n == 0 ? "closed by rigctld" : strerror(errno));
+    return false;
+  }
+  if (n < 0) {
+    return true;
+  }
+
+  hc.last_activity_us = g_get_monotonic_time();
+  g_string_append_len(hc.inbuf, buffer, n);
+  char * newline;
+  // handle_reply() may drop the connection, stop as soon as this socket is gone
+  while (hc.fd == fd && (newline = memchr(hc.inbuf->str, '\n', hc.inbuf->len)) != NULL) {
+    * newline = '\0';
+    char * line = g_strdup(g_strstrip(hc.inbuf->str));
+    g_string_erase(hc.inbuf, 0, newline - hc.inbuf->str + 1);
+    handle_reply(line);
+    g_free(line);
+  }
+  return hc.fd == fd;
+}
+
+static gboolean on_socket_event(gint fd, GIOCondition condition, gpointer data) {
+  // A dropped connection has already removed this watch
+  return read_replies() ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static gboolean on_connected(gint fd, GIOCondition condition, gpointer data) {
+  int err = 0;
+  socklen_t len = sizeof(err);
+  getsockopt(fd, SOL_SOCKET, SO_ERROR, & err, & len);
+  hc.io_watch = 0; // Removed by returning G_SOURCE_REMOVE
+  remove_source( & hc.connect_timer);
+  if (err != 0) {
+    schedule_reconnect(strerror(err));
+    return G_SOURCE_REMOVE;
+  }
+
+  printf("Connected to Hamlib net server\n");
+  if (hc.ever_connected) {
+    hc.stats.reconnects++;
+  }
+  hc.ever_connected = true;
+  hc.backoff_ms = HAMLIB_BACKOFF_MIN_MS;
+  hc.last_activity_us = g_get_monotonic_time();
+  hc.io_watch = g_unix_fd_add(fd, G_IO_IN, on_socket_event, NULL);
+  set_connected(true);
+
+  // Restore the PTT state the operator asked for while we were away
+  if (hc.wanted_ptt >= 0) {
+    send_ptt();
+  }
+  return G_SOURCE_REMOVE;
+}
+
+// A host that drops SYNs would otherwise hold the connect for the kernel's SYN timeout, minutes
+static gboolean on_connect_timer(gpointer data) {
+  hc.connect_timer = 0;
+  schedule_reconnect("connect timed out");
+  return G_SOURCE_REMOVE;
+}
+
+static void start_connect(void) {
+  int one = 1;
+  close_socket();
+  hc.fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (hc.fd < 0) {
+    schedule_reconnect(strerror(errno));
+    return;
+  }
+  setsockopt(hc.fd, IPPROTO_TCP, TCP_NODELAY, & one, sizeof(one));
+  fcntl(hc.fd, F_SETFL, fcntl(hc.fd, F_GETFL) | O_NONBLOCK);
+
+  if (connect(hc.fd, (struct sockaddr * ) & hc.addr, sizeof(hc.addr)) < 0 && errno != EINPROGRESS) {
+    schedule_reconnect(strerror(errno));
+    return;
+  }
+  hc.io_watch = g_unix_fd_add(hc.fd, G_IO_OUT, on_connected, NULL);
+  hc.connect_timer = g_timeout_add(HAMLIB_REPLY_TIMEOUT_MS, on_connect_timer, NULL);
+}
+
+// Once a second: detect replies that never came, and probe an idle connection
+static gboolean on_keepalive_timer(gpointer data) {
+  if (!hc.connected) {
+    return G_SOURCE_CONTINUE;
+  }
+  gint64 now = g_get_monotonic_time();
+  struct hamlib_request * oldest = g_queue_peek_head( & hc.awaiting);
+  if (oldest != NULL) {
+    if (now - oldest->sent_us > HAMLIB_REPLY_TIMEOUT_MS * 1000) {
+      char reason[64];
+      snprintf(reason, sizeof(reason), "no reply to '%s'", oldest->command);
+      schedule_reconnect(reason);
+    }
+  } else if (now - hc.last_activity_us > HAMLIB_KEEPALIVE_S * G_USEC_PER_SEC) {
+    send_request("t");
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+int hamlib_client_open(const char * host, int port) {
+  memset( & hc.addr, 0, sizeof(hc.addr));
+  hc.addr.sin_family = AF_INET;
+  hc.addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host, & hc.addr.sin_addr) != 1) {
+    fprintf(stderr, "Invalid Hamlib host address: %s\n", host);
+    return -1;
+  }
+
+  g_queue_init( & hc.awaiting);
+  hc.inbuf = g_string_new(NULL);
+  memset( & hc.stats, 0, sizeof(hc.stats));
+  hc.backoff_ms = HAMLIB_BACKOFF_MIN_MS;
+  hc.keepalive_timer = g_timeout_add_seconds(1, on_keepalive_timer, NULL);
+  start_connect();
+  return 0;
+}
+
+void hamlib_client_set_state_callback(hamlib_state_fn fn, void * data) {
+  hc.state_fn = fn;
+  hc.state_data = data;
+}
+
+void hamlib_client_set_ptt(bool on) {
+  hc.wanted_ptt = on ? 1 : 0;
+  if (hc.connected) {
+    send_ptt();
+  } else {
+    fprintf(stderr, "Hamlib not connected, PTT %s will be sent on reconnect\n", on ? "on" : "off");
+  }
+}
+
+void hamlib_client_set_ptt_callback(hamlib_ptt_fn fn, void * data) {
+  hc.ptt_fn = fn;
+  hc.ptt_data = data;
+}
+
+bool hamlib_client_connected(void) {
+  return hc.connected;
+}
+
+int hamlib_client_radio_ptt(void) {
+  return hc.radio_ptt;
+}
+
+void hamlib_client_get_stats(struct hamlib_client_stats * stats) {
+  * stats = hc.stats;
+}
+
+bool hamlib_client_unkey(int timeout_ms) {
+  hc.wanted_ptt = 0;
+  if (!hc.connected) {
+    fprintf(stderr, "Hamlib not connected, cannot un-key the radio\n");
+    return false;
+  }
+  send_ptt();
+  // Wait here rather than on the main loop, nothing else should run while shutting down
+  gint64 deadline_us = g_get_monotonic_time() + timeout_ms * 1000LL;
+  while (hc.connected && !g_queue_is_empty( & hc.awaiting)) {
+    int remaining_ms = (int) ((deadline_us - g_get_monotonic_time()) / 1000);
+    struct pollfd pfd = { hc.fd, POLLIN, 0 };
+    if (remaining_ms <= 0 || poll( & pfd, 1, remaining_ms) == 0) {
+      fprintf(stderr, "Hamlib: no reply to T 0 within %d ms, the radio may still be keyed\n", timeout_ms);
+      return false;
+    }
+    if (!read_replies()) {
+      break;
+    }
+  }
+  return hc.connected && hc.radio_ptt == 0;
+}
+
+void hamlib_client_close(void) {
+  if (hc.connected) {
+    // Let rigctld end the session cleanly instead of finding a dead socket later
+    send(hc.fd, "q\n", 2, MSG_NOSIGNAL);
+  }
+  remove_source( & hc.reconnect_timer);
+  remove_source( & hc.keepalive_timer);
+  close_socket();
+  hc.connected = false;
+  hc.ever_connected = false;
+  hc.wanted_ptt = -1;
+  if (hc.inbuf != NULL) {
+    g_string_free(hc.inbuf, TRUE);
+    hc.inbuf = NULL;
+  }
+}
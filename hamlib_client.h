@@ -0,0 +1,63 @@
+/*
+ * hamlib_client.h
+ *
+ * Description:
+ * rigctld (Hamlib net, port 4532) client on the GLib main loop. Used for PTT.
+ * Every reply is read and checked, PTT round trips are timed, an idle connection
+ * is probed with a keepalive and a dead one is reconnected with backoff. The
+ * wanted PTT state is kept across reconnects and re-sent once connected.
+ *
+ * The keepalive is a PTT poll ("t"). When the radio reports something other
+ * than what we asked for (its time-out timer dropped TX, or another controller
+ * keyed or un-keyed it) that is reported through the PTT callback and left
+ * alone: PTT is only ever sent on request and to restore it after a reconnect,
+ * never to overrule the radio.
+ */
+#ifndef HAMLIB_CLIENT_H
+#define HAMLIB_CLIENT_H
+
+#include <stdbool.h>
+
+#define HAMLIB_KEEPALIVE_S 5        // Probe with "t" after this long without traffic
+#define HAMLIB_REPLY_TIMEOUT_MS 2000 // A reply later than this marks the connection stale
+#define HAMLIB_BACKOFF_MIN_MS 250
+#define HAMLIB_BACKOFF_MAX_MS 8000
+
+struct hamlib_client_stats {
+  unsigned int reconnects;
+  unsigned int errors;        // RPRT replies other than 0
+  double last_ptt_ms;         // Round trip of the last T command
+  double max_ptt_ms;
+};
+
+// Called whenever the connection comes up or goes down
+typedef void ( * hamlib_state_fn)(bool connected, void * data);
+
+// Called when a poll finds the radio's PTT changed to differ from the one last asked for
+typedef void ( * hamlib_ptt_fn)(bool on, void * data);
+
+// Start connecting to rigctld, returns immediately. host must be a dotted IPv4 address.
+int hamlib_client_open(const char * host, int port);
+
+void hamlib_client_set_state_callback(hamlib_state_fn fn, void * data);
+
+void hamlib_client_set_ptt_callback(hamlib_ptt_fn fn, void * data);
+
+// Key or un-key the radio. While disconnected the request is kept and sent on reconnect.
+void hamlib_client_set_ptt(bool on);
+
+bool hamlib_client_connected(void);
+
+// PTT as last acknowledged or polled on the radio, -1 while unknown
+int hamlib_client_radio_ptt(void);
+
+void hamlib_client_get_stats(struct hamlib_client_stats * stats);
+
+// Send T 0 and wait up to timeout_ms for rigctld to acknowledge it, before closing while transmitting.
+// Returns true once the radio is known to be un-keyed.
+bool hamlib_client_unkey(int timeout_ms);
+
+// Say goodbye to rigctld and close the connection, forgetting the wanted PTT state
+void hamlib_client_close(void);
+
+#endif
@@ -0,0 +1,460 @@
+/*
+ * hamlib_client_test.c
+ *
+ * Description:
+ * Runs hamlib_client.c against a scripted stand-in rigctld on 127.0.0.1, so
+ * its error handling can be checked without a radio: RPRT errors, a server
+ * that stops answering, reconnect backoff, PTT restored after a reconnect, and
+ * a PTT poll that finds the radio un-keyed by itself (which must not re-key it),
+ * a connect that hangs because the host drops SYNs, and un-keying before
+ * close, acknowledged or given up on after the timeout.
+ *
+ * Usage:
+ * 1. Compile the test using:
+ *    gcc -O2 -o hamlib_client_test hamlib_client_test.c hamlib_client.c trace.c `pkg-config --cflags --libs glib-2.0` -lpthread
+ *
+ * 2. Run it (about 30 seconds, the keepalive poll only runs after HAMLIB_KEEPALIVE_S):
+ *    ./hamlib_client_test
+ *    Exits with 0 when every case passes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include "hamlib_client.h"
+
+#define FAKE_RIG_HOST "127.0.0.1"
+#define FAKE_RIG_PORT 45320 // Each case adds its index, so no case waits for the last one's socket
+#define FAKE_RIG_MAX_CONNECTIONS 4
+#define FAKE_RIG_MAX_LOG 64
+
+// How the stand-in answers on one connection
+enum rig_behaviour {
+  RIG_NORMAL,      // RPRT 0 to T, the PTT state to t
+  RIG_ERROR,       // RPRT -9 to T
+  RIG_SILENT,      // Reads commands and never answers
+  RIG_CLOSE_AFTER, // Answers the first command, then hangs up
+  RIG_DROPS_PTT    // Acknowledges T 1 but reports PTT off, like a radio whose time-out timer fired
+};
+
+struct rig_line {
+  int connection;
+  char text[16];
+};
+
+static struct {
+  int port;
+  int listen_after_ms; // Connects are refused until then
+  int connections;
+  enum rig_behaviour behaviour[FAKE_RIG_MAX_CONNECTIONS];
+  atomic_bool stop;
+  atomic_bool listening;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  struct rig_line log[FAKE_RIG_MAX_LOG]; // Commands received, under lock
+  int n_log;
+  double accepted_ms[FAKE_RIG_MAX_CONNECTIONS];
+  int n_accepted;
+} rig;
+
+static GMainLoop * loop;
+static gint64 start_us;
+static int ptt_reports;
+static bool last_ptt_report;
+
+static double elapsed_ms(void) {
+  return (g_get_monotonic_time() - start_us) / 1000.0;
+}
+
+static void sleep_ms(int ms) {
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep( & ts, NULL);
+}
+
+// Answer one command line, returns false to hang up
+static bool rig_answer(int fd, int connection, const char * line, int * ptt) {
+  enum rig_behaviour behaviour = rig.behaviour[connection];
+  char reply[32] = "";
+  pthread_mutex_lock( & rig.lock);
+  if (rig.n_log < FAKE_RIG_MAX_LOG) {
+    rig.log[rig.n_log].connection = connection;
+    snprintf(rig.log[rig.n_log].text, sizeof(rig.log[rig.n_log].text), "%.15s", line);
+    rig.n_log++;
+  }
+  pthread_mutex_unlock( & rig.lock);
+
+  if (line[0] == 'q') {
+    return false;
+  } else if (behaviour == RIG_SILENT) {
+    return true;
+  } else if (line[0] == 'T') {
+    if (behaviour == RIG_ERROR) {
+      snprintf(reply, sizeof(reply), "RPRT -9\n");
+    } else {
+      * ptt = behaviour == RIG_DROPS_PTT ? 0 : atoi(line + 2);
+      snprintf(reply, sizeof(reply), "RPRT 0\n");
+    }
+  } else if (line[0] == 't') {
+    snprintf(reply, sizeof(reply), "%d\n", * ptt);
+  }
+  send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+  return behaviour != RIG_CLOSE_AFTER;
+}
+
+// Serve one connection until either side hangs up or the case ends
+static void rig_serve(int fd, int connection) {
+  char buffer[256];
+  size_t have = 0;
+  int ptt = 0;
+  while (!atomic_load( & rig.stop)) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll( & pfd, 1, 20) <= 0) {
+      continue;
+    }
+    ssize_t n = recv(fd, buffer + have, sizeof(buffer) - 1 - have, 0);
+    if (n <= 0) {
+      return;
+    }
+    have += n;
+    char * newline;
+    while ((newline = memchr(buffer, '\n', have)) != NULL) {
+      * newline = '\0';
+      bool keep = rig_answer(fd, connection, buffer, & ptt);
+      have -= newline + 1 - buffer;
+      memmove(buffer, newline + 1, have);
+      if (!keep) {
+        return;
+      }
+    }
+  }
+}
+
+static void * rig_thread(void * arg) {
+  sleep_ms(rig.listen_after_ms);
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, & one, sizeof(one));
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(rig.port) };
+  inet_pton(AF_INET, FAKE_RIG_HOST, & addr.sin_addr);
+  if (bind(listener, (struct sockaddr * ) & addr, sizeof(addr)) < 0 || listen(listener, 4) < 0) {
+    perror("Fake rigctld");
+    close(listener);
+    atomic_store( & rig.listening, true); // Nothing to wait for, the case fails on its checks
+    return NULL;
+  }
+  atomic_store( & rig.listening, true);
+  for (int i = 0; i < rig.connections && !atomic_load( & rig.stop); ) {
+    struct pollfd pfd = { listener, POLLIN, 0 };
+    if (poll( & pfd, 1, 20) <= 0) {
+      continue;
+    }
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+    pthread_mutex_lock( & rig.lock);
+    rig.accepted_ms[rig.n_accepted++] = elapsed_ms();
+    pthread_mutex_unlock( & rig.lock);
+    rig_serve(fd, i++);
+    close(fd);
+  }
+  close(listener);
+  return NULL;
+}
+
+// Start the stand-in with one behaviour per connection it will accept
+static void rig_start(int port, int listen_after_ms, int connections, const enum rig_behaviour * behaviour) {
+  rig.port = port;
+  rig.listen_after_ms = listen_after_ms;
+  rig.connections = connections;
+  memcpy(rig.behaviour, behaviour, connections * sizeof(behaviour[0]));
+  rig.n_log = 0;
+  rig.n_accepted = 0;
+  atomic_store( & rig.stop, false);
+  atomic_store( & rig.listening, false);
+  start_us = g_get_monotonic_time();
+  pthread_create( & rig.thread, NULL, rig_thread, NULL);
+  // Unless the case wants refused connects, the client's first one should be accepted
+  while (listen_after_ms == 0 && !atomic_load( & rig.listening)) {
+    sleep_ms(1);
+  }
+}
+
+static void rig_stop(void) {
+  atomic_store( & rig.stop, true);
+  pthread_join(rig.thread, NULL);
+}
+
+static int rig_accepted(void) {
+  pthread_mutex_lock( & rig.lock);
+  int n = rig.n_accepted;
+  pthread_mutex_unlock( & rig.lock);
+  return n;
+}
+
+// How many times connection (or any, for -1) received text
+static int rig_count(int connection, const char * text) {
+  int n = 0;
+  pthread_mutex_lock( & rig.lock);
+  for (int i = 0; i < rig.n_log; i++) {
+    if ((connection < 0 || rig.log[i].connection == connection) && strcmp(rig.log[i].text, text) == 0) {
+      n++;
+    }
+  }
+  pthread_mutex_unlock( & rig.lock);
+  return n;
+}
+
+// The first command received on a connection, "" if none
+static const char * rig_first(int connection) {
+  static char text[16];
+  text[0] = '\0';
+  pthread_mutex_lock( & rig.lock);
+  for (int i = 0; i < rig.n_log; i++) {
+    if (rig.log[i].connection == connection) {
+      snprintf(text, sizeof(text), "%s", rig.log[i].text);
+      break;
+    }
+  }
+  pthread_mutex_unlock( & rig.lock);
+  return text;
+}
+
+static gboolean on_run_done(gpointer data) {
+  g_main_loop_quit(loop);
+  return G_SOURCE_REMOVE;
+}
+
+// Run the main loop until ms after the start of the case
+static void run_until(int ms) {
+  double wait_ms = ms - elapsed_ms();
+  if (wait_ms > 0) {
+    g_timeout_add((guint) wait_ms, on_run_done, NULL);
+    g_main_loop_run(loop);
+  }
+}
+
+static void on_radio_ptt(bool on, void * data) {
+  ptt_reports++;
+  last_ptt_report = on;
+}
+
+static void open_client(int port) {
+  ptt_reports = 0;
+  hamlib_client_set_ptt_callback(on_radio_ptt, NULL);
+  hamlib_client_open(FAKE_RIG_HOST, port);
+}
+
+#define CHECK(condition) do { \
+  if (!(condition)) { \
+    fprintf(stderr, "  check failed: %s\n", #condition); \
+    ok = false; \
+  } \
+} while (0)
+
+// rigctld refusing a command is counted and logged, and not taken as the radio's PTT
+static bool test_rprt_error(int port) {
+  bool ok = true;
+  const enum rig_behaviour script[] = { RIG_ERROR };
+  rig_start(port, 0, 1, script);
+  open_client(port);
+  run_until(300);
+  hamlib_client_set_ptt(true);
+  run_until(1000);
+  struct hamlib_client_stats stats;
+  hamlib_client_get_stats( & stats);
+  CHECK(rig_count(0, "T 1") == 1);
+  CHECK(stats.errors == 1);
+  CHECK(hamlib_client_radio_ptt() == -1);
+  CHECK(hamlib_client_connected());
+  hamlib_client_close();
+  rig_stop();
+  return ok;
+}
+
+// A reply that never comes marks the connection stale after HAMLIB_REPLY_TIMEOUT_MS
+static bool test_silent_reconnects(int port) {
+  bool ok = true;
+  const enum rig_behaviour script[] = { RIG_SILENT, RIG_NORMAL };
+  rig_start(port, 0, 2, script);
+  open_client(port);
+  run_until(300);
+  hamlib_client_set_ptt(true);
+  run_until(300 + HAMLIB_REPLY_TIMEOUT_MS - 200);
+  CHECK(rig_accepted() == 1);
+  run_until(300 + HAMLIB_REPLY_TIMEOUT_MS + 1000 + HAMLIB_BACKOFF_MIN_MS + 500);
+  struct hamlib_client_stats stats;
+  hamlib_client_get_stats( & stats);
+  CHECK(rig_accepted() == 2);
+  CHECK(stats.reconnects == 1);
+  CHECK(hamlib_client_connected());
+  hamlib_client_close();
+  rig_stop();
+  return ok;
+}
+
+// Connects refused: retries after 250, 500, 1000, 2000 ms, so a server that appears at 2 s is found at 3.75 s
+static bool test_backoff(int port) {
+  bool ok = true;
+  const enum rig_behaviour script[] = { RIG_NORMAL };
+  rig_start(port, 2000, 1, script);
+  open_client(port);
+  double expected_ms = 0;
+  for (int backoff = HAMLIB_BACKOFF_MIN_MS; expected_ms < 2000; backoff *= 2) {
+    expected_ms += backoff;
+  }
+  run_until((int) expected_ms + 600);
+  CHECK(rig_accepted() == 1);
+  if (rig_accepted() == 1) {
+    printf("  connected at %.0f ms, expected %.0f ms\n", rig.accepted_ms[0], expected_ms);
+    CHECK(rig.accepted_ms[0] > expected_ms - 100 && rig.accepted_ms[0] < expected_ms + 400);
+  }
+  CHECK(hamlib_client_connected());
+  hamlib_client_close();
+  rig_stop();
+  return ok;
+}
+
+// The server hangs up while we transmit: PTT on is the first thing sent on the new connection
+static bool test_ptt_restored(int port) {
+  bool ok = true;
+  const enum rig_behaviour script[] = { RIG_CLOSE_AFTER, RIG_NORMAL };
+  rig_start(port, 0, 2, script);
+  open_client(port);
+  run_until(300);
+  hamlib_client_set_ptt(true);
+  run_until(300 + HAMLIB_BACKOFF_MIN_MS + 700);
+  CHECK(rig_accepted() == 2);
+  CHECK(strcmp(rig_first(1), "T 1") == 0);
+  CHECK(hamlib_client_radio_ptt() == 1);
+  hamlib_client_close();
+  rig_stop();
+  return ok;
+}
+
+// The radio drops TX by itself: reported once through the callback, never keyed again by a poll
+static bool test_poll_does_not_rekey(int port) {
+  bool ok = true;
+  const enum rig_behaviour script[] = { RIG_DROPS_PTT };
+  rig_start(port, 0, 1, script);
+  open_client(port);
+  run_until(300);
+  hamlib_client_set_ptt(true);
+  run_until(300 + 2 * (HAMLIB_KEEPALIVE_S + 1) * 1000 + 500);
+  CHECK(rig_count(0, "t") >= 2);
+  CHECK(rig_count(0, "T 1") == 1);
+  CHECK(ptt_reports == 1 && !last_ptt_report);
+  CHECK(hamlib_client_radio_ptt() == 0);
+  hamlib_client_close();
+  rig_stop();
+  return ok;
+}
+
+// A host that drops SYNs, here a listener whose accept queue is full, is given up on after
+// HAMLIB_REPLY_TIMEOUT_MS rather than the kernel's SYN timeout
+static bool test_connect_timeout(int port) {
+  bool ok = true;
+  int one = 1;
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+  inet_pton(AF_INET, FAKE_RIG_HOST, & addr.sin_addr);
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, & one, sizeof(one));
+  bind(listener, (struct sockaddr * ) & addr, sizeof(addr));
+  listen(listener, 0);
+  int filler = socket(AF_INET, SOCK_STREAM, 0);
+  fcntl(filler, F_SETFL, O_NONBLOCK);
+  connect(filler, (struct sockaddr * ) & addr, sizeof(addr));
+  sleep_ms(50);
+
+  start_us = g_get_monotonic_time();
+  open_client(port);
+  run_until(HAMLIB_REPLY_TIMEOUT_MS + 100);
+  CHECK(!hamlib_client_connected());
+  close(filler);
+  close(listener);
+
+  // The retry after the minimum backoff finds a listener; the first SYN's own retransmit would come much later
+  const enum rig_behaviour script[] = { RIG_NORMAL };
+  rig_start(port, 0, 1, script);
+  run_until(HAMLIB_BACKOFF_MIN_MS + 300);
+  CHECK(rig_accepted() == 1);
+  CHECK(hamlib_client_connected());
+  hamlib_client_close();
+  rig_stop();
+  return ok;
+}
+
+// Stopping while transmitting: T 0 goes out and is acknowledged before the session ends
+static bool test_unkey_before_close(int port) {
+  bool ok = true;
+  const enum rig_behaviour script[] = { RIG_NORMAL };
+  rig_start(port, 0, 1, script);
+  open_client(port);
+  run_until(300);
+  hamlib_client_set_ptt(true);
+  run_until(600);
+  CHECK(hamlib_client_radio_ptt() == 1);
+  CHECK(hamlib_client_unkey(HAMLIB_REPLY_TIMEOUT_MS));
+  CHECK(hamlib_client_radio_ptt() == 0);
+  hamlib_client_close();
+  rig_stop();
+  CHECK(rig_count(0, "T 0") == 1);
+  return ok;
+}
+
+// A rigctld that does not answer holds up the stop for HAMLIB_REPLY_TIMEOUT_MS at most
+static bool test_unkey_times_out(int port) {
+  bool ok = true;
+  const enum rig_behaviour script[] = { RIG_SILENT };
+  rig_start(port, 0, 1, script);
+  open_client(port);
+  run_until(300);
+  hamlib_client_set_ptt(true);
+  double before_ms = elapsed_ms();
+  CHECK(!hamlib_client_unkey(HAMLIB_REPLY_TIMEOUT_MS));
+  double waited_ms = elapsed_ms() - before_ms;
+  printf("  gave up after %.0f ms\n", waited_ms);
+  CHECK(waited_ms > HAMLIB_REPLY_TIMEOUT_MS - 100 && waited_ms < HAMLIB_REPLY_TIMEOUT_MS + 300);
+  hamlib_client_close();
+  rig_stop();
+  CHECK(rig_count(0, "T 0") == 1);
+  return ok;
+}
+
+int main(void) {
+  static const struct {
+    const char * name;
+    bool ( * run)(int port);
+  } tests[] = {
+    { "rprt_error", test_rprt_error },
+    { "silent_reconnects", test_silent_reconnects },
+    { "backoff", test_backoff },
+    { "ptt_restored", test_ptt_restored },
+    { "poll_does_not_rekey", test_poll_does_not_rekey },
+    { "connect_timeout", test_connect_timeout },
+    { "unkey_before_close", test_unkey_before_close },
+    { "unkey_times_out", test_unkey_times_out },
+  };
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  loop = g_main_loop_new(NULL, FALSE);
+  pthread_mutex_init( & rig.lock, NULL);
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    printf("%s:\n", tests[i].name);
+    bool ok = tests[i].run(FAKE_RIG_PORT + (int) i);
+    printf("%s: %s\n", tests[i].name, ok ? "ok" : "FAILED");
+    failed += !ok;
+  }
+  g_main_loop_unref(loop);
+  printf("%d of %d failed\n", failed, (int)(sizeof(tests) / sizeof(tests[0])));
+  return failed == 0 ? 0 : 1;
+}
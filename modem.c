@@ -0,0 +1,180 @@
+/*
+ * modem.c
+ *
+ * Description:
+ * FreeDV modem wrapper used by the audio engine. Replaces the ./freedv_tx and
+ * ./freedv_rx child processes (and the sox gain stage in front of freedv_tx)
+ * with direct calls into libcodec2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "modem.h"
+
+#define MODEM_TX_LIMIT_DBFS -1.0f
+#define MODEM_TX_LIMIT_RELEASE_MS 50.0f
+
+int modem_mode_from_name(const char * name) {
+  if (strcmp(name, "700C") == 0) {
+    return FREEDV_MODE_700C;
+  } else if (strcmp(name, "700D") == 0) {
+    return FREEDV_MODE_700D;
+  } else if (strcmp(name, "700E") == 0) {
+    return FREEDV_MODE_700E;
+  }
+  return -1;
+}
+
+const char * modem_mode_name(int mode) {
+  switch (mode) {
+  case FREEDV_MODE_700C:
+    return "700C";
+  case FREEDV_MODE_700D:
+    return "700D";
+  case FREEDV_MODE_700E:
+    return "700E";
+  }
+  return "?";
+}
+
+// Reliable text from our own TX modem is never received, the callback only has to exist
+static void on_tx_reliable_text_rx(reliable_text_t rt, const char * txt_ptr, int length, void * state) {
+}
+
+// Keep the callsign another station sends as reliable text, like freedv_rx --reliabletext
+static void on_rx_reliable_text_rx(reliable_text_t rt, const char * txt_ptr, int length, void * state) {
+  struct modem * m = state;
+  snprintf(m->rx_callsign, sizeof(m->rx_callsign), "%.*s", length, txt_ptr);
+  m->rx_callsign_count++;
+  reliable_text_reset(rt);
+}
+
+// Common part of modem_open_tx / modem_open_rx
+static struct modem * modem_open(const char * mode) {
+  int fdv_mode = modem_mode_from_name(mode);
+  if (fdv_mode < 0) {
+    fprintf(stderr, "Unsupported FreeDV mode: %s\n", mode);
+    return NULL;
+  }
+
+  struct modem * m = calloc(1, sizeof(struct modem));
+  if (m == NULL) {
+    perror("Failed to allocate modem");
+    return NULL;
+  }
+
+  m->fdv = freedv_open(fdv_mode);
+  if (m->fdv == NULL) {
+    fprintf(stderr, "freedv_open failed for mode %s\n", mode);
+    free(m);
+    return NULL;
+  }
+
+  m->mode = fdv_mode;
+  m->n_speech = freedv_get_n_speech_samples(m->fdv);
+  m->n_modem = freedv_get_n_nom_modem_samples(m->fdv);
+  m->n_max_modem = freedv_get_n_max_modem_samples(m->fdv);
+  m->gain_q12 = 4096;
+  m->bit_rate = (float) freedv_get_bits_per_modem_frame(m->fdv) * freedv_get_modem_sample_rate(m->fdv) / m->n_modem;
+  return m;
+}
+
+struct modem * modem_open_tx(const char * mode, const char * callsign, int input_level_db) {
+  struct modem * m = modem_open(mode);
+  if (m == NULL) {
+    return NULL;
+  }
+
+  // Same settings freedv_tx uses by default
+  freedv_set_clip(m->fdv, 0);
+  freedv_set_tx_bpf(m->fdv, 1);
+
+  // Equivalent of freedv_tx --reliabletext <callsign>
+  m->reliable_text = reliable_text_create();
+  reliable_text_set_string(m->reliable_text, callsign, strlen(callsign));
+  reliable_text_use_with_freedv(m->reliable_text, m->fdv, on_tx_reliable_text_rx, NULL);
+
+  // Hard limit just below full scale so a raised input level does not clip
+  dsp_limiter_init( & m->limiter, MODEM_TX_LIMIT_DBFS, 0, MODEM_TX_LIMIT_RELEASE_MS, freedv_get_speech_sample_rate(m->fdv));
+  modem_set_input_level(m, input_level_db);
+  return m;
+}
+
+struct modem * modem_open_rx(const char * mode, int squelch_level) {
+  struct modem * m = modem_open(mode);
+  if (m == NULL) {
+    return NULL;
+  }
+
+  m->stats = calloc(1, sizeof(struct MODEM_STATS));
+  if (m->stats == NULL) {
+    perror("Failed to allocate modem stats");
+    modem_close(m);
+    return NULL;
+  }
+  m->reliable_text = reliable_text_create();
+  reliable_text_use_with_freedv(m->reliable_text, m->fdv, on_rx_reliable_text_rx, m);
+  modem_set_squelch(m, squelch_level);
+  return m;
+}
+
+void modem_set_input_level(struct modem * m, int input_level_db) {
+  // Equivalent of sox vol <input_level>dB
+  m->gain_q12 = dsp_gain_q12_from_db((float) input_level_db);
+  m->input_level_db = input_level_db;
+}
+
+void modem_set_squelch(struct modem * m, int squelch_level) {
+  // Equivalent of freedv_rx --squelch <squelch_level>
+  freedv_set_snr_squelch_thresh(m->fdv, (float) squelch_level);
+  freedv_set_squelch_en(m->fdv, 1);
+  m->squelch_level = squelch_level;
+}
+
+void modem_tx_frame(struct modem * m, short * modem_out, short * speech_in) {
+  dsp_dc_block( & m->dc_block, speech_in, m->n_speech);
+  dsp_gain(speech_in, m->n_speech, m->gain_q12);
+  dsp_limiter( & m->limiter, speech_in, m->n_speech);
+  freedv_tx(m->fdv, modem_out, speech_in);
+}
+
+int modem_rx_nin(struct modem * m) {
+  return freedv_nin(m->fdv);
+}
+
+int modem_rx_frame(struct modem * m, short * speech_out, const short * modem_in) {
+  // freedv_rx takes a non-const pointer but does not write through it
+  return freedv_rx(m->fdv, speech_out, (short * ) modem_in);
+}
+
+void modem_rx_reset(struct modem * m) {
+  freedv_set_sync(m->fdv, FREEDV_SYNC_UNSYNC);
+  reliable_text_reset(m->reliable_text);
+  m->rx_callsign[0] = '\0';
+}
+
+void modem_get_rx_stats(struct modem * m, struct modem_rx_stats * stats) {
+  freedv_get_modem_extended_stats(m->fdv, m->stats);
+  stats->mode = m->mode;
+  stats->sync = m->stats->sync != 0;
+  stats->snr_db = m->stats->snr_est;
+  stats->freq_offset_hz = m->stats->foff;
+  stats->clock_offset_ppm = m->stats->clock_offset * 1e6f;
+
+  // Eb/No from the SNR in 3 kHz, then the coherent QPSK bit error rate 0.5 * erfc(sqrt(Eb/No))
+  float ebno_db = m->stats->snr_est + 10.0f * log10f(3000.0f / m->bit_rate);
+  stats->ber_est = 0.5f * erfcf(sqrtf(powf(10.0f, ebno_db / 10.0f)));
+}
+
+void modem_close(struct modem * m) {
+  if (m == NULL) {
+    return;
+  }
+  free(m->stats);
+  if (m->reliable_text != NULL) {
+    reliable_text_destroy(m->reliable_text);
+  }
+  freedv_close(m->fdv);
+  free(m);
+}
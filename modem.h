@@ -0,0 +1,81 @@
+/*
+ * modem.h
+ *
+ * Description:
+ * Thin wrapper around the libcodec2 FreeDV API. It holds one freedv instance
+ * configured the same way the freedv_tx / freedv_rx command line tools used to
+ * configure it, and processes whole frames of 8 kHz S16 audio.
+ */
+#ifndef MODEM_H
+#define MODEM_H
+
+#include <stdbool.h>
+#include <codec2/freedv_api.h>
+#include <codec2/modem_stats.h>
+#include <codec2/reliable_text.h>
+#include "dsp.h"
+
+// Demodulator state after one RX frame
+struct modem_rx_stats {
+  int mode;               // FREEDV_MODE_xxx of the modem the stats came from
+  bool sync;
+  float snr_db;           // In a 3 kHz noise bandwidth
+  float freq_offset_hz;
+  float clock_offset_ppm;
+  float ber_est;          // Raw bit error rate estimated from the SNR, QPSK in white noise
+};
+
+struct modem {
+  struct freedv * fdv;
+  reliable_text_t reliable_text;
+  int mode;              // FREEDV_MODE_xxx
+  int n_speech;          // Speech samples per frame (TX input, RX max output)
+  int n_modem;           // Nominal modem samples per frame (TX output)
+  int n_max_modem;       // Largest value freedv_nin() can return (RX input)
+  int gain_q12;          // TX input gain in Q12 fixed point (4096 = 0dB)
+  int input_level_db;    // TX input level the gain was computed from
+  struct dsp_dc_block dc_block;  // TX microphone DC offset removal
+  struct dsp_limiter limiter;    // TX peak limiter after the gain
+  int squelch_level;     // RX SNR squelch threshold in dB
+  float bit_rate;        // Modem bits per second, for the BER estimate
+  struct MODEM_STATS * stats; // RX only, too large for the stack
+  char rx_callsign[16];  // RX only, last callsign received as reliable text, written by modem_rx_frame()
+  unsigned int rx_callsign_count; // RX only, callsigns received so far, tells a repeat of rx_callsign from no news
+};
+
+// Map a mode name from config.ini ("700C", "700D", "700E") to FREEDV_MODE_xxx, -1 if unknown
+int modem_mode_from_name(const char * name);
+
+// Name of a FREEDV_MODE_xxx as used in config.ini, "?" if unknown
+const char * modem_mode_name(int mode);
+
+// Open a TX modem that sends the callsign as reliable text and applies input_level_db of gain
+struct modem * modem_open_tx(const char * mode, const char * callsign, int input_level_db);
+
+// Open an RX modem with the SNR squelch set to squelch_level dB
+struct modem * modem_open_rx(const char * mode, int squelch_level);
+
+// Change the TX input level or RX squelch of an open modem
+void modem_set_input_level(struct modem * m, int input_level_db);
+void modem_set_squelch(struct modem * m, int squelch_level);
+
+// Remove DC, apply the input gain and limit n_speech samples of speech_in in place, then modulate them into n_modem samples
+void modem_tx_frame(struct modem * m, short * modem_out, short * speech_in);
+
+// Number of modem samples the next modem_rx_frame() call expects
+int modem_rx_nin(struct modem * m);
+
+// Demodulate modem_rx_nin() samples, returns the number of speech samples written to speech_out.
+// modem_in is only read.
+int modem_rx_frame(struct modem * m, short * speech_out, const short * modem_in);
+
+// Drop sync and any half received text so the next frames are searched afresh, e.g. after retuning.
+// Only the OFDM modes (700D, 700E) can be told to; 700C loses sync by itself within a few frames.
+void modem_rx_reset(struct modem * m);
+
+// Read the demodulator state after the last modem_rx_frame()
+void modem_get_rx_stats(struct modem * m, struct modem_rx_stats * stats);
+
+void modem_close(struct modem * m);
+
+#endif
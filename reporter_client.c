@@ -0,0 +1,401 @@
+/*
+ * reporter_client.c
+ *
+ * Description:
+ * The Python client took a whole interpreter (tens of MB and seconds to start
+ * on a Pi) to send a handful of events, and its IPC loop blocked the thread
+ * that should have been running sio.wait(), so nothing from the server was
+ * ever read, not even Engine.IO pings.
+ *
+ * Engine.IO 4 over WebSocket, one packet per text message:
+ *   0{json}  open, carries pingInterval and pingTimeout
+ *   2 / 3    ping from the server / our pong
+ *   1        close
+ *   4...     a Socket.IO packet: 0 connect (with our auth), 1 disconnect,
+ *            2 event ["name", {...}], 4 connect error
+ *
+ * A connection that hears nothing, not even a ping, for pingInterval plus
+ * pingTimeout is dead and is dropped, and the next attempt waits twice as long
+ * as the last one, up to REPORTER_BACKOFF_MAX_MS.
+ *
+ * The station state (mode, transmitting, frequency, message) is a snapshot
+ * that every change overwrites. What the server was last told is kept beside
+ * it; once changes have been quiet for REPORTER_DEBOUNCE_MS only the fields
+ * that differ are sent, so scrolling through channels or a quick PTT blip
+ * costs at most one update. A new connection has been told nothing, so it
+ * gets the whole snapshot, not the history of events it missed. Stations
+ * heard while offline wait in a short queue, one entry per callsign.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "reporter_client.h"
+#include "websocket.h"
+
+#define EIO_PATH "socket.io/?EIO=4&transport=websocket"
+#define EIO_PING_INTERVAL_MS 25000 // Engine.IO defaults, until the open packet says otherwise
+#define EIO_PING_TIMEOUT_MS 20000
+
+struct reporter_snapshot {
+  char mode[8];
+  bool transmitting;
+  int freq_hz;
+  char message[128];
+};
+
+struct reporter_heard {
+  char callsign[16];
+  char mode[8];
+  int snr_db;
+  gint64 heard_us;
+};
+
+static struct {
+  char url[512];
+  struct reporter_station station;
+  struct websocket * ws;
+  bool connected;            // Socket.IO namespace connect acknowledged
+  int ping_interval_ms;
+  int ping_timeout_ms;
+  guint watchdog_timer;
+  guint retry_timer;
+  int backoff_ms;
+  struct reporter_snapshot state; // Latest station state
+  struct reporter_snapshot told;  // What the server has been sent on this connection
+  bool told_valid;                // False until the snapshot has been sent once
+  guint debounce_timer;
+  gint64 changed_since_us;        // First change not yet sent, 0 if none
+  GQueue heard;                   // struct reporter_heard, waiting for a connection
+} rc = { .backoff_ms = REPORTER_BACKOFF_MIN_MS };
+
+static void start_connect(void);
+
+// Append s as a JSON string
+static void append_json_string(GString * out, const char * s) {
+  g_string_append_c(out, '"');
+  for (; * s != '\0'; s++) {
+    unsigned char c = * s;
+    if (c == '"' || c == '\\') {
+      g_string_append_c(out, '\\');
+      g_string_append_c(out, c);
+    } else if (c < 0x20) {
+      g_string_append_printf(out, "\\u%04x", c);
+    } else {
+      g_string_append_c(out, c);
+    }
+  }
+  g_string_append_c(out, '"');
+}
+
+// Send one Socket.IO event, args is the JSON object that follows the name
+static void emit(const char * name, const char * args) {
+  if (!rc.connected) {
+    return;
+  }
+  GString * packet = g_string_new("42[");
+  append_json_string(packet, name);
+  g_string_append_printf(packet, ",%s]", args);
+  printf("Reporter: %s\n", packet->str + 2);
+  ws_send_text(rc.ws, packet->str);
+  g_string_free(packet, TRUE);
+}
+
+static void emit_tx(void) {
+  GString * args = g_string_new("{\"mode\":");
+  append_json_string(args, rc.state.mode);
+  g_string_append_printf(args, ",\"transmitting\":%s}", rc.state.transmitting ? "true" : "false");
+  emit("tx_report", args->str);
+  g_string_free(args, TRUE);
+}
+
+static void emit_freq(void) {
+  char args[32];
+  snprintf(args, sizeof(args), "{\"freq\":%d}", rc.state.freq_hz);
+  emit("freq_change", args);
+}
+
+static void emit_message(void) {
+  GString * args = g_string_new("{\"message\":");
+  append_json_string(args, rc.state.message);
+  g_string_append_c(args, '}');
+  emit("message_update", args->str);
+  g_string_free(args, TRUE);
+}
+
+static void emit_rx(const struct reporter_heard * h) {
+  GString * args = g_string_new("{\"callsign\":");
+  append_json_string(args, h->callsign);
+  g_string_append(args, ",\"mode\":");
+  append_json_string(args, h->mode);
+  g_string_append_printf(args, ",\"snr\":%d}", h->snr_db);
+  emit("rx_report", args->str);
+  g_string_free(args, TRUE);
+}
+
+// Send the parts of the snapshot the server does not have yet
+static void publish(void) {
+  if (rc.debounce_timer != 0) {
+    g_source_remove(rc.debounce_timer);
+    rc.debounce_timer = 0;
+  }
+  rc.changed_since_us = 0;
+  if (!rc.connected) {
+    return;
+  }
+  if (!rc.told_valid || strcmp(rc.state.mode, rc.told.mode) != 0 || rc.state.transmitting != rc.told.transmitting) {
+    emit_tx();
+  }
+  if (!rc.told_valid || rc.state.freq_hz != rc.told.freq_hz) {
+    emit_freq();
+  }
+  if (!rc.told_valid || strcmp(rc.state.message, rc.told.message) != 0) {
+    emit_message();
+  }
+  rc.told = rc.state;
+  rc.told_valid = true;
+}
+
+static gboolean on_debounce_timer(gpointer data) {
+  rc.debounce_timer = 0;
+  publish();
+  return G_SOURCE_REMOVE;
+}
+
+// The snapshot changed, send it once changes stop coming (or have kept coming for REPORTER_DEBOUNCE_MAX_MS)
+static void state_changed(void) {
+  gint64 now = g_get_monotonic_time();
+  if (rc.changed_since_us == 0) {
+    rc.changed_since_us = now;
+  } else if (now - rc.changed_since_us >= REPORTER_DEBOUNCE_MAX_MS * 1000LL) {
+    return; // Let the pending timer fire
+  }
+  if (rc.debounce_timer != 0) {
+    g_source_remove(rc.debounce_timer);
+  }
+  rc.debounce_timer = g_timeout_add(REPORTER_DEBOUNCE_MS, on_debounce_timer, NULL);
+}
+
+// Stations heard while offline, stale ones are no longer worth a spot
+static void send_heard(void) {
+  gint64 now = g_get_monotonic_time();
+  struct reporter_heard * h;
+  while (rc.connected && (h = g_queue_pop_head( & rc.heard)) != NULL) {
+    if (now - h->heard_us < REPORTER_HEARD_MAX_AGE_S * G_USEC_PER_SEC) {
+      emit_rx(h);
+    }
+    g_free(h);
+  }
+}
+
+static gboolean on_retry_timer(gpointer data) {
+  rc.retry_timer = 0;
+  start_connect();
+  return G_SOURCE_REMOVE;
+}
+
+static void disconnect(void) {
+  if (rc.watchdog_timer != 0) {
+    g_source_remove(rc.watchdog_timer);
+    rc.watchdog_timer = 0;
+  }
+  if (rc.ws != NULL) {
+    ws_close(rc.ws);
+    rc.ws = NULL;
+  }
+  rc.connected = false;
+  rc.told_valid = false;
+}
+
+// Drop the connection and try again after the current backoff, spread a little so
+// stations dropped together by a server restart do not all come back at once
+static void connection_lost(const char * reason) {
+  disconnect();
+  if (rc.retry_timer != 0) {
+    return;
+  }
+  int delay_ms = rc.backoff_ms + g_random_int_range(0, rc.backoff_ms / 4 + 1);
+  fprintf(stderr, "Reporter connection to %s lost: %s, retrying in %d ms\n", rc.url, reason, delay_ms);
+  rc.retry_timer = g_timeout_add(delay_ms, on_retry_timer, NULL);
+  rc.backoff_ms = MIN(rc.backoff_ms * 2, REPORTER_BACKOFF_MAX_MS);
+}
+
+static gboolean on_watchdog(gpointer data) {
+  rc.watchdog_timer = 0;
+  connection_lost("no ping from the server");
+  return G_SOURCE_REMOVE;
+}
+
+static void feed_watchdog(void) {
+  if (rc.watchdog_timer != 0) {
+    g_source_remove(rc.watchdog_timer);
+  }
+  rc.watchdog_timer = g_timeout_add(rc.ping_interval_ms + rc.ping_timeout_ms, on_watchdog, NULL);
+}
+
+// Integer value of "key": in a flat JSON object, default_value when absent
+static int json_int(const char * json, const char * key, int default_value) {
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  const char * p = strstr(json, pattern);
+  return p != NULL ? atoi(p + strlen(pattern)) : default_value;
+}
+
+static void send_connect(void) {
+  GString * auth = g_string_new("40{\"callsign\":");
+  append_json_string(auth, rc.station.callsign);
+  g_string_append(auth, ",\"grid_square\":");
+  append_json_string(auth, rc.station.grid_square);
+  g_string_append(auth, ",\"version\":");
+  append_json_string(auth, rc.station.version);
+  g_string_append(auth, ",\"role\":\"report_wo\",\"os\":\"linux\"}");
+  ws_send_text(rc.ws, auth->str);
+  g_string_free(auth, TRUE);
+}
+
+// One Socket.IO packet, text is what follows the Engine.IO "4"
+static void on_socketio_packet(const char * text) {
+  switch (text[0]) {
+  case '0':
+    printf("Reporter connected to %s as %s\n", rc.url, rc.station.callsign);
+    rc.connected = true;
+    rc.backoff_ms = REPORTER_BACKOFF_MIN_MS;
+    publish();
+    send_heard();
+    break;
+  case '1':
+    connection_lost("disconnected by the server");
+    break;
+  case '2':
+    // Nothing the server sends a report-only client needs an answer, log it
+    printf("Reporter event: %.200s\n", text + 1);
+    break;
+  case '4':
+    connection_lost(text + 1);
+    break;
+  }
+}
+
+static void on_ws_opened(struct websocket * ws, void * data) {
+  feed_watchdog();
+}
+
+static void on_ws_message(struct websocket * ws, const char * text, size_t len, void * data) {
+  feed_watchdog();
+  switch (text[0]) {
+  case '0':
+    rc.ping_interval_ms = json_int(text + 1, "pingInterval", EIO_PING_INTERVAL_MS);
+    rc.ping_timeout_ms = json_int(text + 1, "pingTimeout", EIO_PING_TIMEOUT_MS);
+    feed_watchdog();
+    send_connect();
+    break;
+  case '1':
+    connection_lost("closed by the server");
+    break;
+  case '2':
+    ws_send_text(ws, "3");
+    break;
+  case '4':
+    on_socketio_packet(text + 1);
+    break;
+  }
+}
+
+static void on_ws_closed(struct websocket * ws, const char * reason, void * data) {
+  rc.ws = NULL; // Freed by the WebSocket code
+  connection_lost(reason);
+}
+
+static void start_connect(void) {
+  static const struct ws_callbacks callbacks = { on_ws_opened, on_ws_message, on_ws_closed };
+  char url[600];
+  snprintf(url, sizeof(url), "%s%s%s", rc.url, g_str_has_suffix(rc.url, "/") ? "" : "/", EIO_PATH);
+  rc.ping_interval_ms = EIO_PING_INTERVAL_MS;
+  rc.ping_timeout_ms = EIO_PING_TIMEOUT_MS;
+  rc.ws = ws_open(url, & callbacks, NULL);
+  if (rc.ws == NULL) {
+    fprintf(stderr, "Reporter disabled, cannot use %s\n", rc.url);
+  }
+}
+
+void reporter_client_open(const char * url, const struct reporter_station * station) {
+  snprintf(rc.url, sizeof(rc.url), "%s", url);
+  g_queue_init( & rc.heard);
+  rc.station = * station;
+  if (rc.url[0] == '\0') {
+    printf("Reporter disabled, reporter_url is empty\n");
+    return;
+  }
+  start_connect();
+}
+
+void reporter_client_set_station(const struct reporter_station * station) {
+  if (memcmp( & rc.station, station, sizeof(rc.station)) == 0) {
+    return;
+  }
+  rc.station = * station;
+  if (rc.ws != NULL) {
+    printf("Reporter reconnecting as %s %s\n", station->callsign, station->grid_square);
+    disconnect();
+    start_connect();
+  }
+}
+
+void reporter_client_tx(const char * mode, bool transmitting) {
+  snprintf(rc.state.mode, sizeof(rc.state.mode), "%s", mode);
+  rc.state.transmitting = transmitting;
+  state_changed();
+}
+
+void reporter_client_freq(int freq_hz) {
+  rc.state.freq_hz = freq_hz;
+  state_changed();
+}
+
+void reporter_client_message(const char * message) {
+  snprintf(rc.state.message, sizeof(rc.state.message), "%s", message);
+  state_changed();
+}
+
+void reporter_client_rx(const char * callsign, const char * mode, int snr_db) {
+  struct reporter_heard heard = { .snr_db = snr_db, .heard_us = g_get_monotonic_time() };
+  snprintf(heard.callsign, sizeof(heard.callsign), "%s", callsign);
+  snprintf(heard.mode, sizeof(heard.mode), "%s", mode);
+  if (rc.connected) {
+    emit_rx( & heard);
+    return;
+  }
+
+  // Offline, keep the newest report of each station
+  for (GList * l = rc.heard.head; l != NULL; l = l->next) {
+    struct reporter_heard * queued = l->data;
+    if (strcmp(queued->callsign, heard.callsign) == 0) {
+      * queued = heard;
+      return;
+    }
+  }
+  if (g_queue_get_length( & rc.heard) >= REPORTER_HEARD_QUEUE_MAX) {
+    g_free(g_queue_pop_head( & rc.heard));
+  }
+  struct reporter_heard * h = g_new(struct reporter_heard, 1);
+  * h = heard;
+  g_queue_push_tail( & rc.heard, h);
+}
+
+bool reporter_client_connected(void) {
+  return rc.connected;
+}
+
+void reporter_client_close(void) {
+  if (rc.retry_timer != 0) {
+    g_source_remove(rc.retry_timer);
+    rc.retry_timer = 0;
+  }
+  if (rc.debounce_timer != 0) {
+    g_source_remove(rc.debounce_timer);
+    rc.debounce_timer = 0;
+  }
+  disconnect();
+  g_queue_clear_full( & rc.heard, g_free);
+  rc.backoff_ms = REPORTER_BACKOFF_MIN_MS;
+}
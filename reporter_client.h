@@ -0,0 +1,53 @@
+/*
+ * reporter_client.h
+ *
+ * Description:
+ * FreeDV Reporter (qso.freedv.org) client inside freedv_pttd, replacing the
+ * sioclient.py child process. Speaks Socket.IO over Engine.IO 4 on a plain
+ * WebSocket (see websocket.h) on the GLib main loop and reports the station as
+ * a report-only client: tx_report, freq_change, message_update and rx_report.
+ *
+ * Any Socket.IO 4 server can stand in for qso.freedv.org by pointing
+ * reporter_url in config.ini at it, e.g. ws://127.0.0.1:45400/ for
+ * reporter_client_test --serve 45400 (see reporter_client_test.c). An empty
+ * reporter_url turns reporting off.
+ */
+#ifndef REPORTER_CLIENT_H
+#define REPORTER_CLIENT_H
+
+#include <stdbool.h>
+
+#define REPORTER_DEFAULT_URL "ws://qso.freedv.org/"
+#define REPORTER_BACKOFF_MIN_MS 1000     // First wait before connecting again, doubles on every failure
+#define REPORTER_BACKOFF_MAX_MS 300000
+#define REPORTER_DEBOUNCE_MS 750         // State changes closer together than this go out as one update
+#define REPORTER_DEBOUNCE_MAX_MS 3000    // ...unless they keep coming for this long
+#define REPORTER_HEARD_QUEUE_MAX 32      // Stations heard while offline, one entry per callsign
+#define REPORTER_HEARD_MAX_AGE_S 600     // Older ones are not sent after reconnecting
+
+// Who we are, sent when connecting
+struct reporter_station {
+  char callsign[32];
+  char grid_square[16];
+  char version[64];
+};
+
+// Start connecting, returns immediately
+void reporter_client_open(const char * url, const struct reporter_station * station);
+
+// The callsign or locator changed, reconnects so the server shows the new one
+void reporter_client_set_station(const struct reporter_station * station);
+
+// Update the station snapshot, sent after REPORTER_DEBOUNCE_MS and again in full on every reconnect
+void reporter_client_tx(const char * mode, bool transmitting);
+void reporter_client_freq(int freq_hz);
+void reporter_client_message(const char * message);
+
+// A station we decoded, see rx_report.h. Queued while not connected.
+void reporter_client_rx(const char * callsign, const char * mode, int snr_db);
+
+bool reporter_client_connected(void);
+
+void reporter_client_close(void);
+
+#endif
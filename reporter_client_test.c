@@ -0,0 +1,589 @@
+/*
+ * reporter_client_test.c
+ *
+ * Description:
+ * Runs reporter_client.c and websocket.c against a scripted stand-in FreeDV
+ * Reporter on 127.0.0.1: a WebSocket server speaking just enough Engine.IO 4
+ * and Socket.IO to open a session, acknowledge the namespace connect, ping,
+ * and then misbehave the way a case asks. The cases cover the handshake,
+ * ping/pong and the watchdog, a reconnect that replays the snapshot,
+ * fragmented frames with a control frame between the fragments, and the
+ * server closing the session both as Socket.IO and as WebSocket.
+ *
+ * --measure connects once and prints the time from reporter_client_open to
+ * connected and the process's RSS. --serve runs the stand-in on its own, so
+ * the old Python client can be measured against the same server:
+ *
+ *    ./reporter_client_test --serve 45400 &
+ *    python3 -c 'import time; t = time.time(); import socketio, resource; s = socketio.Client();
+ *      s.connect("ws://127.0.0.1:45400/", transports=["websocket"]);
+ *      print((time.time() - t) * 1000, "ms", resource.getrusage(resource.RUSAGE_SELF).ru_maxrss, "kB")'
+ *
+ * Measured on an x86_64 build host (single core), three runs each:
+ *    reporter_client.c  41.8-45.0 ms to connected, RSS 2.6-2.8 MB before
+ *                       reporter_client_open and 3.0-3.2 MB after, the
+ *                       stand-in's thread included
+ *    sioclient.py       not measured there, python-socketio could not be
+ *                       installed; python3 3.11 with only the standard
+ *                       modules it imports already takes 142-147 ms to start
+ *                       and exit and 20 MB RSS, before socketio, requests and
+ *                       websocket-client are loaded or anything is connected
+ * The C time is mostly the stand-in's 10-20 ms poll intervals on each step.
+ *
+ * Usage:
+ * 1. Compile the test using:
+ *    gcc -O2 -o reporter_client_test reporter_client_test.c reporter_client.c websocket.c `pkg-config --cflags --libs glib-2.0` -lpthread
+ *
+ * 2. Run it (about 20 seconds, reconnects wait REPORTER_BACKOFF_MIN_MS):
+ *    ./reporter_client_test
+ *    Exits with 0 when every case passes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include "reporter_client.h"
+#include "websocket.h"
+
+#define FAKE_SIO_HOST "127.0.0.1"
+#define FAKE_SIO_PORT 45400 // Each case adds its index, so no case waits for the last one's socket
+#define FAKE_SIO_MAX_CONNECTIONS 4
+#define FAKE_SIO_MAX_LOG 128
+#define FAKE_SIO_PING_INTERVAL_MS 300 // Sent in the open packet, far below the real server's so the watchdog trips quickly
+#define FAKE_SIO_PING_TIMEOUT_MS 200
+#define FAKE_SIO_PINGS_FOR_MS 2000    // SIO_STOPS_PINGING goes quiet after this
+#define FAKE_SIO_HANG_UP_MS 1500      // SIO_HANG_UP and the close behaviours act this long after the connect
+#define FAKE_SIO_CLOSE_MS 300
+
+// How the stand-in behaves on one connection
+enum sio_behaviour {
+  SIO_NORMAL,         // Open, acknowledge the connect, ping every FAKE_SIO_PING_INTERVAL_MS
+  SIO_STOPS_PINGING,  // Goes quiet after FAKE_SIO_PINGS_FOR_MS, as a server that hung would
+  SIO_HANG_UP,        // Drops the TCP connection FAKE_SIO_HANG_UP_MS after the connect
+  SIO_FRAGMENTED,     // Every message in three fragments, with a WebSocket ping after the first
+  SIO_DISCONNECT,     // Sends a Socket.IO disconnect (41) FAKE_SIO_CLOSE_MS after the connect
+  SIO_CLOSE_FRAME     // Sends a WebSocket close frame FAKE_SIO_CLOSE_MS after the connect
+};
+
+// What one connection received: the upgrade request line, text messages, and <pong> / <close> for control frames
+struct sio_line {
+  int connection;
+  char text[256];
+};
+
+static struct {
+  int port;
+  int connections;
+  enum sio_behaviour behaviour[FAKE_SIO_MAX_CONNECTIONS];
+  atomic_bool stop;
+  atomic_bool listening;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  struct sio_line log[FAKE_SIO_MAX_LOG]; // Under lock
+  int n_log;
+  double accepted_ms[FAKE_SIO_MAX_CONNECTIONS];
+  int n_accepted;
+} sio;
+
+static GMainLoop * loop;
+static gint64 start_us;
+
+static double elapsed_ms(void) {
+  return (g_get_monotonic_time() - start_us) / 1000.0;
+}
+
+static void sleep_ms(int ms) {
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep( & ts, NULL);
+}
+
+static void sio_log(int connection, const char * text, size_t len) {
+  pthread_mutex_lock( & sio.lock);
+  if (sio.n_log < FAKE_SIO_MAX_LOG) {
+    sio.log[sio.n_log].connection = connection;
+    snprintf(sio.log[sio.n_log].text, sizeof(sio.log[sio.n_log].text), "%.*s", (int) len, text);
+    sio.n_log++;
+  }
+  pthread_mutex_unlock( & sio.lock);
+}
+
+// One unmasked frame, as a server sends them
+static void send_frame(int fd, int opcode, bool fin, const char * payload, size_t len) {
+  unsigned char header[4];
+  size_t h = 0;
+  header[h++] = (fin ? 0x80 : 0) | opcode;
+  if (len < 126) {
+    header[h++] = len;
+  } else {
+    header[h++] = 126;
+    header[h++] = len >> 8;
+    header[h++] = len;
+  }
+  send(fd, header, h, MSG_NOSIGNAL);
+  send(fd, payload, len, MSG_NOSIGNAL);
+}
+
+// A text message, in three fragments with a ping between the first two when fragmented
+static void send_text(int fd, enum sio_behaviour behaviour, const char * text) {
+  size_t len = strlen(text);
+  if (behaviour != SIO_FRAGMENTED) {
+    send_frame(fd, 0x1, true, text, len);
+    return;
+  }
+  size_t third = len / 3;
+  send_frame(fd, 0x1, false, text, third);
+  send_frame(fd, 0x9, true, "fake", 4);
+  send_frame(fd, 0x0, false, text + third, third);
+  send_frame(fd, 0x0, true, text + 2 * third, len - 2 * third);
+}
+
+// Read the HTTP upgrade and answer it, false if the client went away first
+static bool sio_upgrade(int fd, int connection) {
+  char request[2048];
+  size_t have = 0;
+  char * end = NULL;
+  while (end == NULL && !atomic_load( & sio.stop)) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll( & pfd, 1, 20) <= 0) {
+      continue;
+    }
+    ssize_t n = recv(fd, request + have, sizeof(request) - 1 - have, 0);
+    if (n <= 0) {
+      return false;
+    }
+    have += n;
+    request[have] = '\0';
+    end = strstr(request, "\r\n\r\n");
+  }
+  if (end == NULL) {
+    return false;
+  }
+  sio_log(connection, request, strcspn(request, "\r"));
+
+  char key[64] = "";
+  const char * header = strstr(request, "Sec-WebSocket-Key: ");
+  if (header != NULL) {
+    snprintf(key, sizeof(key), "%.*s", (int) strcspn(header + 19, "\r"), header + 19);
+  }
+  guint8 digest[20];
+  gsize digest_len = sizeof(digest);
+  GChecksum * sha1 = g_checksum_new(G_CHECKSUM_SHA1);
+  g_checksum_update(sha1, (const guchar * ) key, strlen(key));
+  g_checksum_update(sha1, (const guchar * ) "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36);
+  g_checksum_get_digest(sha1, digest, & digest_len);
+  g_checksum_free(sha1);
+  gchar * accept = g_base64_encode(digest, digest_len);
+  char response[256];
+  snprintf(response, sizeof(response), "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+    "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+  g_free(accept);
+  send(fd, response, strlen(response), MSG_NOSIGNAL);
+  return true;
+}
+
+// Serve one connection until either side hangs up or the case ends
+static void sio_serve(int fd, int connection) {
+  enum sio_behaviour behaviour = sio.behaviour[connection];
+  if (!sio_upgrade(fd, connection)) {
+    return;
+  }
+  char open[160];
+  snprintf(open, sizeof(open), "0{\"sid\":\"fake%d\",\"upgrades\":[],\"pingInterval\":%d,\"pingTimeout\":%d,\"maxPayload\":1000000}",
+    connection, FAKE_SIO_PING_INTERVAL_MS, FAKE_SIO_PING_TIMEOUT_MS);
+  send_text(fd, behaviour, open);
+
+  gint64 accepted_us = g_get_monotonic_time();
+  gint64 connected_us = 0; // When the namespace connect was acknowledged
+  gint64 next_ping_us = accepted_us + FAKE_SIO_PING_INTERVAL_MS * 1000LL;
+  bool closing = false;
+  unsigned char buffer[4096];
+  size_t have = 0;
+  while (!atomic_load( & sio.stop)) {
+    gint64 now = g_get_monotonic_time();
+    bool pinging = behaviour != SIO_STOPS_PINGING || now - accepted_us < FAKE_SIO_PINGS_FOR_MS * 1000LL;
+    if (pinging && !closing && now >= next_ping_us) {
+      send_text(fd, behaviour, "2");
+      next_ping_us += FAKE_SIO_PING_INTERVAL_MS * 1000LL;
+    }
+    if (connected_us != 0 && !closing) {
+      gint64 since_ms = (now - connected_us) / 1000;
+      if (behaviour == SIO_HANG_UP && since_ms >= FAKE_SIO_HANG_UP_MS) {
+        return;
+      } else if (behaviour == SIO_DISCONNECT && since_ms >= FAKE_SIO_CLOSE_MS) {
+        send_text(fd, behaviour, "41");
+        closing = true;
+      } else if (behaviour == SIO_CLOSE_FRAME && since_ms >= FAKE_SIO_CLOSE_MS) {
+        send_frame(fd, 0x8, true, "\x03\xe9", 2); // 1001, going away
+        closing = true;
+      }
+    }
+
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll( & pfd, 1, 10) <= 0) {
+      continue;
+    }
+    ssize_t n = recv(fd, buffer + have, sizeof(buffer) - have, 0);
+    if (n <= 0) {
+      return;
+    }
+    have += n;
+    // Client frames are masked and never fragmented by websocket.c
+    while (have >= 6) {
+      int opcode = buffer[0] & 0x0F;
+      size_t len = buffer[1] & 0x7F;
+      size_t h = 2;
+      if (len == 126) {
+        len = (buffer[2] << 8) | buffer[3];
+        h = 4;
+      }
+      if (have < h + 4 + len) {
+        break;
+      }
+      const unsigned char * mask = buffer + h;
+      char * payload = (char * ) buffer + h + 4;
+      for (size_t i = 0; i < len; i++) {
+        payload[i] ^= mask[i & 3];
+      }
+      if (opcode == 0x1) {
+        sio_log(connection, payload, len);
+        if (strncmp(payload, "40", 2) == 0 && connected_us == 0) {
+          send_text(fd, behaviour, "40{\"sid\":\"fake-namespace\"}");
+          connected_us = g_get_monotonic_time();
+        }
+      } else if (opcode == 0xA) {
+        sio_log(connection, "<pong>", 6);
+      } else if (opcode == 0x8) {
+        sio_log(connection, "<close>", 7);
+        return;
+      }
+      have -= h + 4 + len;
+      memmove(buffer, buffer + h + 4 + len, have);
+    }
+  }
+}
+
+static void * sio_thread(void * arg) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, & one, sizeof(one));
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(sio.port) };
+  inet_pton(AF_INET, FAKE_SIO_HOST, & addr.sin_addr);
+  if (bind(listener, (struct sockaddr * ) & addr, sizeof(addr)) < 0 || listen(listener, 4) < 0) {
+    perror("Fake Socket.IO server");
+    close(listener);
+    atomic_store( & sio.listening, true); // Nothing to wait for, the case fails on its checks
+    return NULL;
+  }
+  atomic_store( & sio.listening, true);
+  for (int i = 0; i < sio.connections && !atomic_load( & sio.stop); ) {
+    struct pollfd pfd = { listener, POLLIN, 0 };
+    if (poll( & pfd, 1, 20) <= 0) {
+      continue;
+    }
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+    pthread_mutex_lock( & sio.lock);
+    sio.accepted_ms[sio.n_accepted++] = elapsed_ms();
+    pthread_mutex_unlock( & sio.lock);
+    sio_serve(fd, i++);
+    close(fd);
+  }
+  close(listener);
+  return NULL;
+}
+
+// Start the stand-in with one behaviour per connection it will accept
+static void sio_start(int port, int connections, const enum sio_behaviour * behaviour) {
+  sio.port = port;
+  sio.connections = connections;
+  memcpy(sio.behaviour, behaviour, connections * sizeof(behaviour[0]));
+  sio.n_log = 0;
+  sio.n_accepted = 0;
+  atomic_store( & sio.stop, false);
+  atomic_store( & sio.listening, false);
+  start_us = g_get_monotonic_time();
+  pthread_create( & sio.thread, NULL, sio_thread, NULL);
+  while (!atomic_load( & sio.listening)) {
+    sleep_ms(1);
+  }
+}
+
+static void sio_stop(void) {
+  atomic_store( & sio.stop, true);
+  pthread_join(sio.thread, NULL);
+}
+
+static int sio_accepted(void) {
+  pthread_mutex_lock( & sio.lock);
+  int n = sio.n_accepted;
+  pthread_mutex_unlock( & sio.lock);
+  return n;
+}
+
+// How many messages connection (or any, for -1) received that start with prefix and contain part (may be NULL)
+static int sio_count(int connection, const char * prefix, const char * part) {
+  int n = 0;
+  pthread_mutex_lock( & sio.lock);
+  for (int i = 0; i < sio.n_log; i++) {
+    const char * text = sio.log[i].text;
+    if ((connection < 0 || sio.log[i].connection == connection) && strncmp(text, prefix, strlen(prefix)) == 0 &&
+        (part == NULL || strstr(text, part) != NULL)) {
+      n++;
+    }
+  }
+  pthread_mutex_unlock( & sio.lock);
+  return n;
+}
+
+// Index in the log of the first message on connection starting with prefix, -1 if none
+static int sio_find(int connection, const char * prefix) {
+  int found = -1;
+  pthread_mutex_lock( & sio.lock);
+  for (int i = 0; i < sio.n_log && found < 0; i++) {
+    if (sio.log[i].connection == connection && strncmp(sio.log[i].text, prefix, strlen(prefix)) == 0) {
+      found = i;
+    }
+  }
+  pthread_mutex_unlock( & sio.lock);
+  return found;
+}
+
+static gboolean on_run_done(gpointer data) {
+  g_main_loop_quit(loop);
+  return G_SOURCE_REMOVE;
+}
+
+// Run the main loop until ms after the start of the case
+static void run_until(int ms) {
+  double wait_ms = ms - elapsed_ms();
+  if (wait_ms > 0) {
+    g_timeout_add((guint) wait_ms, on_run_done, NULL);
+    g_main_loop_run(loop);
+  }
+}
+
+static void open_client(int port) {
+  static const struct reporter_station station = { "N0CALL", "AA00aa", "freedv_ptt test" };
+  char url[64];
+  snprintf(url, sizeof(url), "ws://%s:%d/", FAKE_SIO_HOST, port);
+  reporter_client_tx("700D", false);
+  reporter_client_freq(14236000);
+  reporter_client_message("testing");
+  reporter_client_open(url, & station);
+}
+
+#define CHECK(condition) do { \
+  if (!(condition)) { \
+    fprintf(stderr, "  check failed: %s\n", #condition); \
+    ok = false; \
+  } \
+} while (0)
+
+// Upgrade to the Engine.IO path, connect with our auth, then the whole snapshot; later changes are debounced
+static bool test_handshake(int port) {
+  bool ok = true;
+  const enum sio_behaviour script[] = { SIO_NORMAL };
+  sio_start(port, 1, script);
+  open_client(port);
+  run_until(500);
+  CHECK(sio_count(0, "GET /socket.io/?EIO=4&transport=websocket ", NULL) == 1);
+  CHECK(sio_count(0, "40{\"callsign\":\"N0CALL\",\"grid_square\":\"AA00aa\"", "\"role\":\"report_wo\"") == 1);
+  CHECK(reporter_client_connected());
+  CHECK(sio_count(0, "42[\"tx_report\"", "\"mode\":\"700D\",\"transmitting\":false") == 1);
+  CHECK(sio_count(0, "42[\"freq_change\"", "14236000") == 1);
+  CHECK(sio_count(0, "42[\"message_update\"", "testing") == 1);
+  reporter_client_rx("K1ABC", "700D", 7);
+  reporter_client_freq(7100000);
+  reporter_client_freq(7177000);
+  run_until(500 + REPORTER_DEBOUNCE_MS + 300);
+  CHECK(sio_count(0, "42[\"rx_report\"", "\"callsign\":\"K1ABC\",\"mode\":\"700D\",\"snr\":7") == 1);
+  CHECK(sio_count(0, "42[\"freq_change\"", NULL) == 2);
+  CHECK(sio_count(0, "42[\"freq_change\"", "7177000") == 1);
+  CHECK(sio_count(0, "42[\"tx_report\"", NULL) == 1);
+  reporter_client_close();
+  sio_stop();
+  return ok;
+}
+
+// Pings are answered; once they stop the connection is dropped after pingInterval + pingTimeout, not before
+static bool test_ping_pong_watchdog(int port) {
+  bool ok = true;
+  const enum sio_behaviour script[] = { SIO_STOPS_PINGING, SIO_NORMAL };
+  sio_start(port, 2, script);
+  open_client(port);
+  int quiet_ms = FAKE_SIO_PINGS_FOR_MS - FAKE_SIO_PING_INTERVAL_MS / 2; // About when the last ping went out
+  run_until(quiet_ms + FAKE_SIO_PING_INTERVAL_MS + FAKE_SIO_PING_TIMEOUT_MS - 100);
+  CHECK(sio_count(0, "3", NULL) >= FAKE_SIO_PINGS_FOR_MS / FAKE_SIO_PING_INTERVAL_MS - 1);
+  CHECK(sio_accepted() == 1);
+  CHECK(reporter_client_connected());
+  run_until(quiet_ms + FAKE_SIO_PING_INTERVAL_MS + FAKE_SIO_PING_TIMEOUT_MS + 300);
+  CHECK(!reporter_client_connected());
+  CHECK(sio_count(0, "<close>", NULL) == 1);
+  run_until(quiet_ms + FAKE_SIO_PING_INTERVAL_MS + FAKE_SIO_PING_TIMEOUT_MS + REPORTER_BACKOFF_MIN_MS * 5 / 4 + 800);
+  CHECK(sio_accepted() == 2);
+  CHECK(reporter_client_connected());
+  reporter_client_close();
+  sio_stop();
+  return ok;
+}
+
+// The server drops the connection: the new one gets the full snapshot as it is now, then what was heard meanwhile
+static bool test_reconnect_replays_snapshot(int port) {
+  bool ok = true;
+  const enum sio_behaviour script[] = { SIO_HANG_UP, SIO_NORMAL };
+  sio_start(port, 2, script);
+  open_client(port);
+  run_until(FAKE_SIO_HANG_UP_MS + 400);
+  CHECK(!reporter_client_connected());
+  CHECK(sio_accepted() == 1);
+  reporter_client_message("changed while offline");
+  reporter_client_rx("K1ABC", "700D", 3);
+  reporter_client_rx("K1ABC", "700D", 9); // Only the newest report of a station is kept
+  run_until(FAKE_SIO_HANG_UP_MS + REPORTER_BACKOFF_MIN_MS * 5 / 4 + REPORTER_DEBOUNCE_MS + 800);
+  CHECK(sio_accepted() == 2);
+  CHECK(reporter_client_connected());
+  CHECK(sio_count(1, "42[\"tx_report\"", "700D") == 1);
+  CHECK(sio_count(1, "42[\"freq_change\"", "14236000") == 1);
+  CHECK(sio_count(1, "42[\"message_update\"", "changed while offline") == 1);
+  CHECK(sio_count(1, "42[\"message_update\"", NULL) == 1);
+  CHECK(sio_count(1, "42[\"rx_report\"", "\"snr\":9") == 1);
+  CHECK(sio_count(1, "42[\"rx_report\"", NULL) == 1);
+  CHECK(sio_find(1, "42[\"tx_report\"") >= 0 && sio_find(1, "42[\"tx_report\"") < sio_find(1, "42[\"rx_report\""));
+  reporter_client_close();
+  sio_stop();
+  return ok;
+}
+
+// Messages in fragments, with a ping between them that must be answered on its own
+static bool test_fragmented_frames(int port) {
+  bool ok = true;
+  const enum sio_behaviour script[] = { SIO_FRAGMENTED };
+  sio_start(port, 1, script);
+  open_client(port);
+  run_until(1000);
+  CHECK(reporter_client_connected());
+  CHECK(sio_count(0, "40{", NULL) == 1);
+  CHECK(sio_count(0, "42[\"tx_report\"", NULL) == 1);
+  CHECK(sio_count(0, "3", NULL) >= 2);
+  CHECK(sio_count(0, "<pong>", NULL) >= 4);
+  reporter_client_close();
+  sio_stop();
+  return ok;
+}
+
+// A Socket.IO disconnect and a WebSocket close frame both end the session and are followed by a reconnect
+static bool test_server_close(int port) {
+  bool ok = true;
+  const enum sio_behaviour script[] = { SIO_DISCONNECT, SIO_CLOSE_FRAME, SIO_NORMAL };
+  sio_start(port, 3, script);
+  open_client(port);
+  run_until(FAKE_SIO_CLOSE_MS + 300);
+  CHECK(!reporter_client_connected());
+  CHECK(sio_count(0, "<close>", NULL) == 1);
+  int second_ms = FAKE_SIO_CLOSE_MS + 300 + REPORTER_BACKOFF_MIN_MS * 5 / 4;
+  run_until(second_ms + FAKE_SIO_CLOSE_MS + 300);
+  CHECK(sio_accepted() == 2);
+  CHECK(!reporter_client_connected());
+  CHECK(sio_count(1, "<close>", NULL) == 1);
+  run_until(second_ms + FAKE_SIO_CLOSE_MS + 300 + REPORTER_BACKOFF_MIN_MS * 5 / 4 + 300);
+  CHECK(sio_accepted() == 3);
+  CHECK(reporter_client_connected());
+  CHECK(sio_count(2, "42[\"tx_report\"", NULL) == 1);
+  reporter_client_close();
+  sio_stop();
+  return ok;
+}
+
+static gboolean on_measure_poll(gpointer data) {
+  if (reporter_client_connected()) {
+    g_main_loop_quit(loop);
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// VmRSS or VmHWM of this process in kB
+static long status_kb(const char * key) {
+  char line[128];
+  long kb = -1;
+  FILE * file = fopen("/proc/self/status", "r");
+  while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, key, strlen(key)) == 0) {
+      kb = atol(line + strlen(key) + 1);
+    }
+  }
+  if (file != NULL) {
+    fclose(file);
+  }
+  return kb;
+}
+
+// Time to connected and memory, with the stand-in on a thread of this process
+static int measure(void) {
+  const enum sio_behaviour script[] = { SIO_NORMAL };
+  sio_start(FAKE_SIO_PORT, 1, script);
+  long before_kb = status_kb("VmRSS:");
+  gint64 t0 = g_get_monotonic_time();
+  open_client(FAKE_SIO_PORT);
+  g_timeout_add(1, on_measure_poll, NULL);
+  g_timeout_add(WS_CONNECT_TIMEOUT_MS, on_run_done, NULL);
+  g_main_loop_run(loop);
+  double connect_ms = (g_get_monotonic_time() - t0) / 1000.0;
+  bool connected = reporter_client_connected();
+  printf("{\"client\":\"reporter_client.c\",\"connected\":%s,\"time_to_connected_ms\":%.1f,"
+    "\"rss_before_kb\":%ld,\"rss_kb\":%ld,\"hwm_kb\":%ld}\n", connected ? "true" : "false", connect_ms,
+    before_kb, status_kb("VmRSS:"), status_kb("VmHWM:"));
+  reporter_client_close();
+  sio_stop();
+  return connected ? 0 : 1;
+}
+
+// The stand-in alone, for clients in other processes
+static int serve(int port) {
+  const enum sio_behaviour script[] = { SIO_NORMAL, SIO_NORMAL, SIO_NORMAL, SIO_NORMAL };
+  sio_start(port, FAKE_SIO_MAX_CONNECTIONS, script);
+  printf("Stand-in FreeDV Reporter on ws://%s:%d/\n", FAKE_SIO_HOST, port);
+  pthread_join(sio.thread, NULL);
+  return 0;
+}
+
+int main(int argc, char * argv[]) {
+  static const struct {
+    const char * name;
+    bool ( * run)(int port);
+  } tests[] = {
+    { "handshake", test_handshake },
+    { "ping_pong_watchdog", test_ping_pong_watchdog },
+    { "reconnect_replays_snapshot", test_reconnect_replays_snapshot },
+    { "fragmented_frames", test_fragmented_frames },
+    { "server_close", test_server_close },
+  };
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  loop = g_main_loop_new(NULL, FALSE);
+  pthread_mutex_init( & sio.lock, NULL);
+  if (argc > 1 && strcmp(argv[1], "--measure") == 0) {
+    return measure();
+  } else if (argc > 2 && strcmp(argv[1], "--serve") == 0) {
+    return serve(atoi(argv[2]));
+  }
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    printf("%s:\n", tests[i].name);
+    bool ok = tests[i].run(FAKE_SIO_PORT + (int) i);
+    printf("%s: %s\n", tests[i].name, ok ? "ok" : "FAILED");
+    failed += !ok;
+  }
+  g_main_loop_unref(loop);
+  printf("%d of %d failed\n", failed, (int)(sizeof(tests) / sizeof(tests[0])));
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+/*
+ * rig_state.c
+ *
+ * Description:
+ * Diff-only tuning for the sBitx. Every channel change used to send the
+ * frequency, the mode, PITCH, LOW and HIGH whether or not they changed, and the
+ * mode was picked by strstr() matching on the frequency string. The channel
+ * table below carries the sideband and passband of each channel instead, and
+ * rig_state_tune() only queues the commands whose value differs from what the
+ * radio was last told. Hopping between channels of the same band is then a
+ * single "f" command.
+ *
+ * The built-in channels are copied into a table that channels_file can add to,
+ * sorted by frequency so a scan changes band (and so sideband) as rarely as
+ * possible.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "rig_state.h"
+#include "telnet_queue.h"
+
+static const struct rig_channel builtin_channels[] = {
+  // sBitx doesnt really support 160 or 60 meters
+  { "80 Meters", 3625000, "LSB", 1500, 900, 2100 },
+  { "80 Meters", 3643000, "LSB", 1500, 900, 2100 },
+  { "80 Meters", 3693000, "LSB", 1500, 900, 2100 },
+  { "80 Meters", 3697000, "LSB", 1500, 900, 2100 },
+  { "80 Meters", 3850000, "LSB", 1500, 900, 2100 },
+  { "40 Meters", 7177000, "LSB", 1500, 900, 2100 },
+  { "40 Meters", 7197000, "LSB", 1500, 900, 2100 },
+  { "20 Meters", 14236000, "DIGITAL", 1500, 900, 2100 },
+  { "20 Meters", 14240000, "DIGITAL", 1500, 900, 2100 },
+  { "17 Meters", 18118000, "DIGITAL", 1500, 900, 2100 },
+  { "15 Meters", 21313000, "DIGITAL", 1500, 900, 2100 },
+  { "12 Meters", 24933000, "DIGITAL", 1500, 900, 2100 },
+  { "10 Meters", 28330000, "DIGITAL", 1500, 900, 2100 },
+  { "10 Meters", 28720000, "DIGITAL", 1500, 900, 2100 }
+};
+
+static struct rig_channel channels[RIG_CHANNELS_MAX];
+static int channel_count = -1; // -1 until the built-in channels have been copied
+
+static struct rig_state state = { RIG_UNKNOWN, "", RIG_UNKNOWN, RIG_UNKNOWN, RIG_UNKNOWN };
+
+static void use_builtin_channels(void) {
+  if (channel_count < 0) {
+    channel_count = sizeof(builtin_channels) / sizeof(builtin_channels[0]);
+    memcpy(channels, builtin_channels, sizeof(builtin_channels));
+  }
+}
+
+static int compare_channels(const void * a, const void * b) {
+  const struct rig_channel * x = a, * y = b;
+  return (x->freq_hz > y->freq_hz) - (x->freq_hz < y->freq_hz);
+}
+
+// Band menu group of a channel given without one
+static void band_name(int freq_hz, char * band, size_t size) {
+  static const struct { int low_khz, high_khz, meters; } bands[] = {
+    { 1800, 2000, 160 }, { 3500, 4000, 80 }, { 5250, 5450, 60 }, { 7000, 7300, 40 }, { 10100, 10150, 30 },
+    { 14000, 14350, 20 }, { 18068, 18168, 17 }, { 21000, 21450, 15 }, { 24890, 24990, 12 }, { 28000, 29700, 10 }
+  };
+  for (size_t i = 0; i < sizeof(bands) / sizeof(bands[0]); i++) {
+    if (freq_hz >= bands[i].low_khz * 1000 && freq_hz <= bands[i].high_khz * 1000) {
+      snprintf(band, size, "%d Meters", bands[i].meters);
+      return;
+    }
+  }
+  snprintf(band, size, "Other");
+}
+
+// Parse "<freq_hz> <mode> [<pitch> <low> <high>] [band]", false if the line is not a channel
+static bool parse_channel(const char * line, struct rig_channel * channel, const struct rig_channel * defaults) {
+  int consumed = 0;
+  * channel = * defaults;
+  if (sscanf(line, "%d %15s %n", & channel->freq_hz, channel->mode, & consumed) < 2 || channel->freq_hz <= 0) {
+    return false;
+  }
+  if (strcmp(channel->mode, "LSB") != 0 && strcmp(channel->mode, "USB") != 0 && strcmp(channel->mode, "DIGITAL") != 0) {
+    return false;
+  }
+  line += consumed;
+  if (sscanf(line, "%d %d %d %n", & channel->pitch_hz, & channel->low_hz, & channel->high_hz, & consumed) == 3) {
+    line += consumed;
+  } else {
+    channel->pitch_hz = defaults->pitch_hz;
+    channel->low_hz = defaults->low_hz;
+    channel->high_hz = defaults->high_hz;
+  }
+  size_t len = strcspn(line, "\r\n");
+  if (len == 0) {
+    band_name(channel->freq_hz, channel->band, sizeof(channel->band));
+  } else {
+    snprintf(channel->band, sizeof(channel->band), "%.*s", (int) len, line);
+  }
+  return channel->low_hz < channel->high_hz;
+}
+
+int rig_channels_load(const char * path) {
+  use_builtin_channels();
+  FILE * file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  char line[256];
+  int line_no = 0, loaded = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line_no++;
+    const char * p = line + strspn(line, " \t");
+    if ( * p == '#' || * p == '\n' || * p == '\r' || * p == '\0') {
+      continue;
+    }
+    struct rig_channel channel;
+    if (!parse_channel(p, & channel, & builtin_channels[0])) {
+      fprintf(stderr, "%s:%d: not a channel, expected <freq_hz> <LSB|USB|DIGITAL> [<pitch> <low> <high>] [band]\n", path, line_no);
+      continue;
+    }
+    struct rig_channel * existing = (struct rig_channel * ) rig_channel_find(channel.freq_hz);
+    if (existing != NULL) {
+      * existing = channel;
+    } else if (channel_count < RIG_CHANNELS_MAX) {
+      channels[channel_count++] = channel;
+    } else {
+      fprintf(stderr, "%s:%d: more than %d channels, ignored\n", path, line_no, RIG_CHANNELS_MAX);
+      continue;
+    }
+    loaded++;
+  }
+  fclose(file);
+  qsort(channels, channel_count, sizeof(channels[0]), compare_channels);
+  printf("Read %d channel%s from %s, %d in the table\n", loaded, loaded == 1 ? "" : "s", path, channel_count);
+  return loaded;
+}
+
+int rig_channel_count(void) {
+  use_builtin_channels();
+  return channel_count;
+}
+
+const struct rig_channel * rig_channel_get(int index) {
+  use_builtin_channels();
+  return index >= 0 && index < channel_count ? & channels[index] : NULL;
+}
+
+const struct rig_channel * rig_channel_find(int freq_hz) {
+  use_builtin_channels();
+  for (int i = 0; i < channel_count; i++) {
+    if (channels[i].freq_hz == freq_hz) {
+      return & channels[i];
+    }
+  }
+  return NULL;
+}
+
+const struct rig_channel * rig_channel_default(void) {
+  return rig_channel_find(14236000);
+}
+
+// Queue "<name> <value>" if the value differs from the cached one
+static int set_if_changed(int * cached, int value, const char * name) {
+  char command[32];
+  if ( * cached == value) {
+    return 0;
+  }
+  snprintf(command, sizeof(command), "%s %d", name, value);
+  telnet_queue_send(command);
+  * cached = value;
+  return 1;
+}
+
+int rig_state_tune(const struct rig_channel * channel) {
+  char command[32];
+  int sent = 0;
+
+  if (state.freq_hz != channel->freq_hz) {
+    // The sBitx takes whole kHz or Hz on the "f" command
+    if (channel->freq_hz % 1000 == 0) {
+      snprintf(command, sizeof(command), "f %d", channel->freq_hz / 1000);
+    } else {
+      snprintf(command, sizeof(command), "f %d", channel->freq_hz);
+    }
+    telnet_queue_send(command);
+    state.freq_hz = channel->freq_hz;
+    sent++;
+  }
+
+  if (strcmp(state.mode, channel->mode) != 0) {
+    snprintf(command, sizeof(command), "m %s", channel->mode);
+    telnet_queue_send(command);
+    snprintf(state.mode, sizeof(state.mode), "%s", channel->mode);
+    sent++;
+    // A mode change on the sBitx can bring its own pitch and passband, so those are resent
+    state.pitch_hz = RIG_UNKNOWN;
+    state.low_hz = RIG_UNKNOWN;
+    state.high_hz = RIG_UNKNOWN;
+  }
+
+  sent += set_if_changed( & state.pitch_hz, channel->pitch_hz, "PITCH");
+  sent += set_if_changed( & state.low_hz, channel->low_hz, "LOW");
+  sent += set_if_changed( & state.high_hz, channel->high_hz, "HIGH");
+
+  printf("Tuning to %d Hz %s: %d command%s\n", channel->freq_hz, channel->mode, sent, sent == 1 ? "" : "s");
+  return sent;
+}
+
+void rig_state_invalidate(void) {
+  state.freq_hz = RIG_UNKNOWN;
+  state.mode[0] = '\0';
+  state.pitch_hz = RIG_UNKNOWN;
+  state.low_hz = RIG_UNKNOWN;
+  state.high_hz = RIG_UNKNOWN;
+}
+
+const struct rig_state * rig_state_get(void) {
+  return & state;
+}
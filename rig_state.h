@@ -0,0 +1,68 @@
+/*
+ * rig_state.h
+ *
+ * Description:
+ * Cached model of the sBitx settings we control over the telnet port, plus the
+ * table of FreeDV channels offered in the band menu and scanned by SCAN. Tuning
+ * compares the wanted settings with the cached ones and only sends the commands
+ * that differ.
+ *
+ * The table starts with the built-in channels and can be extended from a text
+ * file (channels_file in config.ini), one channel per line:
+ *
+ *   <freq_hz> <LSB|USB|DIGITAL> [<pitch_hz> <low_hz> <high_hz>] [band name]
+ *
+ * e.g. "5403500 USB 1500 900 2100 60 Meters". A line for a frequency already
+ * in the table replaces that channel; without a band name the channel goes
+ * under the amateur band it is in. Blank lines and lines starting with #
+ * are skipped; the table is kept in frequency order.
+ */
+#ifndef RIG_STATE_H
+#define RIG_STATE_H
+
+#define RIG_UNKNOWN -1
+#define RIG_CHANNELS_MAX 64
+#define RIG_CHANNELS_DEFAULT_FILE "channels.txt"
+
+// One FreeDV channel with the sideband and filter settings it needs
+struct rig_channel {
+  char band[24];      // Band menu group, e.g. "40 Meters"
+  int freq_hz;
+  char mode[16];      // sBitx mode, "LSB", "USB" or "DIGITAL"
+  int pitch_hz;
+  int low_hz;         // Passband lower shoulder
+  int high_hz;        // Passband upper shoulder
+};
+
+// What the radio was last told, RIG_UNKNOWN / "" where we don't know
+struct rig_state {
+  int freq_hz;
+  char mode[16];
+  int pitch_hz;
+  int low_hz;
+  int high_hz;
+};
+
+// Add the channels in path to the built-in ones, returns how many were read or -1 if the file cannot be opened
+int rig_channels_load(const char * path);
+
+int rig_channel_count(void);
+
+// Channel at index in frequency order, NULL past the end
+const struct rig_channel * rig_channel_get(int index);
+
+// Look up a channel by frequency, NULL if it is not in the table
+const struct rig_channel * rig_channel_find(int freq_hz);
+
+// Settings used for frequencies that are not in the table
+const struct rig_channel * rig_channel_default(void);
+
+// Send only the commands needed to put the radio on the channel, returns how many were queued
+int rig_state_tune(const struct rig_channel * channel);
+
+// Forget the cached state so the next tune sends everything (e.g. after a reconnect)
+void rig_state_invalidate(void);
+
+const struct rig_state * rig_state_get(void);
+
+#endif
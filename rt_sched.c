@@ -0,0 +1,94 @@
+/*
+ * rt_sched.c
+ *
+ * Description:
+ * mlockall with MCL_FUTURE makes every later allocation fail once the memlock
+ * limit is reached, so it is only attempted when the limit is unlimited or the
+ * process runs as root, which is not held to it. Priorities
+ * are clamped to what SCHED_FIFO accepts and a core that does not exist is
+ * ignored rather than failing the whole pin.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "rt_sched.h"
+
+bool rt_lock_memory(void) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_MEMLOCK, & limit) == 0 && limit.rlim_cur != RLIM_INFINITY && geteuid() != 0) {
+    printf("Memory not locked: memlock limit is %llu kB, it needs to be unlimited (ulimit -l)\n",
+      (unsigned long long) limit.rlim_cur / 1024);
+    return false;
+  }
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+    printf("Memory not locked: mlockall: %s\n", strerror(errno));
+    return false;
+  }
+  printf("Memory locked\n");
+  return true;
+}
+
+// True when cpu is a core this process may run on
+static bool cpu_usable(int cpu) {
+  long count = sysconf(_SC_NPROCESSORS_CONF);
+  if (cpu < 0 || cpu >= count || cpu >= CPU_SETSIZE) {
+    printf("CPU %d does not exist (%ld cores), audio threads not pinned\n", cpu, count);
+    return false;
+  }
+  return true;
+}
+
+void rt_avoid_cpu(int cpu) {
+  if (cpu == RT_CPU_ANY || !cpu_usable(cpu)) {
+    return;
+  }
+  cpu_set_t set;
+  if (pthread_getaffinity_np(pthread_self(), sizeof(set), & set) != 0) {
+    return;
+  }
+  CPU_CLR(cpu, & set);
+  if (CPU_COUNT( & set) == 0) {
+    printf("CPU %d is the only core available, the main loop shares it with the audio threads\n", cpu);
+    return;
+  }
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), & set);
+  if (err != 0) {
+    printf("Could not keep the main loop off CPU %d: %s\n", cpu, strerror(err));
+  }
+}
+
+void rt_setup_thread(const char * name, int priority, int cpu) {
+  bool pinned = false;
+  if (cpu != RT_CPU_ANY && cpu_usable(cpu)) {
+    cpu_set_t set;
+    CPU_ZERO( & set);
+    CPU_SET(cpu, & set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), & set);
+    if (err != 0) {
+      printf("%s thread not pinned to CPU %d: %s\n", name, cpu, strerror(err));
+    }
+    pinned = err == 0;
+  }
+
+  if (priority == RT_PRIORITY_OFF) {
+    return;
+  }
+  int min = sched_get_priority_min(SCHED_FIFO);
+  int max = sched_get_priority_max(SCHED_FIFO);
+  struct sched_param param = { .sched_priority = priority < min ? min : (priority > max ? max : priority) };
+  int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, & param);
+  if (err == EPERM) {
+    printf("%s thread left at normal priority: no permission for SCHED_FIFO %d (needs CAP_SYS_NICE or an rtprio limit)\n",
+      name, param.sched_priority);
+  } else if (err != 0) {
+    printf("%s thread left at normal priority: %s\n", name, strerror(err));
+  } else {
+    printf("%s thread running SCHED_FIFO %d%s\n", name, param.sched_priority, pinned ? " (pinned)" : "");
+  }
+}
@@ -0,0 +1,37 @@
+/*
+ * rt_sched.h
+ *
+ * Description:
+ * Optional real-time setup for the audio path on a busy Pi: SCHED_FIFO for the
+ * audio threads, mlockall for the process and pinning the audio threads to one
+ * core while everything else stays off it. Every step is best effort; when the
+ * permission is missing it logs what was skipped and why, and the program runs
+ * on with normal scheduling.
+ *
+ * SCHED_FIFO needs root, CAP_SYS_NICE or an rtprio limit, e.g. in
+ * /etc/security/limits.conf:  pi - rtprio 90  and  pi - memlock unlimited
+ */
+#ifndef RT_SCHED_H
+#define RT_SCHED_H
+
+#include <stdbool.h>
+
+#define RT_PRIORITY_OFF 0
+#define RT_CPU_ANY -1
+
+struct rt_settings {
+  int priority;      // SCHED_FIFO priority for the capture threads, RT_PRIORITY_OFF for normal scheduling
+  int cpu;           // Core for the audio threads, RT_CPU_ANY to leave them unpinned
+  bool lock_memory;  // mlockall the process so audio never waits on a page fault
+};
+
+// Lock current and future memory if the memlock limit allows it, returns true when locked
+bool rt_lock_memory(void);
+
+// Keep the calling thread, and threads it creates later, off the audio core
+void rt_avoid_cpu(int cpu);
+
+// Apply priority and cpu to the calling thread, name is only for the log
+void rt_setup_thread(const char * name, int priority, int cpu);
+
+#endif
@@ -0,0 +1,473 @@
+/*
+ * rx_fanout.c
+ *
+ * Description:
+ * Channelizer: a Hilbert FIR turns the real capture into an analytic signal
+ * once per round, then every channel multiplies it by its own complex
+ * oscillator and keeps the real part, which moves the spectrum down by the
+ * channel offset without an image. A channel at offset 0 is the capture as is.
+ *
+ * Worker pool: every channel/mode demodulator is a job. A round is: channelize
+ * the new samples into each channel's buffer, reset the job counter, post the
+ * go semaphore once per worker, take jobs on the calling thread as well, then
+ * wait on the done semaphore once per worker. Jobs are taken with an atomic
+ * increment, so the load spreads over however many cores there are. Channel
+ * buffers are only written between rounds, while no worker is running, so
+ * during a round they are read-only for everyone. Samples every mode of a
+ * channel has consumed are dropped from the front at the end of the round.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "rx_fanout.h"
+#include "rt_sched.h"
+#include "trace.h"
+
+#define RX_FANOUT_RATE 8000
+#define HILBERT_TAPS 63             // Odd, the delay (HILBERT_TAPS - 1) / 2 must be odd too
+#define HILBERT_DELAY ((HILBERT_TAPS - 1) / 2)
+
+struct rx_channel;
+
+struct rx_decoder {
+  struct rx_channel * channel;
+  struct modem * modem;
+  int pos;                      // Next sample of the channel buffer for this modem
+  short * speech;               // Speech decoded in the current round
+  int speech_len;
+  int speech_size;
+  int frames;                   // Modem frames finished in the current round
+  struct modem_rx_stats stats;  // After the last finished frame
+  unsigned int callsigns_taken; // modem->rx_callsign_count at the last rx_fanout_take_stats
+};
+
+struct rx_channel {
+  int offset_hz;
+  double osc_re, osc_im;        // Oscillator phase as a unit vector
+  double step_re, step_im;      // Rotation per sample
+  short * capture;              // Channel audio, only written between rounds
+  int capture_len;
+  int capture_size;
+  struct rx_decoder * decoders; // This channel's modes
+  int count;
+  int playing;                  // Mode whose speech is used, -1 before any has synced
+};
+
+struct rx_fanout {
+  struct rx_channel channels[RX_FANOUT_MAX_CHANNELS];
+  int n_channels;
+  struct rx_decoder decoders[RX_FANOUT_MAX_CHANNELS * RX_FANOUT_MAX_MODES];
+  int n_decoders;
+  float hilbert[HILBERT_TAPS];
+  float * history;              // Last HILBERT_TAPS - 1 input samples followed by the new ones
+  float * analytic_im;          // Hilbert output for the new samples
+  int selected;                 // Channel chosen by the user or RX_CHANNEL_AUTO
+  int playing;                  // Channel whose speech is played, -1 before any has synced
+  int priority;
+  pthread_t workers[RX_FANOUT_MAX_WORKERS];
+  int n_workers;
+  atomic_int next_job;
+  atomic_bool closing;
+  sem_t go;
+  sem_t done;
+};
+
+// Demodulate every whole frame of the channel buffer past this decoder's position. A frame
+// without speech gives nin samples of silence instead, so the output keeps pace with the input.
+static void decoder_run(struct rx_decoder * d) {
+  struct rx_channel * c = d->channel;
+  d->frames = 0;
+  d->speech_len = 0;
+  int nin;
+  while (c->capture_len - d->pos >= (nin = modem_rx_nin(d->modem)) &&
+      d->speech_len + d->modem->n_speech + nin <= d->speech_size) {
+    int nout = modem_rx_frame(d->modem, d->speech + d->speech_len, c->capture + d->pos);
+    if (nout == 0) {
+      nout = nin;
+      memset(d->speech + d->speech_len, 0, nout * sizeof(short));
+    }
+    d->speech_len += nout;
+    d->pos += nin;
+    d->frames++;
+  }
+  if (d->frames > 0) {
+    modem_get_rx_stats(d->modem, & d->stats);
+  }
+}
+
+// Take jobs until there are none left in this round
+static void run_jobs(struct rx_fanout * f) {
+  int job;
+  while ((job = atomic_fetch_add( & f->next_job, 1)) < f->n_decoders) {
+    decoder_run( & f->decoders[job]);
+  }
+}
+
+static void * worker_thread(void * arg) {
+  struct rx_fanout * f = arg;
+  trace_set_thread_name("RX worker");
+  rt_setup_thread("RX worker", f->priority, RT_CPU_ANY);
+  for (;;) {
+    sem_wait( & f->go);
+    if (atomic_load( & f->closing)) {
+      break;
+    }
+    run_jobs(f);
+    sem_post( & f->done);
+  }
+  return NULL;
+}
+
+// Hamming windowed ideal Hilbert transformer: 2 / (pi n) at odd n from the centre, zero at even n
+static void hilbert_init(float * taps) {
+  for (int i = 0; i < HILBERT_TAPS; i++) {
+    int n = i - HILBERT_DELAY;
+    float window = 0.54f - 0.46f * cosf(2.0f * (float) M_PI * i / (HILBERT_TAPS - 1));
+    taps[i] = n % 2 != 0 ? window * 2.0f / ((float) M_PI * n) : 0.0f;
+  }
+}
+
+// Shift n new samples by every channel's offset and append them to the channel buffers
+static void channelize(struct rx_fanout * f, const short * in, int n) {
+  bool shifted = false;
+  for (int i = 0; i < f->n_channels; i++) {
+    shifted |= f->channels[i].offset_hz != 0;
+  }
+  float * x = f->history + HILBERT_TAPS - 1;
+  if (shifted) {
+    for (int k = 0; k < n; k++) {
+      x[k] = in[k];
+    }
+    // With an odd delay the non-zero taps are the even ones
+    for (int k = 0; k < n; k++) {
+      float acc = 0;
+      for (int t = 0; t < HILBERT_TAPS; t += 2) {
+        acc += f->hilbert[t] * x[k - t];
+      }
+      f->analytic_im[k] = acc;
+    }
+  }
+
+  for (int i = 0; i < f->n_channels; i++) {
+    struct rx_channel * c = & f->channels[i];
+    short * out = c->capture + c->capture_len;
+    if (c->offset_hz == 0) {
+      memcpy(out, in, n * sizeof(short));
+    } else {
+      // Re{(I + jQ) e^-jwt} with I delayed to line up with the Hilbert output
+      const float * re = x - HILBERT_DELAY;
+      for (int k = 0; k < n; k++) {
+        double y = re[k] * c->osc_re + f->analytic_im[k] * c->osc_im;
+        out[k] = (short) (y > 32767 ? 32767 : (y < -32768 ? -32768 : y));
+        double next_re = c->osc_re * c->step_re - c->osc_im * c->step_im;
+        c->osc_im = c->osc_re * c->step_im + c->osc_im * c->step_re;
+        c->osc_re = next_re;
+      }
+      // Keep the oscillator on the unit circle
+      double norm = sqrt(c->osc_re * c->osc_re + c->osc_im * c->osc_im);
+      c->osc_re /= norm;
+      c->osc_im /= norm;
+    }
+    c->capture_len += n;
+  }
+
+  if (shifted) {
+    memmove(f->history, f->history + n, (HILBERT_TAPS - 1) * sizeof(float));
+  }
+}
+
+// Split a comma separated list into at most max entries, returns how many
+static int split_list(const char * text, char items[][8], int max) {
+  char list[128];
+  snprintf(list, sizeof(list), "%s", text);
+  char * saveptr;
+  int n = 0;
+  for (char * item = strtok_r(list, ", ", & saveptr); item != NULL; item = strtok_r(NULL, ", ", & saveptr)) {
+    if (n == max) {
+      fprintf(stderr, "Only %d RX modes or channels are used, ignoring %s\n", max, item);
+      continue;
+    }
+    snprintf(items[n++], 8, "%s", item);
+  }
+  return n;
+}
+
+struct rx_fanout * rx_fanout_open(const char * modes, const char * channels, int workers, int squelch_level, int priority) {
+  struct rx_fanout * f = calloc(1, sizeof(struct rx_fanout));
+  if (f == NULL) {
+    perror("Failed to allocate RX fanout");
+    return NULL;
+  }
+  f->selected = RX_CHANNEL_AUTO;
+  f->playing = -1;
+  f->priority = priority;
+  sem_init( & f->go, 0, 0);
+  sem_init( & f->done, 0, 0);
+  hilbert_init(f->hilbert);
+  if (channels[0] == '\0') {
+    channels = "0";
+  }
+
+  char mode_names[RX_FANOUT_MAX_MODES][8];
+  char offsets[RX_FANOUT_MAX_CHANNELS][8];
+  int n_modes = split_list(modes, mode_names, RX_FANOUT_MAX_MODES);
+  int n_offsets = split_list(channels, offsets, RX_FANOUT_MAX_CHANNELS);
+
+  for (int i = 0; i < n_offsets; i++) {
+    struct rx_channel * c = & f->channels[f->n_channels];
+    c->offset_hz = atoi(offsets[i]);
+    c->osc_re = 1.0;
+    c->step_re = cos(2.0 * M_PI * c->offset_hz / RX_FANOUT_RATE);
+    c->step_im = sin(2.0 * M_PI * c->offset_hz / RX_FANOUT_RATE);
+    c->decoders = & f->decoders[f->n_decoders];
+    c->playing = -1;
+    int max_nin = 0;
+    for (int j = 0; j < n_modes; j++) {
+      struct rx_decoder * d = & f->decoders[f->n_decoders];
+      d->channel = c;
+      d->modem = modem_open_rx(mode_names[j], squelch_level);
+      if (d->modem == NULL) {
+        continue;
+      }
+      // Speech comes out at about the rate modem samples go in, allow for a full buffer plus a frame
+      d->speech_size = 2 * (RX_FANOUT_MAX_INPUT + d->modem->n_max_modem) + d->modem->n_speech;
+      d->speech = malloc(d->speech_size * sizeof(short));
+      if (d->speech == NULL) {
+        modem_close(d->modem);
+        d->modem = NULL;
+        continue;
+      }
+      if (d->modem->n_max_modem > max_nin) {
+        max_nin = d->modem->n_max_modem;
+      }
+      f->n_decoders++;
+      c->count++;
+    }
+    if (c->count == 0) {
+      continue;
+    }
+    // Room for a round of new samples on top of the most any modem can have left over
+    c->capture_size = RX_FANOUT_MAX_INPUT + max_nin;
+    c->capture = malloc(c->capture_size * sizeof(short));
+    f->n_channels++;
+    if (c->capture == NULL) {
+      perror("Failed to allocate RX channel buffer");
+      rx_fanout_close(f);
+      return NULL;
+    }
+  }
+  f->history = calloc(HILBERT_TAPS - 1 + RX_FANOUT_MAX_INPUT, sizeof(float));
+  f->analytic_im = calloc(RX_FANOUT_MAX_INPUT, sizeof(float));
+  if (f->n_decoders == 0 || f->history == NULL || f->analytic_im == NULL) {
+    fprintf(stderr, "Failed to set up RX decoding of \"%s\"\n", modes);
+    rx_fanout_close(f);
+    return NULL;
+  }
+
+  // The calling thread takes jobs too, more workers than the other jobs would only sleep
+  if (workers > f->n_decoders - 1) {
+    workers = f->n_decoders - 1;
+  }
+  if (workers > RX_FANOUT_MAX_WORKERS) {
+    workers = RX_FANOUT_MAX_WORKERS;
+  }
+  for (int i = 0; i < workers; i++) {
+    if (pthread_create( & f->workers[i], NULL, worker_thread, f) != 0) {
+      perror("Failed to start RX worker thread");
+      break;
+    }
+    f->n_workers++;
+  }
+  printf("RX decoding %s in %d channel%s (%s Hz) with %d worker thread%s\n", modes, f->n_channels,
+    f->n_channels == 1 ? "" : "s", channels, f->n_workers, f->n_workers == 1 ? "" : "s");
+  return f;
+}
+
+int rx_fanout_channel_count(struct rx_fanout * f) {
+  return f->n_channels;
+}
+
+void rx_fanout_set_squelch(struct rx_fanout * f, int squelch_level) {
+  for (int i = 0; i < f->n_decoders; i++) {
+    if (f->decoders[i].modem->squelch_level != squelch_level) {
+      modem_set_squelch(f->decoders[i].modem, squelch_level);
+    }
+  }
+}
+
+void rx_fanout_select_channel(struct rx_fanout * f, int channel) {
+  f->selected = channel >= 0 && channel < f->n_channels ? channel : RX_CHANNEL_AUTO;
+}
+
+void rx_fanout_reset(struct rx_fanout * f) {
+  for (int i = 0; i < f->n_channels; i++) {
+    struct rx_channel * c = & f->channels[i];
+    c->capture_len = 0;
+    c->playing = -1;
+  }
+  for (int i = 0; i < f->n_decoders; i++) {
+    struct rx_decoder * d = & f->decoders[i];
+    modem_rx_reset(d->modem);
+    d->pos = 0;
+    d->frames = 0;
+    d->speech_len = 0;
+    memset( & d->stats, 0, sizeof(d->stats));
+    d->stats.mode = d->modem->mode;
+    d->callsigns_taken = d->modem->rx_callsign_count;
+  }
+  f->playing = -1;
+}
+
+// Of n candidates, the one with sync and the best SNR, staying with playing unless another is RX_FANOUT_SWITCH_DB better
+static int choose(const struct modem_rx_stats * const * stats, int n, int playing) {
+  int best = -1;
+  for (int i = 0; i < n; i++) {
+    if (stats[i]->sync && (best < 0 || stats[i]->snr_db > stats[best]->snr_db)) {
+      best = i;
+    }
+  }
+  if (best < 0) {
+    return playing; // Nobody in sync, keep the last one so its squelched output and stats carry on
+  }
+  if (playing >= 0 && best != playing && stats[playing]->sync &&
+      stats[best]->snr_db < stats[playing]->snr_db + RX_FANOUT_SWITCH_DB) {
+    return playing;
+  }
+  return best;
+}
+
+// Decoder of a channel whose stats and speech are used
+static struct rx_decoder * channel_decoder(struct rx_channel * c) {
+  return & c->decoders[c->playing >= 0 ? c->playing : 0];
+}
+
+int rx_fanout_process(struct rx_fanout * f, const short * modem_in, int n, short * speech_out, int max) {
+  if (n > RX_FANOUT_MAX_INPUT) {
+    n = RX_FANOUT_MAX_INPUT;
+  }
+  for (int i = 0; i < f->n_channels; i++) {
+    struct rx_channel * c = & f->channels[i];
+    if (n > c->capture_size - c->capture_len) {
+      n = c->capture_size - c->capture_len; // Only if a modem stopped consuming, never in normal running
+    }
+  }
+  channelize(f, modem_in, n);
+
+  atomic_store( & f->next_job, 0);
+  for (int i = 0; i < f->n_workers; i++) {
+    sem_post( & f->go);
+  }
+  run_jobs(f);
+  for (int i = 0; i < f->n_workers; i++) {
+    sem_wait( & f->done);
+  }
+
+  // Best mode in each channel, then the channel to play
+  const struct modem_rx_stats * candidates[RX_FANOUT_MAX_CHANNELS * RX_FANOUT_MAX_MODES];
+  for (int i = 0; i < f->n_channels; i++) {
+    struct rx_channel * c = & f->channels[i];
+    for (int j = 0; j < c->count; j++) {
+      candidates[j] = & c->decoders[j].stats;
+    }
+    int chosen = choose(candidates, c->count, c->playing);
+    if (chosen != c->playing) {
+      printf("RX channel %+d Hz mode detected: %s (SNR %.1f dB)\n", c->offset_hz,
+        modem_mode_name(c->decoders[chosen].modem->mode), c->decoders[chosen].stats.snr_db);
+      TRACE_INSTANT("RX mode switch");
+      c->playing = chosen;
+    }
+  }
+  int playing = f->selected;
+  if (playing == RX_CHANNEL_AUTO) {
+    for (int i = 0; i < f->n_channels; i++) {
+      candidates[i] = & channel_decoder( & f->channels[i])->stats;
+    }
+    playing = choose(candidates, f->n_channels, f->playing);
+  }
+  if (playing != f->playing && playing >= 0) {
+    printf("RX playing channel %+d Hz\n", f->channels[playing].offset_hz);
+    f->playing = playing;
+  }
+
+  struct rx_decoder * d = channel_decoder( & f->channels[f->playing >= 0 ? f->playing : 0]);
+  int nout = d->speech_len < max ? d->speech_len : max;
+  memcpy(speech_out, d->speech, nout * sizeof(short));
+
+  // Drop what every mode of a channel has consumed
+  for (int i = 0; i < f->n_channels; i++) {
+    struct rx_channel * c = & f->channels[i];
+    int consumed = c->capture_len;
+    for (int j = 0; j < c->count; j++) {
+      if (c->decoders[j].pos < consumed) {
+        consumed = c->decoders[j].pos;
+      }
+    }
+    if (consumed > 0) {
+      memmove(c->capture, c->capture + consumed, (c->capture_len - consumed) * sizeof(short));
+      c->capture_len -= consumed;
+      for (int j = 0; j < c->count; j++) {
+        c->decoders[j].pos -= consumed;
+      }
+    }
+  }
+  return nout;
+}
+
+int rx_fanout_take_stats(struct rx_fanout * f, struct rx_channel_stats * stats, int max) {
+  int n = 0;
+  for (int i = 0; i < f->n_channels && n < max; i++) {
+    struct rx_decoder * d = channel_decoder( & f->channels[i]);
+    if (d->frames == 0) {
+      continue;
+    }
+    struct rx_channel_stats * s = & stats[n++];
+    s->channel = i;
+    s->offset_hz = f->channels[i].offset_hz;
+    s->playing = i == (f->playing >= 0 ? f->playing : 0);
+    s->modem = d->stats;
+    snprintf(s->callsign, sizeof(s->callsign), "%s", d->modem->rx_callsign);
+
+    // Any mode of the channel may have received a callsign this round, not only the one played
+    s->callsign_heard = false;
+    for (int j = 0; j < f->channels[i].count; j++) {
+      struct rx_decoder * e = & f->channels[i].decoders[j];
+      if (e->modem->rx_callsign_count != e->callsigns_taken) {
+        e->callsigns_taken = e->modem->rx_callsign_count;
+        s->callsign_heard = true;
+        s->callsign_mode = e->modem->mode;
+        s->callsign_snr_db = e->stats.snr_db;
+        snprintf(s->callsign, sizeof(s->callsign), "%s", e->modem->rx_callsign);
+      }
+    }
+  }
+  return n;
+}
+
+void rx_fanout_close(struct rx_fanout * f) {
+  if (f == NULL) {
+    return;
+  }
+  atomic_store( & f->closing, true);
+  for (int i = 0; i < f->n_workers; i++) {
+    sem_post( & f->go);
+  }
+  for (int i = 0; i < f->n_workers; i++) {
+    pthread_join(f->workers[i], NULL);
+  }
+  for (int i = 0; i < f->n_decoders; i++) {
+    modem_close(f->decoders[i].modem);
+    free(f->decoders[i].speech);
+  }
+  for (int i = 0; i < f->n_channels; i++) {
+    free(f->channels[i].capture);
+  }
+  sem_destroy( & f->go);
+  sem_destroy( & f->done);
+  free(f->history);
+  free(f->analytic_im);
+  free(f);
+}
@@ -0,0 +1,76 @@
+/*
+ * rx_fanout.h
+ *
+ * Description:
+ * Decodes the RX passband as several channels, each with several FreeDV modes
+ * (700C, 700D and 700E by default), so stations are heard whichever mode they
+ * call in and several stations a few hundred Hz apart are heard at once.
+ *
+ * A channelizer makes one copy of the capture per channel, shifted so that the
+ * channel's offset lands on the modem centre frequency. Every channel/mode pair
+ * has its own demodulator; a pool of worker threads runs all of them on each
+ * round of new samples, each reading its channel's shared buffer from its own
+ * position without copying or locking.
+ *
+ * Within a channel the mode that has sync with the best SNR wins; a different
+ * mode only takes over when it is clearly better, so two modes that both sync do
+ * not flip back and forth. The channel played is either picked the same way
+ * across channels or chosen by the user.
+ */
+#ifndef RX_FANOUT_H
+#define RX_FANOUT_H
+
+#include <stdbool.h>
+#include "modem.h"
+
+#define RX_FANOUT_MAX_MODES 3
+#define RX_FANOUT_MAX_CHANNELS 8
+#define RX_FANOUT_MAX_WORKERS 8
+#define RX_FANOUT_MAX_INPUT 4000    // Most capture samples per rx_fanout_process call
+#define RX_FANOUT_SWITCH_DB 3.0f    // SNR advantage a mode or channel needs to take over from the one playing
+#define RX_CHANNEL_AUTO -1          // Play the channel with the best signal
+
+// State of one channel after a round
+struct rx_channel_stats {
+  int channel;                 // Index in the channel list
+  int offset_hz;               // From the modem centre frequency
+  bool playing;                // This channel's audio goes to the headset
+  char callsign[16];           // Last callsign received as reliable text, empty if none yet
+  bool callsign_heard;         // callsign was received (again) since the last rx_fanout_take_stats
+  int callsign_mode;           // FREEDV_MODE_xxx that received it, when callsign_heard
+  float callsign_snr_db;       // SNR of that mode at the time
+  struct modem_rx_stats modem; // Of the mode chosen in this channel
+};
+
+struct rx_fanout;
+
+// Open one RX modem per mode in the comma separated list for every channel offset (in Hz,
+// comma separated, e.g. "-300,0,300") and a pool of worker threads to run them. The
+// calling thread of rx_fanout_process works too. Workers get SCHED_FIFO priority when it
+// is not RT_PRIORITY_OFF.
+struct rx_fanout * rx_fanout_open(const char * modes, const char * channels, int workers, int squelch_level, int priority);
+
+int rx_fanout_channel_count(struct rx_fanout * f);
+
+// Change the squelch of every modem, call between rounds from the processing thread
+void rx_fanout_set_squelch(struct rx_fanout * f, int squelch_level);
+
+// Play channel, or RX_CHANNEL_AUTO, call between rounds from the processing thread
+void rx_fanout_select_channel(struct rx_fanout * f, int channel);
+
+// Forget every channel's buffered audio, sync and chosen mode, e.g. after the radio was retuned.
+// Call between rounds from the processing thread.
+void rx_fanout_reset(struct rx_fanout * f);
+
+// Demodulate n new samples in every channel and mode, at most RX_FANOUT_MAX_INPUT. Copies
+// up to max speech samples of the channel being played to speech_out and returns how many;
+// 0 until its mode has a whole modem frame, silence while it has nothing to say.
+int rx_fanout_process(struct rx_fanout * f, const short * modem_in, int n, short * speech_out, int max);
+
+// State of each channel that finished a modem frame in the last round, returns how many
+int rx_fanout_take_stats(struct rx_fanout * f, struct rx_channel_stats * stats, int max);
+
+// Stop the threads and close the modems
+void rx_fanout_close(struct rx_fanout * f);
+
+#endif
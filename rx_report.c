@@ -0,0 +1,141 @@
+/*
+ * rx_report.c
+ *
+ * Description:
+ * Reports wait in a small queue with at most one entry per callsign; hearing a
+ * queued callsign again only updates its mode and SNR. The time each callsign
+ * was last sent is kept in a hash table, which also drops what has gone stale.
+ * A one-shot timer sends the head of the queue once RX_REPORT_INTERVAL_MS has
+ * passed since the previous report, so nothing is woken while the queue is
+ * empty.
+ *
+ * Sent as the rx_report event of the FreeDV Reporter protocol, see
+ * reporter_client.h.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <glib.h>
+#include "rx_report.h"
+#include "reporter_client.h"
+
+struct rx_report_entry {
+  char callsign[16];
+  char mode[8];
+  int snr_db;
+};
+
+static struct {
+  GQueue queue;
+  GHashTable * sent;  // Callsign -> g_get_monotonic_time() it was last reported
+  gint64 last_sent;   // Any callsign
+  guint timer;
+} rr;
+
+static void schedule(void);
+
+static void send_next(void) {
+  struct rx_report_entry * entry = g_queue_pop_head( & rr.queue);
+  reporter_client_rx(entry->callsign, entry->mode, entry->snr_db);
+  rr.last_sent = g_get_monotonic_time();
+  gint64 * sent = g_new(gint64, 1);
+  * sent = rr.last_sent;
+  g_hash_table_insert(rr.sent, g_strdup(entry->callsign), sent);
+  g_free(entry);
+}
+
+static gboolean on_timer(gpointer data) {
+  rr.timer = 0;
+  send_next();
+  schedule();
+  return G_SOURCE_REMOVE;
+}
+
+// Send now if the interval has passed, otherwise when it does
+static void schedule(void) {
+  if (rr.timer != 0 || g_queue_is_empty( & rr.queue)) {
+    return;
+  }
+  gint64 wait_us = rr.last_sent + RX_REPORT_INTERVAL_MS * 1000LL - g_get_monotonic_time();
+  if (rr.last_sent == 0 || wait_us <= 0) {
+    send_next();
+    wait_us = RX_REPORT_INTERVAL_MS * 1000LL;
+    if (g_queue_is_empty( & rr.queue)) {
+      return;
+    }
+  }
+  rr.timer = g_timeout_add(wait_us / 1000 + 1, on_timer, NULL);
+}
+
+static gboolean is_stale(gpointer key, gpointer value, gpointer now) {
+  return * (gint64 * ) now - * (gint64 * ) value >= RX_REPORT_REPEAT_S * G_USEC_PER_SEC;
+}
+
+// Reliable text is a few characters of A-Z, 0-9 and /; anything else is not worth reporting
+static bool clean_callsign(const char * in, char * out, size_t size) {
+  size_t n = 0;
+  for (; in[n] != '\0'; n++) {
+    if (n + 1 >= size || !(isalnum((unsigned char) in[n]) || in[n] == '/')) {
+      return false;
+    }
+    out[n] = toupper((unsigned char) in[n]);
+  }
+  out[n] = '\0';
+  return n > 0;
+}
+
+void rx_report_open(void) {
+  g_queue_init( & rr.queue);
+  rr.sent = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  rr.last_sent = 0;
+}
+
+void rx_report_heard(const char * callsign, const char * mode, float snr_db) {
+  char call[16];
+  if (rr.sent == NULL || !clean_callsign(callsign, call, sizeof(call))) {
+    return;
+  }
+
+  // Still waiting to go out, the newer decode replaces it in place
+  for (GList * l = rr.queue.head; l != NULL; l = l->next) {
+    struct rx_report_entry * queued = l->data;
+    if (strcmp(queued->callsign, call) == 0) {
+      snprintf(queued->mode, sizeof(queued->mode), "%s", mode);
+      queued->snr_db = (int) lroundf(snr_db);
+      return;
+    }
+  }
+
+  gint64 now = g_get_monotonic_time();
+  g_hash_table_foreach_remove(rr.sent, is_stale, & now);
+  if (g_hash_table_contains(rr.sent, call)) {
+    return; // Reported less than RX_REPORT_REPEAT_S ago
+  }
+
+  if (g_queue_get_length( & rr.queue) >= RX_REPORT_QUEUE_MAX) {
+    struct rx_report_entry * oldest = g_queue_pop_head( & rr.queue);
+    fprintf(stderr, "RX report queue full, dropped: %s\n", oldest->callsign);
+    g_free(oldest);
+  }
+  struct rx_report_entry * entry = g_new0(struct rx_report_entry, 1);
+  snprintf(entry->callsign, sizeof(entry->callsign), "%s", call);
+  snprintf(entry->mode, sizeof(entry->mode), "%s", mode);
+  entry->snr_db = (int) lroundf(snr_db);
+  g_queue_push_tail( & rr.queue, entry);
+  printf("Heard %s in %s at %d dB SNR\n", entry->callsign, entry->mode, entry->snr_db);
+  schedule();
+}
+
+void rx_report_close(void) {
+  if (rr.timer != 0) {
+    g_source_remove(rr.timer);
+    rr.timer = 0;
+  }
+  g_queue_clear_full( & rr.queue, g_free);
+  if (rr.sent != NULL) {
+    g_hash_table_destroy(rr.sent);
+    rr.sent = NULL;
+  }
+}
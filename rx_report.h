@@ -0,0 +1,25 @@
+/*
+ * rx_report.h
+ *
+ * Description:
+ * Tells FreeDV Reporter which stations we hear. Every callsign decoded as
+ * reliable text is handed in as it arrives; a station that keeps calling is
+ * reported once per RX_REPORT_REPEAT_S, and reports leave for the reporter at
+ * most one per RX_REPORT_INTERVAL_MS, so a busy net cannot flood the server.
+ * Runs on the GLib main loop, like reporter_client.
+ */
+#ifndef RX_REPORT_H
+#define RX_REPORT_H
+
+#define RX_REPORT_REPEAT_S 30        // Same callsign reported again at most this often
+#define RX_REPORT_INTERVAL_MS 1000   // Spacing between any two reports
+#define RX_REPORT_QUEUE_MAX 16
+
+void rx_report_open(void);
+
+// A callsign was received in mode (e.g. "700D") at snr_db
+void rx_report_heard(const char * callsign, const char * mode, float snr_db);
+
+void rx_report_close(void);
+
+#endif
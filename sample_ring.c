@@ -0,0 +1,143 @@
+/*
+ * sample_ring.c
+ *
+ * Description:
+ * head and tail are running sample counts that never wrap in practice (64 bits
+ * at 8 kHz), so fill is head - tail and a position in the buffer is the count
+ * modulo the capacity. The producer publishes with a release store of head after
+ * writing the samples and the consumer releases space with a release store of
+ * tail after reading them. Each side keeps a cached copy of the other's index
+ * and only reloads it (touching the other side's cache line) when the cached
+ * value says there is not enough room or data.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sample_ring.h"
+
+int sample_ring_init(struct sample_ring * r, int frame_samples, int frames) {
+  memset(r, 0, sizeof( * r));
+  r->frame_samples = frame_samples;
+  r->capacity = frame_samples * frames;
+  size_t bytes = (size_t) r->capacity * sizeof(short);
+  bytes = (bytes + SAMPLE_RING_CACHE_LINE - 1) / SAMPLE_RING_CACHE_LINE * SAMPLE_RING_CACHE_LINE;
+  r->buf = aligned_alloc(SAMPLE_RING_CACHE_LINE, bytes);
+  if (r->buf == NULL) {
+    perror("Failed to allocate sample ring");
+    return -1;
+  }
+  memset(r->buf, 0, bytes); // Touch every page now rather than in the audio threads
+  return 0;
+}
+
+void sample_ring_destroy(struct sample_ring * r) {
+  free(r->buf);
+  r->buf = NULL;
+}
+
+int sample_ring_reserve(struct sample_ring * r, short ** ptr, int n) {
+  uint64_t head = atomic_load_explicit( & r->head, memory_order_relaxed);
+  if (head - r->tail_cache + n > (uint64_t) r->capacity) {
+    r->tail_cache = atomic_load_explicit( & r->tail, memory_order_acquire);
+  }
+  int space = r->capacity - (int) (head - r->tail_cache);
+  int offset = (int) (head % r->capacity);
+  int contiguous = r->capacity - offset;
+  if (n > space) {
+    n = space;
+  }
+  if (n > contiguous) {
+    n = contiguous;
+  }
+  * ptr = r->buf + offset;
+  return n;
+}
+
+void sample_ring_commit(struct sample_ring * r, int n) {
+  uint64_t head = atomic_load_explicit( & r->head, memory_order_relaxed) + n;
+  atomic_store_explicit( & r->head, head, memory_order_release);
+  int fill = (int) (head - r->tail_cache); // tail only grows, so this is an upper bound
+  if (fill > atomic_load_explicit( & r->high_water, memory_order_relaxed)) {
+    atomic_store_explicit( & r->high_water, fill, memory_order_relaxed);
+  }
+}
+
+int sample_ring_write(struct sample_ring * r, const short * samples, int n) {
+  int written = 0;
+  while (written < n) {
+    short * ptr;
+    int chunk = sample_ring_reserve(r, & ptr, n - written);
+    if (chunk == 0) {
+      break;
+    }
+    memcpy(ptr, samples + written, chunk * sizeof(short));
+    sample_ring_commit(r, chunk);
+    written += chunk;
+  }
+  if (written < n) {
+    sample_ring_overrun(r, n - written);
+  }
+  return written;
+}
+
+void sample_ring_overrun(struct sample_ring * r, int n) {
+  atomic_fetch_add_explicit( & r->overruns, (uint64_t) n, memory_order_relaxed);
+}
+
+int sample_ring_available(struct sample_ring * r) {
+  uint64_t tail = atomic_load_explicit( & r->tail, memory_order_relaxed);
+  r->head_cache = atomic_load_explicit( & r->head, memory_order_acquire);
+  return (int) (r->head_cache - tail);
+}
+
+int sample_ring_peek(struct sample_ring * r, const short ** ptr, int n) {
+  uint64_t tail = atomic_load_explicit( & r->tail, memory_order_relaxed);
+  if (r->head_cache - tail < (uint64_t) n) {
+    r->head_cache = atomic_load_explicit( & r->head, memory_order_acquire);
+  }
+  int queued = (int) (r->head_cache - tail);
+  int offset = (int) (tail % r->capacity);
+  int contiguous = r->capacity - offset;
+  if (n > queued) {
+    n = queued;
+  }
+  if (n > contiguous) {
+    n = contiguous;
+  }
+  * ptr = r->buf + offset;
+  return n;
+}
+
+void sample_ring_release(struct sample_ring * r, int n) {
+  uint64_t tail = atomic_load_explicit( & r->tail, memory_order_relaxed);
+  atomic_store_explicit( & r->tail, tail + n, memory_order_release);
+}
+
+int sample_ring_read(struct sample_ring * r, short * samples, int n) {
+  if (n > r->capacity || sample_ring_available(r) < n) {
+    return 0;
+  }
+  int done = 0;
+  while (done < n) {
+    const short * ptr;
+    int chunk = sample_ring_peek(r, & ptr, n - done);
+    memcpy(samples + done, ptr, chunk * sizeof(short));
+    sample_ring_release(r, chunk);
+    done += chunk;
+  }
+  return n;
+}
+
+void sample_ring_underrun(struct sample_ring * r) {
+  atomic_fetch_add_explicit( & r->underruns, 1, memory_order_relaxed);
+}
+
+void sample_ring_get_stats(struct sample_ring * r, struct sample_ring_stats * stats) {
+  uint64_t tail = atomic_load_explicit( & r->tail, memory_order_acquire);
+  uint64_t head = atomic_load_explicit( & r->head, memory_order_acquire);
+  stats->capacity = r->capacity;
+  stats->fill = head > tail ? (int) (head - tail) : 0;
+  stats->high_water = atomic_load_explicit( & r->high_water, memory_order_relaxed);
+  stats->overruns = atomic_load_explicit( & r->overruns, memory_order_relaxed);
+  stats->underruns = atomic_load_explicit( & r->underruns, memory_order_relaxed);
+}
@@ -0,0 +1,80 @@
+/*
+ * sample_ring.h
+ *
+ * Description:
+ * Lock-free single-producer single-consumer ring of S16 samples for handing
+ * audio between the engine threads without blocking or allocating. The
+ * capacity is a whole number of modem frames, and the producer and consumer
+ * indices sit on separate cache lines so the two threads do not share a line
+ * they both write.
+ *
+ * Both sides can work in place: the producer reserves contiguous space, fills
+ * it (e.g. with snd_pcm_readi) and commits it; the consumer peeks at contiguous
+ * samples and releases them. sample_ring_write/sample_ring_read copy for callers
+ * that do not care.
+ *
+ * Each ring counts overruns (samples the producer had to drop because the ring
+ * was full), underruns (reported by the consumer when it was starved) and the
+ * highest fill level seen, which the engine shows in the GUI and the log.
+ */
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define SAMPLE_RING_CACHE_LINE 64
+
+struct sample_ring_stats {
+  int capacity;        // Samples
+  int fill;            // Samples queued right now
+  int high_water;      // Most samples ever queued
+  uint64_t overruns;   // Samples dropped by the producer
+  uint64_t underruns;  // Times the consumer was starved
+};
+
+struct sample_ring {
+  // Written by the producer only
+  _Alignas(SAMPLE_RING_CACHE_LINE) _Atomic uint64_t head; // Total samples committed
+  uint64_t tail_cache;                                     // Producer's last view of tail
+  _Atomic int high_water;
+  _Atomic uint64_t overruns;
+
+  // Written by the consumer only
+  _Alignas(SAMPLE_RING_CACHE_LINE) _Atomic uint64_t tail; // Total samples released
+  uint64_t head_cache;                                     // Consumer's last view of head
+  _Atomic uint64_t underruns;
+
+  _Alignas(SAMPLE_RING_CACHE_LINE) short * buf;
+  int capacity;
+  int frame_samples;
+};
+
+// Allocate a ring of frames * frame_samples samples, returns 0 or -1
+int sample_ring_init(struct sample_ring * r, int frame_samples, int frames);
+void sample_ring_destroy(struct sample_ring * r);
+
+// Producer: get up to n contiguous free samples at * ptr, returns how many (0 when full)
+int sample_ring_reserve(struct sample_ring * r, short ** ptr, int n);
+// Producer: publish n samples written at the pointer from the last reserve
+void sample_ring_commit(struct sample_ring * r, int n);
+// Producer: copy in as many of n samples as fit, counting the rest as overrun
+int sample_ring_write(struct sample_ring * r, const short * samples, int n);
+// Producer: count n samples that were dropped without going through the ring
+void sample_ring_overrun(struct sample_ring * r, int n);
+
+// Consumer: samples queued right now
+int sample_ring_available(struct sample_ring * r);
+// Consumer: get up to n contiguous queued samples at * ptr, returns how many
+int sample_ring_peek(struct sample_ring * r, const short ** ptr, int n);
+// Consumer: give back n samples from the last peek
+void sample_ring_release(struct sample_ring * r, int n);
+// Consumer: copy out exactly n samples, returns n, or 0 leaving the ring untouched if fewer are queued
+int sample_ring_read(struct sample_ring * r, short * samples, int n);
+// Consumer: count a time the consumer needed samples that had not arrived
+void sample_ring_underrun(struct sample_ring * r);
+
+// Counters and fill level, callable from any thread
+void sample_ring_get_stats(struct sample_ring * r, struct sample_ring_stats * stats);
+
+#endif
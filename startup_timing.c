@@ -0,0 +1,83 @@
+/*
+ * startup_timing.c
+ *
+ * Description:
+ * Startup breakdown, printed as e.g.
+ *
+ *   Startup timing (ms since start, time since previous stage):
+ *     config loaded                  2.1     +2.1
+ *     window shown                  95.4    +93.3
+ *     ...
+ *
+ * Stages are recorded from the GTK thread only.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <glib.h>
+#include "startup_timing.h"
+
+struct startup_stage {
+  const char * name;
+  gint64 at_us;
+};
+
+static struct {
+  gint64 begin_us;
+  int expected;
+  int count;
+  bool reported;
+  guint deadline_timer;
+  struct startup_stage stages[STARTUP_STAGES_MAX];
+} st;
+
+static gboolean on_deadline(gpointer data) {
+  st.deadline_timer = 0;
+  startup_timing_report();
+  return G_SOURCE_REMOVE;
+}
+
+void startup_timing_begin(int expected) {
+  st.begin_us = g_get_monotonic_time();
+  st.expected = expected;
+  st.deadline_timer = g_timeout_add_seconds(STARTUP_REPORT_DEADLINE_S, on_deadline, NULL);
+}
+
+void startup_mark(const char * stage) {
+  if (st.reported || st.count == STARTUP_STAGES_MAX) {
+    return;
+  }
+  for (int i = 0; i < st.count; i++) {
+    if (strcmp(st.stages[i].name, stage) == 0) {
+      return;
+    }
+  }
+  st.stages[st.count].name = stage;
+  st.stages[st.count].at_us = g_get_monotonic_time();
+  st.count++;
+  if (st.count == st.expected) {
+    startup_timing_report();
+  }
+}
+
+void startup_timing_report(void) {
+  if (st.reported) {
+    return;
+  }
+  st.reported = true;
+  if (st.deadline_timer != 0) {
+    g_source_remove(st.deadline_timer);
+    st.deadline_timer = 0;
+  }
+
+  printf("Startup timing (ms since start, time since previous stage):\n");
+  gint64 previous_us = st.begin_us;
+  for (int i = 0; i < st.count; i++) {
+    printf("  %-28s %8.1f %+8.1f\n", st.stages[i].name,
+      (st.stages[i].at_us - st.begin_us) / 1000.0, (st.stages[i].at_us - previous_us) / 1000.0);
+    previous_us = st.stages[i].at_us;
+  }
+  if (st.count < st.expected) {
+    printf("  (%d of %d stages reached within %d s)\n", st.count, st.expected, STARTUP_REPORT_DEADLINE_S);
+  }
+}
@@ -0,0 +1,24 @@
+/*
+ * startup_timing.h
+ *
+ * Description:
+ * Records how long each startup stage took, measured from the start of the
+ * process, and prints them as one table once every stage has been reached (or
+ * the deadline passes) so a slow startup shows which stage regressed.
+ */
+#ifndef STARTUP_TIMING_H
+#define STARTUP_TIMING_H
+
+#define STARTUP_STAGES_MAX 16
+#define STARTUP_REPORT_DEADLINE_S 15 // Print whatever has been reached by then
+
+// Start the clock, expected is the number of stages that complete startup
+void startup_timing_begin(int expected);
+
+// Record that a stage has been reached, repeated stages are ignored
+void startup_mark(const char * stage);
+
+// Print the breakdown now, later marks are ignored
+void startup_timing_report(void);
+
+#endif
@@ -0,0 +1,775 @@
+/*
+ * station.c
+ *
+ * Description:
+ * The station logic that used to live in the GTK callbacks of freedv_ptt2.46.c,
+ * with the same behaviour: TX selects the warm audio path before keying, RX
+ * keeps the radio keyed until the TX tail has played out, a reconnect to the
+ * radio puts it back on the current channel and the reporter hears about every
+ * PTT and frequency change and every callsign we receive (see rx_report.c).
+ * What the window used to read from the engine directly now goes out as
+ * events: RX modem stats CONTROL_RX_EVENT_HZ times a second and the audio ring
+ * counters every CONTROL_RING_EVENT_MS.
+ *
+ * SCAN steps through the channel table (see rig_state.h), staying scan_dwell_ms
+ * on each, and stops on the first channel where a demodulator gets sync. A hop
+ * is one "f" command within a band, and the RX audio queued from the previous
+ * channel is dropped with the demodulator sync, so the dwell is spent listening
+ * to the new channel only. The reporter is told the frequency once the scan
+ * stops, not on every hop.
+ *
+ * The headset and sBitx sound cards are looked up by name at startup (see
+ * audio_devices.h), and a card configured by number is stored back by its ALSA
+ * id so that it is still found after being renumbered. Cards coming and going
+ * are passed on to the audio engine, which reopens whatever it has lost; STATE
+ * names the devices that are missing meanwhile.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "station.h"
+#include "control_protocol.h"
+#include "audio_engine.h"
+#include "audio_devices.h"
+#include "telnet_queue.h"
+#include "rig_state.h"
+#include "hamlib_client.h"
+#include "reporter_client.h"
+#include "rx_report.h"
+#include "config_store.h"
+#include "startup_timing.h"
+#include "trace.h"
+
+#define SERVER_IP "127.0.0.1"
+#define SERVER_PORT 4532
+#define TELNET_PORT 8081
+#define PLAYBACK_LATENCY_MS 400 // Default ALSA playback buffer, lower it once the audio threads run SCHED_FIFO
+#define PLAYBACK_LATENCY_MIN_MS 20
+#define HEADSET_DEVICE "CARD=5,DEV=0" // Where the devices used to be hard-coded, stored by id once found
+#define SBITX_TX_DEVICE "CARD=2,DEV=0"
+#define SBITX_RX_DEVICE "CARD=1,DEV=1"
+#define RX_MODES "700C,700D,700E" // Decoded at once, the one with sync is played
+#define RX_CHANNELS "0" // RX channel offsets in Hz from the modem centre, e.g. "-400,0,400" for a busy net
+#define TIMESHIFT_MINUTES 10 // RX kept in the time-shift file, about 1.9 MB per minute
+#define TIMESHIFT_REPLAY_S 120 // Replay looks this far back for the start of the last over
+#define TIMESHIFT_EXPORT_S 300 // Saved by SAVE_RX
+#define SCAN_DWELL_MS 1500 // Time on each channel, long enough for 700D/700E to sync on a signal that is there
+#define SCAN_DWELL_MIN_MS 300
+#define SCAN_SETTLE_MS 250 // Sync this soon after a hop may still come from the sBitx's own audio delay
+
+_Static_assert(RX_FANOUT_MAX_CHANNELS <= CONTROL_MAX_CHANNELS, "clients size their channel tables by CONTROL_MAX_CHANNELS");
+
+static struct {
+  struct station_options options;
+  station_event_fn event;
+  void * event_data;
+  int rxtx_mode; // -1 indicates no mode selected, 0 for TX, 1 for RX
+  bool rx_pending; // RX requested, radio stays keyed until the TX tail has played out
+  int ptt_owner; // Client that keyed the radio, 0 when none
+  int current_freq_hz; // Channel the radio is tuned to, restored after a telnet reconnect
+  enum { AUDIO_OPENING, AUDIO_READY, AUDIO_FAILED } audio_status;
+  pthread_t audio_open_thread;
+  bool audio_open_running; // audio_open_thread has been started and not joined yet
+  struct audio_settings audio_open_settings; // Only read by audio_open_thread while it runs
+  pthread_t export_thread;
+  bool export_running; // export_thread has been started and not joined yet
+  bool replaying; // As last reported in STATE
+  guint rx_timer;
+  guint ring_timer;
+  guint scan_timer; // Set while scanning
+  int scan_index; // Channel table index of the channel being listened to
+  gint64 scan_hop_us; // When the scan last retuned
+  uint64_t logged_xruns[2];
+} st = { .rxtx_mode = -1 };
+
+// Send one event line to the listener
+static void emit(const char * format, ...) {
+  char line[CONTROL_LINE_MAX];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (st.event != NULL) {
+    st.event(line, st.event_data);
+  }
+}
+
+static void append_state(GString * out) {
+  static const char * audio_text[] = { "opening", "ready", "failed" };
+  const char * ptt = st.rxtx_mode == 0 || st.rx_pending ? "tx" : (st.rxtx_mode == 1 ? "rx" : "none");
+  char missing[64];
+  audio_engine_missing_devices(missing, sizeof(missing));
+  g_string_append_printf(out, "ptt=%s radio_ptt=%d freq=%d radio=%d hamlib=%d audio=%s missing=%s timeshift=%d replay=%d scan=%d",
+    ptt, hamlib_client_radio_ptt(), st.current_freq_hz, telnet_queue_connected(), hamlib_client_connected(),
+    audio_text[st.audio_status], missing, audio_engine_timeshift() != NULL, st.replaying, st.scan_timer != 0);
+}
+
+static void emit_state(void) {
+  GString * state = g_string_new("STATE ");
+  append_state(state);
+  emit("%s", state->str);
+  g_string_free(state, TRUE);
+}
+
+static void save_release_version(void) {
+  config_set("version", "sBitx fdv_ptt " FREEDV_PTT_VERSION);
+}
+
+void station_create_default_config(void) {
+  config_set("fdvmode", "700D");
+  config_set("callsign", "N0CALL");
+  config_set("grid_square", "AA00ab");
+  config_set_int("squelch_level", -5);
+  config_set_int("input_level", 1);
+  config_set_int("start_mode", -1);
+  config_set("message", "--");
+  config_set("reporter_url", REPORTER_DEFAULT_URL);
+  config_set_int("rig_command_gap_ms", 20);
+  config_set("hamlib_host", SERVER_IP);
+  config_set_int("hamlib_port", SERVER_PORT);
+  config_set_int("rt_priority", RT_PRIORITY_OFF);
+  config_set_int("audio_cpu", RT_CPU_ANY);
+  config_set_int("lock_memory", 0);
+  config_set_int("playback_latency_ms", PLAYBACK_LATENCY_MS);
+  config_set_int("native_audio", 1);
+  config_set("headset_device", HEADSET_DEVICE);
+  config_set("sbitx_tx_device", SBITX_TX_DEVICE);
+  config_set("sbitx_rx_device", SBITX_RX_DEVICE);
+  config_set("rx_modes", RX_MODES);
+  config_set("rx_channels", RX_CHANNELS);
+  config_set("channels_file", RIG_CHANNELS_DEFAULT_FILE);
+  config_set_int("scan_dwell_ms", SCAN_DWELL_MS);
+  config_set("timeshift_file", TIMESHIFT_DEFAULT_FILE);
+  config_set_int("timeshift_minutes", TIMESHIFT_MINUTES);
+}
+
+void station_load_options(struct station_options * options) {
+  options->rt.priority = config_get_int("rt_priority", RT_PRIORITY_OFF);
+  options->rt.cpu = config_get_int("audio_cpu", RT_CPU_ANY);
+  options->rt.lock_memory = config_get_int("lock_memory", 0) != 0;
+  options->playback_latency_ms = config_get_int("playback_latency_ms", PLAYBACK_LATENCY_MS);
+}
+
+static void load_reporter_station(struct reporter_station * station) {
+  snprintf(station->callsign, sizeof(station->callsign), "%s", config_get("callsign", "N0CALL"));
+  snprintf(station->grid_square, sizeof(station->grid_square), "%s", config_get("grid_square", "AA00aa"));
+  snprintf(station->version, sizeof(station->version), "%s", config_get("version", "1.0.0"));
+}
+
+// Tell the reporter about a changed setting that it shows
+static void on_config_changed(const char * key, const char * value, void * data) {
+  if (strcmp(key, "fdvmode") == 0) {
+    reporter_client_tx(value, st.rxtx_mode == 0 || st.rx_pending);
+  } else if (strcmp(key, "message") == 0) {
+    reporter_client_message(value);
+  } else if (strcmp(key, "callsign") == 0 || strcmp(key, "grid_square") == 0) {
+    struct reporter_station station;
+    load_reporter_station( & station);
+    reporter_client_set_station( & station);
+  }
+}
+
+// Collect the audio engine settings from the configuration
+static void load_audio_settings(struct audio_settings * settings) {
+  snprintf(settings->mode, sizeof(settings->mode), "%s", config_get("fdvmode", "700D"));
+  snprintf(settings->callsign, sizeof(settings->callsign), "%s", config_get("callsign", "N0CALL"));
+  snprintf(settings->rx_modes, sizeof(settings->rx_modes), "%s", config_get("rx_modes", RX_MODES));
+  snprintf(settings->rx_channels, sizeof(settings->rx_channels), "%s", config_get("rx_channels", RX_CHANNELS));
+  // The RX modem thread decodes too, one worker per remaining core
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  settings->rx_workers = config_get_int("rx_workers", cores > 1 ? (int) cores - 1 : 1);
+  settings->input_level_db = config_get_int("input_level", 1);
+  settings->squelch_level = config_get_int("squelch_level", -5);
+  int latency = st.options.playback_latency_ms;
+  settings->playback_latency_ms = latency < PLAYBACK_LATENCY_MIN_MS ? PLAYBACK_LATENCY_MIN_MS : latency;
+  settings->native_rate = config_get_int("native_audio", 1) != 0; // 0 goes back to plughw: at 8 kHz
+  snprintf(settings->headset_device, sizeof(settings->headset_device), "%s", config_get("headset_device", HEADSET_DEVICE));
+  snprintf(settings->sbitx_tx_device, sizeof(settings->sbitx_tx_device), "%s", config_get("sbitx_tx_device", SBITX_TX_DEVICE));
+  snprintf(settings->sbitx_rx_device, sizeof(settings->sbitx_rx_device), "%s", config_get("sbitx_rx_device", SBITX_RX_DEVICE));
+  settings->rt = st.options.rt;
+  snprintf(settings->timeshift_file, sizeof(settings->timeshift_file), "%s", config_get("timeshift_file", TIMESHIFT_DEFAULT_FILE));
+  settings->timeshift_minutes = config_get_int("timeshift_minutes", TIMESHIFT_MINUTES);
+}
+
+// Save a setting, the ones the audio engine uses are handed to it at once
+static bool set_setting(const char * key, const char * value, GString * reply) {
+  if (key[0] == '\0') {
+    g_string_append(reply, "bad key"); // "SET  value" would write "=value" to config.ini
+    return false;
+  }
+  for (const char * p = key; * p != '\0'; p++) {
+    if (!islower((unsigned char) * p) && * p != '_' && !isdigit((unsigned char) * p)) {
+      g_string_append(reply, "bad key");
+      return false;
+    }
+  }
+  if (strcmp(key, "fdvmode") == 0 && modem_mode_from_name(value) < 0) {
+    g_string_append(reply, "unknown mode");
+    return false;
+  }
+  printf("Saved %s: %s\n", key, value);
+  config_set(key, value);
+  save_release_version();
+
+  // One that is still opening picks the settings up when it is ready
+  bool audio = strcmp(key, "squelch_level") == 0 || strcmp(key, "input_level") == 0 ||
+    strcmp(key, "fdvmode") == 0 || strcmp(key, "callsign") == 0;
+  if (audio && st.audio_status == AUDIO_READY) {
+    struct audio_settings settings;
+    load_audio_settings( & settings);
+    audio_engine_configure( & settings);
+  }
+  return true;
+}
+
+static void stop_scan(const char * reason);
+
+// Key the radio. Pressed again while the previous over is still playing out, keep transmitting.
+static void ptt_on(int client) {
+  TRACE_INSTANT("PTT ON command");
+  stop_scan("PTT");
+  st.ptt_owner = client;
+  if (st.rx_pending) {
+    st.rx_pending = false;
+    audio_engine_select(AUDIO_PATH_TX);
+    return;
+  }
+  if (st.rxtx_mode != 0) {
+    // If not already in TX mode, switch the warm audio engine over to the TX path
+    TRACE_ASYNC_BEGIN("PTT on", TRACE_ID_PTT_ON);
+    audio_engine_select(AUDIO_PATH_TX);
+
+    st.rxtx_mode = 0;
+    hamlib_client_set_ptt(true); // Send TX command to radio
+    printf("Switched to TX mode.\n");
+    reporter_client_tx(config_get("fdvmode", "700D"), true);
+    emit_state();
+  }
+}
+
+// Un-key the radio and finish switching to RX
+static void switch_to_rx(void) {
+  st.rxtx_mode = 1;
+  st.ptt_owner = 0;
+  hamlib_client_set_ptt(false); // Send RX command to radio
+  printf("Switched to RX mode.\n");
+  reporter_client_tx(config_get("fdvmode", "700D"), false);
+  emit_state();
+}
+
+// Runs on the main loop once the TX tail has left the sBitx input
+static gboolean finish_tx_tail(gpointer data) {
+  TRACE_INSTANT("TX tail drained");
+  if (st.rx_pending) {
+    st.rx_pending = false;
+    switch_to_rx();
+  }
+  return G_SOURCE_REMOVE;
+}
+
+// Called from the TX audio thread when the TX tail has drained
+static void on_tx_drained(void * data) {
+  g_idle_add(finish_tx_tail, NULL);
+}
+
+static void ptt_off(void) {
+  TRACE_INSTANT("PTT OFF command");
+  if (st.rxtx_mode != 1 && !st.rx_pending) {
+    TRACE_ASYNC_BEGIN("PTT off", TRACE_ID_PTT_OFF);
+    // If not already in RX mode, switch the warm audio engine over to the RX path.
+    // Coming from TX the radio stays keyed until the last modem frame has been played, see finish_tx_tail()
+    if (audio_engine_select(AUDIO_PATH_RX)) {
+      st.rx_pending = true;
+      return;
+    }
+    switch_to_rx();
+  }
+}
+
+static void tune(int freq_hz) {
+  // Look up the sideband and passband for the channel, only the settings that differ are sent
+  const struct rig_channel * channel = rig_channel_find(freq_hz);
+  struct rig_channel other;
+  if (channel == NULL) {
+    other = * rig_channel_default();
+    other.freq_hz = freq_hz;
+    channel = & other;
+  }
+  printf("Changing frequency to: %d Hz\n", freq_hz);
+  st.current_freq_hz = freq_hz;
+  rig_state_tune(channel);
+}
+
+static void change_frequency(int freq_hz) {
+  stop_scan("frequency chosen");
+  tune(freq_hz);
+  reporter_client_freq(freq_hz);
+  emit_state();
+}
+
+// Move the scan on to the next channel in the table
+static void scan_hop(void) {
+  st.scan_index = (st.scan_index + 1) % rig_channel_count();
+  tune(rig_channel_get(st.scan_index)->freq_hz);
+  audio_engine_reset_rx();
+  st.scan_hop_us = g_get_monotonic_time();
+  emit_state();
+}
+
+static gboolean on_scan_timer(gpointer data) {
+  scan_hop();
+  return G_SOURCE_CONTINUE;
+}
+
+static bool start_scan(const char * args, GString * reply) {
+  if (st.audio_status != AUDIO_READY) {
+    g_string_append(reply, "audio engine not ready");
+    return false;
+  }
+  if (st.rxtx_mode == 0 || st.rx_pending) {
+    g_string_append(reply, "transmitting");
+    return false;
+  }
+  int dwell_ms = args[0] != '\0' ? atoi(args) : config_get_int("scan_dwell_ms", SCAN_DWELL_MS);
+  if (dwell_ms < SCAN_DWELL_MIN_MS) {
+    g_string_append_printf(reply, "dwell below %d ms", SCAN_DWELL_MIN_MS);
+    return false;
+  }
+  if (st.scan_timer != 0) {
+    g_source_remove(st.scan_timer);
+  }
+
+  // Carry on from the channel we are on, or from the one below it when that is not in the table
+  st.scan_index = -1;
+  for (int i = 0; i < rig_channel_count() && rig_channel_get(i)->freq_hz <= st.current_freq_hz; i++) {
+    st.scan_index = i;
+  }
+  st.scan_timer = g_timeout_add(dwell_ms, on_scan_timer, NULL);
+  printf("Scanning %d channels, %d ms each\n", rig_channel_count(), dwell_ms);
+  scan_hop();
+  return true;
+}
+
+// End a scan, if one is running, on the channel it is on
+static void stop_scan(const char * reason) {
+  if (st.scan_timer == 0) {
+    return;
+  }
+  g_source_remove(st.scan_timer);
+  st.scan_timer = 0;
+  printf("Scan stopped on %d Hz: %s\n", st.current_freq_hz, reason);
+  reporter_client_freq(st.current_freq_hz);
+  emit_state();
+}
+
+// Describe one entry of the channel table, the band name runs to the end of the line
+static bool describe_channel(const char * args, GString * reply) {
+  const struct rig_channel * channel = isdigit((unsigned char) args[0]) ? rig_channel_get(atoi(args)) : NULL;
+  if (channel == NULL) {
+    g_string_append(reply, "bad channel");
+    return false;
+  }
+  g_string_append_printf(reply, "freq=%d mode=%s pitch=%d low=%d high=%d band=%s", channel->freq_hz, channel->mode,
+    channel->pitch_hz, channel->low_hz, channel->high_hz, channel->band);
+  return true;
+}
+
+// Send the RX modem stats of each channel that finished frames since the last call
+static gboolean send_rx_events(gpointer data) {
+  static struct rx_channel_stats stats[RX_STATS_QUEUE_SIZE];
+  if (st.audio_status != AUDIO_READY) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  // A replay ends by itself once it has caught up with the recording
+  struct timeshift * ts = audio_engine_timeshift();
+  bool replaying = ts != NULL && timeshift_replaying(ts);
+  if (replaying != st.replaying) {
+    st.replaying = replaying;
+    emit_state();
+  }
+
+  int n = audio_engine_take_rx_stats(stats, RX_STATS_QUEUE_SIZE);
+  bool settled = g_get_monotonic_time() - st.scan_hop_us >= SCAN_SETTLE_MS * 1000LL;
+  for (int channel = 0; channel < RX_FANOUT_MAX_CHANNELS; channel++) {
+    // Average over the frames since the last event, the rest is the newest frame's
+    float snr_db = 0, ber = 0;
+    int frames = 0;
+    const struct rx_channel_stats * last = NULL;
+    for (int i = 0; i < n; i++) {
+      if (stats[i].channel == channel) {
+        if (stats[i].callsign_heard) {
+          rx_report_heard(stats[i].callsign, modem_mode_name(stats[i].callsign_mode), stats[i].callsign_snr_db);
+        }
+        snr_db += stats[i].modem.snr_db;
+        ber += stats[i].modem.ber_est;
+        frames++;
+        last = & stats[i];
+      }
+    }
+    if (frames == 0) {
+      continue;
+    }
+    if (st.scan_timer != 0 && settled && last->modem.sync) {
+      char reason[48];
+      snprintf(reason, sizeof(reason), "%s sync, SNR %.1f dB", modem_mode_name(last->modem.mode), last->modem.snr_db);
+      stop_scan(reason);
+    }
+    char callsign[sizeof(last->callsign)];
+    snprintf(callsign, sizeof(callsign), "%s", last->callsign);
+    for (char * p = callsign; * p != '\0'; p++) {
+      if (!isgraph((unsigned char) * p)) {
+        * p = '_';
+      }
+    }
+    emit("RX channel=%d offset=%d playing=%d sync=%d mode=%s snr=%.1f ber=%.2e foff=%.1f clock=%.0f callsign=%s",
+      channel, last->offset_hz, last->playing, last->modem.sync, modem_mode_name(last->modem.mode),
+      snr_db / frames, ber / frames, last->modem.freq_offset_hz, last->modem.clock_offset_ppm, callsign);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// Send the audio ring fill and xrun counters, logging new xruns
+static gboolean send_ring_events(gpointer data) {
+  static const enum audio_path_select paths[2] = { AUDIO_PATH_TX, AUDIO_PATH_RX };
+  for (int i = 0; i < 2; i++) {
+    struct sample_ring_stats stats;
+    if (!audio_engine_get_ring_stats(paths[i], & stats)) {
+      continue;
+    }
+    const char * name = paths[i] == AUDIO_PATH_TX ? "TX" : "RX";
+    emit("RING path=%s fill=%d capacity=%d high=%d overruns=%llu underruns=%llu", i == 0 ? "tx" : "rx",
+      stats.fill, stats.capacity, stats.high_water, (unsigned long long) stats.overruns, (unsigned long long) stats.underruns);
+    if (stats.overruns + stats.underruns != st.logged_xruns[i]) {
+      st.logged_xruns[i] = stats.overruns + stats.underruns;
+      printf("%s audio ring xrun: %llu samples overrun, %llu underruns, high water %d of %d\n", name,
+        (unsigned long long) stats.overruns, (unsigned long long) stats.underruns, stats.high_water, stats.capacity);
+    }
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// Runs on the main loop once the RX export has been written, data is the prefix or NULL on failure
+static gboolean on_rx_exported(gpointer data) {
+  pthread_join(st.export_thread, NULL);
+  st.export_running = false;
+  if (data != NULL) {
+    emit("SAVED prefix=%s", (char * ) data);
+  } else {
+    emit("SAVE_FAILED");
+  }
+  g_free(data);
+  return G_SOURCE_REMOVE;
+}
+
+// Write the recent RX to WAV files off the main loop, data is the file name prefix
+static void * export_rx(void * data) {
+  gchar * prefix = data;
+  int result = timeshift_export(audio_engine_timeshift(), prefix, config_get_int("timeshift_export_s", TIMESHIFT_EXPORT_S));
+  if (result < 0) {
+    g_free(prefix);
+    prefix = NULL;
+  }
+  g_idle_add(on_rx_exported, prefix);
+  return NULL;
+}
+
+// Save the last few minutes of RX, named after the time
+static bool save_rx(GString * reply) {
+  if (audio_engine_timeshift() == NULL) {
+    g_string_append(reply, "not recording");
+    return false;
+  }
+  if (st.export_running) {
+    g_string_append(reply, "already saving");
+    return false;
+  }
+  char prefix[64];
+  time_t now = time(NULL);
+  struct tm tm;
+  strftime(prefix, sizeof(prefix), "rx_%Y%m%d_%H%M%S", localtime_r( & now, & tm));
+  gchar * arg = g_strdup(prefix);
+  st.export_running = pthread_create( & st.export_thread, NULL, export_rx, arg) == 0;
+  if (!st.export_running) {
+    perror("Failed to start RX export thread");
+    g_free(arg);
+    g_string_append(reply, "no thread");
+    return false;
+  }
+  g_string_append_printf(reply, "prefix=%s", prefix);
+  return true;
+}
+
+// Start or stop playing back the last over, RX keeps decoding and recording meanwhile
+static bool replay(const char * args, GString * reply) {
+  struct timeshift * ts = audio_engine_timeshift();
+  if (ts == NULL) {
+    g_string_append(reply, "not recording");
+    return false;
+  }
+  if (strcmp(args, "STOP") == 0) {
+    timeshift_replay_stop(ts);
+  } else if (!timeshift_replay(ts, args[0] != '\0' ? atoi(args) : config_get_int("timeshift_replay_s", TIMESHIFT_REPLAY_S))) {
+    g_string_append(reply, "nothing recorded yet");
+    return false;
+  }
+  st.replaying = timeshift_replaying(ts);
+  emit_state();
+  return true;
+}
+
+bool station_command(int client, const char * command, GString * reply) {
+  char verb[32];
+  size_t len = strcspn(command, " ");
+  snprintf(verb, sizeof(verb), "%.*s", (int) len, command);
+  const char * args = command[len] == ' ' ? command + len + 1 : "";
+
+  if (strcmp(verb, "STATUS") == 0) {
+    append_state(reply);
+  } else if (strcmp(verb, "PTT") == 0 && (strcmp(args, "ON") == 0 || strcmp(args, "OFF") == 0)) {
+    if (st.audio_status == AUDIO_OPENING) {
+      g_string_append(reply, "audio engine still opening");
+      return false;
+    }
+    if (strcmp(args, "ON") == 0) {
+      ptt_on(client);
+    } else {
+      ptt_off();
+    }
+  } else if (strcmp(verb, "FREQ") == 0 && atoi(args) > 0) {
+    change_frequency(atoi(args));
+  } else if (strcmp(verb, "CHANNELS") == 0) {
+    g_string_append_printf(reply, "count=%d", rig_channel_count());
+  } else if (strcmp(verb, "CHANNEL") == 0) {
+    return describe_channel(args, reply);
+  } else if (strcmp(verb, "SCAN") == 0) {
+    if (strcmp(args, "STOP") == 0) {
+      stop_scan("stopped");
+      return true;
+    }
+    return start_scan(args, reply);
+  } else if (strcmp(verb, "GET") == 0 && args[0] != '\0') {
+    g_string_append_printf(reply, "value=%s", config_get(args, ""));
+  } else if (strcmp(verb, "SET") == 0 && strchr(args, ' ') != NULL) {
+    char key[64];
+    size_t key_len = strcspn(args, " ");
+    snprintf(key, sizeof(key), "%.*s", (int) key_len, args);
+    return set_setting(key, args + key_len + 1, reply);
+  } else if (strcmp(verb, "RX_CHANNEL") == 0 && args[0] != '\0') {
+    int channel = strcmp(args, "AUTO") == 0 ? RX_CHANNEL_AUTO : atoi(args);
+    if (channel != RX_CHANNEL_AUTO && (channel < 0 || channel >= RX_FANOUT_MAX_CHANNELS || !isdigit((unsigned char) args[0]))) {
+      g_string_append(reply, "bad channel");
+      return false;
+    }
+    audio_engine_select_rx_channel(channel);
+  } else if (strcmp(verb, "REPLAY") == 0) {
+    return replay(args, reply);
+  } else if (strcmp(verb, "SAVE_RX") == 0) {
+    return save_rx(reply);
+  } else {
+    g_string_append(reply, "unknown command");
+    return false;
+  }
+  return true;
+}
+
+void station_client_closed(int client) {
+  if (client == st.ptt_owner && (st.rxtx_mode == 0 || st.rx_pending)) {
+    printf("Control client that keyed the radio went away, switching to RX\n");
+    ptt_off();
+  }
+}
+
+// Called when the sBitx telnet connection comes up or goes down
+static void on_telnet_state(bool connected, void * data) {
+  if (connected) {
+    startup_mark("telnet connected");
+    // Nothing is known about the radio after a (re)connect, put it back on the current channel
+    rig_state_invalidate();
+    tune(st.current_freq_hz);
+  }
+  emit_state();
+}
+
+// Called when the Hamlib connection comes up or goes down
+static void on_hamlib_state(bool connected, void * data) {
+  if (connected) {
+    startup_mark("hamlib connected");
+  }
+  emit_state();
+}
+
+// Called when a poll finds the radio's PTT is not what we asked for; it is never put back from here
+static void on_radio_ptt(bool on, void * data) {
+  if (!on && (st.rxtx_mode == 0 || st.rx_pending)) {
+    // The time-out timer or another controller un-keyed the radio, follow it to RX instead of re-keying
+    printf("Radio dropped TX by itself, switching to RX\n");
+    ptt_off();
+  } else if (on) {
+    fprintf(stderr, "Radio was keyed by another controller\n");
+  }
+  emit_state();
+}
+
+// Runs on the main loop once the audio engine has been opened
+static gboolean on_audio_engine_opened(gpointer data) {
+  int result = GPOINTER_TO_INT(data);
+  if (!st.audio_open_running) {
+    return G_SOURCE_REMOVE; // Already joined by station_stop
+  }
+  pthread_join(st.audio_open_thread, NULL);
+  st.audio_open_running = false;
+  if (result < 0) {
+    fprintf(stderr, "Failed to open audio engine, TX/RX audio is unavailable\n");
+    st.audio_status = AUDIO_FAILED;
+    startup_mark("audio engine failed");
+  } else {
+    st.audio_status = AUDIO_READY;
+    startup_mark("audio engine ready");
+    // Settings changed while the engine was opening
+    struct audio_settings settings;
+    load_audio_settings( & settings);
+    audio_engine_configure( & settings);
+  }
+  emit_state();
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean send_audio_device_state(gpointer data) {
+  emit_state();
+  return G_SOURCE_REMOVE;
+}
+
+// Called from an audio thread when it loses a device or opens it again
+static void on_audio_device(void * data) {
+  g_idle_add(send_audio_device_state, NULL);
+}
+
+// Called on the main loop when sound cards have come or gone
+static void on_sound_devices_changed(void * data) {
+  audio_engine_devices_changed();
+}
+
+// Look up the configured sound cards, and store one given by number under its id, which does not change on replug
+static void find_audio_devices(void) {
+  static const struct {
+    const char * key;
+    const char * fallback;
+  } devices[] = {
+    { "headset_device", HEADSET_DEVICE },
+    { "sbitx_tx_device", SBITX_TX_DEVICE },
+    { "sbitx_rx_device", SBITX_RX_DEVICE },
+  };
+  audio_devices_print();
+  for (size_t i = 0; i < sizeof(devices) / sizeof(devices[0]); i++) {
+    const char * spec = config_get(devices[i].key, devices[i].fallback);
+    const char * card = strchr(spec, ':') != NULL ? strchr(spec, ':') + 1 : spec;
+    card += strncmp(card, "CARD=", 5) == 0 ? 5 : 0;
+    char device[AUDIO_DEVICE_NAME_MAX];
+    if (!audio_devices_resolve(spec, device, sizeof(device))) {
+      fprintf(stderr, "%s %s not found, waiting for it to be plugged in\n", devices[i].key, spec);
+    } else if (isdigit((unsigned char) card[0])) {
+      printf("%s %s is %s, saved\n", devices[i].key, spec, device);
+      config_set(devices[i].key, device);
+    }
+  }
+}
+
+// Open the ALSA devices and modems off the main loop
+static void * open_audio_engine(void * arg) {
+  int result = audio_engine_open( & st.audio_open_settings);
+  g_idle_add(on_audio_engine_opened, GINT_TO_POINTER(result));
+  return NULL;
+}
+
+void station_start(const struct station_options * options, station_event_fn fn, void * data) {
+  st.options = * options;
+  st.event = fn;
+  st.event_data = data;
+  const char * channels_file = config_get("channels_file", RIG_CHANNELS_DEFAULT_FILE);
+  if (rig_channels_load(channels_file) < 0 && errno != ENOENT) {
+    perror(channels_file);
+  }
+  st.current_freq_hz = rig_channel_default()->freq_hz;
+  save_release_version();
+
+  // The connects are non-blocking and proceed together, their callbacks report the state
+  telnet_queue_set_state_callback(on_telnet_state, NULL);
+  if (telnet_queue_open(SERVER_IP, TELNET_PORT, config_get_int("rig_command_gap_ms", 20)) < 0) {
+    exit(EXIT_FAILURE);
+  }
+  hamlib_client_set_state_callback(on_hamlib_state, NULL);
+  hamlib_client_set_ptt_callback(on_radio_ptt, NULL);
+  if (hamlib_client_open(config_get("hamlib_host", SERVER_IP), config_get_int("hamlib_port", SERVER_PORT)) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  // Opening ALSA and the modems takes a while, do it on a thread of its own
+  find_audio_devices();
+  audio_devices_watch(on_sound_devices_changed, NULL);
+  load_audio_settings( & st.audio_open_settings);
+  audio_engine_set_tx_drained_callback(on_tx_drained, NULL);
+  audio_engine_set_device_callback(on_audio_device, NULL);
+  st.audio_open_running = pthread_create( & st.audio_open_thread, NULL, open_audio_engine, NULL) == 0;
+  if (!st.audio_open_running) {
+    perror("Failed to start audio engine thread");
+    st.audio_status = AUDIO_FAILED;
+  }
+  st.rx_timer = g_timeout_add(1000 / CONTROL_RX_EVENT_HZ, send_rx_events, NULL);
+  st.ring_timer = g_timeout_add(CONTROL_RING_EVENT_MS, send_ring_events, NULL);
+
+  // Write out the defaults of a new configuration
+  config_store_flush();
+
+  // Connect to FreeDV Reporter and say where we are
+  struct reporter_station station;
+  load_reporter_station( & station);
+  reporter_client_tx(config_get("fdvmode", "700D"), false);
+  reporter_client_freq(st.current_freq_hz);
+  reporter_client_message(config_get("message", "--"));
+  reporter_client_open(config_get("reporter_url", REPORTER_DEFAULT_URL), & station);
+  rx_report_open();
+  config_store_set_change_callback(on_config_changed, NULL);
+  startup_mark("reporter started");
+}
+
+void station_stop(void) {
+  // Un-key first, while rigctld is still connected; the control connections closing below report nothing
+  if (st.rxtx_mode == 0 || st.rx_pending) {
+    printf("Un-keying the radio before stopping\n");
+    hamlib_client_unkey(HAMLIB_REPLY_TIMEOUT_MS);
+    st.rxtx_mode = 1;
+    st.rx_pending = false;
+  }
+  if (st.audio_open_running) {
+    // Let the open finish so it can be closed properly
+    pthread_join(st.audio_open_thread, NULL);
+    st.audio_open_running = false;
+  }
+  if (st.export_running) {
+    // The export reads the time-shift file, which closes with the engine
+    pthread_join(st.export_thread, NULL);
+    st.export_running = false;
+  }
+  g_source_remove(st.rx_timer);
+  g_source_remove(st.ring_timer);
+  if (st.scan_timer != 0) {
+    g_source_remove(st.scan_timer);
+    st.scan_timer = 0;
+  }
+  st.event = NULL;
+  config_store_set_change_callback(NULL, NULL);
+  rx_report_close();
+  reporter_client_close();
+  hamlib_client_close();
+  telnet_queue_close();
+  audio_devices_unwatch();
+  audio_engine_close();
+}
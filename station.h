@@ -0,0 +1,44 @@
+/*
+ * station.h
+ *
+ * Description:
+ * Everything that runs the station, with no GUI attached: the config.ini
+ * defaults, the sBitx telnet and Hamlib connections, the audio engine, PTT
+ * sequencing, tuning, the FreeDV Reporter client and the time-shift controls.
+ * It runs on the GLib main loop of freedv_pttd, takes commands as lines of the
+ * control API and reports every change as an event line (see control_protocol.h).
+ */
+#ifndef STATION_H
+#define STATION_H
+
+#include <stdbool.h>
+#include <glib.h>
+#include "rt_sched.h"
+
+// Settings that can only change with a restart, from config.ini or the command line
+struct station_options {
+  struct rt_settings rt;
+  int playback_latency_ms;
+};
+
+// Called with every event line, without the "EVENT " prefix
+typedef void ( * station_event_fn)(const char * event, void * data);
+
+// Fill a new configuration with default values
+void station_create_default_config(void);
+
+void station_load_options(struct station_options * options);
+
+// Connect to the radio, open the audio engine in the background and start the reporter
+void station_start(const struct station_options * options, station_event_fn fn, void * data);
+
+// Run one control API command from client, see control_server.h
+bool station_command(int client, const char * command, GString * reply);
+
+// A client's connection closed, releases PTT if that client keyed the radio
+void station_client_closed(int client);
+
+// Un-key, stop the reporter and close the connections and the audio engine
+void station_stop(void);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ * telnet_queue.c
+ *
+ * Description:
+ * Asynchronous replacement for the blocking send() + nanosleep(200 ms) sequences
+ * used to talk to the sBitx telnet port.
+ *
+ * The sBitx telnet server treats each received segment as one command and the
+ * commands carry no terminator, so two commands must never share a segment.
+ * The old code guaranteed that by sleeping 200 ms after every send. Here the
+ * socket runs with TCP_NODELAY and a command is only released once the previous
+ * one has been answered, timed out, and the minimum gap has passed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include "telnet_queue.h"
+
+struct telnet_command {
+  char * text;
+  gint64 queued_us;
+};
+
+static struct {
+  struct sockaddr_in addr;
+  int fd;
+  bool connected;
+  int min_gap_ms;
+  GQueue queue;
+  struct telnet_command * in_flight;
+  gint64 sent_us;
+  gint64 last_send_us;
+  guint read_watch;
+  guint timer; // Gap timer while idle, response timeout while a command is in flight
+  guint retry_timer;
+  telnet_state_fn state_fn;
+  void * state_data;
+  struct telnet_queue_stats stats;
+  double total_rtt_ms;
+} tq = { .fd = -1 };
+
+static void pump(void);
+static void start_connect(void);
+
+static void command_free(struct telnet_command * cmd) {
+  g_free(cmd->text);
+  g_free(cmd);
+}
+
+static void cancel_timer(void) {
+  if (tq.timer != 0) {
+    g_source_remove(tq.timer);
+    tq.timer = 0;
+  }
+}
+
+// Finish the in-flight command and release the next one
+static void complete_in_flight(gboolean answered) {
+  if (tq.in_flight == NULL) {
+    return;
+  }
+  double rtt_ms = (g_get_monotonic_time() - tq.sent_us) / 1000.0;
+  if (answered) {
+    tq.stats.answered++;
+    tq.stats.last_rtt_ms = rtt_ms;
+    tq.total_rtt_ms += rtt_ms;
+    tq.stats.avg_rtt_ms = tq.total_rtt_ms / tq.stats.answered;
+    if (rtt_ms > tq.stats.max_rtt_ms) {
+      tq.stats.max_rtt_ms = rtt_ms;
+    }
+    printf("Rig: %s (answered in %.1f ms, queued %.1f ms)\n", tq.in_flight->text, rtt_ms,
+      (tq.sent_us - tq.in_flight->queued_us) / 1000.0);
+  } else {
+    tq.stats.timeouts++;
+    printf("Rig: %s (no answer after %d ms)\n", tq.in_flight->text, TELNET_RESPONSE_TIMEOUT_MS);
+  }
+  command_free(tq.in_flight);
+  tq.in_flight = NULL;
+  cancel_timer();
+  pump();
+}
+
+static gboolean on_response_timeout(gpointer data) {
+  tq.timer = 0;
+  complete_in_flight(FALSE);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean on_gap_elapsed(gpointer data) {
+  tq.timer = 0;
+  pump();
+  return G_SOURCE_REMOVE;
+}
+
+static void set_connected(bool connected) {
+  if (tq.connected == connected) {
+    return;
+  }
+  tq.connected = connected;
+  if (tq.state_fn != NULL) {
+    tq.state_fn(connected, tq.state_data);
+  }
+}
+
+static void close_socket(void) {
+  if (tq.read_watch != 0) {
+    g_source_remove(tq.read_watch);
+    tq.read_watch = 0;
+  }
+  cancel_timer();
+  if (tq.fd >= 0) {
+    close(tq.fd);
+    tq.fd = -1;
+  }
+}
+
+static gboolean on_retry_timer(gpointer data) {
+  tq.retry_timer = 0;
+  start_connect();
+  return G_SOURCE_REMOVE;
+}
+
+// Forget the connection. The command in flight may or may not have reached the radio and is dropped;
+// the queued ones have not been sent yet and go out, in order, once the radio is back.
+static void drop_connection(void) {
+  close_socket();
+  if (tq.in_flight != NULL) {
+    fprintf(stderr, "Rig: %s dropped, the connection was lost before it was answered\n", tq.in_flight->text);
+    command_free(tq.in_flight);
+    tq.in_flight = NULL;
+  }
+  set_connected(false);
+  if (tq.retry_timer == 0) {
+    tq.retry_timer = g_timeout_add(TELNET_RETRY_MS, on_retry_timer, NULL);
+  }
+}
+
+static gboolean on_readable(gint fd, GIOCondition condition, gpointer data) {
+  char buffer[1024];
+  ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    fprintf(stderr, "Telnet connection lost: %s\n", n == 0 ? "closed by radio" : strerror(errno));
+    tq.read_watch = 0;
+    drop_connection();
+    return G_SOURCE_REMOVE;
+  }
+  // Anything the radio prints after a command counts as its answer
+  if (n > 0) {
+    complete_in_flight(TRUE);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// Send the next queued command if the radio is ready for it
+static void pump(void) {
+  if (!tq.connected || tq.in_flight != NULL || tq.timer != 0 || g_queue_is_empty( & tq.queue)) {
+    return;
+  }
+
+  gint64 now = g_get_monotonic_time();
+  gint64 wait_us = tq.last_send_us + tq.min_gap_ms * 1000 - now;
+  if (tq.last_send_us != 0 && wait_us > 0) {
+    tq.timer = g_timeout_add((guint)((wait_us + 999) / 1000), on_gap_elapsed, NULL);
+    return;
+  }
+
+  struct telnet_command * cmd = g_queue_pop_head( & tq.queue);
+  if (send(tq.fd, cmd->text, strlen(cmd->text), MSG_NOSIGNAL) < 0) {
+    perror("Send command failed");
+    command_free(cmd);
+    drop_connection();
+    return;
+  }
+  tq.in_flight = cmd;
+  tq.sent_us = now;
+  tq.last_send_us = now;
+  tq.stats.sent++;
+  tq.timer = g_timeout_add(TELNET_RESPONSE_TIMEOUT_MS, on_response_timeout, NULL);
+}
+
+static gboolean on_connected(gint fd, GIOCondition condition, gpointer data) {
+  int err = 0;
+  socklen_t len = sizeof(err);
+  getsockopt(fd, SOL_SOCKET, SO_ERROR, & err, & len);
+  tq.read_watch = 0; // Removed by returning G_SOURCE_REMOVE
+  if (err != 0) {
+    fprintf(stderr, "Telnet connection failed: %s, retrying in %d ms\n", strerror(err), TELNET_RETRY_MS);
+    drop_connection();
+    return G_SOURCE_REMOVE;
+  }
+
+  printf("Connected to sBitx telnet server\n");
+  tq.read_watch = g_unix_fd_add(fd, G_IO_IN, on_readable, NULL);
+  tq.last_send_us = 0;
+  set_connected(true);
+  pump();
+  return G_SOURCE_REMOVE;
+}
+
+static void start_connect(void) {
+  int one = 1;
+
+  close_socket();
+  tq.fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (tq.fd < 0) {
+    perror("Telnet socket creation error");
+    drop_connection();
+    return;
+  }
+  // Every command must leave in its own segment, see the note at the top of this file
+  setsockopt(tq.fd, IPPROTO_TCP, TCP_NODELAY, & one, sizeof(one));
+  fcntl(tq.fd, F_SETFL, fcntl(tq.fd, F_GETFL) | O_NONBLOCK);
+
+  if (connect(tq.fd, (struct sockaddr * ) & tq.addr, sizeof(tq.addr)) < 0 && errno != EINPROGRESS) {
+    fprintf(stderr, "Telnet connection failed: %s, retrying in %d ms\n", strerror(errno), TELNET_RETRY_MS);
+    drop_connection();
+    return;
+  }
+  tq.read_watch = g_unix_fd_add(tq.fd, G_IO_OUT, on_connected, NULL);
+}
+
+int telnet_queue_open(const char * ip, int port, int min_gap_ms) {
+  memset( & tq.addr, 0, sizeof(tq.addr));
+  tq.addr.sin_family = AF_INET;
+  tq.addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, ip, & tq.addr.sin_addr) != 1) {
+    fprintf(stderr, "Invalid telnet server address: %s\n", ip);
+    return -1;
+  }
+
+  g_queue_init( & tq.queue);
+  tq.min_gap_ms = min_gap_ms;
+  start_connect();
+  return 0;
+}
+
+void telnet_queue_set_state_callback(telnet_state_fn fn, void * data) {
+  tq.state_fn = fn;
+  tq.state_data = data;
+}
+
+bool telnet_queue_connected(void) {
+  return tq.connected;
+}
+
+void telnet_queue_send(const char * command) {
+  struct telnet_command * cmd = g_new0(struct telnet_command, 1);
+  cmd->text = g_strdup(command);
+  cmd->queued_us = g_get_monotonic_time();
+  g_queue_push_tail( & tq.queue, cmd);
+  if (g_queue_get_length( & tq.queue) > TELNET_QUEUE_MAX) {
+    // The radio has been away for a while, the oldest settings have been overridden by now anyway
+    struct telnet_command * oldest = g_queue_pop_head( & tq.queue);
+    fprintf(stderr, "Rig: %s dropped, %d commands are already waiting for the radio\n", oldest->text, TELNET_QUEUE_MAX);
+    command_free(oldest);
+  }
+  pump();
+}
+
+unsigned int telnet_queue_pending(void) {
+  return g_queue_get_length( & tq.queue) + (tq.in_flight != NULL ? 1 : 0);
+}
+
+void telnet_queue_get_stats(struct telnet_queue_stats * stats) {
+  * stats = tq.stats;
+}
+
+void telnet_queue_close(void) {
+  if (tq.retry_timer != 0) {
+    g_source_remove(tq.retry_timer);
+    tq.retry_timer = 0;
+  }
+  close_socket();
+  tq.connected = false;
+  if (tq.in_flight != NULL) {
+    command_free(tq.in_flight);
+    tq.in_flight = NULL;
+  }
+  g_queue_clear_full( & tq.queue, (GDestroyNotify) command_free);
+}
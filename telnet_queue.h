@@ -0,0 +1,50 @@
+/*
+ * telnet_queue.h
+ *
+ * Description:
+ * Non-blocking command queue for the sBitx telnet port (8081), driven by the
+ * GLib main loop. Commands are sent one at a time; the next one goes out as soon
+ * as the radio has answered the previous one (or a response timeout expires),
+ * but never sooner than a configurable minimum gap after the previous send.
+ * The connection is made in the background and retried while the radio is away.
+ */
+#ifndef TELNET_QUEUE_H
+#define TELNET_QUEUE_H
+
+#include <stdbool.h>
+
+#define TELNET_RESPONSE_TIMEOUT_MS 200 // Give up waiting for an answer after the old fixed delay
+#define TELNET_RETRY_MS 2000           // Delay before reconnecting after a failed or lost connection
+#define TELNET_QUEUE_MAX 64            // Commands kept while the radio is away, the oldest go first
+
+struct telnet_queue_stats {
+  unsigned int sent;
+  unsigned int answered;
+  unsigned int timeouts;
+  double last_rtt_ms;
+  double avg_rtt_ms;
+  double max_rtt_ms;
+};
+
+// Called whenever the connection comes up or goes down
+typedef void ( * telnet_state_fn)(bool connected, void * data);
+
+// Start connecting to the telnet server, returns immediately. -1 if ip is not a dotted IPv4 address.
+int telnet_queue_open(const char * ip, int port, int min_gap_ms);
+
+void telnet_queue_set_state_callback(telnet_state_fn fn, void * data);
+
+bool telnet_queue_connected(void);
+
+// Queue a command, returns immediately. Commands queued while disconnected, or not yet sent when the
+// connection drops, wait for the next connection; only the one in flight when it drops is lost.
+void telnet_queue_send(const char * command);
+
+// Number of commands queued or waiting for an answer
+unsigned int telnet_queue_pending(void);
+
+void telnet_queue_get_stats(struct telnet_queue_stats * stats);
+
+void telnet_queue_close(void);
+
+#endif
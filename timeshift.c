@@ -0,0 +1,455 @@
+/*
+ * timeshift.c
+ *
+ * Description:
+ * File layout: one header page, then the modem input stream, then the speech
+ * stream, each capacity samples long. Capacity is a whole number of pages and
+ * the recorder only ever writes whole pages at page-aligned offsets, so every
+ * write dirties exactly the pages it fills and the kernel writes them back in
+ * large sequential runs. The file is allocated up front with posix_fallocate so
+ * the SD card never has to find space for it mid-session.
+ *
+ * The RX modem thread owns the producer side of a staging ring per stream and
+ * of a small queue of sync changes; the recorder thread owns everything in the
+ * mapping except replay_pos. written[] in the header only advances once the
+ * page it covers is complete, so replay and export never read a half-filled
+ * page. Ahead of a replay the recorder touches the pages that are about to be
+ * played, so reading them from the RX modem thread does not wait on the card.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "timeshift.h"
+#include "sample_ring.h"
+#include "modem.h"
+#include "trace.h"
+
+#define TIMESHIFT_RATE 8000
+#define TIMESHIFT_MAGIC "FDVTS001"
+#define TIMESHIFT_INDEX_SIZE 256   // Sync changes kept in the file
+#define TIMESHIFT_EVENTS 64        // Sync changes waiting for the recorder thread
+#define TIMESHIFT_STAGING_S 10     // How long the recorder may be held up by the card before audio is dropped
+#define TIMESHIFT_FLUSH_MS 250
+#define TIMESHIFT_PREFETCH_S 2     // Replay audio paged in ahead of the RX modem thread
+#define TIMESHIFT_EXPORT_MARGIN_S 30 // Kept clear of the write position while exporting
+
+enum timeshift_stream { STREAM_MODEM, STREAM_SPEECH, STREAMS };
+
+struct timeshift_mark {
+  uint64_t pos[STREAMS];  // Sample of each stream where the change happened
+  int64_t time_ms;        // Wall clock
+  int32_t mode;
+  int32_t sync;
+};
+
+struct timeshift_header {
+  char magic[8];
+  uint32_t rate;
+  uint32_t capacity;
+  _Atomic uint64_t written[STREAMS]; // Samples of each stream in the file, always a whole number of pages
+  _Atomic uint64_t marks;            // Sync changes ever written to index
+  struct timeshift_mark index[TIMESHIFT_INDEX_SIZE];
+};
+
+struct timeshift {
+  int fd;
+  uint8_t * map;
+  size_t map_size;
+  struct timeshift_header * header;
+  short * data[STREAMS];
+  int capacity;                 // Samples per stream
+  int batch;                    // Samples per page
+  struct sample_ring staging[STREAMS];
+
+  // RX modem thread only
+  uint64_t recorded[STREAMS];   // Samples that made it into staging
+  bool sync;
+
+  // RX modem thread -> recorder thread
+  struct timeshift_mark events[TIMESHIFT_EVENTS];
+  atomic_uint event_head;
+  atomic_uint event_tail;
+
+  _Atomic int64_t replay_pos;   // Next speech sample to play, -1 when not replaying
+  atomic_bool closing;
+  sem_t wake;
+  pthread_t thread;
+};
+
+static int64_t realtime_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, & ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Copy n samples of a stream starting at pos, wrapping at the end of the buffer
+static void stream_copy(struct timeshift * ts, int stream, uint64_t pos, short * out, int n) {
+  while (n > 0) {
+    int offset = (int)(pos % ts->capacity);
+    int chunk = ts->capacity - offset < n ? ts->capacity - offset : n;
+    memcpy(out, ts->data[stream] + offset, chunk * sizeof(short));
+    out += chunk;
+    pos += chunk;
+    n -= chunk;
+  }
+}
+
+// Move whole pages from a staging ring into the file. At close the last part page is padded with silence.
+static void flush_stream(struct timeshift * ts, int stream, bool final) {
+  struct sample_ring * r = & ts->staging[stream];
+  uint64_t written = atomic_load_explicit( & ts->header->written[stream], memory_order_relaxed);
+  int available = sample_ring_available(r);
+  while (available >= ts->batch || (final && available > 0)) {
+    short * dest = ts->data[stream] + written % ts->capacity;
+    int want = available < ts->batch ? available : ts->batch;
+    int copied = 0;
+    while (copied < want) {
+      const short * src;
+      int n = sample_ring_peek(r, & src, want - copied);
+      memcpy(dest + copied, src, n * sizeof(short));
+      sample_ring_release(r, n);
+      copied += n;
+    }
+    memset(dest + copied, 0, (ts->batch - copied) * sizeof(short));
+    written += ts->batch;
+    atomic_store_explicit( & ts->header->written[stream], written, memory_order_release);
+    available -= want;
+  }
+}
+
+static void flush_events(struct timeshift * ts) {
+  unsigned int tail = atomic_load_explicit( & ts->event_tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit( & ts->event_head, memory_order_acquire);
+  uint64_t marks = atomic_load_explicit( & ts->header->marks, memory_order_relaxed);
+  while (tail != head) {
+    ts->header->index[marks % TIMESHIFT_INDEX_SIZE] = ts->events[tail % TIMESHIFT_EVENTS];
+    marks++;
+    tail++;
+  }
+  atomic_store_explicit( & ts->header->marks, marks, memory_order_release);
+  atomic_store_explicit( & ts->event_tail, tail, memory_order_release);
+}
+
+// Touch the pages a replay is about to read so they are in memory before the RX modem thread gets there
+static void prefetch_replay(struct timeshift * ts) {
+  int64_t pos = atomic_load( & ts->replay_pos);
+  if (pos < 0) {
+    return;
+  }
+  uint64_t end = atomic_load( & ts->header->written[STREAM_SPEECH]);
+  if (end > (uint64_t) pos + TIMESHIFT_PREFETCH_S * TIMESHIFT_RATE) {
+    end = pos + TIMESHIFT_PREFETCH_S * TIMESHIFT_RATE;
+  }
+  for (uint64_t p = pos; p < end; p += ts->batch) {
+    (void) * (volatile short * )(ts->data[STREAM_SPEECH] + p % ts->capacity);
+  }
+}
+
+static void * recorder_thread(void * arg) {
+  struct timeshift * ts = arg;
+  trace_set_thread_name("Time-shift");
+  while (!atomic_load( & ts->closing)) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, & deadline);
+    deadline.tv_nsec += TIMESHIFT_FLUSH_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    sem_timedwait( & ts->wake, & deadline);
+
+    TRACE_BEGIN("time-shift flush");
+    flush_stream(ts, STREAM_MODEM, false);
+    flush_stream(ts, STREAM_SPEECH, false);
+    flush_events(ts);
+    prefetch_replay(ts);
+    TRACE_END("time-shift flush");
+  }
+  flush_stream(ts, STREAM_MODEM, true);
+  flush_stream(ts, STREAM_SPEECH, true);
+  flush_events(ts);
+  return NULL;
+}
+
+static size_t round_up(size_t n, size_t unit) {
+  return (n + unit - 1) / unit * unit;
+}
+
+struct timeshift * timeshift_open(const char * path, int minutes) {
+  if (minutes <= 0) {
+    return NULL;
+  }
+  struct timeshift * ts = calloc(1, sizeof( * ts));
+  if (ts == NULL) {
+    return NULL;
+  }
+  long page = sysconf(_SC_PAGESIZE);
+  ts->batch = (int)(page / sizeof(short));
+  ts->capacity = (int) round_up((size_t) minutes * 60 * TIMESHIFT_RATE, ts->batch);
+  size_t header_size = round_up(sizeof(struct timeshift_header), page);
+  ts->map_size = header_size + STREAMS * (size_t) ts->capacity * sizeof(short);
+
+  ts->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (ts->fd < 0) {
+    perror("Time-shift file");
+    free(ts);
+    return NULL;
+  }
+  struct stat st;
+  bool reuse = fstat(ts->fd, & st) == 0 && (size_t) st.st_size == ts->map_size;
+  if (!reuse) {
+    int err = ftruncate(ts->fd, 0) < 0 ? errno : posix_fallocate(ts->fd, 0, ts->map_size);
+    if (err != 0) {
+      fprintf(stderr, "Time-shift file: cannot allocate %zu MB: %s\n", ts->map_size >> 20, strerror(err));
+      close(ts->fd);
+      free(ts);
+      return NULL;
+    }
+  }
+  ts->map = mmap(NULL, ts->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ts->fd, 0);
+  if (ts->map == MAP_FAILED) {
+    perror("Time-shift mmap");
+    close(ts->fd);
+    free(ts);
+    return NULL;
+  }
+
+  ts->header = (struct timeshift_header * ) ts->map;
+  if (!reuse || memcmp(ts->header->magic, TIMESHIFT_MAGIC, sizeof(ts->header->magic)) != 0 ||
+      ts->header->rate != TIMESHIFT_RATE || ts->header->capacity != (uint32_t) ts->capacity) {
+    reuse = false;
+    memset(ts->map, 0, header_size);
+    memcpy(ts->header->magic, TIMESHIFT_MAGIC, sizeof(ts->header->magic));
+    ts->header->rate = TIMESHIFT_RATE;
+    ts->header->capacity = ts->capacity;
+  }
+  int staging_frames = (TIMESHIFT_STAGING_S * TIMESHIFT_RATE + ts->batch - 1) / ts->batch;
+  for (int s = 0; s < STREAMS; s++) {
+    ts->data[s] = (short * )(ts->map + header_size + s * (size_t) ts->capacity * sizeof(short));
+    ts->recorded[s] = atomic_load( & ts->header->written[s]);
+    if (sample_ring_init( & ts->staging[s], ts->batch, staging_frames) < 0) {
+      while (--s >= 0) {
+        sample_ring_destroy( & ts->staging[s]);
+      }
+      munmap(ts->map, ts->map_size);
+      close(ts->fd);
+      free(ts);
+      return NULL;
+    }
+  }
+  atomic_store( & ts->replay_pos, -1);
+  sem_init( & ts->wake, 0, 0);
+  pthread_create( & ts->thread, NULL, recorder_thread, ts);
+  printf("Time-shift recorder: last %d minutes in %s (%zu MB%s)\n", minutes, path, ts->map_size >> 20,
+    reuse ? ", resumed" : "");
+  return ts;
+}
+
+void timeshift_record(struct timeshift * ts, const short * modem_in, int n, const short * speech, int nout,
+  bool sync, int mode) {
+  if (sync != ts->sync) {
+    unsigned int head = atomic_load_explicit( & ts->event_head, memory_order_relaxed);
+    if (head - atomic_load_explicit( & ts->event_tail, memory_order_acquire) < TIMESHIFT_EVENTS) {
+      struct timeshift_mark * mark = & ts->events[head % TIMESHIFT_EVENTS];
+      mark->pos[STREAM_MODEM] = ts->recorded[STREAM_MODEM];
+      mark->pos[STREAM_SPEECH] = ts->recorded[STREAM_SPEECH];
+      mark->time_ms = realtime_ms();
+      mark->mode = mode;
+      mark->sync = sync;
+      atomic_store_explicit( & ts->event_head, head + 1, memory_order_release);
+    }
+    ts->sync = sync;
+  }
+  ts->recorded[STREAM_MODEM] += sample_ring_write( & ts->staging[STREAM_MODEM], modem_in, n);
+  ts->recorded[STREAM_SPEECH] += sample_ring_write( & ts->staging[STREAM_SPEECH], speech, nout);
+}
+
+bool timeshift_replay(struct timeshift * ts, int seconds) {
+  uint64_t written = atomic_load( & ts->header->written[STREAM_SPEECH]);
+  if (written == 0) {
+    return false;
+  }
+  uint64_t span = (uint64_t) seconds * TIMESHIFT_RATE;
+  uint64_t limit = ts->capacity - ts->batch; // Leave the page being overwritten next alone
+  if (span > limit) {
+    span = limit;
+  }
+  uint64_t from = written > span ? written - span : 0;
+
+  // Start of the newest over in range, if there is one
+  uint64_t marks = atomic_load_explicit( & ts->header->marks, memory_order_acquire);
+  uint64_t first = marks > TIMESHIFT_INDEX_SIZE ? marks - TIMESHIFT_INDEX_SIZE : 0;
+  for (uint64_t i = marks; i > first; i--) {
+    const struct timeshift_mark * mark = & ts->header->index[(i - 1) % TIMESHIFT_INDEX_SIZE];
+    if (mark->pos[STREAM_SPEECH] < from) {
+      break;
+    }
+    if (mark->sync && mark->pos[STREAM_SPEECH] < written) {
+      from = mark->pos[STREAM_SPEECH];
+      break;
+    }
+  }
+  atomic_store( & ts->replay_pos, (int64_t) from);
+  printf("Time-shift replay of the last %.1f seconds\n", (double)(written - from) / TIMESHIFT_RATE);
+  return true;
+}
+
+void timeshift_replay_stop(struct timeshift * ts) {
+  atomic_store( & ts->replay_pos, -1);
+}
+
+bool timeshift_replaying(struct timeshift * ts) {
+  return atomic_load( & ts->replay_pos) >= 0;
+}
+
+int timeshift_replay_read(struct timeshift * ts, short * speech, int n) {
+  int64_t pos = atomic_load( & ts->replay_pos);
+  if (pos < 0) {
+    return 0;
+  }
+  if ((uint64_t) pos + n > atomic_load_explicit( & ts->header->written[STREAM_SPEECH], memory_order_acquire)) {
+    atomic_compare_exchange_strong( & ts->replay_pos, & pos, -1); // Caught up, back to live audio
+    return 0;
+  }
+  stream_copy(ts, STREAM_SPEECH, pos, speech, n);
+  atomic_compare_exchange_strong( & ts->replay_pos, & pos, pos + n); // Lose to a restart or stop from the GUI
+  return n;
+}
+
+static void put_le16(uint8_t * p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t * p, uint32_t v) {
+  put_le16(p, v & 0xffff);
+  put_le16(p + 2, v >> 16);
+}
+
+// Write samples [from, from + n) of a stream as a mono 16-bit WAV file
+static int export_wav(struct timeshift * ts, int stream, const char * path, uint64_t from, int n) {
+  FILE * file = fopen(path, "wb");
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+  uint8_t header[44];
+  memcpy(header, "RIFF", 4);
+  put_le32(header + 4, 36 + n * 2);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  put_le32(header + 16, 16);
+  put_le16(header + 20, 1); // PCM
+  put_le16(header + 22, 1); // Mono
+  put_le32(header + 24, TIMESHIFT_RATE);
+  put_le32(header + 28, TIMESHIFT_RATE * 2);
+  put_le16(header + 32, 2);
+  put_le16(header + 34, 16);
+  memcpy(header + 36, "data", 4);
+  put_le32(header + 40, n * 2);
+  bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+
+  short chunk[4096];
+  for (int done = 0; ok && done < n; ) {
+    int len = n - done < 4096 ? n - done : 4096;
+    stream_copy(ts, stream, from + done, chunk, len);
+    for (int i = 0; i < len; i++) {
+      put_le16((uint8_t * ) & chunk[i], (uint16_t) chunk[i]);
+    }
+    ok = fwrite(chunk, sizeof(short), len, file) == (size_t) len;
+    done += len;
+  }
+  if (fclose(file) != 0 || !ok) {
+    fprintf(stderr, "Could not write %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+// List the sync changes from speech sample from onwards, with their offset into the speech file
+static int export_marks(struct timeshift * ts, const char * path, uint64_t from) {
+  FILE * file = fopen(path, "w");
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+  uint64_t marks = atomic_load_explicit( & ts->header->marks, memory_order_acquire);
+  uint64_t first = marks > TIMESHIFT_INDEX_SIZE ? marks - TIMESHIFT_INDEX_SIZE : 0;
+  for (uint64_t i = first; i < marks; i++) {
+    const struct timeshift_mark * mark = & ts->header->index[i % TIMESHIFT_INDEX_SIZE];
+    if (mark->pos[STREAM_SPEECH] < from) {
+      continue;
+    }
+    int offset_s = (int)((mark->pos[STREAM_SPEECH] - from) / TIMESHIFT_RATE);
+    time_t when = mark->time_ms / 1000;
+    struct tm tm;
+    char clock[16];
+    strftime(clock, sizeof(clock), "%H:%M:%S", localtime_r( & when, & tm));
+    fprintf(file, "%02d:%02d  %s  %s %s\n", offset_s / 60, offset_s % 60, clock,
+      mark->sync ? "sync" : "sync lost", mark->sync ? modem_mode_name(mark->mode) : "");
+  }
+  return fclose(file) == 0 ? 0 : -1;
+}
+
+int timeshift_export(struct timeshift * ts, const char * prefix, int seconds) {
+  uint64_t span = (uint64_t) seconds * TIMESHIFT_RATE;
+  uint64_t limit = ts->capacity > 2 * TIMESHIFT_EXPORT_MARGIN_S * TIMESHIFT_RATE ?
+    ts->capacity - TIMESHIFT_EXPORT_MARGIN_S * TIMESHIFT_RATE : ts->capacity / 2;
+  if (span > limit) {
+    span = limit;
+  }
+
+  static const char * suffix[STREAMS] = { "modem", "speech" };
+  uint64_t from[STREAMS];
+  int result = 0;
+  for (int s = 0; s < STREAMS; s++) {
+    uint64_t written = atomic_load_explicit( & ts->header->written[s], memory_order_acquire);
+    int n = (int)(written < span ? written : span);
+    from[s] = written - n;
+    char path[512];
+    snprintf(path, sizeof(path), "%s_%s.wav", prefix, suffix[s]);
+    if (export_wav(ts, s, path, from[s], n) < 0) {
+      result = -1;
+    }
+  }
+  char path[512];
+  snprintf(path, sizeof(path), "%s.txt", prefix);
+  if (export_marks(ts, path, from[STREAM_SPEECH]) < 0) {
+    result = -1;
+  }
+  if (result == 0) {
+    printf("Exported the last %d seconds of RX to %s_modem.wav and %s_speech.wav\n",
+      (int)(span / TIMESHIFT_RATE), prefix, prefix);
+  }
+  return result;
+}
+
+void timeshift_close(struct timeshift * ts) {
+  if (ts == NULL) {
+    return;
+  }
+  atomic_store( & ts->closing, true);
+  sem_post( & ts->wake);
+  pthread_join(ts->thread, NULL);
+
+  for (int s = 0; s < STREAMS; s++) {
+    struct sample_ring_stats stats;
+    sample_ring_get_stats( & ts->staging[s], & stats);
+    if (stats.overruns > 0) {
+      printf("Time-shift recorder dropped %llu samples, the card could not keep up\n",
+        (unsigned long long) stats.overruns);
+    }
+    sample_ring_destroy( & ts->staging[s]);
+  }
+  sem_destroy( & ts->wake);
+  munmap(ts->map, ts->map_size);
+  close(ts->fd);
+  free(ts);
+}
@@ -0,0 +1,56 @@
+/*
+ * timeshift.h
+ *
+ * Description:
+ * Continuous recorder of the RX modem input and the decoded speech, so a weak
+ * station that was missed can be played again or saved without stopping RX.
+ *
+ * Both streams go into one pre-allocated file that is memory-mapped and used as
+ * a circular buffer of the last few minutes. The file starts with a header page
+ * holding how far each stream has been written and an index of sync changes
+ * with their wall-clock time, which is what replay uses to find the start of
+ * the last over. The file survives a restart and is picked up again when its
+ * size matches.
+ *
+ * The RX modem thread only copies into in-memory staging rings; a recorder
+ * thread moves whole pages from them into the mapping, so a slow SD card can
+ * hold up the recorder but never the audio.
+ */
+#ifndef TIMESHIFT_H
+#define TIMESHIFT_H
+
+#include <stdbool.h>
+
+#define TIMESHIFT_DEFAULT_FILE "timeshift.bin"
+
+struct timeshift;
+
+// Open or create path holding minutes of both streams and start the recorder thread, NULL on failure
+struct timeshift * timeshift_open(const char * path, int minutes);
+
+// RX modem thread: append n modem input samples and nout speech samples, with the sync state
+// and mode of the channel being played. Never blocks; what does not fit is dropped and counted.
+void timeshift_record(struct timeshift * ts, const short * modem_in, int n, const short * speech, int nout,
+  bool sync, int mode);
+
+// Play back the decoded speech from the start of the latest over that began within the last
+// seconds, or from seconds ago when none did. Returns false when nothing is recorded yet.
+bool timeshift_replay(struct timeshift * ts, int seconds);
+
+void timeshift_replay_stop(struct timeshift * ts);
+
+bool timeshift_replaying(struct timeshift * ts);
+
+// RX modem thread: replace n samples of live speech with the replay, returns n while
+// replaying and 0 once it has caught up with the recording or was stopped
+int timeshift_replay_read(struct timeshift * ts, short * speech, int n);
+
+// Write the last seconds as prefix_modem.wav (decodable again with freedv_rx),
+// prefix_speech.wav and prefix.txt listing the sync changes. Takes a while on an
+// SD card, call it off the GTK thread. Returns 0 or -1.
+int timeshift_export(struct timeshift * ts, const char * prefix, int seconds);
+
+// Stop the recorder thread, write out what is staged and unmap the file
+void timeshift_close(struct timeshift * ts);
+
+#endif
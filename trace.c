@@ -0,0 +1,130 @@
+/*
+ * trace.c
+ *
+ * Description:
+ * Multi-producer ring of timestamped events. A writer claims a slot with one
+ * atomic increment and publishes it by storing the slot's sequence number last,
+ * so recording never blocks or takes a lock and costs a clock read and a few
+ * stores. The dump skips slots that are being rewritten while it reads them.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+#define TRACE_THREADS_MAX 16
+
+struct trace_slot {
+  _Atomic uint64_t seq; // Claim index + 1 once the slot is complete, 0 while being written
+  const char * name;
+  int64_t ts_ns;
+  int64_t value;
+  uint32_t id;
+  int32_t tid;
+  char phase;
+};
+
+struct trace_thread {
+  _Atomic int32_t tid;
+  const char * name;
+};
+
+static struct trace_slot ring[TRACE_RING_SIZE];
+static _Atomic uint64_t next_slot;
+static struct trace_thread threads[TRACE_THREADS_MAX];
+static _Atomic int thread_count;
+static _Thread_local int32_t cached_tid;
+
+static int32_t current_tid(void) {
+  if (cached_tid == 0) {
+    cached_tid = (int32_t) syscall(SYS_gettid);
+  }
+  return cached_tid;
+}
+
+void trace_event(const char * name, char phase, uint32_t id, int64_t value) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, & ts);
+
+  uint64_t index = atomic_fetch_add_explicit( & next_slot, 1, memory_order_relaxed);
+  struct trace_slot * slot = & ring[index & (TRACE_RING_SIZE - 1)];
+  atomic_store_explicit( & slot->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->name = name;
+  slot->ts_ns = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+  slot->value = value;
+  slot->id = id;
+  slot->tid = current_tid();
+  slot->phase = phase;
+  atomic_store_explicit( & slot->seq, index + 1, memory_order_release);
+}
+
+void trace_set_thread_name(const char * name) {
+  int n = atomic_fetch_add( & thread_count, 1);
+  if (n >= TRACE_THREADS_MAX) {
+    return;
+  }
+  threads[n].name = name;
+  atomic_store_explicit( & threads[n].tid, current_tid(), memory_order_release);
+}
+
+int trace_dump(const char * path) {
+  FILE * file = fopen(path, "w");
+  if (file == NULL) {
+    perror("Failed to open trace file");
+    return -1;
+  }
+  int pid = (int) getpid();
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"freedv_ptt\"}}", pid, pid);
+
+  int named = atomic_load( & thread_count);
+  for (int i = 0; i < named && i < TRACE_THREADS_MAX; i++) {
+    int32_t tid = atomic_load_explicit( & threads[i].tid, memory_order_acquire);
+    if (tid != 0) {
+      fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+        pid, tid, threads[i].name);
+    }
+  }
+
+  uint64_t end = atomic_load_explicit( & next_slot, memory_order_acquire);
+  uint64_t start = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+  int written = 0;
+  for (uint64_t index = start; index < end; index++) {
+    struct trace_slot * slot = & ring[index & (TRACE_RING_SIZE - 1)];
+    if (atomic_load_explicit( & slot->seq, memory_order_acquire) != index + 1) {
+      continue; // Not finished yet, or already reused
+    }
+    struct trace_slot copy;
+    copy.name = slot->name;
+    copy.ts_ns = slot->ts_ns;
+    copy.value = slot->value;
+    copy.id = slot->id;
+    copy.tid = slot->tid;
+    copy.phase = slot->phase;
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit( & slot->seq, memory_order_relaxed) != index + 1) {
+      continue; // Overwritten while copying
+    }
+
+    fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+      copy.name, copy.phase, copy.ts_ns / 1000.0, pid, copy.tid);
+    if (copy.phase == 'b' || copy.phase == 'e') {
+      fprintf(file, ",\"cat\":\"ptt\",\"id\":%u", copy.id);
+    } else if (copy.phase == 'i') {
+      fprintf(file, ",\"s\":\"t\"");
+    } else if (copy.phase == 'C') {
+      fprintf(file, ",\"args\":{\"value\":%lld}", (long long) copy.value);
+    }
+    fprintf(file, "}");
+    written++;
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  printf("Trace: %d events written to %s\n", written, path);
+  return written;
+}
@@ -0,0 +1,42 @@
+/*
+ * trace.h
+ *
+ * Description:
+ * Low-overhead event trace for following a PTT transition across the GTK,
+ * Hamlib and audio threads. Events go into a fixed-size lock-free ring (the
+ * oldest are overwritten) and can be dumped at any time as Chrome trace-event
+ * JSON, to be opened in chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Names must be string literals (or otherwise live for the whole session),
+ * only the pointer is stored.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_RING_SIZE 8192 // Events kept, must be a power of two
+#define TRACE_DEFAULT_FILE "/tmp/freedv_ptt_trace.json"
+
+// Async span ids, a span may begin on one thread and end on another
+#define TRACE_ID_PTT_ON 1
+#define TRACE_ID_PTT_OFF 2
+
+// Record one event. phase is a Chrome trace phase: 'B'/'E' span on this thread,
+// 'i' instant, 'b'/'e' async span identified by id, 'C' counter with value.
+void trace_event(const char * name, char phase, uint32_t id, int64_t value);
+
+#define TRACE_BEGIN(name) trace_event(name, 'B', 0, 0)
+#define TRACE_END(name) trace_event(name, 'E', 0, 0)
+#define TRACE_INSTANT(name) trace_event(name, 'i', 0, 0)
+#define TRACE_ASYNC_BEGIN(name, id) trace_event(name, 'b', id, 0)
+#define TRACE_ASYNC_END(name, id) trace_event(name, 'e', id, 0)
+#define TRACE_COUNTER(name, value) trace_event(name, 'C', 0, value)
+
+// Name the calling thread in the dump
+void trace_set_thread_name(const char * name);
+
+// Write the events currently in the ring to path, returns the number written or -1
+int trace_dump(const char * path);
+
+#endif
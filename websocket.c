@@ -0,0 +1,467 @@
+/*
+ * websocket.c
+ *
+ * Description:
+ * A connection goes lookup (thread) -> non-blocking connect -> HTTP upgrade
+ * -> frames. Outgoing bytes wait in one buffer that the write watch drains;
+ * incoming bytes collect in another and are cut into frames as they complete.
+ * Client frames are masked as the RFC requires, server frames must not be.
+ * Fragmented messages are joined before they are handed on.
+ *
+ * Callbacks may call ws_close on the connection they were called for; the
+ * struct is only freed once the watch that made the call has returned.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include "websocket.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_OP_CONTINUATION 0x0
+#define WS_OP_TEXT 0x1
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING 0x9
+#define WS_OP_PONG 0xA
+
+struct websocket {
+  char host[256];
+  char port[8];
+  char path[256];
+  char key[32];           // Sec-WebSocket-Key sent with the upgrade
+  struct ws_callbacks cb;
+  void * data;
+  pthread_t lookup_thread;
+  bool looking_up;        // lookup_thread has been started and not joined yet
+  struct addrinfo * addrs;
+  struct addrinfo * next_addr;
+  int lookup_error;
+  int fd;
+  enum { WS_LOOKUP, WS_CONNECTING, WS_UPGRADING, WS_OPEN } state;
+  guint io_watch;
+  bool watching_out;
+  guint connect_timer;
+  GString * in;
+  GString * out;
+  GString * message;      // Fragments of a message not finished yet
+  int dispatching;        // Callbacks running for this connection
+  bool dead;              // Closed, free once nothing is dispatching
+};
+
+static void try_next_address(struct websocket * ws);
+
+static void free_ws(struct websocket * ws) {
+  if (ws->addrs != NULL) {
+    freeaddrinfo(ws->addrs);
+  }
+  g_string_free(ws->in, TRUE);
+  g_string_free(ws->out, TRUE);
+  g_string_free(ws->message, TRUE);
+  g_free(ws);
+}
+
+static void teardown(struct websocket * ws) {
+  if (ws->io_watch != 0) {
+    g_source_remove(ws->io_watch);
+    ws->io_watch = 0;
+  }
+  if (ws->connect_timer != 0) {
+    g_source_remove(ws->connect_timer);
+    ws->connect_timer = 0;
+  }
+  if (ws->fd >= 0) {
+    close(ws->fd);
+    ws->fd = -1;
+  }
+  ws->dead = true;
+}
+
+// Free now, or when the callback running for this connection returns
+static void release(struct websocket * ws) {
+  if (ws->dispatching == 0 && !ws->looking_up) {
+    free_ws(ws);
+  }
+}
+
+static void fail(struct websocket * ws, const char * reason) {
+  if (ws->dead) {
+    return;
+  }
+  teardown(ws);
+  ws->dispatching++;
+  ws->cb.closed(ws, reason, ws->data);
+  ws->dispatching--;
+  release(ws);
+}
+
+static gboolean on_socket(gint fd, GIOCondition condition, gpointer data);
+
+static void watch_socket(struct websocket * ws, bool writable) {
+  if (ws->io_watch != 0) {
+    if (ws->watching_out == writable) {
+      return;
+    }
+    g_source_remove(ws->io_watch);
+  }
+  ws->watching_out = writable;
+  ws->io_watch = g_unix_fd_add(ws->fd, G_IO_IN | G_IO_HUP | G_IO_ERR | (writable ? G_IO_OUT : 0), on_socket, ws);
+}
+
+// Write what the socket takes, watch for writability while anything is left
+static bool flush(struct websocket * ws) {
+  while (ws->out->len > 0) {
+    ssize_t n = send(ws->fd, ws->out->str, ws->out->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (n < 0) {
+      fail(ws, g_strerror(errno));
+      return false;
+    }
+    g_string_erase(ws->out, 0, n);
+  }
+  watch_socket(ws, ws->out->len > 0);
+  return true;
+}
+
+// Append one frame with a fresh mask
+static void queue_frame(struct websocket * ws, int opcode, const char * payload, size_t len) {
+  unsigned char header[14];
+  size_t h = 0;
+  header[h++] = 0x80 | opcode;
+  if (len < 126) {
+    header[h++] = 0x80 | len;
+  } else if (len < 65536) {
+    header[h++] = 0x80 | 126;
+    header[h++] = len >> 8;
+    header[h++] = len;
+  } else {
+    header[h++] = 0x80 | 127;
+    for (int i = 7; i >= 0; i--) {
+      header[h++] = (uint64_t) len >> (8 * i);
+    }
+  }
+  guint32 mask = g_random_int();
+  unsigned char * m = header + h;
+  memcpy(m, & mask, 4);
+  h += 4;
+  g_string_append_len(ws->out, (const char * ) header, h);
+  gsize start = ws->out->len;
+  g_string_append_len(ws->out, payload, len);
+  for (size_t i = 0; i < len; i++) {
+    ws->out->str[start + i] ^= m[i & 3];
+  }
+}
+
+// base64(SHA-1(key + GUID)), what the server must answer the upgrade with
+static gchar * expected_accept(const char * key) {
+  guint8 digest[20];
+  gsize digest_len = sizeof(digest);
+  GChecksum * sha1 = g_checksum_new(G_CHECKSUM_SHA1);
+  g_checksum_update(sha1, (const guchar * ) key, strlen(key));
+  g_checksum_update(sha1, (const guchar * ) WS_GUID, strlen(WS_GUID));
+  g_checksum_get_digest(sha1, digest, & digest_len);
+  g_checksum_free(sha1);
+  return g_base64_encode(digest, digest_len);
+}
+
+// Check the upgrade response once its headers are complete, false while they are not
+static bool take_upgrade_response(struct websocket * ws) {
+  char * end = g_strstr_len(ws->in->str, ws->in->len, "\r\n\r\n");
+  if (end == NULL) {
+    if (ws->in->len > 8192) {
+      fail(ws, "upgrade response too long");
+    }
+    return false;
+  }
+  * end = '\0';
+  gchar * accept = expected_accept(ws->key);
+  bool switched = strncmp(ws->in->str, "HTTP/1.1 101", 12) == 0;
+  bool accepted = false;
+  gchar ** lines = g_strsplit(ws->in->str, "\r\n", -1);
+  for (gchar ** line = lines; * line != NULL; line++) {
+    if (g_ascii_strncasecmp( * line, "Sec-WebSocket-Accept:", 21) == 0) {
+      accepted = strcmp(g_strstrip( * line + 21), accept) == 0;
+    }
+  }
+  g_strfreev(lines);
+  g_free(accept);
+  g_string_erase(ws->in, 0, end + 4 - ws->in->str);
+
+  if (!switched || !accepted) {
+    fail(ws, switched ? "bad Sec-WebSocket-Accept" : "server refused the upgrade");
+    return false;
+  }
+  g_source_remove(ws->connect_timer);
+  ws->connect_timer = 0;
+  ws->state = WS_OPEN;
+  ws->cb.opened(ws, ws->data);
+  return true;
+}
+
+// Handle every complete frame in the input buffer
+static void take_frames(struct websocket * ws) {
+  while (!ws->dead && ws->in->len >= 2) {
+    const unsigned char * p = (const unsigned char * ) ws->in->str;
+    bool fin = p[0] & 0x80;
+    int opcode = p[0] & 0x0F;
+    uint64_t len = p[1] & 0x7F;
+    size_t h = 2;
+    if (p[1] & 0x80) {
+      fail(ws, "masked frame from server");
+      return;
+    }
+    if (len == 126) {
+      if (ws->in->len < 4) {
+        return;
+      }
+      len = (p[2] << 8) | p[3];
+      h = 4;
+    } else if (len == 127) {
+      if (ws->in->len < 10) {
+        return;
+      }
+      len = 0;
+      for (int i = 0; i < 8; i++) {
+        len = (len << 8) | p[2 + i];
+      }
+      h = 10;
+    }
+    if (len > WS_MESSAGE_MAX) {
+      fail(ws, "message too large");
+      return;
+    }
+    if (ws->in->len < h + len) {
+      return;
+    }
+    const char * payload = ws->in->str + h;
+
+    switch (opcode) {
+    case WS_OP_TEXT:
+    case WS_OP_CONTINUATION:
+      if (ws->message->len + len > WS_MESSAGE_MAX) {
+        fail(ws, "message too large");
+        return;
+      }
+      g_string_append_len(ws->message, payload, len);
+      if (fin) {
+        ws->cb.message(ws, ws->message->str, ws->message->len, ws->data);
+        g_string_truncate(ws->message, 0);
+      }
+      break;
+    case WS_OP_PING:
+      queue_frame(ws, WS_OP_PONG, payload, len);
+      break;
+    case WS_OP_CLOSE:
+      queue_frame(ws, WS_OP_CLOSE, payload, len < 2 ? len : 2);
+      flush(ws);
+      fail(ws, "closed by server");
+      return;
+    }
+    if (!ws->dead) {
+      g_string_erase(ws->in, 0, h + len);
+    }
+  }
+}
+
+static void send_upgrade(struct websocket * ws) {
+  guint8 nonce[16];
+  for (size_t i = 0; i < sizeof(nonce); i++) {
+    nonce[i] = g_random_int_range(0, 256);
+  }
+  gchar * key = g_base64_encode(nonce, sizeof(nonce));
+  snprintf(ws->key, sizeof(ws->key), "%s", key);
+  g_free(key);
+  g_string_append_printf(ws->out,
+    "GET %s HTTP/1.1\r\n"
+    "Host: %s\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: %s\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n", ws->path, ws->host, ws->key);
+  ws->state = WS_UPGRADING;
+  flush(ws);
+}
+
+static gboolean on_socket(gint fd, GIOCondition condition, gpointer data) {
+  struct websocket * ws = data;
+  ws->dispatching++;
+
+  if (ws->state == WS_CONNECTING) {
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, & error, & error_len);
+    if (error != 0) {
+      fprintf(stderr, "WebSocket connect to %s:%s failed: %s\n", ws->host, ws->port, g_strerror(error));
+      ws->io_watch = 0;
+      close(ws->fd);
+      ws->fd = -1;
+      ws->dispatching--;
+      try_next_address(ws);
+      return G_SOURCE_REMOVE;
+    }
+    send_upgrade(ws);
+  } else {
+    if (condition & (G_IO_IN | G_IO_HUP | G_IO_ERR)) {
+      char buf[4096];
+      ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (n > 0) {
+        g_string_append_len(ws->in, buf, n);
+        if (ws->state == WS_OPEN || take_upgrade_response(ws)) {
+          take_frames(ws);
+        }
+      } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        fail(ws, n == 0 ? "connection closed" : g_strerror(errno));
+      }
+    }
+    if (!ws->dead && (condition & G_IO_OUT)) {
+      flush(ws);
+    }
+    if (!ws->dead && ws->out->len > 0) {
+      flush(ws); // Pongs queued while reading
+    }
+  }
+
+  ws->dispatching--;
+  if (ws->dead) {
+    release(ws);
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// Connect to the next address the lookup returned
+static void try_next_address(struct websocket * ws) {
+  while (ws->next_addr != NULL) {
+    struct addrinfo * a = ws->next_addr;
+    ws->next_addr = a->ai_next;
+    ws->fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+    if (ws->fd < 0) {
+      continue;
+    }
+    if (connect(ws->fd, a->ai_addr, a->ai_addrlen) < 0 && errno != EINPROGRESS) {
+      close(ws->fd);
+      ws->fd = -1;
+      continue;
+    }
+    ws->state = WS_CONNECTING;
+    ws->io_watch = 0;
+    watch_socket(ws, true);
+    return;
+  }
+  fail(ws, "could not connect");
+}
+
+static gboolean on_lookup_done(gpointer data) {
+  struct websocket * ws = data;
+  pthread_join(ws->lookup_thread, NULL);
+  ws->looking_up = false;
+  if (ws->dead) {
+    release(ws); // Closed while looking up
+    return G_SOURCE_REMOVE;
+  }
+  if (ws->lookup_error != 0) {
+    fail(ws, gai_strerror(ws->lookup_error));
+    return G_SOURCE_REMOVE;
+  }
+  ws->next_addr = ws->addrs;
+  try_next_address(ws);
+  return G_SOURCE_REMOVE;
+}
+
+// getaddrinfo can take seconds on a poor uplink, keep it off the main loop
+static void * lookup(void * data) {
+  struct websocket * ws = data;
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+  ws->lookup_error = getaddrinfo(ws->host, ws->port, & hints, & ws->addrs);
+  g_idle_add(on_lookup_done, ws);
+  return NULL;
+}
+
+static gboolean on_connect_timeout(gpointer data) {
+  struct websocket * ws = data;
+  ws->connect_timer = 0;
+  fail(ws, "timed out");
+  return G_SOURCE_REMOVE;
+}
+
+// Split ws://host[:port][/path] into the struct
+static bool parse_url(struct websocket * ws, const char * url) {
+  if (strncmp(url, "ws://", 5) != 0) {
+    fprintf(stderr, "WebSocket URL %s not supported, only ws:// is\n", url);
+    return false;
+  }
+  const char * host = url + 5;
+  size_t host_len = strcspn(host, ":/");
+  if (host_len == 0 || host_len >= sizeof(ws->host)) {
+    fprintf(stderr, "WebSocket URL %s has no usable host\n", url);
+    return false;
+  }
+  snprintf(ws->host, sizeof(ws->host), "%.*s", (int) host_len, host);
+  const char * rest = host + host_len;
+  snprintf(ws->port, sizeof(ws->port), "80");
+  if ( * rest == ':') {
+    size_t port_len = strcspn(rest + 1, "/");
+    snprintf(ws->port, sizeof(ws->port), "%.*s", (int) port_len, rest + 1);
+    rest += 1 + port_len;
+  }
+  snprintf(ws->path, sizeof(ws->path), "%s", * rest == '/' ? rest : "/");
+  return true;
+}
+
+struct websocket * ws_open(const char * url, const struct ws_callbacks * callbacks, void * data) {
+  struct websocket * ws = g_new0(struct websocket, 1);
+  if (!parse_url(ws, url)) {
+    g_free(ws);
+    return NULL;
+  }
+  ws->cb = * callbacks;
+  ws->data = data;
+  ws->fd = -1;
+  ws->state = WS_LOOKUP;
+  ws->in = g_string_new(NULL);
+  ws->out = g_string_new(NULL);
+  ws->message = g_string_new(NULL);
+  ws->looking_up = pthread_create( & ws->lookup_thread, NULL, lookup, ws) == 0;
+  if (!ws->looking_up) {
+    perror("Failed to start WebSocket lookup thread");
+    free_ws(ws);
+    return NULL;
+  }
+  ws->connect_timer = g_timeout_add(WS_CONNECT_TIMEOUT_MS, on_connect_timeout, ws);
+  return ws;
+}
+
+bool ws_send_text(struct websocket * ws, const char * text) {
+  if (ws->dead || ws->state != WS_OPEN) {
+    return false;
+  }
+  queue_frame(ws, WS_OP_TEXT, text, strlen(text));
+  // Inside a callback the watch flushes when the callback returns
+  return ws->dispatching > 0 || flush(ws);
+}
+
+void ws_close(struct websocket * ws) {
+  if (ws->dead) {
+    return;
+  }
+  if (ws->state == WS_OPEN) {
+    // Best effort goodbye, 1000 = normal closure
+    g_string_truncate(ws->out, 0);
+    queue_frame(ws, WS_OP_CLOSE, "\x03\xe8", 2);
+    send(ws->fd, ws->out->str, ws->out->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+  }
+  teardown(ws);
+  release(ws);
+}
@@ -0,0 +1,37 @@
+/*
+ * websocket.h
+ *
+ * Description:
+ * Minimal RFC 6455 WebSocket client on the GLib main loop: ws:// URLs, text
+ * messages, ping/pong and close. Name lookup runs on a short-lived thread and
+ * everything else is non-blocking, so nothing here ever stalls the loop.
+ * There is no TLS; wss:// URLs are refused.
+ */
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WS_CONNECT_TIMEOUT_MS 10000  // Lookup, connect and handshake together
+#define WS_MESSAGE_MAX 65536         // Larger incoming messages close the connection
+
+struct websocket;
+
+struct ws_callbacks {
+  void ( * opened)(struct websocket * ws, void * data);
+  void ( * message)(struct websocket * ws, const char * text, size_t len, void * data);
+  // The connection failed or ended, ws is freed after this returns
+  void ( * closed)(struct websocket * ws, const char * reason, void * data);
+};
+
+// Start connecting to url (ws://host[:port]/path), NULL if the URL cannot be used
+struct websocket * ws_open(const char * url, const struct ws_callbacks * callbacks, void * data);
+
+// Queue a text message, false if the connection is not open
+bool ws_send_text(struct websocket * ws, const char * text);
+
+// Close without calling back, ws is freed
+void ws_close(struct websocket * ws);
+
+#endif